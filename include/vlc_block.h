@@ -138,10 +138,17 @@ struct block_t
  *      with preheader and or body (increase
  *      and decrease are supported). Use it as it is optimised.
  * - block_Duplicate : create a copy of a block.
+ * - block_Shareable : make the payload of a block shareable (no copy).
+ * - block_Share : create a new block sharing the payload of a shareable
+ *      block, without copying it; the header is private.
+ * - block_Writable : copy the payload of a shared block before writing to it.
  ****************************************************************************/
 VLC_EXPORT( void,      block_Init,    ( block_t *, void *, size_t ) );
 VLC_EXPORT( block_t *, block_Alloc,   ( size_t ) LIBVLC_USED );
 VLC_EXPORT( block_t *, block_Realloc, ( block_t *, ssize_t i_pre, size_t i_body ) LIBVLC_USED );
+VLC_EXPORT( block_t *, block_Shareable, ( block_t * ) LIBVLC_USED );
+VLC_EXPORT( block_t *, block_Share,   ( block_t * ) LIBVLC_USED );
+VLC_EXPORT( block_t *, block_Writable, ( block_t * ) LIBVLC_USED );
 
 #define block_New( dummy, size ) block_Alloc(size)
 
@@ -333,4 +340,35 @@ VLC_EXPORT( block_t *,      block_FifoShow,     ( block_fifo_t * ) );
 size_t block_FifoSize( const block_fifo_t *p_fifo ) LIBVLC_USED;
 VLC_EXPORT( size_t,         block_FifoCount,    ( const block_fifo_t *p_fifo ) LIBVLC_USED );
 
+/****************************************************************************
+ * Lock-free rings of blocks (one producer thread, one consumer thread).
+ ****************************************************************************
+ * - block_RingNew : create a ring with room for (at least) a number of blocks
+ * - block_RingRelease : destroy a ring and free all blocks in it.
+ * - block_RingPut : put a block list (and wait for room if needed)
+ * - block_RingTryPut : put a block if there is room
+ * - block_RingGet : get a packet from the ring (and wait if it is empty)
+ * - block_RingShow : show the first packet of the ring (and wait if needed)
+ * - block_RingCount : how many packets are waiting in the ring
+ * - block_RingSize : how many bytes are waiting in the ring
+ * - block_RingWake : wake ups the consumer with block_RingGet() = NULL
+ *
+ * Put functions may only be called by the producer, Get and Show by the
+ * consumer. Calls on one side must not overlap, but they may come from
+ * different threads if they are serialized. Nobody sleeps unless the ring
+ * is empty (consumer) or full (producer).
+ *
+ * block_RingGet and block_RingShow are cancellation points.
+ ****************************************************************************/
+
+VLC_EXPORT( block_ring_t *, block_RingNew,      ( size_t i_max ) LIBVLC_USED );
+VLC_EXPORT( void,           block_RingRelease,  ( block_ring_t * ) );
+VLC_EXPORT( size_t,         block_RingPut,      ( block_ring_t *, block_t * ) );
+VLC_EXPORT( bool,           block_RingTryPut,   ( block_ring_t *, block_t * ) );
+VLC_EXPORT( block_t *,      block_RingGet,      ( block_ring_t * ) LIBVLC_USED );
+VLC_EXPORT( block_t *,      block_RingShow,     ( block_ring_t * ) );
+VLC_EXPORT( void,           block_RingWake,     ( block_ring_t * ) );
+VLC_EXPORT( size_t,         block_RingCount,    ( const block_ring_t * ) LIBVLC_USED );
+VLC_EXPORT( size_t,         block_RingSize,     ( const block_ring_t * ) LIBVLC_USED );
+
 #endif /* VLC_BLOCK_H */
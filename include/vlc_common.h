@@ -304,6 +304,7 @@ typedef struct iso639_lang_t iso639_lang_t;
 /* block */
 typedef struct block_t      block_t;
 typedef struct block_fifo_t block_fifo_t;
+typedef struct block_ring_t block_ring_t;
 
 /* httpd */
 typedef struct httpd_t          httpd_t;
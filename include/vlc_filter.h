@@ -37,6 +37,13 @@
 
 typedef struct filter_owner_sys_t filter_owner_sys_t;
 
+/**
+ * Renders the lines [i_start, i_end) of a video filter output.
+ * See filter_SliceVideo().
+ */
+typedef void (*filter_slice_t)( filter_t *, void *p_data,
+                                int i_start, int i_end );
+
 /** Structure describing a filter
  * @warning BIG FAT WARNING : the code relies on the first 4 members of
  * filter_t and decoder_t to be the same, so if you have anything to add,
@@ -79,12 +86,17 @@ struct filter_t
             int         (*pf_mouse)( filter_t *, vlc_mouse_t *,
                                      const vlc_mouse_t *p_old,
                                      const vlc_mouse_t *p_new );
+            /* Set by the owner if it can run the slices of
+             * filter_SliceVideo() on several threads. */
+            void        (*pf_slices)( filter_t *, filter_slice_t, void *,
+                                      int i_lines, int i_align );
         } video;
 #define pf_video_filter     u.video.pf_filter
 #define pf_video_flush      u.video.pf_flush
 #define pf_video_mouse      u.video.pf_mouse
 #define pf_video_buffer_new u.video.pf_buffer_new
 #define pf_video_buffer_del u.video.pf_buffer_del
+#define pf_video_slices     u.video.pf_slices
 
         struct
         {
@@ -165,6 +177,33 @@ static inline void filter_DeletePicture( filter_t *p_filter, picture_t *p_pictur
     p_filter->pf_video_buffer_del( p_filter, p_picture );
 }
 
+/**
+ * This function will render i_lines lines of a video filter output by
+ * slices, calling pf_slice on consecutive line ranges, possibly from several
+ * threads at once. The ranges are multiples of i_align lines, except the
+ * last one. It returns once all the lines are rendered.
+ *
+ * It is meant for filters where each output line only depends on the input.
+ * The lines are usually those of the first plane: pf_slice has to scale
+ * them for the other planes.
+ *
+ * \param p_filter filter_t object
+ * \param pf_slice slice rendering callback
+ * \param p_data opaque data given to pf_slice
+ * \param i_lines number of lines to render
+ * \param i_align alignment of the slices, in lines
+ */
+static inline void filter_SliceVideo( filter_t *p_filter,
+                                      filter_slice_t pf_slice, void *p_data,
+                                      int i_lines, int i_align )
+{
+    if( p_filter->pf_video_slices )
+        p_filter->pf_video_slices( p_filter, pf_slice, p_data,
+                                   i_lines, i_align );
+    else
+        pf_slice( p_filter, p_data, 0, i_lines );
+}
+
 /**
  * This function will flush the state of a video filter.
  */
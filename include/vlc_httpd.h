@@ -122,6 +122,7 @@ VLC_EXPORT( char*,          httpd_ServerIP, ( const httpd_client_t *cl, char *ps
 /* High level */
 
 VLC_EXPORT( httpd_file_t *, httpd_FileNew, ( httpd_host_t *, const char *psz_url, const char *psz_mime, const char *psz_user, const char *psz_password, const vlc_acl_t *p_acl, httpd_file_callback_t pf_fill, httpd_file_sys_t * ) LIBVLC_USED );
+VLC_EXPORT( httpd_file_t *, httpd_FileNewFromBlock, ( httpd_host_t *, const char *psz_url, const char *psz_mime, const char *psz_user, const char *psz_password, const vlc_acl_t *p_acl, block_t * ) LIBVLC_USED );
 VLC_EXPORT( httpd_file_sys_t *, httpd_FileDelete, ( httpd_file_t * ) );
 
 
@@ -137,6 +138,7 @@ VLC_EXPORT( httpd_stream_t *, httpd_StreamNew,    ( httpd_host_t *, const char *
 VLC_EXPORT( void,             httpd_StreamDelete, ( httpd_stream_t * ) );
 VLC_EXPORT( int,              httpd_StreamHeader, ( httpd_stream_t *, uint8_t *p_data, int i_data ) );
 VLC_EXPORT( int,              httpd_StreamSend,   ( httpd_stream_t *, uint8_t *p_data, int i_data ) );
+VLC_EXPORT( int,              httpd_StreamSendBlock, ( httpd_stream_t *, block_t * ) );
 
 
 /* Msg functions facilities */
@@ -148,6 +148,15 @@ VLC_EXPORT( ssize_t, net_Read, ( vlc_object_t *p_this, int fd, const v_socket_t
 #define net_Read(a,b,c,d,e,f) net_Read(VLC_OBJECT(a),b,c,d,e,f)
 VLC_EXPORT( ssize_t, net_Write, ( vlc_object_t *p_this, int fd, const v_socket_t *, const void *p_data, size_t i_data ) );
 #define net_Write(a,b,c,d,e) net_Write(VLC_OBJECT(a),b,c,d,e)
+
+/* Batched datagram reception: see net_ReadBatch() */
+typedef struct net_batch_t net_batch_t;
+
+VLC_EXPORT( net_batch_t *, net_BatchNew, ( vlc_object_t *p_this, int fd, size_t i_mtu, unsigned i_count ) );
+#define net_BatchNew(a,b,c,d) net_BatchNew(VLC_OBJECT(a),b,c,d)
+VLC_EXPORT( void, net_BatchDelete, ( net_batch_t * ) );
+VLC_EXPORT( block_t *, net_ReadBatch, ( vlc_object_t *p_this, net_batch_t * ) );
+#define net_ReadBatch(a,b) net_ReadBatch(VLC_OBJECT(a),b)
 VLC_EXPORT( char *, net_Gets, ( vlc_object_t *p_this, int fd, const v_socket_t * ) );
 #define net_Gets(a,b,c) net_Gets(VLC_OBJECT(a),b,c)
 
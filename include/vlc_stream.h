@@ -111,6 +111,9 @@ enum stream_query_e
 
     /* XXX only data read through stream_Read/Block will be recorded */
     STREAM_SET_RECORD_STATE,     /**< arg1=bool, arg2=const char *psz_ext (if arg1 is true)  res=can fail */
+
+    /* Use stream_Packets() */
+    STREAM_GET_PACKETS,         /**< arg1= unsigned i_packet, arg2= unsigned i_max, arg3= block_t ** res=can fail */
 };
 
 VLC_EXPORT( int, stream_Read, ( stream_t *s, void *p_read, int i_read ) );
@@ -150,6 +153,23 @@ static inline int stream_Seek( stream_t *s, uint64_t i_pos )
     return stream_Control( s, STREAM_SET_POSITION, i_pos );
 }
 
+/**
+ * Read up to i_max whole packets of i_packet bytes in a single block.
+ * It returns at least one packet unless at the end of the stream, where
+ * the last block can be shorter than a packet.
+ * When the stream supports it, the block is a view of the buffer of the
+ * access and no data is copied: its payload must not be modified without
+ * block_Writable(). Otherwise, it falls back to stream_Block().
+ */
+static inline block_t *stream_Packets( stream_t *s, unsigned i_packet,
+                                       unsigned i_max )
+{
+    block_t *p_block;
+    if( stream_Control( s, STREAM_GET_PACKETS, i_packet, i_max, &p_block ) )
+        return stream_Block( s, i_packet * i_max );
+    return p_block;
+}
+
 /**
  * Get the Content-Type of a stream, or NULL if unknown.
  * Result must be free()'d.
@@ -0,0 +1,494 @@
+/**
+ * @file fec.c
+ * @brief SMPTE 2022-1 forward error correction for RTP
+ */
+/*****************************************************************************
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ ****************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <string.h>
+#include <assert.h>
+
+#include <vlc_common.h>
+#include <vlc_block.h>
+
+#include "fec.h"
+
+#define RTP_FEC_PENDING 64 /* FEC packets waiting for media packets */
+#define RTP_FEC_PTYPE   96
+
+/**
+ * Finds the payload of an RTP packet.
+ * @return the RTP header length, or 0 if the packet is not valid RTP.
+ */
+static size_t rtp_header_len (const block_t *block)
+{
+    const uint8_t *p = block->p_buffer;
+    size_t len = 12;
+
+    if (block->i_buffer < len || (p[0] >> 6) != 2)
+        return 0;
+    len += 4 * (p[0] & 0x0F); /* CSRC */
+    if (p[0] & 0x10) /* header extension */
+    {
+        if (block->i_buffer < len + 4)
+            return 0;
+        len += 4 + 4 * GetWBE (p + len + 2);
+    }
+    if (block->i_buffer < len)
+        return 0;
+    return len;
+}
+
+static inline uint16_t rtp_fec_seq (const block_t *block)
+{
+    return GetWBE (block->p_buffer + 2);
+}
+
+
+/*
+ * XOR accumulator (one per FEC packet being computed)
+ */
+typedef struct
+{
+    uint16_t snbase;
+    uint16_t length;
+    uint8_t  ptype;
+    uint32_t timestamp;
+    size_t   size; /* largest payload accumulated */
+    uint8_t  payload[RTP_FEC_MAX_PAYLOAD];
+} rtp_fec_acc_t;
+
+static void acc_init (rtp_fec_acc_t *acc, uint16_t snbase)
+{
+    acc->snbase = snbase;
+    acc->length = 0;
+    acc->ptype = 0;
+    acc->timestamp = 0;
+    acc->size = 0;
+}
+
+static void acc_xor (rtp_fec_acc_t *acc, const block_t *block, size_t hlen)
+{
+    const uint8_t *p = block->p_buffer;
+    size_t len = block->i_buffer - hlen;
+
+    assert (len <= RTP_FEC_MAX_PAYLOAD);
+    acc->length ^= len;
+    acc->ptype ^= p[1] & 0x7F;
+    acc->timestamp ^= GetDWBE (p + 4);
+
+    if (len > acc->size)
+    {   /* shorter payloads are implicitly zero-padded */
+        memset (acc->payload + acc->size, 0, len - acc->size);
+        acc->size = len;
+    }
+    p += hlen;
+    for (size_t i = 0; i < len; i++)
+        acc->payload[i] ^= p[i];
+}
+
+
+/*
+ * Receiver
+ */
+struct rtp_fec_t
+{
+    block_t  *media[RTP_FEC_WINDOW]; /**< Indexed by sequence number */
+    block_t  *pending; /**< FEC packets waiting for more media packets */
+    unsigned  pendingc;
+    uint32_t  ssrc; /**< Last media SSRC */
+    uint16_t  max_seq; /**< Highest media sequence number seen */
+    unsigned  latency; /**< Media packets from a loss to its column FEC */
+    bool      started;
+};
+
+rtp_fec_t *rtp_fec_create (void)
+{
+    rtp_fec_t *fec = malloc (sizeof (*fec));
+    if (fec == NULL)
+        return NULL;
+
+    for (unsigned i = 0; i < RTP_FEC_WINDOW; i++)
+        fec->media[i] = NULL;
+    fec->pending = NULL;
+    fec->pendingc = 0;
+    fec->ssrc = 0;
+    fec->max_seq = 0;
+    fec->latency = 0;
+    fec->started = false;
+    return fec;
+}
+
+void rtp_fec_destroy (rtp_fec_t *fec)
+{
+    for (unsigned i = 0; i < RTP_FEC_WINDOW; i++)
+        if (fec->media[i] != NULL)
+            block_Release (fec->media[i]);
+    block_ChainRelease (fec->pending);
+    free (fec);
+}
+
+static void fec_store (rtp_fec_t *fec, block_t *block)
+{
+    uint16_t seq = rtp_fec_seq (block);
+    block_t **slot = fec->media + (seq % RTP_FEC_WINDOW);
+
+    if (*slot != NULL)
+        block_Release (*slot);
+    *slot = block;
+
+    if (!fec->started || (int16_t)(seq - fec->max_seq) > 0)
+        fec->max_seq = seq;
+    fec->ssrc = GetDWBE (block->p_buffer + 8);
+    fec->started = true;
+}
+
+/**
+ * @return how many media packets may be received after a lost one before
+ * the FEC packets to rebuild it (0 until a column FEC packet is received).
+ */
+unsigned rtp_fec_latency (const rtp_fec_t *fec)
+{
+    return fec->latency;
+}
+
+/**
+ * Keeps a copy of a received media packet, for later recovery.
+ * @param block valid RTP packet (not consumed)
+ */
+void rtp_fec_media (rtp_fec_t *fec, const block_t *block)
+{
+    size_t hlen = rtp_header_len (block);
+    if (hlen == 0 || block->i_buffer - hlen > RTP_FEC_MAX_PAYLOAD)
+        return;
+
+    block_t *copy = block_Alloc (block->i_buffer);
+    if (unlikely(copy == NULL))
+        return;
+    memcpy (copy->p_buffer, block->p_buffer, block->i_buffer);
+    fec_store (fec, copy);
+}
+
+static const block_t *fec_lookup (const rtp_fec_t *fec, uint16_t seq)
+{
+    const block_t *block = fec->media[seq % RTP_FEC_WINDOW];
+
+    if (block == NULL || rtp_fec_seq (block) != seq)
+        return NULL;
+    return block;
+}
+
+/**
+ * Tries to rebuild the media packet protected by one FEC packet.
+ * @param out [OUT] rebuilt media packet, if any
+ * @return true if the FEC packet is of no further use
+ */
+static bool fec_try (rtp_fec_t *fec, const block_t *fb, block_t **out)
+{
+    const size_t hlen = rtp_header_len (fb);
+    const uint8_t *hdr = fb->p_buffer + hlen;
+    const uint16_t snbase = rtp_fec_snbase (hdr);
+    const unsigned offset = rtp_fec_offset (hdr), na = rtp_fec_na (hdr);
+
+    *out = NULL;
+    if (!fec->started)
+        return false;
+    if ((int16_t)(fec->max_seq - snbase) >= RTP_FEC_WINDOW)
+        return true; /* too old, the media packets are gone */
+
+    unsigned missing = 0;
+    uint16_t lost = 0;
+    for (unsigned k = 0; k < na; k++)
+    {
+        uint16_t seq = snbase + k * offset;
+        if (fec_lookup (fec, seq) == NULL)
+        {
+            missing++;
+            lost = seq;
+        }
+    }
+    if (missing == 0)
+        return true;
+    if (missing > 1)
+        return false; /* maybe later (or never) */
+
+    /* Exactly one packet is missing: XOR everything else together */
+    rtp_fec_acc_t acc;
+    acc.snbase = snbase;
+    acc.length = GetWBE (hdr + 2);
+    acc.ptype = hdr[4] & 0x7F;
+    acc.timestamp = GetDWBE (hdr + 8);
+    acc.size = fb->i_buffer - hlen - RTP_FEC_HEADER_SIZE;
+    memcpy (acc.payload, hdr + RTP_FEC_HEADER_SIZE, acc.size);
+
+    for (unsigned k = 0; k < na; k++)
+    {
+        const block_t *block = fec_lookup (fec, snbase + k * offset);
+        if (block != NULL)
+            acc_xor (&acc, block, rtp_header_len (block));
+    }
+
+    if (acc.length > acc.size)
+        return true; /* corrupt FEC or unprotectable media */
+
+    block_t *block = block_Alloc (12 + acc.length);
+    if (unlikely(block == NULL))
+        return true;
+
+    uint8_t *p = block->p_buffer;
+    p[0] = 0x80;
+    p[1] = acc.ptype;
+    SetWBE (p + 2, lost);
+    SetDWBE (p + 4, acc.timestamp);
+    SetDWBE (p + 8, fec->ssrc);
+    memcpy (p + 12, acc.payload, acc.length);
+
+    *out = block_Duplicate (block);
+    fec_store (fec, block);
+    return true;
+}
+
+/**
+ * Processes a column or row FEC packet.
+ * @param fb FEC RTP packet (consumed)
+ * @return a chain of rebuilt media RTP packets (possibly empty)
+ */
+block_t *rtp_fec_recover (rtp_fec_t *fec, block_t *fb)
+{
+    size_t hlen = rtp_header_len (fb);
+    if (hlen == 0 || fb->i_buffer - hlen < RTP_FEC_HEADER_SIZE
+     || fb->i_buffer - hlen - RTP_FEC_HEADER_SIZE > RTP_FEC_MAX_PAYLOAD)
+        goto drop;
+
+    const uint8_t *hdr = fb->p_buffer + hlen;
+    unsigned offset = rtp_fec_offset (hdr), na = rtp_fec_na (hdr);
+    if (offset == 0 || na == 0 || (na - 1) * offset >= RTP_FEC_WINDOW
+     || (hdr[12] & 0x38) /* not XOR */)
+        goto drop;
+
+    /* The column FEC packets of a L x D matrix are spread over the next
+     * matrix: the last one comes up to 2 x L x D packets after the first
+     * media packet it protects */
+    if (!rtp_fec_is_row (hdr))
+        fec->latency = 2 * offset * na;
+
+    if (fec->pendingc >= RTP_FEC_PENDING)
+    {   /* drop the oldest one */
+        block_t *old = fec->pending;
+        fec->pending = old->p_next;
+        block_Release (old);
+        fec->pendingc--;
+    }
+    fb->p_next = NULL;
+    block_ChainAppend (&fec->pending, fb);
+    fec->pendingc++;
+
+    /* A rebuilt packet may complete another row or column */
+    block_t *chain = NULL, **pp_last = &chain;
+    bool progress;
+    do
+    {
+        progress = false;
+        for (block_t **pp = &fec->pending, *p; (p = *pp) != NULL;)
+        {
+            block_t *block;
+
+            if (!fec_try (fec, p, &block))
+            {
+                pp = &p->p_next;
+                continue;
+            }
+            *pp = p->p_next;
+            block_Release (p);
+            fec->pendingc--;
+
+            if (block != NULL)
+            {
+                *pp_last = block;
+                pp_last = &block->p_next;
+                progress = true;
+            }
+        }
+    }
+    while (progress);
+    return chain;
+
+drop:
+    block_Release (fb);
+    return NULL;
+}
+
+
+/*
+ * Sender
+ */
+struct rtp_fec_encoder_t
+{
+    unsigned      cols, rows;
+    unsigned      pos; /**< Position of the next media packet in the matrix */
+    uint16_t      next_seq;
+    uint16_t      seq[2]; /**< Column and row FEC sequence numbers */
+    bool          row_fec;
+    bool          started;
+    block_t     **colfec; /**< Column FEC packets of the previous matrix */
+    rtp_fec_acc_t row;
+    rtp_fec_acc_t colv[];
+};
+
+/**
+ * Creates a FEC generator for a L x D matrix.
+ * @param cols number of columns (L)
+ * @param rows number of rows (D)
+ * @param row_fec whether to generate row FEC as well as column FEC
+ */
+rtp_fec_encoder_t *rtp_fec_encoder_create (unsigned cols, unsigned rows,
+                                           bool row_fec)
+{
+    assert (cols > 0 && rows > 0);
+
+    rtp_fec_encoder_t *enc = malloc (sizeof (*enc)
+                                     + cols * sizeof (enc->colv[0])
+                                     + cols * sizeof (enc->colfec[0]));
+    if (enc == NULL)
+        return NULL;
+
+    enc->cols = cols;
+    enc->rows = rows;
+    enc->pos = 0;
+    enc->next_seq = 0;
+    enc->seq[0] = enc->seq[1] = 0;
+    enc->row_fec = row_fec;
+    enc->started = false;
+    enc->colfec = (block_t **)(enc->colv + cols);
+    for (unsigned i = 0; i < cols; i++)
+        enc->colfec[i] = NULL;
+    return enc;
+}
+
+void rtp_fec_encoder_destroy (rtp_fec_encoder_t *enc)
+{
+    for (unsigned i = 0; i < enc->cols; i++)
+        if (enc->colfec[i] != NULL)
+            block_Release (enc->colfec[i]);
+    free (enc);
+}
+
+static block_t *fec_packet (const rtp_fec_acc_t *acc, uint16_t seq,
+                            uint32_t timestamp, bool row,
+                            unsigned offset, unsigned na)
+{
+    block_t *block = block_Alloc (12 + RTP_FEC_HEADER_SIZE + acc->size);
+    if (unlikely(block == NULL))
+        return NULL;
+
+    uint8_t *p = block->p_buffer;
+    p[0] = 0x80;
+    p[1] = RTP_FEC_PTYPE;
+    SetWBE (p + 2, seq);
+    SetDWBE (p + 4, timestamp);
+    SetDWBE (p + 8, 0); /* SSRC */
+
+    p += 12;
+    SetWBE (p, acc->snbase);
+    SetWBE (p + 2, acc->length);
+    p[4] = 0x80 | acc->ptype; /* E */
+    p[5] = p[6] = p[7] = 0; /* mask */
+    SetDWBE (p + 8, acc->timestamp);
+    p[12] = row ? 0x40 : 0x00; /* X = 0, D, XOR type, index 0 */
+    p[13] = offset;
+    p[14] = na;
+    p[15] = 0; /* SNBase extension */
+    memcpy (p + RTP_FEC_HEADER_SIZE, acc->payload, acc->size);
+    return block;
+}
+
+/**
+ * Feeds one media packet to the FEC generator.
+ *
+ * As in SMPTE 2022-1, the column FEC packets are not sent with the last row
+ * but spread over the next matrix: the one of column c goes out after the
+ * media packet c * D + D - 1. A burst of up to L packets then never takes
+ * both a media packet and the FEC packet which could rebuild it. The
+ * receiver keeps enough media packets (RTP_FEC_WINDOW) for two matrices of
+ * up to 100 packets.
+ *
+ * @param media RTP packet about to be sent (not consumed)
+ * @return a chain of FEC packets to send (possibly empty); use
+ * rtp_fec_is_row() on their FEC header to pick the destination port.
+ */
+block_t *rtp_fec_encode (rtp_fec_encoder_t *enc, const block_t *media)
+{
+    size_t hlen = rtp_header_len (media);
+    if (hlen == 0 || media->i_buffer - hlen > RTP_FEC_MAX_PAYLOAD)
+    {   /* cannot be protected: start over with the next packet */
+        enc->started = false;
+        return NULL;
+    }
+
+    uint16_t seq = rtp_fec_seq (media);
+    block_t *chain = NULL;
+
+    if (!enc->started || seq != enc->next_seq)
+    {   /* sequence discontinuity: new matrix */
+        enc->pos = 0;
+        for (unsigned i = 0; i < enc->cols; i++)
+        {   /* the previous matrix is over anyway */
+            block_ChainAppend (&chain, enc->colfec[i]);
+            enc->colfec[i] = NULL;
+        }
+    }
+    enc->started = true;
+    enc->next_seq = seq + 1;
+
+    const unsigned col = enc->pos % enc->cols, row = enc->pos / enc->cols;
+    const uint32_t timestamp = GetDWBE (media->p_buffer + 4);
+
+    if (row == 0)
+        acc_init (enc->colv + col, seq);
+    acc_xor (enc->colv + col, media, hlen);
+    if (enc->row_fec)
+    {
+        if (col == 0)
+            acc_init (&enc->row, seq);
+        acc_xor (&enc->row, media, hlen);
+        if (col == enc->cols - 1)
+            block_ChainAppend (&chain, fec_packet (&enc->row, enc->seq[1]++,
+                                                   timestamp, true,
+                                                   1, enc->cols));
+    }
+    if (enc->pos % enc->rows == enc->rows - 1)
+    {   /* the slot of a column FEC packet of the previous matrix */
+        const unsigned c = enc->pos / enc->rows;
+
+        block_ChainAppend (&chain, enc->colfec[c]);
+        enc->colfec[c] = NULL;
+    }
+    if (row == enc->rows - 1)
+    {
+        assert (enc->colfec[col] == NULL);
+        enc->colfec[col] = fec_packet (enc->colv + col, enc->seq[0]++,
+                                       timestamp, false, enc->cols,
+                                       enc->rows);
+    }
+
+    if (++enc->pos == enc->cols * enc->rows)
+        enc->pos = 0;
+    return chain;
+}
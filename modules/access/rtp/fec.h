@@ -0,0 +1,88 @@
+/**
+ * @file fec.h
+ * @brief SMPTE 2022-1 forward error correction for RTP
+ */
+/*****************************************************************************
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ ****************************************************************************/
+
+#ifndef VLC_RTP_FEC_H
+#define VLC_RTP_FEC_H 1
+
+/*
+ * SMPTE 2022-1 protects a media RTP stream with L columns by D rows of XOR
+ * parity packets. Column FEC packets are sent to the media port + 2,
+ * row FEC packets (if any) to the media port + 4. Each FEC packet is an RTP
+ * packet whose payload starts with this 16-bytes header:
+ *
+ *  0                   1                   2                   3
+ *  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |      SNBase low bits          |        Length Recovery        |
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |E| PT recovery |                    Mask                       |
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |                          TS recovery                          |
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |X|D|type |index|    Offset     |      NA       |SNBase ext bits|
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *
+ * A FEC packet protects the NA media packets SNBase, SNBase + Offset, ...
+ * SNBase + (NA - 1) * Offset, i.e. Offset = L and NA = D for a column,
+ * Offset = 1 and NA = L for a row.
+ */
+#define RTP_FEC_HEADER_SIZE 16
+#define RTP_FEC_MAX_PAYLOAD 1500 /**< Largest protected media payload */
+#define RTP_FEC_WINDOW      256  /**< Media packets kept for recovery */
+
+static inline uint16_t rtp_fec_snbase (const uint8_t *fec)
+{
+    return (fec[0] << 8) | fec[1];
+}
+
+static inline uint8_t rtp_fec_offset (const uint8_t *fec)
+{
+    return fec[13];
+}
+
+static inline uint8_t rtp_fec_na (const uint8_t *fec)
+{
+    return fec[14];
+}
+
+/** True for a row FEC packet (port + 4), false for a column one */
+static inline bool rtp_fec_is_row (const uint8_t *fec)
+{
+    return (fec[12] & 0x40) != 0;
+}
+
+/** @section Receiver */
+typedef struct rtp_fec_t rtp_fec_t;
+
+rtp_fec_t *rtp_fec_create (void);
+void rtp_fec_destroy (rtp_fec_t *);
+void rtp_fec_media (rtp_fec_t *, const block_t *);
+block_t *rtp_fec_recover (rtp_fec_t *, block_t *);
+unsigned rtp_fec_latency (const rtp_fec_t *);
+
+/** @section Sender */
+typedef struct rtp_fec_encoder_t rtp_fec_encoder_t;
+
+rtp_fec_encoder_t *rtp_fec_encoder_create (unsigned cols, unsigned rows,
+                                           bool row_fec);
+void rtp_fec_encoder_destroy (rtp_fec_encoder_t *);
+block_t *rtp_fec_encode (rtp_fec_encoder_t *, const block_t *);
+
+#endif
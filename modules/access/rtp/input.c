@@ -29,12 +29,14 @@
 #include <vlc_block.h>
 #include <vlc_network.h>
 
+#include <errno.h>
 #include <unistd.h>
 #ifdef HAVE_POLL
 # include <poll.h>
 #endif
 
 #include "rtp.h"
+#include "fec.h"
 #ifdef HAVE_SRTP
 # include <srtp.h>
 #endif
@@ -46,32 +48,29 @@ static bool fd_dead (int fd)
 }
 
 /**
- * Gets a datagram from the network.
+ * Gets the pending datagrams from the network.
  * @param fd datagram file descriptor
- * @return a block or NULL on fatal error (socket dead)
+ * @param batch reception buffers for fd
+ * @return a chain of blocks or NULL on fatal error (socket dead)
  */
-static block_t *rtp_dgram_recv (vlc_object_t *obj, int fd)
+static block_t *rtp_dgram_recv (vlc_object_t *obj, int fd,
+                                net_batch_t *batch)
 {
-    block_t *block = block_Alloc (0xffff);
-    ssize_t len;
+    block_t *chain;
 
-    block_cleanup_push (block);
     do
     {
-        len = net_Read (obj, fd, NULL,
-                        block->p_buffer, block->i_buffer, false);
+        chain = net_ReadBatch (obj, batch);
 
-        if (((len <= 0) && fd_dead (fd)) || !vlc_object_alive (obj))
+        if (((chain == NULL) && fd_dead (fd)) || !vlc_object_alive (obj))
         {   /* POLLHUP -> permanent (DCCP) socket error */
-            block_Release (block);
-            block = NULL;
-            break;
+            block_ChainRelease (chain);
+            return NULL;
         }
     }
-    while (len == -1);
-    vlc_cleanup_pop ();
+    while (chain == NULL);
 
-    return block ? block_Realloc (block, 0, len) : NULL;
+    return chain;
 }
 
 
@@ -119,46 +118,81 @@ static block_t *rtp_stream_recv (vlc_object_t *obj, int fd)
 }
 
 
+/**
+ * Checks (and decrypts) a received RTP packet.
+ * @return false if the packet must be dropped
+ */
+static bool rtp_check (demux_t *demux, block_t *block)
+{
+    demux_sys_t *p_sys = demux->p_sys;
+
+    if (block->i_buffer < 2)
+        return false;
+
+    /* FIXME */
+    const uint8_t ptype = rtp_ptype (block);
+    if (ptype >= 72 && ptype <= 76)
+        return false; /* Muxed RTCP, ignore for now */
+#ifdef HAVE_SRTP
+    if (p_sys->srtp)
+    {
+        size_t len = block->i_buffer;
+        int canc, err;
+
+        canc = vlc_savecancel ();
+        err = srtp_recv (p_sys->srtp, block->p_buffer, &len);
+        vlc_restorecancel (canc);
+        if (err)
+        {
+            msg_Dbg (demux, "SRTP authentication/decryption failed");
+            return false;
+        }
+        block->i_buffer = len;
+    }
+#else
+    VLC_UNUSED(p_sys);
+#endif
+    return true;
+}
+
+/**
+ * Gets the next valid RTP packets.
+ * @return a chain of blocks or NULL in case of fatal error
+ */
 static block_t *rtp_recv (demux_t *demux)
 {
     demux_sys_t *p_sys = demux->p_sys;
 
-    for (block_t *block;; block_Release (block))
+    for (;;)
     {
-        block = p_sys->framed_rtp
+        block_t *chain, *valid = NULL, **pp_last = &valid;
+
+        chain = p_sys->framed_rtp
                 ? rtp_stream_recv (VLC_OBJECT (demux), p_sys->fd)
-                : rtp_dgram_recv (VLC_OBJECT (demux), p_sys->fd);
-        if (block == NULL)
+                : rtp_dgram_recv (VLC_OBJECT (demux), p_sys->fd,
+                                  p_sys->batch);
+        if (chain == NULL)
         {
             msg_Err (demux, "RTP flow stopped");
             break; /* fatal error */
         }
 
-        if (block->i_buffer < 2)
-            continue;
-
-        /* FIXME */
-        const uint8_t ptype = rtp_ptype (block);
-        if (ptype >= 72 && ptype <= 76)
-            continue; /* Muxed RTCP, ignore for now */
-#ifdef HAVE_SRTP
-        if (p_sys->srtp)
+        while (chain != NULL)
         {
-            size_t len = block->i_buffer;
-            int canc, err;
+            block_t *block = chain;
 
-            canc = vlc_savecancel ();
-            err = srtp_recv (p_sys->srtp, block->p_buffer, &len);
-            vlc_restorecancel (canc);
-            if (err)
+            chain = block->p_next;
+            block->p_next = NULL;
+            if (!rtp_check (demux, block))
             {
-                msg_Dbg (demux, "SRTP authentication/decryption failed");
+                block_Release (block);
                 continue;
             }
-            block->i_buffer = len;
+            *pp_last = block;
+            pp_last = &block->p_next;
         }
-#endif
-        return block; /* success! */
+        if (valid != NULL)
+            return valid; /* success! */
     }
     return NULL;
 }
@@ -183,24 +217,37 @@ void *rtp_thread (void *data)
 
     for (;;)
     {
-        block_t *block = rtp_recv (demux);
-        if (block == NULL)
+        block_t *block, *chain = rtp_recv (demux);
+        if (chain == NULL)
             break;
 
-        if (autodetect)
-        {   /* Autodetect payload type, _before_ rtp_queue() */
-            /* No need for lock - the queue is empty. */
-            if (rtp_autodetect (demux, p_sys->session, block))
+        /* Autodetect payload type, _before_ rtp_queue() */
+        /* No need for lock - the queue is empty. */
+        while (autodetect && chain != NULL)
+        {
+            block = chain;
+            if (!rtp_autodetect (demux, p_sys->session, block))
+                autodetect = false;
+            else
             {
+                chain = block->p_next;
+                block->p_next = NULL;
                 block_Release (block);
-                continue;
             }
-            autodetect = false;
         }
 
+        /* The whole batch is queued at once */
         int canc = vlc_savecancel ();
         vlc_mutex_lock (&p_sys->lock);
-        rtp_queue (demux, p_sys->session, block);
+        while (chain != NULL)
+        {
+            block = chain;
+            chain = block->p_next;
+            block->p_next = NULL;
+            if (p_sys->fec != NULL)
+                rtp_fec_media (p_sys->fec, block);
+            rtp_queue (demux, p_sys->session, block);
+        }
         vlc_mutex_unlock (&p_sys->lock);
         vlc_restorecancel (canc);
 
@@ -211,6 +258,80 @@ void *rtp_thread (void *data)
 }
 
 
+/**
+ * Receives SMPTE 2022-1 FEC packets, and queues the media packets they
+ * rebuild as if they had been received from the network.
+ */
+void *rtp_fec_thread (void *data)
+{
+    demux_t *demux = data;
+    demux_sys_t *p_sys = demux->p_sys;
+    /* The column FEC socket is always open, the row one is optional */
+    const unsigned nfd = (p_sys->fec_fd[1] != -1) ? 2 : 1;
+    struct pollfd ufd[2];
+
+    for (unsigned i = 0; i < nfd; i++)
+    {
+        ufd[i].fd = p_sys->fec_fd[i];
+        ufd[i].events = POLLIN;
+    }
+
+    /* Reception buffer: the FEC packets are copied in blocks of their size */
+    uint8_t *buf = malloc (0xffff);
+    if (unlikely(buf == NULL))
+        return NULL;
+    vlc_cleanup_push (free, buf);
+
+    for (;;)
+    {
+        if (poll (ufd, nfd, -1) == -1)
+        {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            /* Do not spin: the media packets are still received */
+            msg_Err (demux, "FEC polling error: %m");
+            break;
+        }
+
+        for (unsigned i = 0; i < nfd; i++)
+        {
+            if (!(ufd[i].revents & POLLIN))
+                continue;
+
+            ssize_t len = recv (ufd[i].fd, buf, 0xffff, MSG_DONTWAIT);
+            if (len <= 0)
+                continue;
+
+            block_t *block = block_Alloc (len);
+            if (unlikely(block == NULL))
+                continue;
+            memcpy (block->p_buffer, buf, len);
+
+            bool recovered = false;
+            int canc = vlc_savecancel ();
+            vlc_mutex_lock (&p_sys->lock);
+            block_t *chain = rtp_fec_recover (p_sys->fec, block);
+            while (chain != NULL)
+            {
+                block = chain;
+                chain = block->p_next;
+                block->p_next = NULL;
+                p_sys->fec_recovered++;
+                rtp_queue (demux, p_sys->session, block);
+                recovered = true;
+            }
+            vlc_mutex_unlock (&p_sys->lock);
+            vlc_restorecancel (canc);
+
+            if (recovered)
+                rtp_process (demux);
+        }
+    }
+    vlc_cleanup_run ();
+    return NULL;
+}
+
+
 /**
  * Process one RTP packet from the de-jitter queue.
  */
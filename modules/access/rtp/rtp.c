@@ -35,6 +35,7 @@
 #include <vlc_plugin.h>
 
 #include "rtp.h"
+#include "fec.h"
 #ifdef HAVE_SRTP
 # include <srtp.h>
 #endif
@@ -82,6 +83,12 @@
     "(between 96 and 127) if it can't be determined otherwise with " \
     "out-of-band mappings (SDP)" )
 
+#define RTP_FEC_TEXT N_("SMPTE 2022-1 FEC")
+#define RTP_FEC_LONGTEXT N_( \
+    "Lost RTP packets will be rebuilt from the SMPTE 2022-1 column and row " \
+    "forward error correction streams, received on the RTP port + 2 and " \
+    "+ 4 respectively." )
+
 static const char *const dynamic_pt_list[] = { "theora" };
 static const char *const dynamic_pt_list_text[] = { "Theora Encoded Video" };
 
@@ -115,7 +122,7 @@ vlc_module_begin ()
 #endif
     add_integer ("rtp-max-src", 1, RTP_MAX_SRC_TEXT,
                  RTP_MAX_SRC_LONGTEXT, true)
-        change_integer_range (1, 255)
+        change_integer_range (1, 65535)
     add_integer ("rtp-timeout", 5, RTP_TIMEOUT_TEXT,
                  RTP_TIMEOUT_LONGTEXT, true)
     add_integer ("rtp-max-dropout", 3000, RTP_MAX_DROPOUT_TEXT,
@@ -127,6 +134,8 @@ vlc_module_begin ()
     add_string ("rtp-dynamic-pt", NULL, RTP_DYNAMIC_PT_TEXT,
                 RTP_DYNAMIC_PT_LONGTEXT, true)
         change_string_list (dynamic_pt_list, dynamic_pt_list_text, NULL)
+    add_bool ("rtp-fec", false, RTP_FEC_TEXT, RTP_FEC_LONGTEXT, true)
+        change_safe ()
 
     /*add_shortcut ("sctp")*/
     add_shortcut ("dccp", "rtptcp", /* "tcp" is already taken :( */
@@ -207,7 +216,7 @@ static int Open (vlc_object_t *obj)
     int rtcp_dport = var_CreateGetInteger (obj, "rtcp-port");
 
     /* Try to connect */
-    int fd = -1, rtcp_fd = -1;
+    int fd = -1, rtcp_fd = -1, fec_fd[2] = { -1, -1 };
 
     switch (tp)
     {
@@ -220,6 +229,17 @@ static int Open (vlc_object_t *obj)
             if (rtcp_dport > 0) /* XXX: source port is unknown */
                 rtcp_fd = net_OpenDgram (obj, dhost, rtcp_dport, shost, 0,
                                          AF_UNSPEC, tp);
+            if (var_CreateGetBool (obj, "rtp-fec"))
+            {   /* column FEC on port + 2, optional row FEC on port + 4 */
+                fec_fd[0] = net_OpenDgram (obj, dhost, dport + 2, shost, 0,
+                                           AF_UNSPEC, tp);
+                if (fec_fd[0] == -1)
+                    msg_Warn (obj, "cannot receive FEC on port %d",
+                              dport + 2);
+                else
+                    fec_fd[1] = net_OpenDgram (obj, dhost, dport + 4, shost,
+                                               0, AF_UNSPEC, tp);
+            }
             break;
 
          case IPPROTO_DCCP:
@@ -254,6 +274,9 @@ static int Open (vlc_object_t *obj)
         net_Close (fd);
         if (rtcp_fd != -1)
             net_Close (rtcp_fd);
+        for (unsigned i = 0; i < 2; i++)
+            if (fec_fd[i] != -1)
+                net_Close (fec_fd[i]);
         return VLC_EGENERIC;
     }
 
@@ -263,6 +286,13 @@ static int Open (vlc_object_t *obj)
 #endif
     p_sys->fd           = fd;
     p_sys->rtcp_fd      = rtcp_fd;
+    p_sys->batch        = NULL;
+    p_sys->fec_fd[0]    = fec_fd[0];
+    p_sys->fec_fd[1]    = fec_fd[1];
+    p_sys->fec          = NULL;
+    p_sys->fec_recovered = 0;
+    p_sys->thread_ready = false;
+    p_sys->fec_thread_ready = false;
     p_sys->caching      = var_CreateGetInteger (obj, "rtp-caching");
     p_sys->max_src      = var_CreateGetInteger (obj, "rtp-max-src");
     p_sys->timeout      = var_CreateGetInteger (obj, "rtp-timeout")
@@ -303,10 +333,32 @@ static int Open (vlc_object_t *obj)
     }
 #endif
 
+    if (!p_sys->framed_rtp)
+    {   /* reads up to 32 datagrams per system call */
+        p_sys->batch = net_BatchNew (obj, fd, 0xffff, 32);
+        if (p_sys->batch == NULL)
+            goto error;
+    }
+
+    if (fec_fd[0] != -1)
+    {
+        p_sys->fec = rtp_fec_create ();
+        if (p_sys->fec == NULL)
+            goto error;
+    }
+
     if (vlc_clone (&p_sys->thread, rtp_thread, demux,
                    VLC_THREAD_PRIORITY_INPUT))
         goto error;
     p_sys->thread_ready = true;
+
+    if (p_sys->fec != NULL)
+    {
+        if (vlc_clone (&p_sys->fec_thread, rtp_fec_thread, demux,
+                       VLC_THREAD_PRIORITY_INPUT))
+            goto error;
+        p_sys->fec_thread_ready = true;
+    }
     return VLC_SUCCESS;
 
 error:
@@ -323,6 +375,12 @@ static void Close (vlc_object_t *obj)
     demux_t *demux = (demux_t *)obj;
     demux_sys_t *p_sys = demux->p_sys;
 
+    /* The FEC thread uses the RTP thread timer */
+    if (p_sys->fec_thread_ready)
+    {
+        vlc_cancel (p_sys->fec_thread);
+        vlc_join (p_sys->fec_thread, NULL);
+    }
     if (p_sys->thread_ready)
     {
         vlc_cancel (p_sys->thread);
@@ -330,12 +388,24 @@ static void Close (vlc_object_t *obj)
     }
     vlc_mutex_destroy (&p_sys->lock);
 
+    if (p_sys->fec)
+    {
+        msg_Dbg (obj, "%u packet(s) recovered with FEC",
+                 p_sys->fec_recovered);
+        rtp_fec_destroy (p_sys->fec);
+    }
+    for (unsigned i = 0; i < 2; i++)
+        if (p_sys->fec_fd[i] != -1)
+            net_Close (p_sys->fec_fd[i]);
+
 #ifdef HAVE_SRTP
     if (p_sys->srtp)
         srtp_destroy (p_sys->srtp);
 #endif
     if (p_sys->session)
         rtp_session_destroy (demux, p_sys->session);
+    if (p_sys->batch)
+        net_BatchDelete (p_sys->batch);
     if (p_sys->rtcp_fd != -1)
         net_Close (p_sys->rtcp_fd);
     net_Close (p_sys->fd);
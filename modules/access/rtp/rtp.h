@@ -55,6 +55,7 @@ bool rtp_dequeue (demux_t *, const rtp_session_t *, mtime_t *);
 int rtp_add_type (demux_t *demux, rtp_session_t *ses, const rtp_pt_t *pt);
 
 void *rtp_thread (void *data);
+void *rtp_fec_thread (void *data);
 
 /* Global data */
 struct demux_sys_t
@@ -65,7 +66,12 @@ struct demux_sys_t
 #endif
     int           fd;
     int           rtcp_fd;
+    struct net_batch_t *batch; /**< Datagrams reception (NULL if framed_rtp) */
+    int           fec_fd[2]; /**< SMPTE 2022-1 column and row FEC sockets */
+    struct rtp_fec_t *fec; /**< FEC receiver (NULL if disabled) */
+    unsigned      fec_recovered; /**< Media packets rebuilt from FEC */
     vlc_thread_t  thread;
+    vlc_thread_t  fec_thread;
     vlc_timer_t   timer;
     vlc_mutex_t   lock;
 
@@ -73,9 +79,10 @@ struct demux_sys_t
     unsigned      caching;
     uint16_t      max_dropout; /**< Max packet forward misordering */
     uint16_t      max_misorder; /**< Max packet backward misordering */
-    uint8_t       max_src; /**< Max simultaneous RTP sources */
+    unsigned      max_src; /**< Max simultaneous RTP sources */
     bool          framed_rtp; /**< Framed RTP packets over TCP */
     bool          thread_ready;
+    bool          fec_thread_ready;
 #if 0
     bool          dead; /**< End of stream */
 #endif
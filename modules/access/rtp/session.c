@@ -32,13 +32,16 @@
 #include <vlc_demux.h>
 
 #include "rtp.h"
+#include "fec.h"
 
 typedef struct rtp_source_t rtp_source_t;
 
 /** State for a RTP session: */
 struct rtp_session_t
 {
-    rtp_source_t **srcv;
+    rtp_source_t **hashv; /* sources by SSRC */
+    unsigned       hashmask;
+    rtp_source_t  *first, *last; /* sources by last reception time */
     unsigned       srcc;
     uint8_t        ptc;
     rtp_pt_t      *ptv;
@@ -49,6 +52,7 @@ rtp_source_create (demux_t *, const rtp_session_t *, uint32_t, uint16_t);
 static void
 rtp_source_destroy (demux_t *, const rtp_session_t *, rtp_source_t *);
 
+static rtp_source_t *rtp_source_next (const rtp_source_t *);
 static void rtp_decode (demux_t *, const rtp_session_t *, rtp_source_t *);
 
 /**
@@ -57,16 +61,27 @@ static void rtp_decode (demux_t *, const rtp_session_t *, rtp_source_t *);
 rtp_session_t *
 rtp_session_create (demux_t *demux)
 {
+    demux_sys_t *p_sys = demux->p_sys;
     rtp_session_t *session = malloc (sizeof (*session));
     if (session == NULL)
         return NULL;
 
-    session->srcv = NULL;
+    /* One bucket per allowed source, rounded up to a power of two */
+    unsigned hashsize = 1;
+    while (hashsize < p_sys->max_src)
+        hashsize <<= 1;
+
+    session->hashv = calloc (hashsize, sizeof (*session->hashv));
+    if (session->hashv == NULL)
+    {
+        free (session);
+        return NULL;
+    }
+    session->hashmask = hashsize - 1;
+    session->first = session->last = NULL;
     session->srcc = 0;
     session->ptc = 0;
     session->ptv = NULL;
-
-    (void)demux;
     return session;
 }
 
@@ -76,10 +91,13 @@ rtp_session_create (demux_t *demux)
  */
 void rtp_session_destroy (demux_t *demux, rtp_session_t *session)
 {
-    for (unsigned i = 0; i < session->srcc; i++)
-        rtp_source_destroy (demux, session, session->srcv[i]);
+    for (rtp_source_t *src = session->first, *next; src != NULL; src = next)
+    {
+        next = rtp_source_next (src);
+        rtp_source_destroy (demux, session, src);
+    }
 
-    free (session->srcv);
+    free (session->hashv);
     free (session->ptv);
     free (session);
     (void)demux;
@@ -140,6 +158,8 @@ struct rtp_source_t
     uint32_t jitter;  /* interarrival delay jitter estimate */
     mtime_t  last_rx; /* last received packet local timestamp */
     uint32_t last_ts; /* last received packet RTP timestamp */
+    mtime_t  max_rx;  /* highest sequence packet local timestamp */
+    mtime_t  interval; /* packet inter-arrival time estimate */
 
     uint32_t ref_rtp; /* sender RTP timestamp reference */
     mtime_t  ref_ntp; /* sender NTP timestamp reference */
@@ -148,10 +168,17 @@ struct rtp_source_t
     uint16_t max_seq; /* next expected sequence */
 
     uint16_t last_seq; /* sequence of the next dequeued packet */
-    block_t *blocks; /* re-ordered blocks queue */
+    block_t **ring; /* re-ordering buffer, indexed by sequence number */
+    unsigned ringmask; /* re-ordering buffer size minus one */
+    unsigned ringc; /* number of queued blocks */
+
+    rtp_source_t *hash_next; /* next source in the same SSRC bucket */
+    rtp_source_t *prev, *next; /* sources by last reception time */
     void    *opaque[0]; /* Per-source private payload data */
 };
 
+#define RTP_RING_MIN 16 /* initial re-ordering buffer size */
+
 /**
  * Initializes a new RTP source within an RTP session.
  */
@@ -167,12 +194,22 @@ rtp_source_create (demux_t *demux, const rtp_session_t *session,
 
     source->ssrc = ssrc;
     source->jitter = 0;
+    source->max_rx = VLC_TS_INVALID;
+    source->interval = 0;
     source->ref_rtp = 0;
     /* TODO: use VLC_TS_0, but VLC does not like negative PTS at the moment */
     source->ref_ntp = UINT64_C (1) << 62;
     source->max_seq = source->bad_seq = init_seq;
     source->last_seq = init_seq - 1;
-    source->blocks = NULL;
+    source->ring = calloc (RTP_RING_MIN, sizeof (*source->ring));
+    if (source->ring == NULL)
+    {
+        free (source);
+        return NULL;
+    }
+    source->ringmask = RTP_RING_MIN - 1;
+    source->ringc = 0;
+    source->hash_next = source->prev = source->next = NULL;
 
     /* Initializes all payload */
     for (unsigned i = 0; i < session->ptc; i++)
@@ -194,10 +231,157 @@ rtp_source_destroy (demux_t *demux, const rtp_session_t *session,
 
     for (unsigned i = 0; i < session->ptc; i++)
         session->ptv[i].destroy (demux, source->opaque[i]);
-    block_ChainRelease (source->blocks);
+    for (unsigned i = 0; source->ringc > 0; i++)
+        if (source->ring[i] != NULL)
+        {
+            block_Release (source->ring[i]);
+            source->ringc--;
+        }
+    free (source->ring);
     free (source);
 }
 
+static rtp_source_t *rtp_source_next (const rtp_source_t *source)
+{
+    return source->next;
+}
+
+static inline unsigned rtp_ssrc_hash (const rtp_session_t *session,
+                                      uint32_t ssrc)
+{
+    /* SSRCs should be random, but do not trust senders too much */
+    return ((ssrc * UINT32_C(2654435761)) >> 16) & session->hashmask;
+}
+
+/**
+ * Finds an RTP source by SSRC.
+ */
+static rtp_source_t *
+rtp_source_find (const rtp_session_t *session, uint32_t ssrc)
+{
+    rtp_source_t *src = session->hashv[rtp_ssrc_hash (session, ssrc)];
+
+    while (src != NULL && src->ssrc != ssrc)
+        src = src->hash_next;
+    return src;
+}
+
+/**
+ * Moves an RTP source to the end of the reception time list.
+ */
+static void
+rtp_source_touch (rtp_session_t *session, rtp_source_t *src)
+{
+    if (session->last == src)
+        return;
+
+    /* unlink (if linked) */
+    if (src->prev != NULL)
+        src->prev->next = src->next;
+    else if (session->first == src)
+        session->first = src->next;
+    if (src->next != NULL)
+        src->next->prev = src->prev;
+
+    /* append */
+    src->next = NULL;
+    src->prev = session->last;
+    if (session->last != NULL)
+        session->last->next = src;
+    else
+        session->first = src;
+    session->last = src;
+}
+
+/**
+ * Adds a new RTP source to the session.
+ */
+static void
+rtp_source_link (rtp_session_t *session, rtp_source_t *src)
+{
+    rtp_source_t **pp = session->hashv + rtp_ssrc_hash (session, src->ssrc);
+
+    src->hash_next = *pp;
+    *pp = src;
+    rtp_source_touch (session, src);
+    session->srcc++;
+}
+
+/**
+ * RTP source garbage collection. As the sources are ordered by reception
+ * time, only the timed out ones are visited.
+ */
+static void
+rtp_source_expire (demux_t *demux, rtp_session_t *session, mtime_t now)
+{
+    demux_sys_t *p_sys = demux->p_sys;
+    rtp_source_t *src;
+
+    while ((src = session->first) != NULL
+        && (src->last_rx + p_sys->timeout) < now)
+    {
+        rtp_source_t **pp = session->hashv
+                          + rtp_ssrc_hash (session, src->ssrc);
+        while (*pp != src)
+            pp = &(*pp)->hash_next;
+        *pp = src->hash_next;
+
+        session->first = src->next;
+        if (src->next != NULL)
+            src->next->prev = NULL;
+        else
+            session->last = NULL;
+        session->srcc--;
+        rtp_source_destroy (demux, session, src);
+    }
+}
+
+/**
+ * Grows the re-ordering buffer of a source so that it can hold
+ * a packet this far ahead of the next dequeued one.
+ */
+static int
+rtp_source_grow (rtp_source_t *src, unsigned delta)
+{
+    unsigned size = src->ringmask + 1;
+
+    while (size <= delta)
+        size <<= 1;
+
+    block_t **ring = calloc (size, sizeof (*ring));
+    if (ring == NULL)
+        return ENOMEM;
+
+    for (unsigned i = 0, n = 0; n < src->ringc; i++)
+    {
+        block_t *block = src->ring[i];
+        if (block != NULL)
+        {
+            ring[GetWBE (block->p_buffer + 2) & (size - 1)] = block;
+            n++;
+        }
+    }
+    free (src->ring);
+    src->ring = ring;
+    src->ringmask = size - 1;
+    return 0;
+}
+
+/**
+ * Finds the queued packet with the lowest sequence number.
+ */
+static block_t **
+rtp_source_head (const rtp_source_t *src)
+{
+    assert (src->ringc > 0);
+    for (uint16_t seq = src->last_seq + 1;; seq++)
+    {
+        block_t **slot = src->ring + (seq & src->ringmask);
+        if (*slot != NULL)
+            return slot;
+    }
+}
+
 static inline uint16_t rtp_seq (const block_t *block)
 {
     assert (block->i_buffer >= 4);
@@ -256,50 +440,30 @@ rtp_queue (demux_t *demux, rtp_session_t *session, block_t *block)
         block->i_buffer -= padding;
     }
 
-    mtime_t        now = mdate ();
-    rtp_source_t  *src  = NULL;
+    /* reception time, from the kernel if known (see net_ReadBatch()) */
+    mtime_t        now = (block->i_pts > VLC_TS_INVALID) ? block->i_pts
+                                                         : mdate ();
     const uint16_t seq  = rtp_seq (block);
     const uint32_t ssrc = GetDWBE (block->p_buffer + 8);
 
     /* In most case, we know this source already */
-    for (unsigned i = 0, max = session->srcc; i < max; i++)
-    {
-        rtp_source_t *tmp = session->srcv[i];
-        if (tmp->ssrc == ssrc)
-        {
-            src = tmp;
-            break;
-        }
-
-        /* RTP source garbage collection */
-        if ((tmp->last_rx + p_sys->timeout) < now)
-        {
-            rtp_source_destroy (demux, session, tmp);
-            if (--session->srcc > 0)
-                session->srcv[i] = session->srcv[session->srcc - 1];
-        }
-    }
+    rtp_source_t  *src  = rtp_source_find (session, ssrc);
 
     if (src == NULL)
     {
         /* New source */
+        rtp_source_expire (demux, session, now);
         if (session->srcc >= p_sys->max_src)
         {
             msg_Warn (demux, "too many RTP sessions");
             goto drop;
         }
 
-        rtp_source_t **tab;
-        tab = realloc (session->srcv, (session->srcc + 1) * sizeof (*tab));
-        if (tab == NULL)
-            goto drop;
-        session->srcv = tab;
-
         src = rtp_source_create (demux, session, ssrc, seq);
         if (src == NULL)
             goto drop;
 
-        tab[session->srcc++] = src;
+        rtp_source_link (session, src);
         /* Cannot compute jitter yet */
     }
     else
@@ -322,23 +486,35 @@ rtp_queue (demux_t *demux, rtp_session_t *session, block_t *block)
     src->last_rx = now;
     block->i_pts = now; /* store reception time until dequeued */
     src->last_ts = rtp_timestamp (block);
+    rtp_source_touch (session, src);
+    rtp_source_expire (demux, session, now);
 
     /* Check sequence number */
     /* NOTE: the sequence number is per-source,
      * but is independent from the payload type. */
+    int max_misorder = p_sys->max_misorder;
+    if (p_sys->fec != NULL) /* rebuilt packets come that much later */
+        max_misorder += rtp_fec_latency (p_sys->fec);
+
     int16_t delta_seq = seq - src->max_seq;
     if ((delta_seq > 0) ? (delta_seq > p_sys->max_dropout)
-                        : (-delta_seq > p_sys->max_misorder))
+                        : (-delta_seq > max_misorder))
     {
         msg_Dbg (demux, "sequence discontinuity"
                  " (got: %"PRIu16", expected: %"PRIu16")", seq, src->max_seq);
         if (seq == src->bad_seq)
         {
             src->max_seq = src->bad_seq = seq + 1;
-            src->last_seq = seq - 0x7fffe; /* hack for rtp_decode() */
+            src->last_seq = seq - 1;
             msg_Warn (demux, "sequence resynchronized");
-            block_ChainRelease (src->blocks);
-            src->blocks = NULL;
+            for (unsigned i = 0; src->ringc > 0; i++)
+                if (src->ring[i] != NULL)
+                {
+                    block_Release (src->ring[i]);
+                    src->ring[i] = NULL;
+                    src->ringc--;
+                }
+            block->i_flags |= BLOCK_FLAG_DISCONTINUITY;
         }
         else
         {
@@ -348,27 +524,39 @@ rtp_queue (demux_t *demux, rtp_session_t *session, block_t *block)
     }
     else
     if (delta_seq >= 0)
-        src->max_seq = seq + 1;
-
-    /* Queues the block in sequence order,
-     * hence there is a single queue for all payload types. */
-    block_t **pp = &src->blocks;
-    for (block_t *prev = *pp; prev != NULL; prev = *pp)
     {
-        int16_t delta_seq = seq - rtp_seq (prev);
-        if (delta_seq < 0)
-            break;
-        if (delta_seq == 0)
+        /* Packet interval, averaged over the missing packets if any.
+         * Late and rebuilt packets do not count. */
+        if (src->max_rx > VLC_TS_INVALID)
         {
-            msg_Dbg (demux, "duplicate packet (sequence: %"PRIu16")", seq);
-            goto drop; /* duplicate */
+            mtime_t d = (now - src->max_rx) / (delta_seq + 1);
+            src->interval += (d - src->interval + 8) / 16;
         }
-        pp = &prev->p_next;
+        src->max_rx = now;
+        src->max_seq = seq + 1;
     }
-    block->p_next = *pp;
-    *pp = block;
 
-    /*rtp_decode (demux, session, src);*/
+    /* Queues the block by sequence number,
+     * hence there is a single queue for all payload types. */
+    delta_seq = seq - (uint16_t)(src->last_seq + 1);
+    if (delta_seq < 0)
+    {   /* Trash too late packets (and PIM Assert duplicates) */
+        msg_Dbg (demux, "ignoring late packet (sequence: %"PRIu16")", seq);
+        goto drop;
+    }
+    if ((unsigned)delta_seq > src->ringmask
+     && rtp_source_grow (src, delta_seq))
+        goto drop;
+
+    block_t **slot = src->ring + (seq & src->ringmask);
+    if (*slot != NULL)
+    {
+        msg_Dbg (demux, "duplicate packet (sequence: %"PRIu16")", seq);
+        goto drop; /* duplicate */
+    }
+    block->p_next = NULL;
+    *slot = block;
+    src->ringc++;
     return;
 
 drop:
@@ -398,9 +586,8 @@ bool rtp_dequeue (demux_t *demux, const rtp_session_t *session,
 
     *deadlinep = INT64_MAX;
 
-    for (unsigned i = 0, max = session->srcc; i < max; i++)
+    for (rtp_source_t *src = session->first; src != NULL; src = src->next)
     {
-        rtp_source_t *src = session->srcv[i];
         block_t *block;
 
         /* Because of IP packet delay variation (IPDV), we need to guesstimate
@@ -419,8 +606,9 @@ bool rtp_dequeue (demux_t *demux, const rtp_session_t *session,
          * LibVLC E/S-out clock synchronization. Here, we need to bother about
          * re-ordering packets, as decoders can't cope with mis-ordered data.
          */
-        while (((block = src->blocks)) != NULL)
+        while (src->ringc > 0)
         {
+            block = *rtp_source_head (src);
             if ((int16_t)(rtp_seq (block) - (src->last_seq + 1)) <= 0)
             {   /* Next (or earlier) block ready, no need to wait */
                 rtp_decode (demux, session, src);
@@ -441,6 +629,12 @@ bool rtp_dequeue (demux_t *demux, const rtp_session_t *session,
             if (deadline < (CLOCK_FREQ / 40))
                 deadline = CLOCK_FREQ / 40;
 
+            /* With FEC, a missing packet may still be rebuilt once the FEC
+             * packets that protect it are received */
+            if (demux->p_sys->fec != NULL)
+                deadline += rtp_fec_latency (demux->p_sys->fec)
+                          * src->interval;
+
             /* Additionnaly, we implicitly wait for the packetization time
              * multiplied by the number of missing packets. block is the first
              * non-missing packet (lowest sequence number). We have no better
@@ -468,22 +662,16 @@ bool rtp_dequeue (demux_t *demux, const rtp_session_t *session,
 static void
 rtp_decode (demux_t *demux, const rtp_session_t *session, rtp_source_t *src)
 {
-    block_t *block = src->blocks;
+    block_t **slot = rtp_source_head (src);
+    block_t *block = *slot;
 
-    assert (block);
-    src->blocks = block->p_next;
-    block->p_next = NULL;
+    *slot = NULL;
+    src->ringc--;
 
-    /* Discontinuity detection */
+    /* Discontinuity detection (late packets are not queued) */
     uint16_t delta_seq = rtp_seq (block) - (src->last_seq + 1);
     if (delta_seq != 0)
     {
-        if (delta_seq >= 0x8000)
-        {   /* Trash too late packets (and PIM Assert duplicates) */
-            msg_Dbg (demux, "ignoring late packet (sequence: %"PRIu16")",
-                      rtp_seq (block));
-            goto drop;
-        }
         msg_Warn (demux, "%"PRIu16" packet(s) lost", delta_seq);
         block->i_flags |= BLOCK_FLAG_DISCONTINUITY;
     }
@@ -40,8 +40,11 @@
 #include <vlc_plugin.h>
 #include <vlc_access.h>
 #include <vlc_network.h>
+#include <vlc_block.h>
 
 #define MTU 65535
+/* datagrams read at once */
+#define UDP_BATCH 32
 
 /*****************************************************************************
  * Module descriptor
@@ -78,6 +81,12 @@ vlc_module_end ()
 static block_t *BlockUDP( access_t * );
 static int Control( access_t *, int, va_list );
 
+struct access_sys_t
+{
+    int         fd;
+    net_batch_t *p_batch;
+};
+
 /*****************************************************************************
  * Open: open the socket
  *****************************************************************************/
@@ -162,7 +171,23 @@ static int Open( vlc_object_t *p_this )
         msg_Err( p_access, "cannot open socket" );
         return VLC_EGENERIC;
     }
-    p_access->p_sys = (void *)(intptr_t)fd;
+
+    access_sys_t *p_sys = malloc( sizeof( *p_sys ) );
+    if( p_sys == NULL )
+    {
+        net_Close( fd );
+        return VLC_ENOMEM;
+    }
+    p_sys->fd = fd;
+    /* all the pending datagrams are read with a single call */
+    p_sys->p_batch = net_BatchNew( p_access, fd, MTU, UDP_BATCH );
+    if( p_sys->p_batch == NULL )
+    {
+        net_Close( fd );
+        free( p_sys );
+        return VLC_ENOMEM;
+    }
+    p_access->p_sys = p_sys;
 
     /* Update default_pts to a suitable value for udp access */
     var_Create( p_access, "udp-caching", VLC_VAR_INTEGER | VLC_VAR_DOINHERIT );
@@ -175,8 +200,11 @@ static int Open( vlc_object_t *p_this )
 static void Close( vlc_object_t *p_this )
 {
     access_t     *p_access = (access_t*)p_this;
+    access_sys_t *p_sys = p_access->p_sys;
 
-    net_Close( (intptr_t)p_access->p_sys );
+    net_BatchDelete( p_sys->p_batch );
+    net_Close( p_sys->fd );
+    free( p_sys );
 }
 
 /*****************************************************************************
@@ -221,26 +249,15 @@ static int Control( access_t *p_access, int i_query, va_list args )
 }
 
 /*****************************************************************************
- * BlockUDP:
+ * BlockUDP: returns all the pending datagrams, as a chain of blocks stamped
+ * with their arrival time
  *****************************************************************************/
 static block_t *BlockUDP( access_t *p_access )
 {
     access_sys_t *p_sys = p_access->p_sys;
-    block_t      *p_block;
-    ssize_t len;
 
     if( p_access->info.b_eof )
         return NULL;
 
-    /* Read data */
-    p_block = block_New( p_access, MTU );
-    len = net_Read( p_access, (intptr_t)p_sys, NULL,
-                    p_block->p_buffer, MTU, false );
-    if( len < 0 )
-    {
-        block_Release( p_block );
-        return NULL;
-    }
-
-    return block_Realloc( p_block, 0, len );
+    return net_ReadBatch( p_access, p_sys->p_batch );
 }
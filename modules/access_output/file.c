@@ -31,6 +31,7 @@
 #endif
 
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <time.h>
 #include <fcntl.h>
 #include <errno.h>
@@ -65,6 +66,20 @@ static void Close( vlc_object_t * );
                             "of replacing it.")
 #define SYNC_TEXT N_("Synchronous writing")
 #define SYNC_LONGTEXT N_( "Open the file with synchronous writing.")
+#define ASYNC_TEXT N_("Asynchronous writing")
+#define ASYNC_LONGTEXT N_( "Gather the data in large buffers and write them " \
+                           "from a separate thread, so that the stream " \
+                           "output does not wait for the disk.")
+#define BUFSIZE_TEXT N_("Write buffer size (kB)")
+#define BUFSIZE_LONGTEXT N_( "Size of the buffers written at once in " \
+                             "asynchronous mode.")
+#define QUEUE_TEXT N_("Write queue length")
+#define QUEUE_LONGTEXT N_( "Number of buffers that can wait for the disk " \
+                           "before the stream output has to wait too.")
+#define FSYNC_TEXT N_("Flush interval (s)")
+#define FSYNC_LONGTEXT N_( "In asynchronous mode, flush the written data " \
+                           "to the disk at most every so many seconds " \
+                           "(0 leaves it to the system).")
 
 vlc_module_begin ()
     set_description( N_("File stream output") )
@@ -78,6 +93,16 @@ vlc_module_begin ()
 #ifdef O_SYNC
     add_bool( SOUT_CFG_PREFIX "sync", false, SYNC_TEXT,SYNC_LONGTEXT,
               false )
+#endif
+#ifndef WIN32
+    add_bool( SOUT_CFG_PREFIX "async", false, ASYNC_TEXT, ASYNC_LONGTEXT,
+              true )
+    add_integer_with_range( SOUT_CFG_PREFIX "buffer-size", 1024, 64, 4096,
+                            NULL, BUFSIZE_TEXT, BUFSIZE_LONGTEXT, true )
+    add_integer_with_range( SOUT_CFG_PREFIX "queue", 8, 1, 64, NULL,
+                            QUEUE_TEXT, QUEUE_LONGTEXT, true )
+    add_integer( SOUT_CFG_PREFIX "fsync", 0, FSYNC_TEXT, FSYNC_LONGTEXT,
+                 true )
 #endif
     set_callbacks( Open, Close )
 vlc_module_end ()
@@ -90,6 +115,12 @@ static const char *const ppsz_sout_options[] = {
     "append",
 #ifdef O_SYNC
     "sync",
+#endif
+#ifndef WIN32
+    "async",
+    "buffer-size",
+    "queue",
+    "fsync",
 #endif
     NULL
 };
@@ -99,9 +130,63 @@ static int Seek ( sout_access_out_t *, off_t  );
 static ssize_t Read ( sout_access_out_t *, block_t * );
 static int Control( sout_access_out_t *, int, va_list );
 
+#ifndef WIN32
+/* Buffer of the asynchronous writer, written at i_offset in the file */
+typedef struct file_buffer_t file_buffer_t;
+struct file_buffer_t
+{
+    file_buffer_t *p_next;
+    void          *p_base;
+    uint8_t       *p_data;
+    size_t         i_data;
+    size_t         i_size;
+    off_t          i_offset;
+};
+
+static int  AsyncOpen( sout_access_out_t * );
+static void AsyncClose( sout_access_out_t * );
+static ssize_t AsyncWrite( sout_access_out_t *, block_t * );
+static int  AsyncFlush( sout_access_out_t * );
+static void AsyncQueue( sout_access_out_sys_t * );
+#endif
+
 struct sout_access_out_sys_t
 {
     int i_handle;
+
+#ifndef WIN32
+    /* Asynchronous writer: Write() fills p_current, the writer thread
+     * writes the queued buffers in order with pwrite() */
+    bool b_async;
+    vlc_thread_t thread;
+    vlc_mutex_t lock;
+    vlc_cond_t wait;            /* buffer queued, or closing */
+    vlc_cond_t done;            /* buffer written */
+    file_buffer_t *p_current;
+    file_buffer_t *p_queue, **pp_queue_last;
+    file_buffer_t *p_free;
+    unsigned i_queued;
+    unsigned i_buffers;
+    unsigned i_max_buffers;
+    size_t i_bufsize;
+    bool b_writing;
+    bool b_closing;
+    int i_error;
+    off_t i_offset;             /* position of the next written byte */
+    mtime_t i_fsync;
+    mtime_t i_synced;
+
+    struct
+    {
+        uint64_t i_bytes;
+        unsigned i_writes;
+        unsigned i_syncs;
+        uint64_t i_depth;       /* sum of the queue depths */
+        unsigned i_max_depth;
+        unsigned i_waits;       /* the stream output waited for the disk */
+        mtime_t  i_waited;
+    } stats;
+#endif
 };
 
 /*****************************************************************************
@@ -174,16 +259,33 @@ static int Open( vlc_object_t *p_this )
         }
     }
 
+    sout_access_out_sys_t *p_sys = calloc( 1, sizeof( *p_sys ) );
+    if( !p_sys )
+    {
+        close( fd );
+        return VLC_ENOMEM;
+    }
+    p_sys->i_handle = fd;
+
     p_access->pf_write = Write;
     p_access->pf_read  = Read;
     p_access->pf_seek  = Seek;
     p_access->pf_control = Control;
-    p_access->p_sys    = (void *)(intptr_t)fd;
+    p_access->p_sys    = p_sys;
 
     msg_Dbg( p_access, "file access output opened (%s)", p_access->psz_path );
     if (append)
         lseek (fd, 0, SEEK_END);
 
+#ifndef WIN32
+    if( var_GetBool( p_access, SOUT_CFG_PREFIX "async" )
+     && AsyncOpen( p_access ) )
+    {
+        close( fd );
+        free( p_sys );
+        return VLC_EGENERIC;
+    }
+#endif
     return VLC_SUCCESS;
 }
 
@@ -193,8 +295,14 @@ static int Open( vlc_object_t *p_this )
 static void Close( vlc_object_t * p_this )
 {
     sout_access_out_t *p_access = (sout_access_out_t*)p_this;
+    sout_access_out_sys_t *p_sys = p_access->p_sys;
 
-    close( (intptr_t)p_access->p_sys );
+#ifndef WIN32
+    if( p_sys->b_async )
+        AsyncClose( p_access );
+#endif
+    close( p_sys->i_handle );
+    free( p_sys );
 
     msg_Dbg( p_access, "file access output closed" );
 }
@@ -221,10 +329,26 @@ static int Control( sout_access_out_t *p_access, int i_query, va_list args )
  *****************************************************************************/
 static ssize_t Read( sout_access_out_t *p_access, block_t *p_buffer )
 {
+    sout_access_out_sys_t *p_sys = p_access->p_sys;
     ssize_t val;
 
+#ifndef WIN32
+    if( p_sys->b_async )
+    {
+        /* Read back what was written */
+        if( AsyncFlush( p_access ) )
+            return -1;
+        do
+            val = pread( p_sys->i_handle, p_buffer->p_buffer,
+                         p_buffer->i_buffer, p_sys->i_offset );
+        while (val == -1 && errno == EINTR);
+        if( val > 0 )
+            p_sys->i_offset += val;
+        return val;
+    }
+#endif
     do
-        val = read( (intptr_t)p_access->p_sys, p_buffer->p_buffer,
+        val = read( p_sys->i_handle, p_buffer->p_buffer,
                     p_buffer->i_buffer );
     while (val == -1 && errno == EINTR);
     return val;
@@ -235,11 +359,16 @@ static ssize_t Read( sout_access_out_t *p_access, block_t *p_buffer )
  *****************************************************************************/
 static ssize_t Write( sout_access_out_t *p_access, block_t *p_buffer )
 {
+    sout_access_out_sys_t *p_sys = p_access->p_sys;
     size_t i_write = 0;
 
+#ifndef WIN32
+    if( p_sys->b_async )
+        return AsyncWrite( p_access, p_buffer );
+#endif
     while( p_buffer )
     {
-        ssize_t val = write ((intptr_t)p_access->p_sys,
+        ssize_t val = write (p_sys->i_handle,
                              p_buffer->p_buffer, p_buffer->i_buffer);
         if (val == -1)
         {
@@ -270,5 +399,343 @@ static ssize_t Write( sout_access_out_t *p_access, block_t *p_buffer )
  *****************************************************************************/
 static int Seek( sout_access_out_t *p_access, off_t i_pos )
 {
-    return lseek( (intptr_t)p_access->p_sys, i_pos, SEEK_SET );
+    sout_access_out_sys_t *p_sys = p_access->p_sys;
+
+#ifndef WIN32
+    if( p_sys->b_async )
+    {
+        /* The queued buffers keep their own offsets */
+        AsyncQueue( p_sys );
+        p_sys->i_offset = i_pos;
+        return 0;
+    }
+#endif
+    return lseek( p_sys->i_handle, i_pos, SEEK_SET );
+}
+
+#ifndef WIN32
+/*****************************************************************************
+ * Asynchronous writer
+ *****************************************************************************/
+static int WriteBuffer( int fd, const file_buffer_t *p_buf )
+{
+    size_t i_done = 0;
+
+    while( i_done < p_buf->i_data )
+    {
+        ssize_t val = pwrite( fd, p_buf->p_data + i_done,
+                              p_buf->i_data - i_done,
+                              p_buf->i_offset + i_done );
+        if( val == -1 )
+        {
+            if( errno == EINTR )
+                continue;
+            return errno;
+        }
+        i_done += val;
+    }
+    return 0;
+}
+
+static void *Thread( void *data )
+{
+    sout_access_out_t *p_access = data;
+    sout_access_out_sys_t *p_sys = p_access->p_sys;
+
+    vlc_mutex_lock( &p_sys->lock );
+    for( ;; )
+    {
+        file_buffer_t *p_buf = p_sys->p_queue;
+
+        if( p_buf == NULL )
+        {
+            if( p_sys->b_closing )
+                break;
+            vlc_cond_wait( &p_sys->wait, &p_sys->lock );
+            continue;
+        }
+        p_sys->p_queue = p_buf->p_next;
+        if( p_sys->p_queue == NULL )
+            p_sys->pp_queue_last = &p_sys->p_queue;
+        p_sys->i_queued--;
+        p_sys->b_writing = true;
+        vlc_mutex_unlock( &p_sys->lock );
+
+        int i_error = WriteBuffer( p_sys->i_handle, p_buf );
+        bool b_sync = false;
+        if( !i_error && p_sys->i_fsync > 0
+         && mdate() >= p_sys->i_synced + p_sys->i_fsync )
+        {
+            if( fdatasync( p_sys->i_handle ) )
+                i_error = errno;
+            p_sys->i_synced = mdate();
+            b_sync = true;
+        }
+
+        vlc_mutex_lock( &p_sys->lock );
+        if( i_error && !p_sys->i_error )
+            p_sys->i_error = i_error;
+        p_sys->stats.i_bytes += p_buf->i_data;
+        p_sys->stats.i_writes++;
+        if( b_sync )
+            p_sys->stats.i_syncs++;
+        p_buf->i_data = 0;
+        p_buf->p_next = p_sys->p_free;
+        p_sys->p_free = p_buf;
+        p_sys->b_writing = false;
+        vlc_cond_signal( &p_sys->done );
+    }
+    vlc_mutex_unlock( &p_sys->lock );
+    return NULL;
+}
+
+static void BufferDelete( file_buffer_t *p_buf )
+{
+    free( p_buf->p_base );
+    free( p_buf );
+}
+
+/* Queues the current buffer, or recycles it if it is empty */
+static void AsyncQueue( sout_access_out_sys_t *p_sys )
+{
+    file_buffer_t *p_buf = p_sys->p_current;
+
+    if( p_buf == NULL )
+        return;
+    p_sys->p_current = NULL;
+    p_buf->p_next = NULL;
+
+    vlc_mutex_lock( &p_sys->lock );
+    if( p_buf->i_data == 0 )
+    {
+        p_buf->p_next = p_sys->p_free;
+        p_sys->p_free = p_buf;
+        vlc_mutex_unlock( &p_sys->lock );
+        return;
+    }
+    *p_sys->pp_queue_last = p_buf;
+    p_sys->pp_queue_last = &p_buf->p_next;
+    p_sys->i_queued++;
+    p_sys->stats.i_depth += p_sys->i_queued;
+    if( p_sys->i_queued > p_sys->stats.i_max_depth )
+        p_sys->stats.i_max_depth = p_sys->i_queued;
+    vlc_cond_signal( &p_sys->wait );
+    vlc_mutex_unlock( &p_sys->lock );
+}
+
+/* Gets an empty buffer for the data at p_sys->i_offset, waiting for the
+ * writer if all the buffers are in use */
+static file_buffer_t *AsyncBuffer( sout_access_out_t *p_access )
+{
+    sout_access_out_sys_t *p_sys = p_access->p_sys;
+    file_buffer_t *p_buf;
+
+    vlc_mutex_lock( &p_sys->lock );
+    if( p_sys->p_free == NULL && p_sys->i_buffers >= p_sys->i_max_buffers )
+    {
+        mtime_t i_start = mdate();
+        while( p_sys->p_free == NULL )
+            vlc_cond_wait( &p_sys->done, &p_sys->lock );
+        p_sys->stats.i_waits++;
+        p_sys->stats.i_waited += mdate() - i_start;
+    }
+    p_buf = p_sys->p_free;
+    if( p_buf != NULL )
+        p_sys->p_free = p_buf->p_next;
+    else
+        p_sys->i_buffers++;
+    vlc_mutex_unlock( &p_sys->lock );
+
+    if( p_buf == NULL )
+    {
+        p_buf = malloc( sizeof( *p_buf ) );
+        if( p_buf == NULL )
+            goto error;
+        p_buf->p_data = vlc_memalign( &p_buf->p_base, 4096,
+                                      p_sys->i_bufsize );
+        if( p_buf->p_data == NULL )
+        {
+            free( p_buf );
+            goto error;
+        }
+    }
+
+    /* Stop at the next multiple of the buffer size, so that writes stay
+     * aligned in the file after a seek */
+    p_buf->p_next = NULL;
+    p_buf->i_data = 0;
+    p_buf->i_offset = p_sys->i_offset;
+    p_buf->i_size = p_sys->i_bufsize - p_sys->i_offset % p_sys->i_bufsize;
+    return p_buf;
+
+error:
+    vlc_mutex_lock( &p_sys->lock );
+    p_sys->i_buffers--;
+    vlc_mutex_unlock( &p_sys->lock );
+    return NULL;
+}
+
+static ssize_t AsyncWrite( sout_access_out_t *p_access, block_t *p_buffer )
+{
+    sout_access_out_sys_t *p_sys = p_access->p_sys;
+    size_t i_write = 0;
+
+    vlc_mutex_lock( &p_sys->lock );
+    errno = p_sys->i_error;
+    vlc_mutex_unlock( &p_sys->lock );
+    if( errno )
+    {
+        msg_Err( p_access, "cannot write: %m" );
+        block_ChainRelease( p_buffer );
+        return -1;
+    }
+
+    while( p_buffer )
+    {
+        file_buffer_t *p_buf = p_sys->p_current;
+
+        if( p_buf == NULL )
+        {
+            p_buf = p_sys->p_current = AsyncBuffer( p_access );
+            if( p_buf == NULL )
+            {
+                block_ChainRelease( p_buffer );
+                return -1;
+            }
+        }
+
+        size_t i_copy = __MIN( p_buffer->i_buffer,
+                               p_buf->i_size - p_buf->i_data );
+        memcpy( p_buf->p_data + p_buf->i_data, p_buffer->p_buffer, i_copy );
+        p_buf->i_data += i_copy;
+        p_sys->i_offset += i_copy;
+        i_write += i_copy;
+
+        if( p_buf->i_data == p_buf->i_size )
+            AsyncQueue( p_sys );
+
+        if( i_copy == p_buffer->i_buffer )
+        {
+            block_t *p_next = p_buffer->p_next;
+            block_Release( p_buffer );
+            p_buffer = p_next;
+        }
+        else
+        {
+            p_buffer->p_buffer += i_copy;
+            p_buffer->i_buffer -= i_copy;
+        }
+    }
+    return i_write;
+}
+
+/* Waits until everything written so far is in the file */
+static int AsyncFlush( sout_access_out_t *p_access )
+{
+    sout_access_out_sys_t *p_sys = p_access->p_sys;
+    int i_error;
+
+    AsyncQueue( p_sys );
+
+    vlc_mutex_lock( &p_sys->lock );
+    while( p_sys->p_queue != NULL || p_sys->b_writing )
+        vlc_cond_wait( &p_sys->done, &p_sys->lock );
+    i_error = p_sys->i_error;
+    vlc_mutex_unlock( &p_sys->lock );
+
+    if( i_error )
+    {
+        errno = i_error;
+        msg_Err( p_access, "cannot write: %m" );
+        return -1;
+    }
+    return 0;
+}
+
+static int AsyncOpen( sout_access_out_t *p_access )
+{
+    sout_access_out_sys_t *p_sys = p_access->p_sys;
+    struct stat st;
+
+    /* pwrite() needs a regular file */
+    if( fstat( p_sys->i_handle, &st ) || !S_ISREG( st.st_mode ) )
+    {
+        msg_Warn( p_access, "not a regular file, writing synchronously" );
+        return VLC_SUCCESS;
+    }
+
+    p_sys->i_offset = lseek( p_sys->i_handle, 0, SEEK_CUR );
+    if( p_sys->i_offset == -1 )
+        p_sys->i_offset = 0;
+    p_sys->i_bufsize = var_GetInteger( p_access, SOUT_CFG_PREFIX "buffer-size" )
+                       * 1024;
+    /* one buffer is being filled while the others are queued */
+    p_sys->i_max_buffers = var_GetInteger( p_access, SOUT_CFG_PREFIX "queue" )
+                           + 1;
+    p_sys->i_fsync = var_GetInteger( p_access, SOUT_CFG_PREFIX "fsync" )
+                     * CLOCK_FREQ;
+    p_sys->i_synced = mdate();
+    p_sys->p_current = NULL;
+    p_sys->p_queue = NULL;
+    p_sys->pp_queue_last = &p_sys->p_queue;
+    p_sys->p_free = NULL;
+
+    vlc_mutex_init( &p_sys->lock );
+    vlc_cond_init( &p_sys->wait );
+    vlc_cond_init( &p_sys->done );
+    if( vlc_clone( &p_sys->thread, Thread, p_access, VLC_THREAD_PRIORITY_LOW ) )
+    {
+        vlc_cond_destroy( &p_sys->done );
+        vlc_cond_destroy( &p_sys->wait );
+        vlc_mutex_destroy( &p_sys->lock );
+        return VLC_EGENERIC;
+    }
+    p_sys->b_async = true;
+
+    msg_Dbg( p_access, "writing asynchronously with %u buffers of %zu kB",
+             p_sys->i_max_buffers, p_sys->i_bufsize / 1024 );
+    return VLC_SUCCESS;
+}
+
+static void AsyncClose( sout_access_out_t *p_access )
+{
+    sout_access_out_sys_t *p_sys = p_access->p_sys;
+
+    /* The writer empties the queue before leaving */
+    AsyncQueue( p_sys );
+    vlc_mutex_lock( &p_sys->lock );
+    p_sys->b_closing = true;
+    vlc_cond_signal( &p_sys->wait );
+    vlc_mutex_unlock( &p_sys->lock );
+    vlc_join( p_sys->thread, NULL );
+
+    if( p_sys->i_error )
+    {
+        errno = p_sys->i_error;
+        msg_Err( p_access, "cannot write: %m" );
+    }
+    if( p_sys->i_fsync > 0 )
+        fdatasync( p_sys->i_handle );
+
+    if( p_sys->p_current != NULL )
+        BufferDelete( p_sys->p_current );
+    while( p_sys->p_free != NULL )
+    {
+        file_buffer_t *p_buf = p_sys->p_free;
+        p_sys->p_free = p_buf->p_next;
+        BufferDelete( p_buf );
+    }
+    vlc_cond_destroy( &p_sys->done );
+    vlc_cond_destroy( &p_sys->wait );
+    vlc_mutex_destroy( &p_sys->lock );
+
+    msg_Dbg( p_access, "%"PRIu64" bytes in %u writes, %u syncs, queue depth "
+             "%.1f average %u max, waited %u times for %"PRId64" ms",
+             p_sys->stats.i_bytes, p_sys->stats.i_writes,
+             p_sys->stats.i_syncs,
+             p_sys->stats.i_writes ?
+                 (double)p_sys->stats.i_depth / p_sys->stats.i_writes : 0.,
+             p_sys->stats.i_max_depth, p_sys->stats.i_waits,
+             p_sys->stats.i_waited / 1000 );
 }
+#endif
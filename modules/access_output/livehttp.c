@@ -42,6 +42,7 @@
 #include <vlc_fs.h>
 #include <vlc_strings.h>
 #include <vlc_charset.h>
+#include <vlc_httpd.h>
 
 #ifndef O_LARGEFILE
 #   define O_LARGEFILE 0
@@ -51,6 +52,9 @@
 
 #define MAX_RENAME_RETRIES        10
 
+#define DEFAULT_PORT              8080
+#define DEFAULT_HTTPD_NUMSEGS     5
+
 /*****************************************************************************
  * Module descriptor
  *****************************************************************************/
@@ -80,6 +84,12 @@ static void Close( vlc_object_t * );
 
 #define RATECONTROL_TEXT N_("Use muxers rate control mechanism")
 
+#define HTTPD_TEXT N_("Serve segments from memory")
+#define HTTPD_LONGTEXT N_("Keep the segments in memory and serve them, " \
+                          "with the index, from the built-in HTTP server. " \
+                          "The destination is then host:port/path and the " \
+                          "index is the path of the playlist.")
+
 vlc_module_begin ()
     set_description( N_("HTTP Live streaming output") )
     set_shortname( N_("LiveHTTP" ))
@@ -99,6 +109,8 @@ vlc_module_begin ()
                 INDEX_TEXT, INDEX_LONGTEXT, true )
     add_string( SOUT_CFG_PREFIX "index-url", NULL,
                 INDEXURL_TEXT, INDEXURL_LONGTEXT, true )
+    add_bool( SOUT_CFG_PREFIX "httpd", false,
+              HTTPD_TEXT, HTTPD_LONGTEXT, true )
     set_callbacks( Open, Close )
 vlc_module_end ()
 
@@ -114,6 +126,7 @@ static const char *const ppsz_sout_options[] = {
     "index",
     "index-url",
     "ratecontrol",
+    "httpd",
     NULL
 };
 
@@ -121,12 +134,24 @@ static ssize_t Write( sout_access_out_t *, block_t * );
 static int Seek ( sout_access_out_t *, off_t  );
 static int Control( sout_access_out_t *, int, va_list );
 
+/* Segment kept in memory and published by httpd */
+typedef struct livehttp_segment_t livehttp_segment_t;
+struct livehttp_segment_t
+{
+    livehttp_segment_t *p_next;
+    httpd_file_t *p_file; /* owns the data, shared with the clients */
+    char *psz_url;
+    uint32_t i_segment;
+    mtime_t i_duration;
+};
+
 struct sout_access_out_sys_t
 {
     char *psz_cursegPath;
     char *psz_indexPath;
     char *psz_indexUrl;
     mtime_t i_opendts;
+    mtime_t i_lastdts;
     mtime_t  i_seglenm;
     uint32_t i_segment;
     size_t  i_seglen;
@@ -135,8 +160,26 @@ struct sout_access_out_sys_t
     bool b_delsegs;
     bool b_ratecontrol;
     bool b_splitanywhere;
+
+    /* httpd mode: the segment being written, then the published ones,
+     * oldest first. The list and the index are protected by lock, the
+     * data of a published segment never changes. */
+    bool b_httpd;
+    char *psz_segUrl;
+    httpd_host_t *p_httpd_host;
+    httpd_file_t *p_httpd_index;
+    block_t *p_curseg;
+    block_t **pp_curseg_last;
+    vlc_mutex_t lock;
+    livehttp_segment_t *p_first;
+    livehttp_segment_t **pp_last;
+    unsigned i_published;
+    char *psz_index;
 };
 
+static int httpdOpen( sout_access_out_t *, sout_access_out_sys_t * );
+static void httpdClose( sout_access_out_sys_t * );
+
 /*****************************************************************************
  * Open: open the file
  *****************************************************************************/
@@ -164,6 +207,7 @@ static int Open( vlc_object_t *p_this )
     p_sys->b_splitanywhere = var_GetBool( p_access, SOUT_CFG_PREFIX "splitanywhere" );
     p_sys->b_delsegs = var_GetBool( p_access, SOUT_CFG_PREFIX "delsegs" );
     p_sys->b_ratecontrol = var_GetBool( p_access, SOUT_CFG_PREFIX "ratecontrol") ;
+    p_sys->b_httpd = var_GetBool( p_access, SOUT_CFG_PREFIX "httpd" );
 
     p_sys->psz_indexPath = NULL;
     psz_idx = var_GetNonEmptyString( p_access, SOUT_CFG_PREFIX "index" );
@@ -177,9 +221,13 @@ static int Open( vlc_object_t *p_this )
             free( p_sys );
             return VLC_ENOMEM;
         }
-        path_sanitize( psz_tmp );
         p_sys->psz_indexPath = psz_tmp;
-        vlc_unlink( p_sys->psz_indexPath );
+        /* in httpd mode, this is the path of the playlist URL */
+        if ( !p_sys->b_httpd )
+        {
+            path_sanitize( psz_tmp );
+            vlc_unlink( p_sys->psz_indexPath );
+        }
     }
 
     p_sys->psz_indexUrl = var_GetNonEmptyString( p_access, SOUT_CFG_PREFIX "index-url" );
@@ -188,6 +236,15 @@ static int Open( vlc_object_t *p_this )
     p_sys->i_handle = -1;
     p_sys->i_segment = 0;
     p_sys->psz_cursegPath = NULL;
+    p_sys->i_lastdts = 0;
+
+    if ( p_sys->b_httpd && httpdOpen( p_access, p_sys ) != VLC_SUCCESS )
+    {
+        free( p_sys->psz_indexUrl );
+        free( p_sys->psz_indexPath );
+        free( p_sys );
+        return VLC_EGENERIC;
+    }
 
     p_access->pf_write = Write;
     p_access->pf_seek  = Seek;
@@ -323,12 +380,287 @@ static int updateIndexAndDel( sout_access_out_t *p_access, sout_access_out_sys_t
     return 0;
 }
 
+/*****************************************************************************
+ * httpd mode: segments are kept in memory and served by the HTTP server
+ *****************************************************************************/
+static int httpdIndexFill( httpd_file_sys_t *p_args, httpd_file_t *p_file,
+                           uint8_t *psz_request, uint8_t **pp_data, int *pi_data )
+{
+    VLC_UNUSED(p_file); VLC_UNUSED(psz_request);
+    sout_access_out_sys_t *p_sys = (sout_access_out_sys_t *)p_args;
+
+    vlc_mutex_lock( &p_sys->lock );
+    *pi_data = strlen( p_sys->psz_index );
+    *pp_data = malloc( *pi_data );
+    if ( *pp_data )
+        memcpy( *pp_data, p_sys->psz_index, *pi_data );
+    else
+        *pi_data = 0;
+    vlc_mutex_unlock( &p_sys->lock );
+
+    return VLC_SUCCESS;
+}
+
+static void httpdSegmentDelete( livehttp_segment_t *p_seg )
+{
+    if ( p_seg->p_file )
+        httpd_FileDelete( p_seg->p_file );
+    free( p_seg->psz_url );
+    free( p_seg );
+}
+
+/************************************************************************
+ * httpdUpdateIndex: generate the index of the last i_numsegs segments
+ ************************************************************************/
+static int httpdUpdateIndex( sout_access_out_t *p_access, sout_access_out_sys_t *p_sys, bool b_isend )
+{
+    /* The oldest published segment is not listed anymore, it is only
+     * kept for the clients that got the previous index. The list is only
+     * changed by the writer, which is the caller. */
+    livehttp_segment_t *p_seg = p_sys->p_first;
+    for ( unsigned i = p_sys->i_numsegs; i < p_sys->i_published; i++ )
+        p_seg = p_seg->p_next;
+
+    uint32_t i_firstseg = p_seg ? p_seg->i_segment : p_sys->i_segment + 1;
+    int64_t i_target = p_sys->i_seglen;
+    for ( livehttp_segment_t *p = p_seg; p; p = p->p_next )
+    {
+        int64_t i_duration = ( p->i_duration + CLOCK_FREQ / 2 ) / CLOCK_FREQ;
+        if ( i_duration > i_target )
+            i_target = i_duration;
+    }
+
+    char *psz_index;
+    if ( asprintf( &psz_index, "#EXTM3U\n#EXT-X-TARGETDURATION:%"PRId64"\n#EXT-X-MEDIA-SEQUENCE:%"PRIu32"\n", i_target, i_firstseg ) < 0 )
+        return -1;
+
+    for ( ; p_seg; p_seg = p_seg->p_next )
+    {
+        char *psz_name, *psz_tmp;
+        if ( ! ( psz_name = formatSegmentPath( p_access, p_sys->psz_indexUrl, p_seg->i_segment, false ) ) )
+        {
+            free( psz_index );
+            return -1;
+        }
+        int val = asprintf( &psz_tmp, "%s#EXTINF:%"PRId64",\n%s\n", psz_index,
+                            ( p_seg->i_duration + CLOCK_FREQ / 2 ) / CLOCK_FREQ,
+                            psz_name );
+        free( psz_name );
+        free( psz_index );
+        if ( val < 0 )
+            return -1;
+        psz_index = psz_tmp;
+    }
+
+    if ( b_isend )
+    {
+        char *psz_tmp;
+        int val = asprintf( &psz_tmp, "%s"STR_ENDLIST, psz_index );
+        free( psz_index );
+        if ( val < 0 )
+            return -1;
+        psz_index = psz_tmp;
+    }
+
+    vlc_mutex_lock( &p_sys->lock );
+    free( p_sys->psz_index );
+    p_sys->psz_index = psz_index;
+    vlc_mutex_unlock( &p_sys->lock );
+    return 0;
+}
+
+/*****************************************************************************
+ * httpdCloseSegment: publish the segment and drop the oldest one
+ *****************************************************************************/
+static void httpdCloseSegment( sout_access_out_t *p_access, sout_access_out_sys_t *p_sys, bool b_isend )
+{
+    livehttp_segment_t *p_seg, *p_old = NULL;
+
+    if ( p_sys->p_curseg == NULL )
+    {
+        if ( b_isend )
+            httpdUpdateIndex( p_access, p_sys, true );
+        return;
+    }
+
+    block_t *p_data = block_ChainGather( p_sys->p_curseg );
+    p_sys->p_curseg = NULL;
+    p_sys->pp_curseg_last = &p_sys->p_curseg;
+
+    p_seg = malloc( sizeof( *p_seg ) );
+    if ( !p_seg || !p_data )
+    {
+        free( p_seg );
+        if ( p_data )
+            block_Release( p_data );
+        return;
+    }
+    p_seg->p_next = NULL;
+    p_seg->i_segment = p_sys->i_segment;
+    p_seg->i_duration = p_sys->i_lastdts - p_sys->i_opendts;
+    p_seg->p_file = NULL;
+    p_seg->psz_url = formatSegmentPath( p_access, p_sys->psz_segUrl, p_sys->i_segment, false );
+    if ( p_seg->psz_url )
+        p_seg->p_file = httpd_FileNewFromBlock( p_sys->p_httpd_host,
+                                                p_seg->psz_url, "video/MP2T",
+                                                NULL, NULL, NULL, p_data );
+    else
+        block_Release( p_data );
+    if ( !p_seg->p_file )
+    {
+        msg_Err( p_access, "cannot publish segment %"PRIu32, p_seg->i_segment );
+        httpdSegmentDelete( p_seg );
+        return;
+    }
+    msg_Info( p_access, "LiveHttpSegmentComplete: %s (%"PRIu32")" , p_seg->psz_url, p_seg->i_segment );
+
+    vlc_mutex_lock( &p_sys->lock );
+    *p_sys->pp_last = p_seg;
+    p_sys->pp_last = &p_seg->p_next;
+    if ( ++p_sys->i_published > p_sys->i_numsegs + 1 )
+    {
+        p_old = p_sys->p_first;
+        p_sys->p_first = p_old->p_next;
+        p_sys->i_published--;
+    }
+    vlc_mutex_unlock( &p_sys->lock );
+
+    httpdUpdateIndex( p_access, p_sys, b_isend );
+    if ( p_old )
+        httpdSegmentDelete( p_old );
+}
+
+/*****************************************************************************
+ * httpdOpen: listen on the destination host and publish the index
+ *****************************************************************************/
+static int httpdOpen( sout_access_out_t *p_access, sout_access_out_sys_t *p_sys )
+{
+    char *psz_parser, *psz_bind;
+    int i_port = 0;
+
+    vlc_mutex_init( &p_sys->lock );
+    p_sys->psz_segUrl = NULL;
+    p_sys->p_httpd_host = NULL;
+    p_sys->p_httpd_index = NULL;
+    p_sys->p_curseg = NULL;
+    p_sys->pp_curseg_last = &p_sys->p_curseg;
+    p_sys->p_first = NULL;
+    p_sys->pp_last = &p_sys->p_first;
+    p_sys->i_published = 0;
+    p_sys->psz_index = NULL;
+
+    if ( p_sys->i_numsegs == 0 )
+        p_sys->i_numsegs = DEFAULT_HTTPD_NUMSEGS;
+
+    /* p_access->psz_path = "hostname:port/segment-path" */
+    char *psz_host = strdup( p_access->psz_path );
+    if ( !psz_host )
+        goto error;
+    psz_parser = strchr( psz_host, '/' );
+    if ( !psz_parser || !p_sys->psz_indexPath || *p_sys->psz_indexPath != '/' )
+    {
+        msg_Err( p_access, "httpd mode needs segment and index paths" );
+        free( psz_host );
+        goto error;
+    }
+    p_sys->psz_segUrl = strdup( psz_parser );
+    *psz_parser = '\0';
+
+    psz_bind = psz_host;
+    if ( psz_bind[0] == '[' )
+    {
+        psz_bind++;
+        psz_parser = strstr( psz_bind, "]:" );
+        if ( psz_parser )
+            i_port = atoi( psz_parser + 2 );
+        psz_parser = strchr( psz_bind, ']' );
+        if ( psz_parser )
+            *psz_parser = '\0';
+    }
+    else
+    {
+        psz_parser = strrchr( psz_bind, ':' );
+        if ( psz_parser )
+        {
+            *psz_parser = '\0';
+            i_port = atoi( psz_parser + 1 );
+        }
+    }
+    if ( i_port <= 0 )
+        i_port = DEFAULT_PORT;
+
+    p_sys->p_httpd_host = httpd_HostNew( VLC_OBJECT(p_access), psz_bind, i_port );
+    if ( !p_sys->p_httpd_host )
+    {
+        msg_Err( p_access, "cannot listen on %s port %d", psz_bind, i_port );
+        free( psz_host );
+        goto error;
+    }
+    free( psz_host );
+
+    /* List the segments relative to the index if they share its directory */
+    if ( !p_sys->psz_indexUrl && p_sys->psz_segUrl )
+    {
+        size_t i_dir = strrchr( p_sys->psz_indexPath, '/' ) - p_sys->psz_indexPath + 1;
+        if ( !strncmp( p_sys->psz_segUrl, p_sys->psz_indexPath, i_dir ) &&
+             !strchr( p_sys->psz_segUrl + i_dir, '/' ) )
+            p_sys->psz_indexUrl = strdup( p_sys->psz_segUrl + i_dir );
+        else
+            p_sys->psz_indexUrl = strdup( p_sys->psz_segUrl );
+    }
+    if ( !p_sys->psz_segUrl || !p_sys->psz_indexUrl ||
+         httpdUpdateIndex( p_access, p_sys, false ) )
+        goto error;
+
+    p_sys->p_httpd_index = httpd_FileNew( p_sys->p_httpd_host, p_sys->psz_indexPath,
+                                          "application/vnd.apple.mpegurl",
+                                          NULL, NULL, NULL,
+                                          httpdIndexFill, (void *)p_sys );
+    if ( !p_sys->p_httpd_index )
+    {
+        msg_Err( p_access, "cannot publish index %s", p_sys->psz_indexPath );
+        goto error;
+    }
+
+    msg_Dbg( p_access, "serving %s and %s on port %d", p_sys->psz_indexPath, p_sys->psz_segUrl, i_port );
+    return VLC_SUCCESS;
+
+error:
+    httpdClose( p_sys );
+    return VLC_EGENERIC;
+}
+
+/*****************************************************************************
+ * httpdClose: unpublish everything
+ *****************************************************************************/
+static void httpdClose( sout_access_out_sys_t *p_sys )
+{
+    if ( p_sys->p_httpd_index )
+        httpd_FileDelete( p_sys->p_httpd_index );
+
+    while ( p_sys->p_first )
+    {
+        livehttp_segment_t *p_seg = p_sys->p_first;
+        p_sys->p_first = p_seg->p_next;
+        httpdSegmentDelete( p_seg );
+    }
+    block_ChainRelease( p_sys->p_curseg );
+
+    if ( p_sys->p_httpd_host )
+        httpd_HostDelete( p_sys->p_httpd_host );
+    vlc_mutex_destroy( &p_sys->lock );
+    free( p_sys->psz_index );
+    free( p_sys->psz_segUrl );
+}
+
 /*****************************************************************************
  * closeCurrentSegment: Close the segment file
  *****************************************************************************/
 static void closeCurrentSegment( sout_access_out_t *p_access, sout_access_out_sys_t *p_sys, bool b_isend )
 {
-    if ( p_sys->i_handle >= 0 )
+    if ( p_sys->b_httpd )
+        httpdCloseSegment( p_access, p_sys, b_isend );
+    else if ( p_sys->i_handle >= 0 )
     {
         close( p_sys->i_handle );
         p_sys->i_handle = -1;
@@ -352,6 +684,8 @@ static void Close( vlc_object_t * p_this )
 
 
     closeCurrentSegment( p_access, p_sys, true );
+    if ( p_sys->b_httpd )
+        httpdClose( p_sys );
     free( p_sys->psz_indexUrl );
     free( p_sys->psz_indexPath );
     free( p_sys );
@@ -420,16 +754,35 @@ static ssize_t Write( sout_access_out_t *p_access, block_t *p_buffer )
 
     while( p_buffer )
     {
-        if ( p_sys->i_handle >= 0 && ( p_sys->b_splitanywhere || ( p_buffer->i_flags & BLOCK_FLAG_TYPE_I ) ) && ( p_buffer->i_dts-p_sys->i_opendts ) > p_sys->i_seglenm )
+        bool b_open = p_sys->b_httpd ? p_sys->p_curseg != NULL : p_sys->i_handle >= 0;
+
+        p_sys->i_lastdts = p_buffer->i_dts;
+        if ( b_open && ( p_sys->b_splitanywhere || ( p_buffer->i_flags & BLOCK_FLAG_TYPE_I ) ) && ( p_buffer->i_dts-p_sys->i_opendts ) > p_sys->i_seglenm )
         {
             closeCurrentSegment( p_access, p_sys, false );
+            b_open = false;
         }
-        if ( p_buffer->i_buffer > 0 && p_sys->i_handle < 0 )
+        if ( p_buffer->i_buffer > 0 && !b_open )
         {
             p_sys->i_opendts = p_buffer->i_dts;
-            if ( openNextFile( p_access, p_sys ) < 0 )
+            if ( p_sys->b_httpd )
+                p_sys->i_segment++;
+            else if ( openNextFile( p_access, p_sys ) < 0 )
                 return -1;
         }
+        if ( p_sys->b_httpd )
+        {
+            /* keep the block in the segment being written */
+            block_t *p_next = p_buffer->p_next;
+            p_buffer->p_next = NULL;
+            i_write += p_buffer->i_buffer;
+            if ( p_buffer->i_buffer > 0 )
+                block_ChainLastAppend( &p_sys->pp_curseg_last, p_buffer );
+            else
+                block_Release( p_buffer );
+            p_buffer = p_next;
+            continue;
+        }
         ssize_t val = write ( p_sys->i_handle,
                              p_buffer->p_buffer, p_buffer->i_buffer );
         if ( val == -1 )
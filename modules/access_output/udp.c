@@ -51,7 +51,10 @@
 
 #include <vlc_network.h>
 
-#define MAX_EMPTY_BLOCKS 200
+#include "udp_batch.h"
+
+#define MAX_EMPTY_BLOCKS 256
+#define MAX_QUEUED_BLOCKS 16384 /* datagrams in the ring, see QueueUDPPacket */
 
 /*****************************************************************************
  * Module descriptor
@@ -81,6 +84,7 @@ vlc_module_begin ()
     add_integer( SOUT_CFG_PREFIX "caching", DEFAULT_PTS_DELAY / 1000, CACHING_TEXT, CACHING_LONGTEXT, true )
     add_integer( SOUT_CFG_PREFIX "group", 1, GROUP_TEXT, GROUP_LONGTEXT,
                                  true )
+    add_udp_batch( SOUT_CFG_PREFIX )
     add_obsolete_integer( SOUT_CFG_PREFIX "late" )
     add_obsolete_bool( SOUT_CFG_PREFIX "raw" )
 
@@ -96,6 +100,8 @@ vlc_module_end ()
 static const char *const ppsz_sout_options[] = {
     "caching",
     "group",
+    "batch",
+    "batch-window",
     NULL
 };
 
@@ -114,6 +120,8 @@ static int Control( sout_access_out_t *, int, va_list );
 
 static void* ThreadWrite( void * );
 static block_t *NewUDPPacket( sout_access_out_t *, mtime_t );
+static void RecycleUDPPacket( sout_access_out_t *, block_t * );
+static void QueueUDPPacket( sout_access_out_t *, block_t * );
 
 struct sout_access_out_sys_t
 {
@@ -122,9 +130,15 @@ struct sout_access_out_sys_t
     bool          b_mtu_warning;
     size_t        i_mtu;
 
-    block_fifo_t *p_fifo;
-    block_fifo_t *p_empty_blocks;
+    /* Write() produces, ThreadWrite() consumes (and the other way round) */
+    block_ring_t *p_fifo;
+    block_fifo_t *p_overflow;
+    block_ring_t *p_empty_blocks;
     block_t      *p_buffer;
+    bool          b_overflow_warning;
+
+    /* private to the thread */
+    udp_batch_t   batch;
 
     vlc_thread_t  thread;
 };
@@ -215,16 +229,39 @@ static int Open( vlc_object_t *p_this )
     p_sys->i_handle = i_handle;
     p_sys->i_mtu = var_CreateGetInteger( p_this, "mtu" );
     p_sys->b_mtu_warning = false;
-    p_sys->p_fifo = block_FifoNew();
-    p_sys->p_empty_blocks = block_FifoNew();
+    p_sys->p_fifo = block_RingNew( MAX_QUEUED_BLOCKS );
+    p_sys->p_overflow = block_FifoNew();
+    p_sys->b_overflow_warning = false;
+    p_sys->p_empty_blocks = block_RingNew( MAX_EMPTY_BLOCKS );
     p_sys->p_buffer = NULL;
 
+    if( udp_batch_Init( p_this, &p_sys->batch, i_handle,
+                        var_GetInteger( p_access, SOUT_CFG_PREFIX "batch" ),
+                        var_GetInteger( p_access,
+                                        SOUT_CFG_PREFIX "batch-window" ) )
+         || p_sys->p_fifo == NULL || p_sys->p_overflow == NULL
+         || p_sys->p_empty_blocks == NULL )
+    {
+        if( p_sys->p_fifo != NULL )
+            block_RingRelease( p_sys->p_fifo );
+        if( p_sys->p_overflow != NULL )
+            block_FifoRelease( p_sys->p_overflow );
+        if( p_sys->p_empty_blocks != NULL )
+            block_RingRelease( p_sys->p_empty_blocks );
+        udp_batch_Clean( p_this, &p_sys->batch );
+        net_Close (i_handle);
+        free (p_sys);
+        return VLC_ENOMEM;
+    }
+
     if( vlc_clone( &p_sys->thread, ThreadWrite, p_access,
                            VLC_THREAD_PRIORITY_HIGHEST ) )
     {
         msg_Err( p_access, "cannot spawn sout access thread" );
-        block_FifoRelease( p_sys->p_fifo );
-        block_FifoRelease( p_sys->p_empty_blocks );
+        block_RingRelease( p_sys->p_fifo );
+        block_FifoRelease( p_sys->p_overflow );
+        block_RingRelease( p_sys->p_empty_blocks );
+        udp_batch_Clean( p_this, &p_sys->batch );
         net_Close (i_handle);
         free (p_sys);
         return VLC_EGENERIC;
@@ -247,11 +284,13 @@ static void Close( vlc_object_t * p_this )
 
     vlc_cancel( p_sys->thread );
     vlc_join( p_sys->thread, NULL );
-    block_FifoRelease( p_sys->p_fifo );
-    block_FifoRelease( p_sys->p_empty_blocks );
+    block_RingRelease( p_sys->p_fifo );
+    block_FifoRelease( p_sys->p_overflow );
+    block_RingRelease( p_sys->p_empty_blocks );
 
     if( p_sys->p_buffer ) block_Release( p_sys->p_buffer );
 
+    udp_batch_Clean( p_this, &p_sys->batch );
     net_Close( p_sys->i_handle );
     free( p_sys );
 }
@@ -303,7 +342,7 @@ static ssize_t Write( sout_access_out_t *p_access, block_t *p_buffer )
                          now - p_sys->p_buffer->i_dts
                           - p_sys->i_caching );
             }
-            block_FifoPut( p_sys->p_fifo, p_sys->p_buffer );
+            QueueUDPPacket( p_access, p_sys->p_buffer );
             p_sys->p_buffer = NULL;
         }
 
@@ -343,7 +382,7 @@ static ssize_t Write( sout_access_out_t *p_access, block_t *p_buffer )
                              mdate() - p_sys->p_buffer->i_dts
                               - p_sys->i_caching );
                 }
-                block_FifoPut( p_sys->p_fifo, p_sys->p_buffer );
+                QueueUDPPacket( p_access, p_sys->p_buffer );
                 p_sys->p_buffer = NULL;
             }
         }
@@ -374,19 +413,13 @@ static block_t *NewUDPPacket( sout_access_out_t *p_access, mtime_t i_dts)
     sout_access_out_sys_t *p_sys = p_access->p_sys;
     block_t *p_buffer;
 
-    while ( block_FifoCount( p_sys->p_empty_blocks ) > MAX_EMPTY_BLOCKS )
-    {
-        p_buffer = block_FifoGet( p_sys->p_empty_blocks );
-        block_Release( p_buffer );
-    }
-
-    if( block_FifoCount( p_sys->p_empty_blocks ) == 0 )
+    if( block_RingCount( p_sys->p_empty_blocks ) == 0 )
     {
         p_buffer = block_Alloc( p_sys->i_mtu );
     }
     else
     {
-        p_buffer = block_FifoGet(p_sys->p_empty_blocks );
+        p_buffer = block_RingGet( p_sys->p_empty_blocks );
         p_buffer->i_flags = 0;
         p_buffer = block_Realloc( p_buffer, 0, p_sys->i_mtu );
     }
@@ -397,6 +430,74 @@ static block_t *NewUDPPacket( sout_access_out_t *p_access, mtime_t i_dts)
     return p_buffer;
 }
 
+/*****************************************************************************
+ * RecycleUDPPacket: give a sent packet back to Write() (from the thread)
+ *****************************************************************************/
+static void RecycleUDPPacket( sout_access_out_t *p_access, block_t *p_buffer )
+{
+    sout_access_out_sys_t *p_sys = p_access->p_sys;
+
+    if( !block_RingTryPut( p_sys->p_empty_blocks, p_buffer ) )
+        block_Release( p_buffer );
+}
+
+/*****************************************************************************
+ * QueueUDPPacket: hand a datagram over to the thread (from Write())
+ *****************************************************************************
+ * The ring covers the usual caching at common bitrates; beyond it (e.g. high
+ * bitrates with a long caching), datagrams go to an unbounded FIFO rather
+ * than stalling the stream output. Once the FIFO is in use, every datagram
+ * goes there until the thread has drained it, which keeps them in order.
+ *****************************************************************************/
+static void QueueUDPPacket( sout_access_out_t *p_access, block_t *p_buffer )
+{
+    sout_access_out_sys_t *p_sys = p_access->p_sys;
+
+    if( block_FifoCount( p_sys->p_overflow ) == 0
+     && block_RingTryPut( p_sys->p_fifo, p_buffer ) )
+        return;
+
+    if( !p_sys->b_overflow_warning )
+    {
+        msg_Dbg( p_access, "more than %u datagrams queued",
+                 MAX_QUEUED_BLOCKS );
+        p_sys->b_overflow_warning = true;
+    }
+    block_FifoPut( p_sys->p_overflow, p_buffer );
+    /* The thread may have found both queues empty and be waiting on the
+     * ring: wake it up with block_RingGet() = NULL. */
+    block_RingWake( p_sys->p_fifo );
+}
+
+/* Next datagram in order, from the ring or else from the FIFO (thread side).
+ * The ring only gets new datagrams when the FIFO is empty. */
+static block_t *DequeueUDPPacket( sout_access_out_sys_t *p_sys, bool b_get )
+{
+    for( ;; )
+    {
+        block_t *p_pk;
+
+        if( block_RingCount( p_sys->p_fifo ) == 0
+         && block_FifoCount( p_sys->p_overflow ) > 0 )
+            return b_get ? block_FifoGet( p_sys->p_overflow )
+                         : block_FifoShow( p_sys->p_overflow );
+
+        p_pk = b_get ? block_RingGet( p_sys->p_fifo )
+                     : block_RingShow( p_sys->p_fifo );
+        if( p_pk != NULL )
+            return p_pk;
+    }
+}
+
+static void ReleaseBatch( void *data )
+{
+    udp_batch_t *p_batch = data;
+
+    for( unsigned int i = 0; i < p_batch->i_nb_blocks; i++ )
+        block_Release( p_batch->pp_blocks[i] );
+    p_batch->i_nb_blocks = 0;
+}
+
 /*****************************************************************************
  * ThreadWrite: Write a packet on the network at the good time.
  *****************************************************************************/
@@ -412,7 +513,7 @@ static void* ThreadWrite( void *data )
 
     for (;;)
     {
-        block_t *p_pk = block_FifoGet( p_sys->p_fifo );
+        block_t *p_pk = DequeueUDPPacket( p_sys, true );
         mtime_t       i_date, i_sent;
 
         i_date = p_sys->i_caching + p_pk->i_dts;
@@ -424,7 +525,7 @@ static void* ThreadWrite( void *data )
                     msg_Dbg( p_access, "mmh, hole (%"PRId64" > 2s) -> drop",
                              i_date - i_date_last );
 
-                block_FifoPut( p_sys->p_empty_blocks, p_pk );
+                RecycleUDPPacket( p_access, p_pk );
 
                 i_date_last = i_date;
                 i_dropped_packets++;
@@ -438,15 +539,36 @@ static void* ThreadWrite( void *data )
             }
         }
 
-        block_cleanup_push( p_pk );
+        udp_batch_Append( &p_sys->batch, p_pk );
+        vlc_cleanup_push( ReleaseBatch, &p_sys->batch );
         i_to_send--;
         if( !i_to_send || (p_pk->i_flags & BLOCK_FLAG_CLOCK) )
         {
             mwait( i_date );
             i_to_send = i_group;
         }
-        if ( send( p_sys->i_handle, p_pk->p_buffer, p_pk->i_buffer, 0 ) == -1 )
-            msg_Warn( p_access, "send error: %m" );
+
+        /* Take along the following packets which are due soon enough. PCR
+         * packets are always sent on their own, at the right time. */
+        while( !udp_batch_IsFull( &p_sys->batch )
+                && ( block_RingCount( p_sys->p_fifo )
+                      || block_FifoCount( p_sys->p_overflow ) ) )
+        {
+            block_t *p_next = DequeueUDPPacket( p_sys, false );
+            mtime_t i_next_date = p_sys->i_caching + p_next->i_dts;
+
+            if( (p_next->i_flags & BLOCK_FLAG_CLOCK)
+                 || i_next_date > mdate() + p_sys->batch.i_window
+                 || i_next_date - i_date > 2000000
+                 || i_next_date - i_date < -1000 )
+                break;
+
+            udp_batch_Append( &p_sys->batch,
+                              DequeueUDPPacket( p_sys, true ) );
+            i_date = i_next_date;
+        }
+
+        udp_batch_Send( VLC_OBJECT(p_access), &p_sys->batch );
         vlc_cleanup_pop();
 
         if( i_dropped_packets )
@@ -464,7 +586,9 @@ static void* ThreadWrite( void *data )
         }
 #endif
 
-        block_FifoPut( p_sys->p_empty_blocks, p_pk );
+        for( unsigned i = 0; i < p_sys->batch.i_nb_blocks; i++ )
+            RecycleUDPPacket( p_access, p_sys->batch.pp_blocks[i] );
+        p_sys->batch.i_nb_blocks = 0;
 
         i_date_last = i_date;
     }
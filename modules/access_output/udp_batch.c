@@ -0,0 +1,137 @@
+/**
+ * @file udp_batch.c
+ * @brief Batched datagram output shared by the UDP outputs
+ */
+/*****************************************************************************
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <string.h>
+
+#include <vlc_common.h>
+#include <vlc_block.h>
+#include <vlc_network.h>
+
+#include "udp_batch.h"
+
+/**
+ * Sets up a batch for a connected socket.
+ * @param i_size maximum number of datagrams per system call
+ * @param i_window_ms datagrams due within this many ms are sent together
+ */
+int udp_batch_Init( vlc_object_t *p_obj, udp_batch_t *p_batch, int i_handle,
+                    int64_t i_size, int64_t i_window_ms )
+{
+    p_batch->i_handle = i_handle;
+    p_batch->i_size = __MAX( __MIN( i_size, UDP_BATCH_MAX ), 1 );
+    p_batch->i_window = i_window_ms * 1000;
+#ifndef HAVE_SENDMMSG
+    if( p_batch->i_size > 1 )
+    {
+        msg_Warn( p_obj, "sendmmsg() is not available, batching disabled" );
+        p_batch->i_size = 1;
+    }
+#endif
+    p_batch->i_nb_blocks = 0;
+    p_batch->i_nb_calls = p_batch->i_nb_datagrams = 0;
+    p_batch->i_max_batch = 0;
+
+    p_batch->pp_blocks = malloc( p_batch->i_size * sizeof(block_t *) );
+    if( p_batch->pp_blocks == NULL )
+        return VLC_ENOMEM;
+
+    if( p_batch->i_size > 1 )
+        msg_Dbg( p_obj, "sending up to %u datagrams per call",
+                 p_batch->i_size );
+    return VLC_SUCCESS;
+}
+
+/**
+ * Prints the statistics and frees the batch, which must be empty.
+ */
+void udp_batch_Clean( vlc_object_t *p_obj, udp_batch_t *p_batch )
+{
+    if( p_batch->i_nb_calls )
+        msg_Dbg( p_obj, "sent %"PRIu64" datagrams in %"PRIu64" calls "
+                 "(average %.1f, max %u)",
+                 p_batch->i_nb_datagrams, p_batch->i_nb_calls,
+                 (double)p_batch->i_nb_datagrams / p_batch->i_nb_calls,
+                 p_batch->i_max_batch );
+    free( p_batch->pp_blocks );
+}
+
+/**
+ * Writes the pending datagrams on the network. The blocks are left in the
+ * batch for the caller to release or recycle.
+ */
+void udp_batch_Send( vlc_object_t *p_obj, udp_batch_t *p_batch )
+{
+    unsigned int i_sent = 0;
+
+#ifdef HAVE_SENDMMSG
+    if( p_batch->i_nb_blocks > 1 )
+    {
+        struct mmsghdr p_msgs[p_batch->i_nb_blocks];
+        struct iovec p_iovs[p_batch->i_nb_blocks];
+
+        memset( p_msgs, 0, sizeof(p_msgs) );
+        for( unsigned int i = 0; i < p_batch->i_nb_blocks; i++ )
+        {
+            p_iovs[i].iov_base = p_batch->pp_blocks[i]->p_buffer;
+            p_iovs[i].iov_len = p_batch->pp_blocks[i]->i_buffer;
+            p_msgs[i].msg_hdr.msg_iov = &p_iovs[i];
+            p_msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        while( i_sent < p_batch->i_nb_blocks )
+        {
+            int i_ret = sendmmsg( p_batch->i_handle, p_msgs + i_sent,
+                                  p_batch->i_nb_blocks - i_sent, 0 );
+            p_batch->i_nb_calls++;
+            if( i_ret == -1 )
+            {
+                msg_Warn( p_obj, "send error: %m" );
+                i_sent++; /* skip the faulty datagram */
+            }
+            else
+            {
+                p_batch->i_nb_datagrams += i_ret;
+                if( (unsigned int)i_ret > p_batch->i_max_batch )
+                    p_batch->i_max_batch = i_ret;
+                i_sent += i_ret;
+            }
+        }
+        return;
+    }
+#endif
+
+    for( ; i_sent < p_batch->i_nb_blocks; i_sent++ )
+    {
+        block_t *p_block = p_batch->pp_blocks[i_sent];
+
+        p_batch->i_nb_calls++;
+        if( send( p_batch->i_handle, p_block->p_buffer, p_block->i_buffer,
+                  0 ) == -1 )
+            msg_Warn( p_obj, "send error: %m" );
+        else
+            p_batch->i_nb_datagrams++;
+    }
+    if( p_batch->i_nb_blocks && !p_batch->i_max_batch )
+        p_batch->i_max_batch = 1;
+}
@@ -0,0 +1,75 @@
+/**
+ * @file udp_batch.h
+ * @brief Batched datagram output shared by the UDP outputs
+ */
+/*****************************************************************************
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#ifndef VLC_UDP_BATCH_H
+#define VLC_UDP_BATCH_H 1
+
+#define UDP_BATCH_MAX 1024 /* datagrams */
+
+#define UDP_BATCH_TEXT N_("Batch size")
+#define UDP_BATCH_LONGTEXT N_("Maximum number of datagrams sent with a " \
+    "single system call (1 disables batching). This needs sendmmsg(); " \
+    "without it, batching is disabled.")
+#define UDP_BATCH_WINDOW_TEXT N_("Batch window (ms)")
+#define UDP_BATCH_WINDOW_LONGTEXT N_("Datagrams due within this window are " \
+    "sent together; they may be sent that much early or late. Datagrams " \
+    "carrying a clock reference are always sent on their own.")
+
+/* Options of the modules using udp_batch_t, under their prefix */
+#define add_udp_batch( prefix ) \
+    add_integer( prefix "batch", 1, UDP_BATCH_TEXT, UDP_BATCH_LONGTEXT, \
+                 true ) \
+    add_integer( prefix "batch-window", 2, UDP_BATCH_WINDOW_TEXT, \
+                 UDP_BATCH_WINDOW_LONGTEXT, true )
+
+/**
+ * Datagrams waiting to be sent together on a connected socket. The blocks
+ * stay owned by the caller, which disposes of them after udp_batch_Send().
+ */
+typedef struct udp_batch_t
+{
+    int           i_handle;
+    unsigned int  i_size;   /* maximum number of datagrams per call */
+    mtime_t       i_window;
+
+    block_t     **pp_blocks;
+    unsigned int  i_nb_blocks;
+
+    /* statistics */
+    uint64_t      i_nb_calls, i_nb_datagrams;
+    unsigned int  i_max_batch;
+} udp_batch_t;
+
+int udp_batch_Init( vlc_object_t *, udp_batch_t *, int i_handle,
+                    int64_t i_size, int64_t i_window_ms );
+void udp_batch_Clean( vlc_object_t *, udp_batch_t * );
+void udp_batch_Send( vlc_object_t *, udp_batch_t * );
+
+static inline bool udp_batch_IsFull( const udp_batch_t *p_batch )
+{
+    return p_batch->i_nb_blocks == p_batch->i_size;
+}
+
+static inline void udp_batch_Append( udp_batch_t *p_batch, block_t *p_block )
+{
+    p_batch->pp_blocks[p_batch->i_nb_blocks++] = p_block;
+}
+
+#endif
@@ -356,6 +356,10 @@ static void Close( vlc_object_t * );
 #define ASM_TEXT N_("CPU optimizations")
 #define ASM_LONGTEXT N_( "Use assembler CPU optimizations.")
 
+#define STATMUX_TEXT N_("Statistical multiplexing service")
+#define STATMUX_LONGTEXT N_( "Follow the bitrate targets that the TS mux " \
+    "statistical multiplexer assigns to this service name (ABR only).")
+
 #define STATS_TEXT N_("Filename for 2 pass stats file")
 #define STATS_LONGTEXT N_( "Filename for 2 pass stats file for multi-pass encoding.")
 
@@ -686,6 +690,9 @@ vlc_module_begin ()
     add_string( SOUT_CFG_PREFIX "stats", "x264_2pass.log", STATS_TEXT,
                 STATS_LONGTEXT, false )
 
+    add_string( SOUT_CFG_PREFIX "statmux", "", STATMUX_TEXT,
+                STATMUX_LONGTEXT, true )
+
     add_string( SOUT_CFG_PREFIX "preset", NULL , PRESET_TEXT , PRESET_TEXT, false )
         change_string_list( x264_preset_names, x264_preset_names, 0 );
     add_string( SOUT_CFG_PREFIX "tune", NULL , TUNE_TEXT, TUNE_TEXT, false )
@@ -711,10 +718,12 @@ static const char *const ppsz_sout_options[] = {
     "aq-mode", "aq-strength", "psy-rd", "psy", "profile", "lookahead",
     "sync-lookahead", "slices",
     "slice-max-size", "slice-max-mbs", "intra-refresh", "mbtree", "hrd",
-    "tune","preset", "opengop", NULL
+    "tune","preset", "opengop", "statmux", NULL
 };
 
 static block_t *Encode( encoder_t *, picture_t * );
+static int StatmuxCallback( vlc_object_t *, char const *,
+                            vlc_value_t, vlc_value_t, void * );
 
 struct encoder_sys_t
 {
@@ -726,6 +735,11 @@ struct encoder_sys_t
     char            *psz_stat_name;
     int             i_sei_size;
     uint8_t         *p_sei;
+
+    /* statistical multiplexing */
+    char            *psz_statmux;
+    vlc_mutex_t     statmux_lock;
+    int             i_statmux_bitrate; /* new target in bi/s, or 0 */
 };
 
 #ifdef PTW32_STATIC_LIB
@@ -769,6 +783,9 @@ static int  Open ( vlc_object_t *p_this )
     p_sys->psz_stat_name = NULL;
     p_sys->i_sei_size = 0;
     p_sys->p_sei = NULL;
+    p_sys->psz_statmux = NULL;
+    vlc_mutex_init( &p_sys->statmux_lock );
+    p_sys->i_statmux_bitrate = 0;
 
     x264_param_default( &p_sys->param );
     char *psz_preset = var_GetString( p_enc, SOUT_CFG_PREFIX  "preset" );
@@ -1249,6 +1266,9 @@ static int  Open ( vlc_object_t *p_this )
         {
             msg_Warn( p_enc, "pthread Win32 Initialization failed" );
             vlc_mutex_unlock( &pthread_win32_mutex );
+            vlc_mutex_destroy( &p_sys->statmux_lock );
+            free( p_sys->psz_stat_name );
+            free( p_sys );
             return VLC_EGENERIC;
         }
     }
@@ -1280,6 +1300,25 @@ static int  Open ( vlc_object_t *p_this )
         return VLC_EGENERIC;
     }
 
+    psz_val = var_GetString( p_enc, SOUT_CFG_PREFIX "statmux" );
+    if( psz_val && *psz_val && p_sys->param.rc.i_rc_method != X264_RC_ABR )
+        msg_Warn( p_enc, "statistical multiplexing requires a bitrate" );
+    else if( psz_val && *psz_val )
+    {
+        /* The TS mux publishes the targets in a libvlc variable. */
+        if( asprintf( &p_sys->psz_statmux, "statmux-%s", psz_val ) == -1 )
+            p_sys->psz_statmux = NULL;
+        else
+        {
+            var_Create( p_enc->p_libvlc, p_sys->psz_statmux,
+                        VLC_VAR_INTEGER );
+            var_AddCallback( p_enc->p_libvlc, p_sys->psz_statmux,
+                             StatmuxCallback, p_enc );
+            msg_Dbg( p_enc, "following statmux service %s", psz_val );
+        }
+    }
+    free( psz_val );
+
     /* get the globals headers */
     size_t i_extra = x264_encoder_headers( p_sys->h, &nal, &i_nal );
     uint8_t *p_extra = p_enc->fmt_out.p_extra = malloc( i_extra );
@@ -1382,6 +1421,31 @@ static block_t *Encode( encoder_t *p_enc, picture_t *p_pict )
     block_t *p_block;
     int i_nal=0, i_out=0, i=0;
 
+    if( p_sys->psz_statmux != NULL )
+    {
+        int i_bitrate;
+
+        vlc_mutex_lock( &p_sys->statmux_lock );
+        i_bitrate = p_sys->i_statmux_bitrate;
+        p_sys->i_statmux_bitrate = 0;
+        vlc_mutex_unlock( &p_sys->statmux_lock );
+
+        if( i_bitrate && i_bitrate / 1000 != p_sys->param.rc.i_bitrate )
+        {
+            bool b_cbr = p_sys->param.rc.i_vbv_max_bitrate
+                          == p_sys->param.rc.i_bitrate;
+            p_sys->param.rc.i_bitrate = i_bitrate / 1000;
+            if( b_cbr )
+                p_sys->param.rc.i_vbv_max_bitrate = p_sys->param.rc.i_bitrate;
+            if( x264_encoder_reconfig( p_sys->h, &p_sys->param ) < 0 )
+                msg_Warn( p_enc, "cannot change bitrate to %d kbi/s",
+                          p_sys->param.rc.i_bitrate );
+            else
+                msg_Dbg( p_enc, "new statmux bitrate %d kbi/s",
+                         p_sys->param.rc.i_bitrate );
+        }
+    }
+
     /* init pic */
 #if X264_BUILD >= 98
     x264_picture_init( &pic );
@@ -1476,6 +1540,15 @@ static void Close( vlc_object_t *p_this )
     encoder_t     *p_enc = (encoder_t *)p_this;
     encoder_sys_t *p_sys = p_enc->p_sys;
 
+    if( p_sys->psz_statmux != NULL )
+    {
+        var_DelCallback( p_enc->p_libvlc, p_sys->psz_statmux,
+                         StatmuxCallback, p_enc );
+        var_Destroy( p_enc->p_libvlc, p_sys->psz_statmux );
+        free( p_sys->psz_statmux );
+    }
+    vlc_mutex_destroy( &p_sys->statmux_lock );
+
     free( p_sys->psz_stat_name );
     free( p_sys->p_sei );
 
@@ -1500,3 +1573,21 @@ static void Close( vlc_object_t *p_this )
 
     free( p_sys );
 }
+
+/*****************************************************************************
+ * StatmuxCallback: new bitrate target from the statistical multiplexer
+ *****************************************************************************/
+static int StatmuxCallback( vlc_object_t *p_this, char const *psz_var,
+                            vlc_value_t oldval, vlc_value_t newval,
+                            void *p_data )
+{
+    VLC_UNUSED(p_this); VLC_UNUSED(psz_var); VLC_UNUSED(oldval);
+    encoder_t *p_enc = p_data;
+    encoder_sys_t *p_sys = p_enc->p_sys;
+
+    /* Applied by the encoder thread before the next picture. */
+    vlc_mutex_lock( &p_sys->statmux_lock );
+    p_sys->i_statmux_bitrate = newval.i_int;
+    vlc_mutex_unlock( &p_sys->statmux_lock );
+    return VLC_SUCCESS;
+}
@@ -155,6 +155,12 @@ static void Close ( vlc_object_t * );
     "Tweak the buffer size for reading and writing an integer number of packets. " \
     "Specify the size of the buffer here and not the number of packets." )
 
+#define BULK_TEXT N_("Packets per read")
+#define BULK_LONGTEXT N_( \
+    "Read up to this many TS packets at once and demultiplex them in " \
+    "place, instead of reading packets one by one (0). This saves a lot " \
+    "of CPU on high bitrate streams." )
+
 #define SPLIT_ES_TEXT N_("Separate sub-streams")
 #define SPLIT_ES_LONGTEXT N_( \
     "Separate teletex/dvbs pages into independent ES. " \
@@ -181,6 +187,7 @@ vlc_module_begin ()
     add_integer( "ts-dump-size", 16384, DUMPSIZE_TEXT,
                  DUMPSIZE_LONGTEXT, true )
     add_bool( "ts-split-es", true, SPLIT_ES_TEXT, SPLIT_ES_LONGTEXT, false )
+    add_integer( "ts-bulk-read", 0, BULK_TEXT, BULK_LONGTEXT, true )
 
     set_capability( "demux", 10 )
     set_callbacks( Open, Close )
@@ -352,6 +359,12 @@ struct demux_sys_t
     /* how many TS packet we read at once */
     int         i_ts_read;
 
+    /* bulk reads: packets are demuxed in place */
+    int         i_bulk_read;
+    block_t     *p_bulk;
+    size_t      i_bulk_pos;
+    size_t      i_bulk_csa; /* end of the descrambled packets */
+
     /* All pid */
     ts_pid_t    pid[8192];
 
@@ -397,6 +410,7 @@ struct demux_sys_t
 };
 
 static int Demux    ( demux_t *p_demux );
+static int DemuxBulk( demux_t *p_demux );
 static int DemuxFile( demux_t *p_demux );
 static int Control( demux_t *p_demux, int i_query, va_list args );
 
@@ -412,14 +426,12 @@ static void PSINewTableCallBack( demux_t *, dvbpsi_handle,
 #endif
 static int ChangeKeyCallback( vlc_object_t *, char const *, vlc_value_t, vlc_value_t, void * );
 
-static inline int PIDGet( block_t *p )
-{
-    return ( (p->p_buffer[1]&0x1f)<<8 )|p->p_buffer[2];
-}
+static bool DemuxPacket( demux_t *p_demux, uint8_t *p, block_t *p_pkt );
+static size_t DecryptBulk( demux_t *p_demux, size_t i_pos );
+static bool GatherPES( demux_t *p_demux, ts_pid_t *pid, uint8_t *p,
+                       block_t *p_bk );
 
-static bool GatherPES( demux_t *p_demux, ts_pid_t *pid, block_t *p_bk );
-
-static void PCRHandle( demux_t *p_demux, ts_pid_t *, block_t * );
+static void PCRHandle( demux_t *p_demux, ts_pid_t *, const uint8_t * );
 
 static iod_descriptor_t *IODNew( int , uint8_t * );
 static void              IODFree( iod_descriptor_t * );
@@ -635,9 +647,16 @@ static int Open( vlc_object_t *p_this )
         }
     }
 
+    p_sys->i_bulk_read = var_CreateGetInteger( p_demux, "ts-bulk-read" );
+    p_sys->p_bulk = NULL;
+    p_sys->i_bulk_pos = 0;
+    p_sys->i_bulk_csa = 0;
+
     /* Fill p_demux field */
     if( p_sys->b_file_out )
         p_demux->pf_demux = DemuxFile;
+    else if( p_sys->i_bulk_read > 0 )
+        p_demux->pf_demux = DemuxBulk;
     else
         p_demux->pf_demux = Demux;
     p_demux->pf_control = Control;
@@ -747,6 +766,9 @@ static int Open( vlc_object_t *p_this )
                 p_sys->i_ts_read = 1500 / p_sys->i_packet_size;
             }
             p_sys->buffer = malloc( p_sys->i_packet_size * p_sys->i_ts_read );
+            /* Bulk reads are resent as is */
+            if( p_sys->i_bulk_read > 0 )
+                p_sys->i_bulk_read = p_sys->i_ts_read;
         }
     }
     free( psz_string );
@@ -902,6 +924,8 @@ static void Close( vlc_object_t *p_this )
         net_Close( p_sys->fd );
     }
 
+    if( p_sys->p_bulk )
+        block_Release( p_sys->p_bulk );
     free( p_sys->buffer );
     free( p_sys->psz_file );
 
@@ -1033,6 +1057,47 @@ static int DemuxFile( demux_t *p_demux )
     return 1;
 }
 
+/*****************************************************************************
+ * StreamResync: skip garbage up to the next pair of sync bytes
+ *****************************************************************************/
+static bool StreamResync( demux_t *p_demux )
+{
+    demux_sys_t *p_sys = p_demux->p_sys;
+
+    while( vlc_object_alive (p_demux) )
+    {
+        const uint8_t *p_peek;
+        int i_peek, i_skip = 0;
+
+        i_peek = stream_Peek( p_demux->s, &p_peek,
+                              p_sys->i_packet_size * 10 );
+        if( i_peek < p_sys->i_packet_size + 1 )
+        {
+            msg_Dbg( p_demux, "eof ?" );
+            return false;
+        }
+
+        while( i_skip < i_peek - p_sys->i_packet_size )
+        {
+            if( p_peek[i_skip] == 0x47 &&
+                p_peek[i_skip + p_sys->i_packet_size] == 0x47 )
+            {
+                break;
+            }
+            i_skip++;
+        }
+
+        msg_Dbg( p_demux, "skipping %d bytes of garbage", i_skip );
+        stream_Read( p_demux->s, NULL, i_skip );
+
+        if( i_skip < i_peek - p_sys->i_packet_size )
+        {
+            break;
+        }
+    }
+    return true;
+}
+
 /*****************************************************************************
  * Demux:
  *****************************************************************************/
@@ -1060,37 +1125,8 @@ static int Demux( demux_t *p_demux )
             msg_Warn( p_demux, "lost synchro" );
             block_Release( p_pkt );
 
-            while( vlc_object_alive (p_demux) )
-            {
-                const uint8_t *p_peek;
-                int i_peek, i_skip = 0;
-
-                i_peek = stream_Peek( p_demux->s, &p_peek,
-                                      p_sys->i_packet_size * 10 );
-                if( i_peek < p_sys->i_packet_size + 1 )
-                {
-                    msg_Dbg( p_demux, "eof ?" );
-                    return 0;
-                }
-
-                while( i_skip < i_peek - p_sys->i_packet_size )
-                {
-                    if( p_peek[i_skip] == 0x47 &&
-                        p_peek[i_skip + p_sys->i_packet_size] == 0x47 )
-                    {
-                        break;
-                    }
-                    i_skip++;
-                }
-
-                msg_Dbg( p_demux, "skipping %d bytes of garbage", i_skip );
-                stream_Read( p_demux->s, NULL, i_skip );
-
-                if( i_skip < i_peek - p_sys->i_packet_size )
-                {
-                    break;
-                }
-            }
+            if( !StreamResync( p_demux ) )
+                return 0;
 
             if( !( p_pkt = stream_Block( p_demux->s, p_sys->i_packet_size ) ) )
             {
@@ -1112,63 +1148,235 @@ static int Demux( demux_t *p_demux )
                     p_pkt->p_buffer, p_sys->i_packet_size );
         }
 
-        /* Parse the TS packet */
-        ts_pid_t *p_pid = &p_sys->pid[PIDGet( p_pkt )];
+        b_frame = DemuxPacket( p_demux, p_pkt->p_buffer, p_pkt );
 
-        if( p_pid->b_valid )
+        if( b_frame || ( b_wait_es && p_sys->i_pmt_es > 0 ) )
+            break;
+    }
+
+    if( p_sys->b_udp_out )
+    {
+        /* Send the complete block */
+        net_Write( p_demux, p_sys->fd, NULL, p_sys->buffer,
+                   p_sys->i_ts_read * p_sys->i_packet_size );
+    }
+
+    return 1;
+}
+
+/*****************************************************************************
+ * DemuxBulk: read many TS packets at once and demux them in place
+ *****************************************************************************/
+static int DemuxBulk( demux_t *p_demux )
+{
+    demux_sys_t *p_sys = p_demux->p_sys;
+    const size_t i_packet_size = p_sys->i_packet_size;
+    bool b_wait_es = p_sys->i_pmt_es <= 0;
+    block_t *p_bulk = p_sys->p_bulk;
+
+    if( p_bulk == NULL )
+    {
+        const uint8_t *p_peek;
+
+        /* Start reading on a sync byte */
+        if( stream_Peek( p_demux->s, &p_peek, 1 ) < 1 )
         {
-            if( p_pid->psi )
-            {
-                if( p_pid->i_pid == 0 || ( p_sys->b_dvb_meta && ( p_pid->i_pid == 0x11 || p_pid->i_pid == 0x12 || p_pid->i_pid == 0x14 ) ) )
-                {
-                    dvbpsi_PushPacket( p_pid->psi->handle, p_pkt->p_buffer );
-                }
-                else
-                {
-                    for( int i_prg = 0; i_prg < p_pid->psi->i_prg; i_prg++ )
-                    {
-                        dvbpsi_PushPacket( p_pid->psi->prg[i_prg]->handle,
-                                           p_pkt->p_buffer );
-                    }
-                }
-                block_Release( p_pkt );
-            }
-            else if( !p_sys->b_udp_out )
-            {
-                b_frame = GatherPES( p_demux, p_pid, p_pkt );
-            }
-            else
+            msg_Dbg( p_demux, "eof ?" );
+            return 0;
+        }
+        if( p_peek[0] != 0x47 )
+        {
+            msg_Warn( p_demux, "lost synchro" );
+            if( !StreamResync( p_demux ) )
+                return 0;
+        }
+
+        /* The block may share the buffer of the access */
+        p_bulk = stream_Packets( p_demux->s, i_packet_size, p_sys->i_bulk_read );
+        if( p_bulk != NULL && p_sys->csa && !p_sys->b_udp_out )
+            p_bulk = block_Writable( p_bulk );
+        if( p_bulk == NULL )
+        {
+            msg_Dbg( p_demux, "eof ?" );
+            return 0;
+        }
+        p_sys->p_bulk = p_bulk;
+        p_sys->i_bulk_pos = 0;
+        p_sys->i_bulk_csa = 0;
+
+        if( p_sys->b_start_record )
+        {
+            /* Enable recording once synchronized */
+            stream_Control( p_demux->s, STREAM_SET_RECORD_STATE, true, "ts" );
+            p_sys->b_start_record = false;
+        }
+
+        if( p_sys->b_udp_out )
+            net_Write( p_demux, p_sys->fd, NULL, p_bulk->p_buffer,
+                       p_bulk->i_buffer );
+    }
+
+    /* Stop after a frame is completed, and carry on with the rest of the
+     * buffer next time. */
+    while( p_sys->i_bulk_pos < p_bulk->i_buffer )
+    {
+        size_t i_pos = p_sys->i_bulk_pos;
+
+        /* Check sync byte and re-sync inside the buffer if needed */
+        if( p_bulk->p_buffer[i_pos] != 0x47 )
+        {
+            msg_Warn( p_demux, "lost synchro" );
+            while( ++i_pos < p_bulk->i_buffer )
             {
-                PCRHandle( p_demux, p_pid, p_pkt );
-                block_Release( p_pkt );
+                if( p_bulk->p_buffer[i_pos] == 0x47 &&
+                    ( i_pos + i_packet_size >= p_bulk->i_buffer ||
+                      p_bulk->p_buffer[i_pos + i_packet_size] == 0x47 ) )
+                    break;
             }
+            msg_Dbg( p_demux, "skipping %zu bytes of garbage",
+                     i_pos - p_sys->i_bulk_pos );
+            p_sys->i_bulk_pos = i_pos;
+            continue;
         }
-        else
+
+        /* Complete the last packet after a re-sync or a short read */
+        if( i_pos + i_packet_size > p_bulk->i_buffer )
         {
-            if( !p_pid->b_seen )
+            size_t i_old = p_bulk->i_buffer;
+            size_t i_missing = i_pos + i_packet_size - i_old;
+
+            p_bulk = p_sys->p_bulk = block_Realloc( p_bulk, 0,
+                                                    i_old + i_missing );
+            if( p_bulk == NULL
+                 || stream_Read( p_demux->s, &p_bulk->p_buffer[i_old],
+                                 i_missing ) < (int)i_missing )
             {
-                msg_Dbg( p_demux, "pid[%d] unknown", p_pid->i_pid );
+                msg_Dbg( p_demux, "eof ?" );
+                if( p_bulk != NULL )
+                    block_Release( p_bulk );
+                p_sys->p_bulk = NULL;
+                return 0;
             }
-            /* We have to handle PCR if present */
-            PCRHandle( p_demux, p_pid, p_pkt );
-            block_Release( p_pkt );
         }
-        p_pid->b_seen = true;
+
+        if( p_sys->csa && !p_sys->b_udp_out && i_pos >= p_sys->i_bulk_csa )
+            p_sys->i_bulk_csa = DecryptBulk( p_demux, i_pos );
+
+        bool b_frame = DemuxPacket( p_demux, &p_bulk->p_buffer[i_pos], NULL );
+        p_sys->i_bulk_pos = i_pos + i_packet_size;
 
         if( b_frame || ( b_wait_es && p_sys->i_pmt_es > 0 ) )
             break;
     }
 
-    if( p_sys->b_udp_out )
+    if( p_sys->i_bulk_pos >= p_bulk->i_buffer )
     {
-        /* Send the complete block */
-        net_Write( p_demux, p_sys->fd, NULL, p_sys->buffer,
-                   p_sys->i_ts_read * p_sys->i_packet_size );
+        block_Release( p_bulk );
+        p_sys->p_bulk = NULL;
     }
-
     return 1;
 }
 
+/*****************************************************************************
+ * DecryptBulk: descramble the packets of the bulk read from i_pos on
+ *****************************************************************************
+ * Stops at the first lost sync byte, or after CSA_BULK scrambled packets,
+ * and returns the end of the descrambled packets. The scrambling control
+ * bits are left set, so that GatherPES() still reports the ES as scrambled.
+ *****************************************************************************/
+#define CSA_BULK 256 /* widest csa_DecryptBatch() pass */
+
+static size_t DecryptBulk( demux_t *p_demux, size_t i_pos )
+{
+    demux_sys_t *p_sys = p_demux->p_sys;
+    block_t *p_bulk = p_sys->p_bulk;
+    const size_t i_packet_size = p_sys->i_packet_size;
+    uint8_t *pp_pkts[CSA_BULK];
+    uint8_t pi_flags[CSA_BULK];
+    int i_pkts = 0;
+
+    for( ; i_pos + i_packet_size <= p_bulk->i_buffer
+            && p_bulk->p_buffer[i_pos] == 0x47; i_pos += i_packet_size )
+    {
+        uint8_t *p = &p_bulk->p_buffer[i_pos];
+        ts_pid_t *p_pid = &p_sys->pid[ ((p[1]&0x1f)<<8)|p[2] ];
+
+        /* PSI is never descrambled */
+        if( (p[3]&0x80) == 0 || ( p_pid->b_valid && p_pid->psi ) )
+            continue;
+        if( i_pkts == CSA_BULK )
+            break; /* the rest is done on the next call */
+
+        pi_flags[i_pkts] = p[3]&0xc0;
+        pp_pkts[i_pkts++] = p;
+    }
+
+    if( i_pkts > 0 )
+    {
+        vlc_mutex_lock( &p_sys->csa_lock );
+        csa_DecryptBatch( p_sys->csa, pp_pkts, i_pkts,
+                          p_sys->i_csa_pkt_size );
+        vlc_mutex_unlock( &p_sys->csa_lock );
+    }
+
+    for( int i = 0; i < i_pkts; i++ )
+        pp_pkts[i][3] |= pi_flags[i];
+
+    return i_pos;
+}
+
+/*****************************************************************************
+ * DemuxPacket: dispatch one TS packet by PID. The packet is owned by p_pkt,
+ * or borrowed from a bulk read if p_pkt is NULL.
+ *****************************************************************************/
+static bool DemuxPacket( demux_t *p_demux, uint8_t *p, block_t *p_pkt )
+{
+    demux_sys_t *p_sys = p_demux->p_sys;
+    ts_pid_t *p_pid = &p_sys->pid[ ((p[1]&0x1f)<<8)|p[2] ];
+    bool b_frame = false;
+
+    if( p_pid->b_valid )
+    {
+        if( p_pid->psi )
+        {
+            if( p_pid->i_pid == 0 || ( p_sys->b_dvb_meta && ( p_pid->i_pid == 0x11 || p_pid->i_pid == 0x12 || p_pid->i_pid == 0x14 ) ) )
+            {
+                dvbpsi_PushPacket( p_pid->psi->handle, p );
+            }
+            else
+            {
+                for( int i_prg = 0; i_prg < p_pid->psi->i_prg; i_prg++ )
+                {
+                    dvbpsi_PushPacket( p_pid->psi->prg[i_prg]->handle, p );
+                }
+            }
+        }
+        else if( !p_sys->b_udp_out )
+        {
+            b_frame = GatherPES( p_demux, p_pid, p, p_pkt );
+            p_pkt = NULL;
+        }
+        else
+        {
+            PCRHandle( p_demux, p_pid, p );
+        }
+    }
+    else
+    {
+        if( !p_pid->b_seen )
+        {
+            msg_Dbg( p_demux, "pid[%d] unknown", p_pid->i_pid );
+        }
+        /* We have to handle PCR if present */
+        PCRHandle( p_demux, p_pid, p );
+    }
+    p_pid->b_seen = true;
+
+    if( p_pkt != NULL )
+        block_Release( p_pkt );
+    return b_frame;
+}
+
 /*****************************************************************************
  * Control:
  *****************************************************************************/
@@ -1238,6 +1446,11 @@ static int Control( demux_t *p_demux, int i_query, va_list args )
         if( stream_Seek( p_demux->s, (int64_t)(i64 * f) ) )
             return VLC_EGENERIC;
 
+        if( p_sys->p_bulk )
+        {
+            block_Release( p_sys->p_bulk );
+            p_sys->p_bulk = NULL;
+        }
         return VLC_SUCCESS;
 #if 0
 
@@ -1865,10 +2078,9 @@ static void ParsePES( demux_t *p_demux, ts_pid_t *pid )
     }
 }
 
-static void PCRHandle( demux_t *p_demux, ts_pid_t *pid, block_t *p_bk )
+static void PCRHandle( demux_t *p_demux, ts_pid_t *pid, const uint8_t *p )
 {
     demux_sys_t   *p_sys = p_demux->p_sys;
-    const uint8_t *p = p_bk->p_buffer;
 
     if( p_sys->i_pmt_es <= 0 )
         return;
@@ -1900,9 +2112,11 @@ static void PCRHandle( demux_t *p_demux, ts_pid_t *pid, block_t *p_bk )
     }
 }
 
-static bool GatherPES( demux_t *p_demux, ts_pid_t *pid, block_t *p_bk )
+/* p_bk owns the packet at p, or is NULL if the packet is borrowed (the payload
+ * is then copied only if it is gathered). */
+static bool GatherPES( demux_t *p_demux, ts_pid_t *pid, uint8_t *p,
+                       block_t *p_bk )
 {
-    const uint8_t *p = p_bk->p_buffer;
     const bool b_unit_start = p[1]&0x40;
     const bool b_scrambled  = p[3]&0x80;
     const bool b_adaptation = p[3]&0x20;
@@ -1920,10 +2134,6 @@ static bool GatherPES( demux_t *p_demux, ts_pid_t *pid, block_t *p_bk )
              b_payload, i_cc );
 #endif
 
-    /* For now, ignore additional error correction
-     * TODO: handle Reed-Solomon 204,188 error correction */
-    p_bk->i_buffer = TS_PACKET_SIZE_188;
-
     if( p[1]&0x80 )
     {
         msg_Dbg( p_demux, "transport_error_indicator set (pid=%d)",
@@ -1932,10 +2142,11 @@ static bool GatherPES( demux_t *p_demux, ts_pid_t *pid, block_t *p_bk )
             pid->es->p_pes->i_flags |= BLOCK_FLAG_CORRUPTED;
     }
 
-    if( p_demux->p_sys->csa )
+    /* Packets of a bulk read are already descrambled by DecryptBulk() */
+    if( p_demux->p_sys->csa && p_bk != NULL )
     {
         vlc_mutex_lock( &p_demux->p_sys->csa_lock );
-        csa_Decrypt( p_demux->p_sys->csa, p_bk->p_buffer, p_demux->p_sys->i_csa_pkt_size );
+        csa_Decrypt( p_demux->p_sys->csa, p, p_demux->p_sys->i_csa_pkt_size );
         vlc_mutex_unlock( &p_demux->p_sys->csa_lock );
     }
 
@@ -2001,11 +2212,12 @@ static bool GatherPES( demux_t *p_demux, ts_pid_t *pid, block_t *p_bk )
         }
     }
 
-    PCRHandle( p_demux, pid, p_bk );
+    PCRHandle( p_demux, pid, p );
 
     if( i_skip >= 188 || pid->es->id == NULL || p_demux->p_sys->b_udp_out )
     {
-        block_Release( p_bk );
+        if( p_bk != NULL )
+            block_Release( p_bk );
         return i_ret;
     }
 
@@ -2026,9 +2238,29 @@ static bool GatherPES( demux_t *p_demux, ts_pid_t *pid, block_t *p_bk )
                         pid->es->id, b_scrambled );
     }
 
+    if( !b_unit_start && pid->es->p_pes == NULL )
+    {
+        /* msg_Dbg( p_demux, "broken packet" ); */
+        if( p_bk != NULL )
+            block_Release( p_bk );
+        return i_ret;
+    }
+
     /* We have to gather it */
-    p_bk->p_buffer += i_skip;
-    p_bk->i_buffer -= i_skip;
+    if( p_bk != NULL )
+    {
+        /* For now, ignore additional error correction
+         * TODO: handle Reed-Solomon 204,188 error correction */
+        p_bk->p_buffer += i_skip;
+        p_bk->i_buffer = TS_PACKET_SIZE_188 - i_skip;
+    }
+    else
+    {
+        p_bk = block_Alloc( TS_PACKET_SIZE_188 - i_skip );
+        if( p_bk == NULL )
+            return i_ret;
+        memcpy( p_bk->p_buffer, &p[i_skip], TS_PACKET_SIZE_188 - i_skip );
+    }
 
     if( b_unit_start )
     {
@@ -2057,21 +2289,13 @@ static bool GatherPES( demux_t *p_demux, ts_pid_t *pid, block_t *p_bk )
     }
     else
     {
-        if( pid->es->p_pes == NULL )
-        {
-            /* msg_Dbg( p_demux, "broken packet" ); */
-            block_Release( p_bk );
-        }
-        else
+        block_ChainLastAppend( &pid->es->pp_last, p_bk );
+        pid->es->i_pes_gathered += p_bk->i_buffer;
+        if( pid->es->i_pes_size > 0 &&
+            pid->es->i_pes_gathered >= pid->es->i_pes_size )
         {
-            block_ChainLastAppend( &pid->es->pp_last, p_bk );
-            pid->es->i_pes_gathered += p_bk->i_buffer;
-            if( pid->es->i_pes_size > 0 &&
-                pid->es->i_pes_gathered >= pid->es->i_pes_size )
-            {
-                ParsePES( p_demux, pid );
-                i_ret = true;
-            }
+            ParsePES( p_demux, pid );
+            i_ret = true;
         }
     }
 
@@ -633,6 +633,11 @@ static block_t *ConvertSUBT( block_t *p_block )
 
 static block_t *ConvertAVC1( block_t *p_block )
 {
+    /* The conversion is done in place. */
+    p_block = block_Writable( p_block );
+    if( p_block == NULL )
+        return NULL;
+
     uint8_t *last = p_block->p_buffer;  /* Assume it starts with 0x00000001 */
     uint8_t *dat  = &p_block->p_buffer[4];
     uint8_t *end = &p_block->p_buffer[p_block->i_buffer];
@@ -615,3 +615,636 @@ static void csa_BlockCypher( uint8_t kk[57], uint8_t bd[8], uint8_t ib[8] )
     }
 }
 
+/*****************************************************************************
+ * Batch (de)scrambling
+ *****************************************************************************
+ * The stream cypher is bitsliced: bit n of every csa_word_t belongs to the
+ * n-th packet of the batch, so one pass runs the cypher of as many packets
+ * as there are bits in a word. The block cypher is byte-sliced over all the
+ * 8-byte blocks of the batch: the s-box lookups stay scalar but the register
+ * shuffling becomes pointer swaps and the XORs work on whole words.
+ *****************************************************************************/
+#if defined(__GNUC__) && defined(__AVX2__)
+typedef uint64_t csa_word_t __attribute__((vector_size(32)));
+#elif defined(__GNUC__) && defined(__SSE2__)
+typedef uint64_t csa_word_t __attribute__((vector_size(16)));
+#elif defined(__LP64__) || defined(_WIN64)
+typedef uint64_t csa_word_t;
+#else
+typedef uint32_t csa_word_t;
+#endif
+
+#define CSA_LANES (8 * sizeof(csa_word_t))
+#define CSA_CHUNK 256 /* blocks per byte-sliced pass, at least CSA_LANES */
+
+/* Bitsliced stream cypher state (nibbles are split into 4 bit planes) */
+typedef struct
+{
+    csa_word_t A[11][4];
+    csa_word_t B[11][4];
+    csa_word_t X[4], Y[4], Z[4];
+    csa_word_t D[4], E[4], F[4];
+    csa_word_t p, q, r;
+} csa_bs_t;
+
+/* Transposes a 8x8 bit matrix (byte n holds row n) */
+static inline uint64_t csa_Transpose8( uint64_t x )
+{
+    uint64_t t;
+
+    t = ( x ^ ( x >> 7 ) ) & UINT64_C(0x00AA00AA00AA00AA);
+    x ^= t ^ ( t << 7 );
+    t = ( x ^ ( x >> 14 ) ) & UINT64_C(0x0000CCCC0000CCCC);
+    x ^= t ^ ( t << 14 );
+    t = ( x ^ ( x >> 28 ) ) & UINT64_C(0x00000000F0F0F0F0);
+    x ^= t ^ ( t << 28 );
+    return x;
+}
+
+/* Gathers byte i_offset of every lane into 8 bit planes */
+static void csa_BsLoad( csa_word_t plane[8], uint8_t *const *pp_lane,
+                        int i_offset, int i_lanes )
+{
+    uint8_t bytes[8][CSA_LANES / 8];
+
+    memset( bytes, 0, sizeof( bytes ) );
+    for( int g = 0; 8 * g < i_lanes; g++ )
+    {
+        uint64_t x = 0;
+
+        for( int k = 0; k < 8 && 8 * g + k < i_lanes; k++ )
+            x |= (uint64_t)pp_lane[8 * g + k][i_offset] << ( 8 * k );
+        x = csa_Transpose8( x );
+        for( int b = 0; b < 8; b++ )
+            bytes[b][g] = x >> ( 8 * b );
+    }
+    for( int b = 0; b < 8; b++ )
+        memcpy( &plane[b], bytes[b], sizeof( csa_word_t ) );
+}
+
+/* Scatters 8 bit planes into one byte per lane */
+static void csa_BsStore( uint8_t *p_out, const csa_word_t plane[8],
+                         int i_lanes )
+{
+    uint8_t bytes[8][CSA_LANES / 8];
+
+    for( int b = 0; b < 8; b++ )
+        memcpy( bytes[b], &plane[b], sizeof( csa_word_t ) );
+    for( int g = 0; 8 * g < i_lanes; g++ )
+    {
+        uint64_t x = 0;
+
+        for( int b = 0; b < 8; b++ )
+            x |= (uint64_t)bytes[b][g] << ( 8 * b );
+        x = csa_Transpose8( x );
+        for( int k = 0; k < 8 && 8 * g + k < i_lanes; k++ )
+            p_out[8 * g + k] = x >> ( 8 * k );
+    }
+}
+
+static void csa_BsInit( csa_bs_t *st, const uint8_t ck[8] )
+{
+    const csa_word_t zero = { 0 };
+    const csa_word_t ones = ~zero;
+
+    memset( st, 0, sizeof( *st ) );
+    for( int i = 0; i < 4; i++ )
+    {
+        for( int b = 0; b < 4; b++ )
+        {
+            st->A[1+2*i+0][b] = ( ck[i] >> ( 4 + b ) )&1 ? ones : zero;
+            st->A[1+2*i+1][b] = ( ck[i] >> b )&1 ? ones : zero;
+            st->B[1+2*i+0][b] = ( ck[4+i] >> ( 4 + b ) )&1 ? ones : zero;
+            st->B[1+2*i+1][b] = ( ck[4+i] >> b )&1 ? ones : zero;
+        }
+    }
+}
+
+/* One clock (2 output bits) of csa_StreamCypher() on every lane. in_a and
+ * in_b are the input nibbles during initialisation, NULL afterwards. */
+static void csa_BsClock( csa_bs_t *st, const csa_word_t *in_a,
+                         const csa_word_t *in_b, csa_word_t out[2] )
+{
+    csa_word_t (*const A)[4] = st->A;
+    csa_word_t (*const B)[4] = st->B;
+    csa_word_t s[7][2];
+    csa_word_t extra_B[4], next_A1[4], next_B1[4], next_E[4];
+    csa_word_t carry;
+
+    /* s-boxes in algebraic normal form, s[n][1] is the high output bit */
+    /* s-box 1 */
+    {
+        const csa_word_t x4 = A[4][0], x3 = A[1][2], x2 = A[6][1];
+        const csa_word_t x1 = A[7][3], x0 = A[9][0];
+        const csa_word_t m03 = x0 & x1, m05 = x0 & x2, m06 = x1 & x2;
+        const csa_word_t m09 = x0 & x3, m0a = x1 & x3, m0c = x2 & x3;
+        const csa_word_t m11 = x0 & x4, m14 = x2 & x4, m18 = x3 & x4;
+        const csa_word_t m0b = m03 & x3, m0d = m05 & x3, m0e = m06 & x3;
+        const csa_word_t m13 = m03 & x4, m16 = m06 & x4, m1a = m0a & x4;
+        const csa_word_t m1c = m0c & x4, m1b = m0b & x4, m1d = m0d & x4;
+        const csa_word_t m1e = m0e & x4;
+        s[0][1] = ~(x0 ^ x1 ^ m03 ^ m05 ^ m06 ^ m09 ^ m0a ^ m0c ^ m0d ^ m0e ^
+                   x4 ^ m13 ^ m14 ^ m16 ^ m18 ^ m1a ^ m1b ^ m1c ^ m1e);
+        s[0][0] = x1 ^ m05 ^ x3 ^ m09 ^ m0b ^ m11 ^ m18 ^ m1a ^ m1c ^ m1d;
+    }
+    /* s-box 2 */
+    {
+        const csa_word_t x4 = A[2][1], x3 = A[3][2], x2 = A[6][3];
+        const csa_word_t x1 = A[7][0], x0 = A[9][1];
+        const csa_word_t m03 = x0 & x1, m05 = x0 & x2, m06 = x1 & x2;
+        const csa_word_t m09 = x0 & x3, m0a = x1 & x3, m0c = x2 & x3;
+        const csa_word_t m14 = x2 & x4, m18 = x3 & x4, m07 = m03 & x2;
+        const csa_word_t m0b = m03 & x3, m0d = m05 & x3, m13 = m03 & x4;
+        const csa_word_t m16 = m06 & x4, m19 = m09 & x4, m1a = m0a & x4;
+        const csa_word_t m1c = m0c & x4, m1b = m0b & x4, m1d = m0d & x4;
+        s[1][1] = ~(x0 ^ x1 ^ m05 ^ m06 ^ m07 ^ x3 ^ m16 ^ m19 ^ m1a ^ m1b ^
+                   m1c);
+        s[1][0] = ~(x1 ^ x2 ^ m05 ^ m0b ^ m0d ^ m13 ^ m14 ^ m18 ^ m1b ^ m1d);
+    }
+    /* s-box 3 */
+    {
+        const csa_word_t x4 = A[1][3], x3 = A[2][0], x2 = A[5][1];
+        const csa_word_t x1 = A[5][3], x0 = A[6][2];
+        const csa_word_t m03 = x0 & x1, m05 = x0 & x2, m06 = x1 & x2;
+        const csa_word_t m09 = x0 & x3, m0a = x1 & x3, m0c = x2 & x3;
+        const csa_word_t m12 = x1 & x4, m14 = x2 & x4, m07 = m03 & x2;
+        const csa_word_t m0b = m03 & x3, m0e = m06 & x3, m13 = m03 & x4;
+        const csa_word_t m15 = m05 & x4, m16 = m06 & x4, m19 = m09 & x4;
+        const csa_word_t m1c = m0c & x4, m17 = m07 & x4, m1e = m0e & x4;
+        s[2][1] = ~(x0 ^ x1 ^ m05 ^ m06 ^ m07 ^ x3 ^ m09 ^ m0a ^ m0b ^ m0c ^
+                   m0e ^ x4 ^ m12 ^ m13 ^ m14 ^ m15 ^ m16 ^ m17 ^ m19 ^ m1c ^
+                   m1e);
+        s[2][0] = x1 ^ m03 ^ m05 ^ x3 ^ x4;
+    }
+    /* s-box 4 */
+    {
+        const csa_word_t x4 = A[3][3], x3 = A[1][1], x2 = A[2][3];
+        const csa_word_t x1 = A[4][2], x0 = A[8][0];
+        const csa_word_t m03 = x0 & x1, m06 = x1 & x2, m09 = x0 & x3;
+        const csa_word_t m0c = x2 & x3, m11 = x0 & x4, m12 = x1 & x4;
+        const csa_word_t m18 = x3 & x4, m07 = m03 & x2, m0b = m03 & x3;
+        const csa_word_t m0e = m06 & x3, m19 = m09 & x4, m1c = m0c & x4;
+        const csa_word_t m17 = m07 & x4, m1b = m0b & x4, m1e = m0e & x4;
+        s[3][1] = ~(x0 ^ m03 ^ x2 ^ m07 ^ x3 ^ m0e ^ x4 ^ m11 ^ m12 ^ m17 ^ m18
+                   ^ m19 ^ m1b ^ m1c ^ m1e);
+        s[3][0] = ~(x1 ^ m03 ^ x2 ^ m09 ^ m0b ^ m0c ^ m11 ^ m12 ^ m17 ^ m18 ^
+                   m19 ^ m1b ^ m1c ^ m1e);
+    }
+    /* s-box 5 */
+    {
+        const csa_word_t x4 = A[5][2], x3 = A[4][3], x2 = A[6][0];
+        const csa_word_t x1 = A[8][1], x0 = A[9][2];
+        const csa_word_t m03 = x0 & x1, m05 = x0 & x2, m06 = x1 & x2;
+        const csa_word_t m09 = x0 & x3, m0a = x1 & x3, m11 = x0 & x4;
+        const csa_word_t m12 = x1 & x4, m14 = x2 & x4, m18 = x3 & x4;
+        const csa_word_t m07 = m03 & x2, m0b = m03 & x3, m0d = m05 & x3;
+        const csa_word_t m0e = m06 & x3, m15 = m05 & x4, m16 = m06 & x4;
+        const csa_word_t m19 = m09 & x4, m1a = m0a & x4, m17 = m07 & x4;
+        const csa_word_t m1b = m0b & x4, m1d = m0d & x4, m1e = m0e & x4;
+        s[4][1] = ~(x0 ^ x1 ^ m03 ^ m05 ^ m06 ^ m07 ^ x3 ^ m09 ^ m0b ^ m0d ^
+                   m0e ^ m11 ^ m12 ^ m14 ^ m16 ^ m17 ^ m19 ^ m1a ^ m1d ^ m1e);
+        s[4][0] = m03 ^ x2 ^ m05 ^ m07 ^ m09 ^ m0a ^ m0d ^ m11 ^ m14 ^ m15 ^
+                  m16 ^ m17 ^ m18 ^ m19 ^ m1a ^ m1b;
+    }
+    /* s-box 6 */
+    {
+        const csa_word_t x4 = A[3][1], x3 = A[4][1], x2 = A[5][0];
+        const csa_word_t x1 = A[7][2], x0 = A[9][3];
+        const csa_word_t m03 = x0 & x1, m05 = x0 & x2, m06 = x1 & x2;
+        const csa_word_t m09 = x0 & x3, m0a = x1 & x3, m0c = x2 & x3;
+        const csa_word_t m07 = m03 & x2, m0b = m03 & x3, m0d = m05 & x3;
+        const csa_word_t m0e = m06 & x3, m13 = m03 & x4, m16 = m06 & x4;
+        const csa_word_t m19 = m09 & x4, m17 = m07 & x4, m1b = m0b & x4;
+        const csa_word_t m1e = m0e & x4;
+        s[5][1] = x1 ^ m05 ^ m0b ^ m0c ^ m0d ^ x4 ^ m13 ^ m19;
+        s[5][0] = x0 ^ x2 ^ m06 ^ m07 ^ m0a ^ m0c ^ m0e ^ m13 ^ m16 ^ m17 ^ m1b
+                  ^ m1e;
+    }
+    /* s-box 7 */
+    {
+        const csa_word_t x4 = A[2][2], x3 = A[3][0], x2 = A[7][1];
+        const csa_word_t x1 = A[8][2], x0 = A[8][3];
+        const csa_word_t m03 = x0 & x1, m06 = x1 & x2, m0a = x1 & x3;
+        const csa_word_t m0c = x2 & x3, m11 = x0 & x4, m14 = x2 & x4;
+        const csa_word_t m07 = m03 & x2, m0b = m03 & x3, m0e = m06 & x3;
+        const csa_word_t m13 = m03 & x4, m16 = m06 & x4, m1a = m0a & x4;
+        const csa_word_t m17 = m07 & x4, m1b = m0b & x4, m1e = m0e & x4;
+        s[6][1] = x0 ^ x1 ^ m03 ^ x2 ^ x3 ^ m0b ^ m11 ^ m13 ^ m14 ^ m16 ^ m17 ^
+                  m1b ^ m1e;
+        s[6][0] = x0 ^ m03 ^ x2 ^ m06 ^ m07 ^ x3 ^ m0c ^ x4 ^ m1a ^ m1b;
+    }
+
+    /* use 4x4 xor to produce extra nibble for T3 */
+    extra_B[3] = B[3][0] ^ B[6][1] ^ B[7][2] ^ B[9][3];
+    extra_B[2] = B[6][0] ^ B[8][1] ^ B[3][3] ^ B[4][2];
+    extra_B[1] = B[5][3] ^ B[8][2] ^ B[4][0] ^ B[5][1];
+    extra_B[0] = B[9][2] ^ B[6][3] ^ B[3][1] ^ B[8][0];
+
+    /* T1 and T2 */
+    for( int b = 0; b < 4; b++ )
+    {
+        next_A1[b] = A[10][b] ^ st->X[b];
+        next_B1[b] = B[7][b] ^ B[10][b] ^ st->Y[b];
+        if( in_a != NULL )
+        {
+            next_A1[b] ^= st->D[b] ^ in_a[b];
+            next_B1[b] ^= in_b[b];
+        }
+    }
+    /* if p=1, rotate left */
+    {
+        const csa_word_t b3 = next_B1[3];
+
+        next_B1[3] ^= ( next_B1[3] ^ next_B1[2] ) & st->p;
+        next_B1[2] ^= ( next_B1[2] ^ next_B1[1] ) & st->p;
+        next_B1[1] ^= ( next_B1[1] ^ next_B1[0] ) & st->p;
+        next_B1[0] ^= ( next_B1[0] ^ b3 ) & st->p;
+    }
+
+    /* T3 */
+    for( int b = 0; b < 4; b++ )
+        st->D[b] = st->E[b] ^ st->Z[b] ^ extra_B[b];
+
+    /* T4 = sum, carry of Z + E + r if q */
+    carry = st->r;
+    for( int b = 0; b < 4; b++ )
+    {
+        const csa_word_t sum = st->Z[b] ^ st->E[b] ^ carry;
+
+        carry = ( st->Z[b] & st->E[b] ) | ( carry & ( st->Z[b] ^ st->E[b] ) );
+        next_E[b] = st->F[b];
+        st->F[b] = st->E[b] ^ ( ( st->E[b] ^ sum ) & st->q );
+    }
+    st->r ^= ( st->r ^ carry ) & st->q;
+    memcpy( st->E, next_E, sizeof( next_E ) );
+
+    memmove( &A[2], &A[1], 9 * sizeof( A[1] ) );
+    memmove( &B[2], &B[1], 9 * sizeof( B[1] ) );
+    memcpy( A[1], next_A1, sizeof( next_A1 ) );
+    memcpy( B[1], next_B1, sizeof( next_B1 ) );
+
+    st->X[3] = s[3][0]; st->X[2] = s[2][0]; st->X[1] = s[1][1]; st->X[0] = s[0][1];
+    st->Y[3] = s[5][0]; st->Y[2] = s[4][0]; st->Y[1] = s[3][1]; st->Y[0] = s[2][1];
+    st->Z[3] = s[1][0]; st->Z[2] = s[0][0]; st->Z[1] = s[5][1]; st->Z[0] = s[4][1];
+    st->p = s[6][1];
+    st->q = s[6][0];
+
+    /* 2 output bits are a function of the 4 bits of D */
+    out[1] = st->D[2] ^ st->D[3];
+    out[0] = st->D[0] ^ st->D[1];
+}
+
+/* Initialises the stream cypher of every lane with its 8 bytes at pp_sb,
+ * then XORs the keystream over its pi_len bytes at pp_data. */
+static void csa_BsStream( const uint8_t ck[8], int i_lanes,
+                          uint8_t *const *pp_sb, uint8_t *const *pp_data,
+                          const int *pi_len )
+{
+    csa_bs_t st;
+    csa_word_t in[8], ks[8], out[2];
+    uint8_t stream[CSA_LANES];
+    int i_max = 0;
+
+    csa_BsInit( &st, ck );
+    for( int i = 0; i < 8; i++ )
+    {
+        /* in[4..7] is the high nibble, in[0..3] the low one */
+        csa_BsLoad( in, pp_sb, i, i_lanes );
+        for( int j = 0; j < 4; j++ )
+        {
+            if( j % 2 )
+                csa_BsClock( &st, &in[0], &in[4], out );
+            else
+                csa_BsClock( &st, &in[4], &in[0], out );
+        }
+    }
+
+    for( int l = 0; l < i_lanes; l++ )
+        i_max = __MAX( i_max, pi_len[l] );
+
+    for( int i = 0; i < i_max; i++ )
+    {
+        for( int j = 0; j < 4; j++ )
+            csa_BsClock( &st, NULL, NULL, &ks[6 - 2 * j] );
+        csa_BsStore( stream, ks, i_lanes );
+
+        for( int l = 0; l < i_lanes; l++ )
+        {
+            if( i < pi_len[l] )
+                pp_data[l][i] ^= stream[l];
+        }
+    }
+}
+
+static inline void csa_XorSlice( uint8_t *p_dst, const uint8_t *p_src,
+                                 int i_count )
+{
+    for( int i = 0; i < i_count; i += sizeof( csa_word_t ) )
+    {
+        csa_word_t a, b;
+
+        memcpy( &a, &p_dst[i], sizeof( a ) );
+        memcpy( &b, &p_src[i], sizeof( b ) );
+        a ^= b;
+        memcpy( &p_dst[i], &a, sizeof( a ) );
+    }
+}
+
+/* csa_BlockDecypher() on i_count byte-sliced blocks: R[n] holds byte n of
+ * every block. The results are returned in pp_out[0..7]. */
+static void csa_SlicedBlockDecypher( const uint8_t kk[57],
+                                     uint8_t R[8][CSA_CHUNK], int i_count,
+                                     uint8_t *pp_out[8] )
+{
+    uint8_t sbox_out[CSA_CHUNK], perm_out[CSA_CHUNK];
+    uint8_t *r[8];
+
+    for( int b = 0; b < 8; b++ )
+        r[b] = R[b];
+
+    // loop over kk[56]..kk[1]
+    for( int i = 56; i > 0; i-- )
+    {
+        for( int m = 0; m < i_count; m++ )
+        {
+            sbox_out[m] = block_sbox[ kk[i]^r[6][m] ];
+            perm_out[m] = block_perm[ sbox_out[m] ];
+        }
+
+        uint8_t *t = r[7];
+
+        csa_XorSlice( t, sbox_out, i_count );    /* R8 ^ sbox_out */
+        csa_XorSlice( r[5], perm_out, i_count ); /* next R7 */
+        csa_XorSlice( r[3], t, i_count );        /* next R5 */
+        csa_XorSlice( r[2], t, i_count );        /* next R4 */
+        csa_XorSlice( r[1], t, i_count );        /* next R3 */
+
+        r[7] = r[6];
+        r[6] = r[5];
+        r[5] = r[4];
+        r[4] = r[3];
+        r[3] = r[2];
+        r[2] = r[1];
+        r[1] = r[0];
+        r[0] = t;
+    }
+
+    for( int b = 0; b < 8; b++ )
+        pp_out[b] = r[b];
+}
+
+/* csa_BlockCypher() on i_count byte-sliced blocks */
+static void csa_SlicedBlockCypher( const uint8_t kk[57],
+                                   uint8_t R[8][CSA_CHUNK], int i_count,
+                                   uint8_t *pp_out[8] )
+{
+    uint8_t sbox_out[CSA_CHUNK], perm_out[CSA_CHUNK];
+    uint8_t *r[8];
+
+    for( int b = 0; b < 8; b++ )
+        r[b] = R[b];
+
+    // loop over kk[1]..kk[56]
+    for( int i = 1; i <= 56; i++ )
+    {
+        for( int m = 0; m < i_count; m++ )
+        {
+            sbox_out[m] = block_sbox[ kk[i]^r[7][m] ];
+            perm_out[m] = block_perm[ sbox_out[m] ];
+        }
+
+        uint8_t *t = r[0];
+
+        csa_XorSlice( r[2], t, i_count );        /* next R2 */
+        csa_XorSlice( r[3], t, i_count );        /* next R3 */
+        csa_XorSlice( r[4], t, i_count );        /* next R4 */
+        csa_XorSlice( r[6], perm_out, i_count ); /* next R6 */
+        csa_XorSlice( t, sbox_out, i_count );    /* next R8 */
+
+        r[0] = r[1];
+        r[1] = r[2];
+        r[2] = r[3];
+        r[3] = r[4];
+        r[4] = r[5];
+        r[5] = r[6];
+        r[6] = r[7];
+        r[7] = t;
+    }
+
+    for( int b = 0; b < 8; b++ )
+        pp_out[b] = r[b];
+}
+
+/* Descrambles up to CSA_LANES packets scrambled with the same key */
+static void csa_DecryptGroup( csa_t *c, bool b_odd, uint8_t **pp_pkts,
+                              int i_pkts, int i_pkt_size )
+{
+    uint8_t *ck = b_odd ? c->o_ck : c->e_ck;
+    uint8_t *kk = b_odd ? c->o_kk : c->e_kk;
+    uint8_t *pp_sb[CSA_LANES], *pp_data[CSA_LANES];
+    int pi_len[CSA_LANES], pi_blocks[CSA_LANES];
+    int i_lanes = 0;
+
+    for( int i = 0; i < i_pkts; i++ )
+    {
+        uint8_t *pkt = pp_pkts[i];
+        int i_hdr = 4;
+
+        /* clear transport scrambling control */
+        pkt[3] &= 0x3f;
+
+        if( pkt[3]&0x20 )
+        {
+            /* skip adaption field */
+            i_hdr += pkt[4] + 1;
+        }
+        if( 188 - i_hdr < 8 )
+            continue;
+
+        const int n = (i_pkt_size - i_hdr) / 8;
+        const int i_residue = (i_pkt_size - i_hdr) % 8;
+        if( n <= 0 && i_residue <= 0 )
+            continue;
+
+        /* The first block feeds the stream cypher initialisation, the
+         * keystream covers the other blocks and the residue. */
+        pp_sb[i_lanes] = &pkt[i_hdr];
+        pp_data[i_lanes] = &pkt[n > 0 ? i_hdr + 8 : i_hdr];
+        pi_len[i_lanes] = &pkt[i_pkt_size] - pp_data[i_lanes];
+        pi_blocks[i_lanes] = __MAX( n, 0 );
+        i_lanes++;
+    }
+    if( i_lanes == 0 )
+        return;
+
+    csa_BsStream( ck, i_lanes, pp_sb, pp_data, pi_len );
+
+    /* Every block is now ib[k]: the plain text is
+     * BlockDecypher( ib[k] ) ^ ib[k+1], with ib[n] = 0. Blocks are written
+     * back in increasing order so that ib[k+1] is still there. */
+    uint8_t R[8][CSA_CHUNK], *pp_out[8];
+    uint8_t *pp_block[CSA_CHUNK], *pp_next[CSA_CHUNK];
+    int i_count = 0;
+
+    memset( R, 0, sizeof( R ) );
+    for( int l = 0; l < i_lanes; l++ )
+    {
+        for( int k = 0; k < pi_blocks[l]; k++ )
+        {
+            uint8_t *p_block = pp_sb[l] + 8 * k;
+
+            for( int b = 0; b < 8; b++ )
+                R[b][i_count] = p_block[b];
+            pp_block[i_count] = p_block;
+            pp_next[i_count] = k + 1 < pi_blocks[l] ? p_block + 8 : NULL;
+            i_count++;
+
+            if( i_count == CSA_CHUNK
+             || ( l == i_lanes - 1 && k == pi_blocks[l] - 1 ) )
+            {
+                csa_SlicedBlockDecypher( kk, R, i_count, pp_out );
+                for( int m = 0; m < i_count; m++ )
+                {
+                    for( int b = 0; b < 8; b++ )
+                        pp_block[m][b] = pp_out[b][m]
+                                       ^ ( pp_next[m] ? pp_next[m][b] : 0 );
+                }
+                i_count = 0;
+            }
+        }
+    }
+}
+
+/* Scrambles up to CSA_LANES packets */
+static void csa_EncryptGroup( csa_t *c, uint8_t **pp_pkts, int i_pkts,
+                              int i_pkt_size )
+{
+    uint8_t *ck = c->use_odd ? c->o_ck : c->e_ck;
+    uint8_t *kk = c->use_odd ? c->o_kk : c->e_kk;
+    uint8_t *pp_sb[CSA_LANES], *pp_data[CSA_LANES];
+    int pi_len[CSA_LANES], pi_blocks[CSA_LANES];
+    int i_lanes = 0, i_max_blocks = 0;
+
+    for( int i = 0; i < i_pkts; i++ )
+    {
+        uint8_t *pkt = pp_pkts[i];
+        int i_hdr = 4;
+
+        /* set transport scrambling control */
+        pkt[3] |= 0x80;
+        if( c->use_odd )
+            pkt[3] |= 0x40;
+
+        if( pkt[3]&0x20 )
+        {
+            /* skip adaption field */
+            i_hdr += pkt[4] + 1;
+        }
+
+        const int n = (i_pkt_size - i_hdr) / 8;
+        if( n <= 0 )
+        {
+            pkt[3] &= 0x3f;
+            continue;
+        }
+
+        pp_sb[i_lanes] = &pkt[i_hdr];
+        pp_data[i_lanes] = &pkt[i_hdr + 8];
+        pi_len[i_lanes] = i_pkt_size - i_hdr - 8;
+        pi_blocks[i_lanes] = n;
+        i_max_blocks = __MAX( i_max_blocks, n );
+        i_lanes++;
+    }
+    if( i_lanes == 0 )
+        return;
+
+    /* Cypher block chaining from the last block: each step cyphers one
+     * block of every packet, in place, with ib[n+1] = 0. */
+    uint8_t R[8][CSA_CHUNK], *pp_out[8];
+    uint8_t *pp_block[CSA_LANES];
+
+    memset( R, 0, sizeof( R ) );
+    for( int t = 0; t < i_max_blocks; t++ )
+    {
+        int i_count = 0;
+
+        for( int l = 0; l < i_lanes; l++ )
+        {
+            const int k = pi_blocks[l] - 1 - t;
+            if( k < 0 )
+                continue;
+
+            uint8_t *p_block = pp_sb[l] + 8 * k;
+            for( int b = 0; b < 8; b++ )
+                R[b][i_count] = p_block[b]
+                              ^ ( t > 0 ? p_block[8 + b] : 0 );
+            pp_block[i_count++] = p_block;
+        }
+
+        csa_SlicedBlockCypher( kk, R, i_count, pp_out );
+        for( int m = 0; m < i_count; m++ )
+        {
+            for( int b = 0; b < 8; b++ )
+                pp_block[m][b] = pp_out[b][m];
+        }
+    }
+
+    csa_BsStream( ck, i_lanes, pp_sb, pp_data, pi_len );
+}
+
+/*****************************************************************************
+ * csa_DecryptBatch: descramble many packets at once
+ *****************************************************************************
+ * Same result as calling csa_Decrypt() on every packet.
+ *****************************************************************************/
+void csa_DecryptBatch( csa_t *c, uint8_t **pp_pkts, int i_pkts,
+                       int i_pkt_size )
+{
+    uint8_t *pp_odd[CSA_LANES], *pp_even[CSA_LANES];
+    int i_odd = 0, i_even = 0;
+
+    for( int i = 0; i < i_pkts; i++ )
+    {
+        uint8_t *pkt = pp_pkts[i];
+
+        /* transport scrambling control */
+        if( (pkt[3]&0x80) == 0 )
+            continue;
+
+        if( pkt[3]&0x40 )
+        {
+            pp_odd[i_odd++] = pkt;
+            if( i_odd == (int)CSA_LANES )
+            {
+                csa_DecryptGroup( c, true, pp_odd, i_odd, i_pkt_size );
+                i_odd = 0;
+            }
+        }
+        else
+        {
+            pp_even[i_even++] = pkt;
+            if( i_even == (int)CSA_LANES )
+            {
+                csa_DecryptGroup( c, false, pp_even, i_even, i_pkt_size );
+                i_even = 0;
+            }
+        }
+    }
+    if( i_odd > 0 )
+        csa_DecryptGroup( c, true, pp_odd, i_odd, i_pkt_size );
+    if( i_even > 0 )
+        csa_DecryptGroup( c, false, pp_even, i_even, i_pkt_size );
+}
+
+/*****************************************************************************
+ * csa_EncryptBatch: scramble many packets at once
+ *****************************************************************************
+ * Same result as calling csa_Encrypt() on every packet.
+ *****************************************************************************/
+void csa_EncryptBatch( csa_t *c, uint8_t **pp_pkts, int i_pkts,
+                       int i_pkt_size )
+{
+    for( int i = 0; i < i_pkts; i += CSA_LANES )
+        csa_EncryptGroup( c, &pp_pkts[i], __MIN( i_pkts - i, (int)CSA_LANES ),
+                          i_pkt_size );
+}
@@ -487,6 +487,7 @@ static void TSSchedule  ( sout_mux_t *p_mux, sout_buffer_chain_t *p_chain_ts,
                           mtime_t i_pcr_length, mtime_t i_pcr_dts );
 static void TSDate      ( sout_mux_t *p_mux, sout_buffer_chain_t *p_chain_ts,
                           mtime_t i_pcr_length, mtime_t i_pcr_dts );
+static void TSScramble  ( sout_mux_t *p_mux, sout_buffer_chain_t *p_chain_ts );
 static void GetPAT( sout_mux_t *p_mux, sout_buffer_chain_t *c );
 static void GetPMT( sout_mux_t *p_mux, sout_buffer_chain_t *c );
 
@@ -1933,6 +1934,33 @@ static void TSSchedule( sout_mux_t *p_mux, sout_buffer_chain_t *p_chain_ts,
         TSDate( p_mux, &new_chain, i_pcr_length, i_pcr_dts );
 }
 
+/* Scrambles the flagged packets of the chain by batches */
+static void TSScramble( sout_mux_t *p_mux, sout_buffer_chain_t *p_chain_ts )
+{
+    sout_mux_sys_t  *p_sys = p_mux->p_sys;
+    uint8_t *pp_pkts[256];
+    int i_pkts = 0;
+
+    vlc_mutex_lock( &p_sys->csa_lock );
+    for( block_t *p_ts = p_chain_ts->p_first; p_ts != NULL;
+         p_ts = p_ts->p_next )
+    {
+        if( !(p_ts->i_flags & BLOCK_FLAG_SCRAMBLED) )
+            continue;
+
+        pp_pkts[i_pkts++] = p_ts->p_buffer;
+        if( i_pkts == 256 )
+        {
+            csa_EncryptBatch( p_sys->csa, pp_pkts, i_pkts,
+                              p_sys->i_csa_pkt_size );
+            i_pkts = 0;
+        }
+    }
+    if( i_pkts > 0 )
+        csa_EncryptBatch( p_sys->csa, pp_pkts, i_pkts, p_sys->i_csa_pkt_size );
+    vlc_mutex_unlock( &p_sys->csa_lock );
+}
+
 static void TSDate( sout_mux_t *p_mux, sout_buffer_chain_t *p_chain_ts,
                     mtime_t i_pcr_length, mtime_t i_pcr_dts )
 {
@@ -1968,6 +1996,9 @@ static void TSDate( sout_mux_t *p_mux, sout_buffer_chain_t *p_chain_ts,
         i_pcr_length = i_packet_count;
     }
 
+    if( p_sys->csa != NULL )
+        TSScramble( p_mux, p_chain_ts );
+
     /* msg_Dbg( p_mux, "real pck=%d", i_packet_count ); */
     for( i = 0; i < i_packet_count; i++ )
     {
@@ -1982,13 +2013,6 @@ static void TSDate( sout_mux_t *p_mux, sout_buffer_chain_t *p_chain_ts,
             /* msg_Dbg( p_mux, "pcr=%lld ms", p_ts->i_dts / 1000 ); */
             TSSetPCR( p_ts, p_ts->i_dts - p_sys->i_dts_delay );
         }
-        if( p_ts->i_flags & BLOCK_FLAG_SCRAMBLED )
-        {
-            vlc_mutex_lock( &p_sys->csa_lock );
-            csa_Encrypt( p_sys->csa, p_ts->p_buffer, p_sys->i_csa_pkt_size );
-            vlc_mutex_unlock( &p_sys->csa_lock );
-        }
-
         /* latency */
         p_ts->i_dts += p_sys->i_shaping_delay * 3 / 2;
 
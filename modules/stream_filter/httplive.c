@@ -47,14 +47,32 @@
 static int  Open (vlc_object_t *);
 static void Close(vlc_object_t *);
 
+#define PREFETCH_TEXT N_("Parallel segment downloads")
+#define PREFETCH_LONGTEXT N_( \
+    "Number of segments that are downloaded at the same time.")
+#define CACHE_TEXT N_("Segment cache size (kB)")
+#define CACHE_LONGTEXT N_( \
+    "Maximum amount of downloaded segment data kept in memory. " \
+    "Segments that were already played are evicted first.")
+
 vlc_module_begin()
     set_category(CAT_INPUT)
     set_subcategory(SUBCAT_INPUT_STREAM_FILTER)
     set_description(N_("Http Live Streaming stream filter"))
     set_capability("stream_filter", 20)
+    add_integer("hls-prefetch", 3, PREFETCH_TEXT, PREFETCH_LONGTEXT, true)
+        change_integer_range(1, 8)
+    add_integer("hls-cache", 32768, CACHE_TEXT, CACHE_LONGTEXT, true)
+        change_integer_range(1024, 1048576)
     set_callbacks(Open, Close)
 vlc_module_end()
 
+/* Bandwidth estimator: sampling period and time constant */
+#define HLS_BW_PERIOD  (CLOCK_FREQ / 10)
+#define HLS_BW_TAU     (CLOCK_FREQ * 2)
+/* Maximum number of segments downloaded ahead of playback */
+#define HLS_WINDOW     6
+
 /*****************************************************************************
  *
  *****************************************************************************/
@@ -68,6 +86,7 @@ typedef struct segment_s
     vlc_url_t   url;
     vlc_mutex_t lock;
     block_t     *data;      /* data */
+    bool        busy;       /* being downloaded (protected by lock_wait) */
 } segment_t;
 
 typedef struct hls_stream_s
@@ -87,23 +106,42 @@ typedef struct hls_stream_s
 
 struct stream_sys_t
 {
-    access_t    *p_access;  /* HTTP access input */
     vlc_url_t   m3u8;       /* M3U8 url */
 
     /* */
     vlc_array_t  *hls_stream;/* bandwidth adaptation */
-    uint64_t      bandwidth; /* measured bandwidth (bits per second) */
+    uint64_t      bandwidth; /* estimated bandwidth (bits per second) */
 
     /* Download */
     struct hls_download_s
     {
         int         stream;     /* current hls_stream  */
-        int         segment;    /* current segment for downloading */
+        int         segment;    /* next segment for downloading */
         int         seek;       /* segment requested by seek (default -1) */
-        vlc_mutex_t lock_wait;  /* protect segment download counter */
+        int         active;     /* downloads in progress */
+        vlc_mutex_t lock_wait;  /* protect download state and cache */
         vlc_cond_t  wait;       /* some condition to wait on */
+
+        vlc_thread_t *threads;  /* parallel downloaders */
+        int         count;      /* number of running downloaders */
     } download;
 
+    /* Segment cache */
+    struct hls_cache_s
+    {
+        uint64_t    size;       /* bytes downloaded or being downloaded */
+        uint64_t    max;        /* cache size limit (bytes) */
+    } cache;
+
+    /* Statistics */
+    struct hls_stats_s
+    {
+        mtime_t     open;       /* time the stream was opened */
+        mtime_t     startup;    /* delay until the first byte was read */
+        mtime_t     stalled;    /* total time reads waited for segments */
+        int         waits;      /* number of reads that waited */
+    } stats;
+
     /* Playback */
     struct hls_playback_s
     {
@@ -125,6 +163,7 @@ struct stream_sys_t
     bool        b_meta;     /* meta playlist */
     bool        b_live;     /* live stream? or vod? */
     bool        b_error;    /* parsing error */
+    bool        b_thread;   /* playlist reload thread running */
 };
 
 /****************************************************************************
@@ -134,12 +173,13 @@ static int  Read   (stream_t *, void *p_read, unsigned int i_read);
 static int  Peek   (stream_t *, const uint8_t **pp_peek, unsigned int i_peek);
 static int  Control(stream_t *, int i_query, va_list);
 
-static int  AccessOpen(stream_t *s, vlc_url_t *url);
-static void AccessClose(stream_t *s);
+static access_t *AccessOpen(stream_t *s, vlc_url_t *url);
+static void AccessClose(access_t *p_access);
 static char *AccessReadLine(access_t *p_access, uint8_t *psz_tmp, size_t i_len);
-static int AccessDownload(stream_t *s, segment_t *segment);
+static block_t *AccessDownload(stream_t *s, segment_t *segment);
 
 static void* hls_Thread(vlc_object_t *);
+static void* hls_Prefetch(void *);
 static int get_HTTPLivePlaylist(stream_t *s, hls_stream_t *hls);
 
 static segment_t *segment_GetSegment(hls_stream_t *hls, int wanted);
@@ -290,6 +330,7 @@ static segment_t *segment_New(hls_stream_t* hls, int duration, char *uri)
     segment->bandwidth = 0;
     vlc_UrlParse(&segment->url, uri, 0);
     segment->data = NULL;
+    segment->busy = false;
     vlc_array_append(hls->segments, segment);
     vlc_mutex_init(&segment->lock);
     return segment;
@@ -388,18 +429,23 @@ static char *relative_URI(stream_t *s, const char *uri, const char *path)
     p = strrchr(psz_path, '/');
     if (p) *p = '\0';
 
+    char psz_port[12] = "";
+    if (p_sys->m3u8.i_port > 0)
+        snprintf(psz_port, sizeof(psz_port), ":%d", p_sys->m3u8.i_port);
+
     char *psz_uri = NULL;
     if (p_sys->m3u8.psz_password || p_sys->m3u8.psz_username)
     {
-        if (asprintf(&psz_uri, "%s://%s:%s@%s%s/%s", p_sys->m3u8.psz_protocol,
+        if (asprintf(&psz_uri, "%s://%s:%s@%s%s%s/%s", p_sys->m3u8.psz_protocol,
                      p_sys->m3u8.psz_username, p_sys->m3u8.psz_password,
-                     p_sys->m3u8.psz_host, path ? path : psz_path, uri) < 0)
+                     p_sys->m3u8.psz_host, psz_port,
+                     path ? path : psz_path, uri) < 0)
             goto fail;
     }
     else
     {
-        if (asprintf(&psz_uri, "%s://%s%s/%s", p_sys->m3u8.psz_protocol,
-                 p_sys->m3u8.psz_host, path ? path : psz_path, uri) < 0)
+        if (asprintf(&psz_uri, "%s://%s%s%s/%s", p_sys->m3u8.psz_protocol,
+                 p_sys->m3u8.psz_host, psz_port, path ? path : psz_path, uri) < 0)
            goto fail;
     }
     free(psz_path);
@@ -672,18 +718,19 @@ static int get_HTTPLivePlaylist(stream_t *s, hls_stream_t *hls)
     stream_sys_t *p_sys = s->p_sys;
 
     /* Download new playlist file from server */
-    if (AccessOpen(s, &hls->url) != VLC_SUCCESS)
+    access_t *p_access = AccessOpen(s, &hls->url);
+    if (p_access == NULL)
         return VLC_EGENERIC;
 
     /* Parse the rest of the reply */
     uint8_t *tmp = calloc(1, HTTPLIVE_MAX_LINE);
     if (tmp == NULL)
     {
-        AccessClose(s);
+        AccessClose(p_access);
         return VLC_ENOMEM;
     }
 
-    char *line = AccessReadLine(p_sys->p_access, tmp, HTTPLIVE_MAX_LINE);
+    char *line = AccessReadLine(p_access, tmp, HTTPLIVE_MAX_LINE);
     if (strncmp(line, "#EXTM3U", 7) != 0)
     {
         msg_Err(s, "missing #EXTM3U tag");
@@ -694,7 +741,7 @@ static int get_HTTPLivePlaylist(stream_t *s, hls_stream_t *hls)
 
     for( ; ; )
     {
-        line = AccessReadLine(p_sys->p_access, tmp, HTTPLIVE_MAX_LINE);
+        line = AccessReadLine(p_access, tmp, HTTPLIVE_MAX_LINE);
         if (line == NULL)
         {
             msg_Dbg(s, "end of data");
@@ -707,7 +754,7 @@ static int get_HTTPLivePlaylist(stream_t *s, hls_stream_t *hls)
         /* some more checks for actual data */
         if (strncmp(line, "#EXTINF", 7) == 0)
         {
-            char *uri = AccessReadLine(p_sys->p_access, tmp, HTTPLIVE_MAX_LINE);
+            char *uri = AccessReadLine(p_access, tmp, HTTPLIVE_MAX_LINE);
             if (uri == NULL)
                 p_sys->b_error = true;
             else
@@ -730,13 +777,13 @@ static int get_HTTPLivePlaylist(stream_t *s, hls_stream_t *hls)
 
     free(line);
     free(tmp);
-    AccessClose(s);
+    AccessClose(p_access);
     return VLC_SUCCESS;
 
 error:
     free(line);
     free(tmp);
-    AccessClose(s);
+    AccessClose(p_access);
     return VLC_EGENERIC;
 }
 
@@ -746,18 +793,19 @@ static int get_HTTPLiveMetaPlaylist(stream_t *s, vlc_array_t **streams)
     assert(*streams);
 
     /* Download new playlist file from server */
-    if (AccessOpen(s, &p_sys->m3u8) != VLC_SUCCESS)
+    access_t *p_access = AccessOpen(s, &p_sys->m3u8);
+    if (p_access == NULL)
         return VLC_EGENERIC;
 
     /* Parse the rest of the reply */
     uint8_t *tmp = calloc(1, HTTPLIVE_MAX_LINE);
     if (tmp == NULL)
     {
-        AccessClose(s);
+        AccessClose(p_access);
         return VLC_ENOMEM;
     }
 
-    char *line = AccessReadLine(p_sys->p_access, tmp, HTTPLIVE_MAX_LINE);
+    char *line = AccessReadLine(p_access, tmp, HTTPLIVE_MAX_LINE);
     if (strncmp(line, "#EXTM3U", 7) != 0)
     {
         msg_Err(s, "missing #EXTM3U tag");
@@ -768,7 +816,7 @@ static int get_HTTPLiveMetaPlaylist(stream_t *s, vlc_array_t **streams)
 
     for( ; ; )
     {
-        line = AccessReadLine(p_sys->p_access, tmp, HTTPLIVE_MAX_LINE);
+        line = AccessReadLine(p_access, tmp, HTTPLIVE_MAX_LINE);
         if (line == NULL)
         {
             msg_Dbg(s, "end of data");
@@ -782,7 +830,7 @@ static int get_HTTPLiveMetaPlaylist(stream_t *s, vlc_array_t **streams)
         if (strncmp(line, "#EXT-X-STREAM-INF", 17) == 0)
         {
             p_sys->b_meta = true;
-            char *uri = AccessReadLine(p_sys->p_access, tmp, HTTPLIVE_MAX_LINE);
+            char *uri = AccessReadLine(p_access, tmp, HTTPLIVE_MAX_LINE);
             if (uri == NULL)
                 p_sys->b_error = true;
             else
@@ -793,7 +841,7 @@ static int get_HTTPLiveMetaPlaylist(stream_t *s, vlc_array_t **streams)
         }
         else if (strncmp(line, "#EXTINF", 7) == 0)
         {
-            char *uri = AccessReadLine(p_sys->p_access, tmp, HTTPLIVE_MAX_LINE);
+            char *uri = AccessReadLine(p_access, tmp, HTTPLIVE_MAX_LINE);
             if (uri == NULL)
                 p_sys->b_error = true;
             else
@@ -830,13 +878,13 @@ static int get_HTTPLiveMetaPlaylist(stream_t *s, vlc_array_t **streams)
 
     free(line);
     free(tmp);
-    AccessClose(s);
+    AccessClose(p_access);
     return VLC_SUCCESS;
 
 error:
     free(line);
     free(tmp);
-    AccessClose(s);
+    AccessClose(p_access);
     return VLC_EGENERIC;
 }
 #undef HTTPLIVE_MAX_LINE
@@ -1076,8 +1124,10 @@ static int hls_ReloadPlaylist(stream_t *s)
 
         hls_stream_t *hls_old = hls_Find(p_sys->hls_stream, hls_new);
         if (hls_old == NULL)
-        {   /* new hls stream - append */
+        {   /* new hls stream - append (the download thread reads the array) */
+            vlc_mutex_lock(&p_sys->download.lock_wait);
             vlc_array_append(p_sys->hls_stream, hls_new);
+            vlc_mutex_unlock(&p_sys->download.lock_wait);
             msg_Info(s, "new HLS stream appended (id=%d, bandwidth=%"PRIu64")",
                      hls_new->id, hls_new->bandwidth);
         }
@@ -1095,14 +1145,14 @@ fail:
 }
 
 /****************************************************************************
- * hls_Thread
+ * Bandwidth adaptation
  ****************************************************************************/
 static int BandwidthAdaptation(stream_t *s, int progid, uint64_t *bandwidth)
 {
     stream_sys_t *p_sys = s->p_sys;
-    int candidate = -1;
+    int candidate = -1, lowest = -1;
     uint64_t bw = *bandwidth;
-    uint64_t bw_candidate = 0;
+    uint64_t bw_candidate = 0, bw_lowest = UINT64_MAX;
 
     int count = vlc_array_count(p_sys->hls_stream);
     for (int n = 0; n < count; n++)
@@ -1121,171 +1171,374 @@ static int BandwidthAdaptation(stream_t *s, int progid, uint64_t *bandwidth)
                 bw_candidate = hls->bandwidth;
                 candidate = n; /* possible candidate */
             }
+            if (hls->bandwidth < bw_lowest)
+            {
+                bw_lowest = hls->bandwidth;
+                lowest = n;
+            }
         }
     }
+
+    /* Even the lowest bitrate is too much, that is the best we can do */
+    if (candidate < 0)
+    {
+        bw_candidate = bw_lowest;
+        candidate = lowest;
+    }
     *bandwidth = bw_candidate;
     return candidate;
 }
 
-static int Download(stream_t *s, hls_stream_t *hls, segment_t *segment, int *cur_stream)
+/* Feeds the bandwidth estimator with the bytes one download received during
+ * elapsed. Parallel downloads share the link, so the sample is scaled by
+ * their number. The estimate is an average weighted by the duration of the
+ * samples, with a time constant of HLS_BW_TAU. */
+static void BandwidthSample(stream_t *s, uint64_t bytes, mtime_t elapsed)
 {
-    assert(hls);
-    assert(segment);
+    stream_sys_t *p_sys = s->p_sys;
 
-    vlc_mutex_lock(&segment->lock);
-    if (segment->data != NULL)
+    if (elapsed <= 0)
+        return;
+
+    vlc_mutex_lock(&p_sys->download.lock_wait);
+    int active = (p_sys->download.active > 0) ? p_sys->download.active : 1;
+    uint64_t bw = bytes * 8 * CLOCK_FREQ / elapsed * active; /* bits / s */
+    if (p_sys->bandwidth == 0)
+        p_sys->bandwidth = bw;
+    else
+        p_sys->bandwidth = (p_sys->bandwidth * HLS_BW_TAU + bw * elapsed)
+                         / (HLS_BW_TAU + elapsed);
+    vlc_mutex_unlock(&p_sys->download.lock_wait);
+}
+
+/* Picks the bitrate of the next segment to download from the bandwidth
+ * estimate. Called with lock_wait held. */
+static void BandwidthChoose(stream_t *s)
+{
+    stream_sys_t *p_sys = s->p_sys;
+
+    if (!p_sys->b_meta || (p_sys->bandwidth == 0))
+        return;
+
+    hls_stream_t *hls = hls_Get(p_sys->hls_stream, p_sys->download.stream);
+    if (hls == NULL)
+        return;
+
+    uint64_t bw = p_sys->bandwidth;
+    int newstream = BandwidthAdaptation(s, hls->id, &bw);
+    if ((newstream >= 0) && (newstream != p_sys->download.stream))
     {
-        /* Segment already downloaded */
-        vlc_mutex_unlock(&segment->lock);
-        return VLC_SUCCESS;
+        msg_Info(s, "detected %s bandwidth (%"PRIu64") stream",
+                 (bw >= hls->bandwidth) ? "faster" : "lower", bw);
+        p_sys->download.stream = newstream;
     }
+}
 
-    /* sanity check - can we download this segment on time? */
-    if (s->p_sys->bandwidth > 0)
+/****************************************************************************
+ * Segment cache
+ ****************************************************************************/
+/* Looks for a downloaded copy of segment number wanted, in the current HLS
+ * stream first, then in the other bitrates of a meta playlist. Sets *pending
+ * if a copy is being downloaded. Called with lock_wait held. */
+static segment_t *segment_Ready(stream_t *s, int current, int wanted,
+                                int *stream, bool *pending)
+{
+    stream_sys_t *p_sys = s->p_sys;
+    int count = vlc_array_count(p_sys->hls_stream);
+
+    *pending = false;
+    for (int n = -1; n < count; n++)
     {
-        uint64_t size = (segment->duration * hls->bandwidth); /* bits */
-        int estimated = (int)(size / s->p_sys->bandwidth);
-        if (estimated > segment->duration)
+        int i_stream = (n < 0) ? current : n;
+        if ((n >= 0) && (n == current))
+            continue;
+
+        hls_stream_t *hls = hls_Get(p_sys->hls_stream, i_stream);
+        if (hls == NULL)
+            continue;
+
+        vlc_mutex_lock(&hls->lock);
+        segment_t *segment = segment_GetSegment(hls, wanted);
+        vlc_mutex_unlock(&hls->lock);
+        if (segment == NULL)
+            continue;
+
+        if (segment->busy)
+            *pending = true;
+
+        vlc_mutex_lock(&segment->lock);
+        bool b_ready = (segment->data != NULL);
+        vlc_mutex_unlock(&segment->lock);
+        if (b_ready)
         {
-            msg_Err(s, "cannot quarantee smooth playback");
-            msg_Warn(s,"downloading of segment %d takes %ds, which is longer then its playback (%ds)",
-                        segment->sequence, estimated, segment->duration);
-            vlc_mutex_unlock(&segment->lock);
-            return VLC_EGENERIC;
+            *stream = i_stream;
+            return segment;
         }
     }
+    return NULL;
+}
 
-    mtime_t start = mdate();
-    if (AccessDownload(s, segment) != VLC_SUCCESS)
+/* Hands downloaded data over to the segment. Called with lock_wait held. */
+static void segment_Store(stream_sys_t *p_sys, segment_t *segment, block_t *data)
+{
+    vlc_mutex_lock(&segment->lock);
+    assert(segment->data == NULL);
+    segment->data = data;
+    segment->size = data->i_buffer;
+    vlc_mutex_unlock(&segment->lock);
+
+    p_sys->cache.size += segment->size;
+}
+
+/* Frees the data of a segment. Called with lock_wait held. */
+static void segment_Evict(stream_sys_t *p_sys, segment_t *segment)
+{
+    vlc_mutex_lock(&segment->lock);
+    if (segment->data != NULL)
     {
-        vlc_mutex_unlock(&segment->lock);
-        return VLC_EGENERIC;
+        block_Release(segment->data);
+        segment->data = NULL;
+        p_sys->cache.size -= segment->size;
     }
-    mtime_t duration = mdate() - start;
+    vlc_mutex_unlock(&segment->lock);
+}
 
+/* Resets the read pointer of a segment to the start of its data */
+static void segment_Rewind(segment_t *segment)
+{
+    vlc_mutex_lock(&segment->lock);
+    if (segment->data)
+    {
+        uint64_t size = segment->size - segment->data->i_buffer;
+        if (size > 0)
+        {
+            segment->data->i_buffer += size;
+            segment->data->p_buffer -= size;
+        }
+    }
     vlc_mutex_unlock(&segment->lock);
+}
 
-    msg_Info(s, "downloaded segment %d from stream %d",
-                segment->sequence, *cur_stream);
+/* Finds the segment to evict: if behind, the one furthest behind playback
+ * (i.e. the oldest played one), else the one furthest beyond the download
+ * point (left over by a seek). Segments between the playback and download
+ * points, and segments being read, are never evicted.
+ * Called with lock_wait held. */
+static segment_t *cache_Victim(stream_t *s, bool behind)
+{
+    stream_sys_t *p_sys = s->p_sys;
+    segment_t *victim = NULL;
+    int distance = 0;
 
-    /* check for division by zero */
-    double ms = (double)duration / 1000.0; /* ms */
-    if (ms <= 0.0)
-        return VLC_SUCCESS;
+    for (int i = 0; i < vlc_array_count(p_sys->hls_stream); i++)
+    {
+        hls_stream_t *hls = hls_Get(p_sys->hls_stream, i);
+        if (hls == NULL)
+            continue;
+
+        vlc_mutex_lock(&hls->lock);
+        int count = vlc_array_count(hls->segments);
+        for (int n = 0; n < count; n++)
+        {
+            int d = behind ? p_sys->playback.segment - n
+                           : n - p_sys->download.segment + 1;
+            if (d <= distance)
+                continue;
+
+            segment_t *segment = segment_GetSegment(hls, n);
+            vlc_mutex_lock(&segment->lock);
+            if ((segment->data != NULL) &&
+                (segment->data->i_buffer == segment->size))
+            {
+                victim = segment;
+                distance = d;
+            }
+            vlc_mutex_unlock(&segment->lock);
+        }
+        vlc_mutex_unlock(&hls->lock);
+    }
+    return victim;
+}
+
+/* Makes room for size more bytes in the cache. Returns false if the cache
+ * is full of segments yet to be played. Called with lock_wait held. */
+static bool cache_Reserve(stream_t *s, uint64_t size)
+{
+    stream_sys_t *p_sys = s->p_sys;
 
-    uint64_t bw = ((double)(segment->size * 8) / ms) * 1000; /* bits / s */
-    s->p_sys->bandwidth = bw;
-    if (hls->bandwidth != bw)
+    while ((p_sys->cache.size > 0) &&
+           (p_sys->cache.size + size > p_sys->cache.max))
     {
-        int newstream = BandwidthAdaptation(s, hls->id, &bw);
+        segment_t *victim = cache_Victim(s, true);
+        if (victim == NULL)
+            victim = cache_Victim(s, false);
+        if (victim == NULL)
+            return false;
+
+        msg_Dbg(s, "evicting segment %d from cache", victim->sequence);
+        segment_Evict(p_sys, victim);
+    }
+    return true;
+}
 
-        /* FIXME: we need an average here */
-        if ((newstream >= 0) && (newstream != *cur_stream))
+/****************************************************************************
+ * hls_Thread
+ ****************************************************************************/
+static block_t *Download(stream_t *s, hls_stream_t *hls, segment_t *segment)
+{
+    stream_sys_t *p_sys = s->p_sys;
+
+    assert(hls);
+    assert(segment);
+
+    /* sanity check - can we download this segment on time? */
+    vlc_mutex_lock(&p_sys->download.lock_wait);
+    uint64_t bandwidth = p_sys->bandwidth;
+    vlc_mutex_unlock(&p_sys->download.lock_wait);
+    if (bandwidth > 0)
+    {
+        uint64_t size = (segment->duration * hls->bandwidth); /* bits */
+        int estimated = (int)(size / bandwidth);
+        if (estimated > segment->duration)
         {
-            msg_Info(s, "detected %s bandwidth (%"PRIu64") stream",
-                     (bw >= hls->bandwidth) ? "faster" : "lower", bw);
-            *cur_stream = newstream;
+            msg_Warn(s,"downloading of segment %d takes %ds, which is longer then its playback (%ds)",
+                        segment->sequence, estimated, segment->duration);
         }
     }
-    return VLC_SUCCESS;
+
+    block_t *data = AccessDownload(s, segment);
+    if (data == NULL)
+        return NULL;
+
+    msg_Info(s, "downloaded segment %d from stream (bandwidth=%"PRIu64")",
+                segment->sequence, hls->bandwidth);
+    return data;
 }
 
-static void* hls_Thread(vlc_object_t *p_this)
+/* Downloader: several of them fetch the segments ahead of playback in
+ * parallel, within HLS_WINDOW segments and the cache size. */
+static void* hls_Prefetch(void *data)
 {
-    stream_t *s = (stream_t *)p_this;
+    stream_t *s = (stream_t *)data;
     stream_sys_t *p_sys = s->p_sys;
 
     int canc = vlc_savecancel();
 
-    while (vlc_object_alive(s))
+    vlc_mutex_lock(&p_sys->download.lock_wait);
+    while (vlc_object_alive(s) && !p_sys->b_error)
     {
+        if (p_sys->download.seek >= 0)
+        {
+            p_sys->download.segment = p_sys->download.seek;
+            p_sys->download.seek = -1;
+        }
+
+        BandwidthChoose(s);
         hls_stream_t *hls = hls_Get(p_sys->hls_stream, p_sys->download.stream);
         assert(hls);
 
-        /* Sliding window (~60 seconds worth of movie) */
+        int wanted = p_sys->download.segment;
         vlc_mutex_lock(&hls->lock);
-        int count = vlc_array_count(hls->segments);
+        segment_t *segment = segment_GetSegment(hls, wanted);
         vlc_mutex_unlock(&hls->lock);
 
-        /* Is there a new segment to process? */
-        if ((!p_sys->b_live && (p_sys->playback.segment < (count - 6))) ||
-            (p_sys->download.segment >= count))
+        /* Wait for new segments in the playlist or for playback */
+        if ((segment == NULL) ||
+            (wanted - p_sys->playback.segment >= HLS_WINDOW))
         {
-            /* wait */
-            vlc_mutex_lock(&p_sys->download.lock_wait);
-            while (((p_sys->download.segment - p_sys->playback.segment > 6) ||
-                    (p_sys->download.segment >= count)) &&
-                   (p_sys->download.seek == -1))
-            {
-                if (p_sys->b_live && (mdate() >= p_sys->playlist.wakeup))
-                    break;
-                vlc_cond_wait(&p_sys->download.wait, &p_sys->download.lock_wait);
-                if (!vlc_object_alive(s)) break;
-            }
-            /* */
-            if (p_sys->download.seek >= 0)
-            {
-                p_sys->download.segment = p_sys->download.seek;
-                p_sys->download.seek = -1;
-            }
-            vlc_mutex_unlock(&p_sys->download.lock_wait);
+            vlc_cond_wait(&p_sys->download.wait, &p_sys->download.lock_wait);
+            continue;
         }
 
-        if (!vlc_object_alive(s)) break;
+        /* Already there, in any bitrate? */
+        int stream;
+        bool pending;
+        if ((segment_Ready(s, p_sys->download.stream, wanted,
+                           &stream, &pending) != NULL) || pending)
+        {
+            p_sys->download.segment++;
+            continue;
+        }
 
-        /* reload the m3u8 index file */
-        if (p_sys->b_live)
+        /* Wait for room in the cache, accounting for the estimated size
+         * until the real one is known */
+        uint64_t size = segment->duration * (hls->bandwidth / 8);
+        if (!cache_Reserve(s, size))
         {
-            double wait = 1;
-            mtime_t now = mdate();
-            if (now >= p_sys->playlist.wakeup)
-            {
-                if (hls_ReloadPlaylist(s) != VLC_SUCCESS)
-                {
-                    /* No change in playlist, then backoff */
-                    p_sys->playlist.tries++;
-                    if (p_sys->playlist.tries == 1) wait = 0.5;
-                    else if (p_sys->playlist.tries == 2) wait = 1;
-                    else if (p_sys->playlist.tries >= 3) wait = 3;
-                }
-                else p_sys->playlist.tries = 0;
+            vlc_cond_wait(&p_sys->download.wait, &p_sys->download.lock_wait);
+            continue;
+        }
 
-                /* determine next time to update playlist */
-                p_sys->playlist.last = now;
-                p_sys->playlist.wakeup = now + ((mtime_t)(hls->duration * wait)
-                                                * (mtime_t)1000000);
-            }
+        p_sys->cache.size += size;
+        p_sys->download.segment++;
+        p_sys->download.active++;
+        segment->busy = true;
+        vlc_mutex_unlock(&p_sys->download.lock_wait);
 
-            if (!vlc_object_alive(s)) break;
+        block_t *block = Download(s, hls, segment);
+
+        vlc_mutex_lock(&p_sys->download.lock_wait);
+        segment->busy = false;
+        p_sys->download.active--;
+        p_sys->cache.size -= size;
+        if (block != NULL)
+            segment_Store(p_sys, segment, block);
+        else if (!p_sys->b_live && vlc_object_alive(s))
+        {
+            msg_Err(s, "downloading segment %d failed", segment->sequence);
+            p_sys->b_error = true;
         }
+        vlc_cond_broadcast(&p_sys->download.wait);
+    }
+    vlc_cond_broadcast(&p_sys->download.wait);
+    vlc_mutex_unlock(&p_sys->download.lock_wait);
 
-        vlc_mutex_lock(&hls->lock);
-        segment_t *segment = segment_GetSegment(hls, p_sys->download.segment);
-        vlc_mutex_unlock(&hls->lock);
+    vlc_restorecancel(canc);
+    return NULL;
+}
 
-        if ((segment != NULL) &&
-            (Download(s, hls, segment, &p_sys->download.stream) != VLC_SUCCESS))
-        {
-            if (!vlc_object_alive(s)) break;
+/* Playlist reloading for live streams */
+static void* hls_Thread(vlc_object_t *p_this)
+{
+    stream_t *s = (stream_t *)p_this;
+    stream_sys_t *p_sys = s->p_sys;
 
-            if (!p_sys->b_live)
-            {
-                p_sys->b_error = true;
-                break;
-            }
-        }
+    int canc = vlc_savecancel();
 
-        /* download succeeded */
-        /* determine next segment to download */
+    while (vlc_object_alive(s))
+    {
         vlc_mutex_lock(&p_sys->download.lock_wait);
-        if (p_sys->download.seek >= 0)
+        while (vlc_object_alive(s) && (mdate() < p_sys->playlist.wakeup))
+            vlc_cond_timedwait(&p_sys->download.wait,
+                               &p_sys->download.lock_wait,
+                               p_sys->playlist.wakeup);
+        hls_stream_t *hls = hls_Get(p_sys->hls_stream, p_sys->download.stream);
+        vlc_mutex_unlock(&p_sys->download.lock_wait);
+        assert(hls);
+
+        if (!vlc_object_alive(s)) break;
+
+        /* reload the m3u8 index file */
+        double wait = 1;
+        mtime_t now = mdate();
+        if (hls_ReloadPlaylist(s) != VLC_SUCCESS)
         {
-            p_sys->download.segment = p_sys->download.seek;
-            p_sys->download.seek = -1;
+            /* No change in playlist, then backoff */
+            p_sys->playlist.tries++;
+            if (p_sys->playlist.tries == 1) wait = 0.5;
+            else if (p_sys->playlist.tries == 2) wait = 1;
+            else if (p_sys->playlist.tries >= 3) wait = 3;
         }
-        else if (p_sys->download.segment < count)
-            p_sys->download.segment++;
-        vlc_cond_signal(&p_sys->download.wait);
+        else p_sys->playlist.tries = 0;
+
+        /* determine next time to update playlist */
+        p_sys->playlist.last = now;
+        p_sys->playlist.wakeup = now + ((mtime_t)(hls->duration * wait)
+                                        * (mtime_t)1000000);
+
+        /* wake up the downloaders */
+        vlc_mutex_lock(&p_sys->download.lock_wait);
+        vlc_cond_broadcast(&p_sys->download.wait);
         vlc_mutex_unlock(&p_sys->download.lock_wait);
     }
 
@@ -1293,16 +1546,13 @@ static void* hls_Thread(vlc_object_t *p_this)
     return NULL;
 }
 
-static int Prefetch(stream_t *s, int *current)
+/* Downloads the first segment, which also gives a first bandwidth estimate
+ * to pick the bitrate of the next segments. */
+static int Prefetch(stream_t *s)
 {
     stream_sys_t *p_sys = s->p_sys;
-    int stream;
 
-    /* Try to pick best matching stream */
-again:
-    stream = *current;
-
-    hls_stream_t *hls = hls_Get(p_sys->hls_stream, *current);
+    hls_stream_t *hls = hls_Get(p_sys->hls_stream, p_sys->download.stream);
     if (hls == NULL)
         return VLC_EGENERIC;
 
@@ -1310,42 +1560,15 @@ again:
     if (segment == NULL )
         return VLC_EGENERIC;
 
-    if (Download(s, hls, segment, current) != VLC_SUCCESS)
+    block_t *data = Download(s, hls, segment);
+    if (data == NULL)
         return VLC_EGENERIC;
 
-    /* Found better bandwidth match, try again */
-    if (*current != stream)
-        goto again;
-
-    /* Download first 2 segments of this HLS stream */
-    stream = *current;
-    for (int i = 0; i < 2; i++)
-    {
-        segment_t *segment = segment_GetSegment(hls, p_sys->download.segment);
-        if (segment == NULL )
-            return VLC_EGENERIC;
-
-        if (segment->data)
-        {
-            p_sys->download.segment++;
-            continue;
-        }
-
-        if (Download(s, hls, segment, current) != VLC_SUCCESS)
-            return VLC_EGENERIC;
-
-        p_sys->download.segment++;
-
-        /* adapt bandwidth? */
-        if (*current != stream)
-        {
-            hls_stream_t *hls = hls_Get(p_sys->hls_stream, *current);
-            if (hls == NULL)
-                return VLC_EGENERIC;
-
-             stream = *current;
-        }
-    }
+    vlc_mutex_lock(&p_sys->download.lock_wait);
+    segment_Store(p_sys, segment, data);
+    p_sys->download.segment++;
+    BandwidthChoose(s);
+    vlc_mutex_unlock(&p_sys->download.lock_wait);
 
     return VLC_SUCCESS;
 }
@@ -1353,25 +1576,29 @@ again:
 /****************************************************************************
  * Access
  ****************************************************************************/
-static int AccessOpen(stream_t *s, vlc_url_t *url)
+static access_t *AccessOpen(stream_t *s, vlc_url_t *url)
 {
-    stream_sys_t *p_sys = (stream_sys_t *) s->p_sys;
+    access_t *p_access;
+    char psz_port[12] = "";
 
     if ((url->psz_protocol == NULL) ||
         (url->psz_path == NULL))
-        return VLC_EGENERIC;
+        return NULL;
 
-    p_sys->p_access = vlc_object_create(s, sizeof(access_t));
-    if (p_sys->p_access == NULL)
-        return VLC_ENOMEM;
+    p_access = vlc_object_create(s, sizeof(access_t));
+    if (p_access == NULL)
+        return NULL;
+
+    if (url->i_port > 0)
+        snprintf(psz_port, sizeof(psz_port), ":%d", url->i_port);
 
-    p_sys->p_access->psz_access = strdup(url->psz_protocol);
-    p_sys->p_access->psz_filepath = strdup(url->psz_path);
+    p_access->psz_access = strdup(url->psz_protocol);
+    p_access->psz_filepath = strdup(url->psz_path);
     if (url->psz_password || url->psz_username)
     {
-        if (asprintf(&p_sys->p_access->psz_location, "%s:%s@%s%s",
+        if (asprintf(&p_access->psz_location, "%s:%s@%s%s%s",
                      url->psz_username, url->psz_password,
-                     url->psz_host, url->psz_path) < 0)
+                     url->psz_host, psz_port, url->psz_path) < 0)
         {
             msg_Err(s, "creating http access module");
             goto fail;
@@ -1379,45 +1606,37 @@ static int AccessOpen(stream_t *s, vlc_url_t *url)
     }
     else
     {
-        if (asprintf(&p_sys->p_access->psz_location, "%s%s",
-                     url->psz_host, url->psz_path) < 0)
+        if (asprintf(&p_access->psz_location, "%s%s%s",
+                     url->psz_host, psz_port, url->psz_path) < 0)
         {
             msg_Err(s, "creating http access module");
             goto fail;
         }
     }
-    vlc_object_attach(p_sys->p_access, s);
-    p_sys->p_access->p_module =
-        module_need(p_sys->p_access, "access", "http", true);
-    if (p_sys->p_access->p_module == NULL)
+    vlc_object_attach(p_access, s);
+    p_access->p_module =
+        module_need(p_access, "access", "http", true);
+    if (p_access->p_module == NULL)
     {
         msg_Err(s, "could not load http access module");
         goto fail;
     }
 
-    return VLC_SUCCESS;
+    return p_access;
 
 fail:
-    vlc_object_release(p_sys->p_access);
-    p_sys->p_access = NULL;
-    return VLC_EGENERIC;
+    vlc_object_release(p_access);
+    return NULL;
 }
 
-static void AccessClose(stream_t *s)
+static void AccessClose(access_t *p_access)
 {
-    stream_sys_t *p_sys = (stream_sys_t *) s->p_sys;
-
-    if (p_sys->p_access)
-    {
-        vlc_object_kill(p_sys->p_access);
-        free(p_sys->p_access->psz_access);
-        if (p_sys->p_access->p_module)
-            module_unneed(p_sys->p_access,
-                          p_sys->p_access->p_module);
+    vlc_object_kill(p_access);
+    free(p_access->psz_access);
+    if (p_access->p_module)
+        module_unneed(p_access, p_access->p_module);
 
-        vlc_object_release(p_sys->p_access);
-        p_sys->p_access = NULL;
-    }
+    vlc_object_release(p_access);
 }
 
 static char *AccessReadLine(access_t *p_access, uint8_t *psz_tmp, size_t i_len)
@@ -1458,52 +1677,78 @@ static char *AccessReadLine(access_t *p_access, uint8_t *psz_tmp, size_t i_len)
     return line;
 }
 
-static int AccessDownload(stream_t *s, segment_t *segment)
+static block_t *AccessDownload(stream_t *s, segment_t *segment)
 {
-    stream_sys_t *p_sys = (stream_sys_t *) s->p_sys;
-
     assert(segment);
 
+    /* the request round trip counts in the first bandwidth sample */
+    mtime_t last = mdate();
+
     /* Download new playlist file from server */
-    if (AccessOpen(s, &segment->url) != VLC_SUCCESS)
-        return VLC_EGENERIC;
+    access_t *p_access = AccessOpen(s, &segment->url);
+    if (p_access == NULL)
+        return NULL;
 
-    segment->size = p_sys->p_access->info.i_size;
-    assert(segment->size > 0);
+    uint64_t size = p_access->info.i_size;
+    if (size == 0)
+    {
+        msg_Err(s, "segment %d has no size", segment->sequence);
+        AccessClose(p_access);
+        return NULL;
+    }
 
-    segment->data = block_Alloc(segment->size);
-    if (segment->data == NULL)
+    block_t *data = block_Alloc(size);
+    if (data == NULL)
     {
-        AccessClose(s);
-        return VLC_ENOMEM;
+        AccessClose(p_access);
+        return NULL;
     }
 
-    assert(segment->data->i_buffer == segment->size);
+    assert(data->i_buffer == size);
 
-    ssize_t length = 0, curlen = 0;
-    do
+    uint64_t curlen = 0, sample = 0;
+    while ((curlen < size) && vlc_object_alive(s))
     {
-        if (p_sys->p_access->info.i_size > segment->size)
+        if (p_access->info.i_size > size)
         {
-            msg_Dbg(s, "size changed %"PRIu64, segment->size);
-            segment->data = block_Realloc(segment->data, 0, p_sys->p_access->info.i_size);
-            if (segment->data == NULL)
+            msg_Dbg(s, "size changed %"PRIu64, size);
+            data = block_Realloc(data, 0, p_access->info.i_size);
+            if (data == NULL)
             {
-                AccessClose(s);
-                return VLC_ENOMEM;
+                AccessClose(p_access);
+                return NULL;
             }
-            segment->size = p_sys->p_access->info.i_size;
-            assert(segment->data->i_buffer == segment->size);
+            size = p_access->info.i_size;
+            assert(data->i_buffer == size);
         }
-        length = p_sys->p_access->pf_read(p_sys->p_access,
-                    segment->data->p_buffer + curlen, segment->size - curlen);
-        if ((length <= 0) || ((uint64_t)length >= segment->size))
+        ssize_t length = p_access->pf_read(p_access,
+                    data->p_buffer + curlen, size - curlen);
+        if (length <= 0)
             break;
         curlen += length;
-    } while (vlc_object_alive(s));
+        sample += length;
 
-    AccessClose(s);
-    return VLC_SUCCESS;
+        /* Update the estimate while downloading, so that a slow server is
+         * noticed before the end of the segment */
+        mtime_t now = mdate();
+        if ((now - last >= HLS_BW_PERIOD) || (curlen >= size))
+        {
+            BandwidthSample(s, sample, now - last);
+            sample = 0;
+            last = now;
+        }
+    }
+
+    AccessClose(p_access);
+
+    if (curlen < size)
+    {
+        msg_Err(s, "segment %d truncated (%"PRIu64" of %"PRIu64" bytes)",
+                segment->sequence, curlen, size);
+        block_Release(data);
+        return NULL;
+    }
+    return data;
 }
 
 /****************************************************************************
@@ -1533,10 +1778,12 @@ static int Open(vlc_object_t *p_this)
     vlc_UrlParse(&p_sys->m3u8, psz_uri, 0);
     free(psz_uri);
 
-    p_sys->bandwidth = -1;
+    p_sys->bandwidth = 0;
     p_sys->b_live = true;
     p_sys->b_meta = false;
     p_sys->b_error = false;
+    p_sys->stats.open = mdate();
+    p_sys->cache.max = var_InheritInteger(s, "hls-cache") * INT64_C(1024);
 
     p_sys->hls_stream = vlc_array_new();
     if (p_sys->hls_stream == NULL)
@@ -1545,6 +1792,10 @@ static int Open(vlc_object_t *p_this)
         return VLC_ENOMEM;
     }
 
+    p_sys->download.seek = -1;
+    vlc_mutex_init(&p_sys->download.lock_wait);
+    vlc_cond_init(&p_sys->download.wait);
+
     /* */
     s->pf_read = Read;
     s->pf_peek = Peek;
@@ -1557,11 +1808,11 @@ static int Open(vlc_object_t *p_this)
     }
 
     /* Choose first HLS stream to start with */
-    int current = p_sys->playback.stream = 0;
+    int current = p_sys->playback.stream = p_sys->download.stream = 0;
     p_sys->playback.segment = p_sys->download.segment =
             p_sys->b_live ? live_ChooseSegment(s, current) : 0;
 
-    if (Prefetch(s, &current) != VLC_SUCCESS)
+    if (Prefetch(s) != VLC_SUCCESS)
     {
         msg_Err(s, "fetching first segment.");
         goto fail;
@@ -1574,20 +1825,29 @@ static int Open(vlc_object_t *p_this)
         p_sys->playlist.last = mdate();
         p_sys->playlist.wakeup = p_sys->playlist.last +
                 ((mtime_t)hls->duration * UINT64_C(1000000));
-    }
 
-    p_sys->download.stream = current;
-    p_sys->playback.stream = current;
-    p_sys->download.seek = -1;
+        if (vlc_thread_create(s, "HTTP Live Streaming client",
+                              hls_Thread, VLC_THREAD_PRIORITY_INPUT))
+        {
+            goto fail;
+        }
+        p_sys->b_thread = true;
+    }
 
-    vlc_mutex_init(&p_sys->download.lock_wait);
-    vlc_cond_init(&p_sys->download.wait);
+    int prefetch = var_InheritInteger(s, "hls-prefetch");
+    p_sys->download.threads = malloc(prefetch * sizeof(vlc_thread_t));
+    if (p_sys->download.threads == NULL)
+        goto fail;
 
-    if (vlc_thread_create(s, "HTTP Live Streaming client",
-                          hls_Thread, VLC_THREAD_PRIORITY_INPUT))
+    for (int i = 0; i < prefetch; i++)
     {
-        goto fail;
+        if (vlc_clone(&p_sys->download.threads[i], hls_Prefetch, s,
+                      VLC_THREAD_PRIORITY_INPUT))
+            break;
+        p_sys->download.count++;
     }
+    if (p_sys->download.count == 0)
+        goto fail;
 
     return VLC_SUCCESS;
 
@@ -1607,15 +1867,24 @@ static void Close(vlc_object_t *p_this)
     assert(p_sys->hls_stream);
 
     /* */
+    vlc_object_kill(s);
     vlc_mutex_lock(&p_sys->download.lock_wait);
-    vlc_cond_signal(&p_sys->download.wait);
+    vlc_cond_broadcast(&p_sys->download.wait);
     vlc_mutex_unlock(&p_sys->download.lock_wait);
 
     /* */
-    vlc_thread_join(s);
+    for (int i = 0; i < p_sys->download.count; i++)
+        vlc_join(p_sys->download.threads[i], NULL);
+    free(p_sys->download.threads);
+    if (p_sys->b_thread)
+        vlc_thread_join(s);
     vlc_mutex_destroy(&p_sys->download.lock_wait);
     vlc_cond_destroy(&p_sys->download.wait);
 
+    msg_Dbg(s, "startup %"PRId64" ms, waited %d time(s) for %"PRId64" ms",
+            p_sys->stats.startup / 1000, p_sys->stats.waits,
+            p_sys->stats.stalled / 1000);
+
     /* Free hls streams */
     for (int i = 0; i < vlc_array_count(p_sys->hls_stream); i++)
     {
@@ -1633,89 +1902,71 @@ static void Close(vlc_object_t *p_this)
 /****************************************************************************
  * Stream filters functions
  ****************************************************************************/
+/* Returns the segment to play, waiting for its download if needed. The
+ * downloaders may have switched to another bitrate. */
 static segment_t *GetSegment(stream_t *s)
 {
     stream_sys_t *p_sys = s->p_sys;
     segment_t *segment = NULL;
+    mtime_t stalled = 0;
 
-    /* Is this segment of the current HLS stream ready? */
-    hls_stream_t *hls = hls_Get(p_sys->hls_stream, p_sys->playback.stream);
-    if (hls != NULL)
+    vlc_mutex_lock(&p_sys->download.lock_wait);
+    while (vlc_object_alive(s))
     {
-        vlc_mutex_lock(&hls->lock);
-        segment = segment_GetSegment(hls, p_sys->playback.segment);
+        int wanted = p_sys->playback.segment;
+        int stream;
+        bool pending;
+
+        segment = segment_Ready(s, p_sys->playback.stream, wanted,
+                                &stream, &pending);
         if (segment != NULL)
         {
-            /* This segment is ready? */
-            if (segment->data != NULL)
-            {
-                p_sys->b_cache = hls->b_cache;
-                vlc_mutex_unlock(&hls->lock);
-                goto check;
-            }
+            hls_stream_t *hls = hls_Get(p_sys->hls_stream, stream);
+            p_sys->playback.stream = stream;
+            p_sys->b_cache = hls->b_cache;
+            break;
         }
-        vlc_mutex_unlock(&hls->lock);
-    }
-
-    /* Was the HLS stream changed to another bitrate? */
-    int i_stream = 0;
-    segment = NULL;
-    while(vlc_object_alive(s))
-    {
-        /* Is the next segment ready */
-        hls_stream_t *hls = hls_Get(p_sys->hls_stream, i_stream);
-        if (hls == NULL)
-            return NULL;
+        if (p_sys->b_error)
+            break;
 
+        hls_stream_t *hls = hls_Get(p_sys->hls_stream, p_sys->download.stream);
         vlc_mutex_lock(&hls->lock);
-        segment = segment_GetSegment(hls, p_sys->playback.segment);
-        if (segment == NULL)
+        int count = vlc_array_count(hls->segments);
+        vlc_mutex_unlock(&hls->lock);
+
+        if (!pending && (wanted < count) &&
+            (wanted < p_sys->download.segment) && (p_sys->download.seek < 0))
         {
-            vlc_mutex_unlock(&hls->lock);
-            break;
+            /* Neither downloaded nor being downloaded: it failed or was
+             * evicted */
+            if (p_sys->b_live)
+            {
+                msg_Warn(s, "skipping segment %d", wanted);
+                p_sys->playback.segment++;
+                continue;
+            }
+            p_sys->download.seek = wanted;
+            vlc_cond_broadcast(&p_sys->download.wait);
         }
+        else if (!pending && (wanted >= count) && !p_sys->b_live)
+            break; /* end of stream */
 
-        vlc_mutex_lock(&p_sys->download.lock_wait);
-        int i_segment = p_sys->download.segment;
-        vlc_mutex_unlock(&p_sys->download.lock_wait);
-
-        /* This segment is ready? */
-        if ((segment->data != NULL) &&
-            (p_sys->playback.segment < i_segment))
+        if (stalled == 0)
         {
-            p_sys->playback.stream = i_stream;
-            p_sys->b_cache = hls->b_cache;
-            vlc_mutex_unlock(&hls->lock);
-            goto check;
+            stalled = mdate();
+            if (p_sys->stats.startup > 0)
+                msg_Warn(s, "waiting for segment %d", wanted);
         }
-        vlc_mutex_unlock(&hls->lock);
-
-        if (!p_sys->b_meta)
-            break;
-
-        /* Was the stream changed to another bitrate? */
-        i_stream++;
-        if (i_stream >= vlc_array_count(p_sys->hls_stream))
-            break;
+        vlc_cond_wait(&p_sys->download.wait, &p_sys->download.lock_wait);
+        segment = NULL;
     }
-    /* */
-    return NULL;
 
-check:
-    /* sanity check */
-    if (segment->data->i_buffer == 0)
+    if ((stalled > 0) && (p_sys->stats.startup > 0))
     {
-        vlc_mutex_lock(&hls->lock);
-        int count = vlc_array_count(hls->segments);
-        vlc_mutex_unlock(&hls->lock);
-
-        if ((p_sys->download.segment - p_sys->playback.segment == 0) &&
-            ((count != p_sys->download.segment) || p_sys->b_live))
-            msg_Err(s, "playback will stall");
-        else if ((p_sys->download.segment - p_sys->playback.segment < 3) &&
-                 ((count != p_sys->download.segment) || p_sys->b_live))
-            msg_Warn(s, "playback in danger of stalling");
+        p_sys->stats.waits++;
+        p_sys->stats.stalled += mdate() - stalled;
     }
+    vlc_mutex_unlock(&p_sys->download.lock_wait);
     return segment;
 }
 
@@ -1734,28 +1985,26 @@ static ssize_t hls_Read(stream_t *s, uint8_t *p_read, unsigned int i_read)
             break;
 
         vlc_mutex_lock(&segment->lock);
+        if (segment->data == NULL)
+        {
+            /* evicted meanwhile */
+            vlc_mutex_unlock(&segment->lock);
+            continue;
+        }
+
         if (segment->data->i_buffer == 0)
         {
-            if (!p_sys->b_cache || p_sys->b_live)
-            {
-                block_Release(segment->data);
-                segment->data = NULL;
-            }
-            else
-            {   /* reset playback pointer to start of buffer */
-                uint64_t size = segment->size - segment->data->i_buffer;
-                if (size > 0)
-                {
-                    segment->data->i_buffer += size;
-                    segment->data->p_buffer -= size;
-                }
-            }
-            p_sys->playback.segment++;
             vlc_mutex_unlock(&segment->lock);
 
-            /* signal download thread */
+            /* keep the played segment in the cache if allowed, and signal
+             * the downloaders */
             vlc_mutex_lock(&p_sys->download.lock_wait);
-            vlc_cond_signal(&p_sys->download.wait);
+            if (!p_sys->b_cache || p_sys->b_live)
+                segment_Evict(p_sys, segment);
+            else
+                segment_Rewind(segment);
+            p_sys->playback.segment++;
+            vlc_cond_broadcast(&p_sys->download.wait);
             vlc_mutex_unlock(&p_sys->download.lock_wait);
             continue;
         }
@@ -1782,6 +2031,12 @@ static ssize_t hls_Read(stream_t *s, uint8_t *p_read, unsigned int i_read)
 
     } while ((i_read > 0) && vlc_object_alive(s));
 
+    if ((copied > 0) && (p_sys->stats.startup == 0))
+    {
+        p_sys->stats.startup = mdate() - p_sys->stats.open;
+        msg_Dbg(s, "playback started after %"PRId64" ms",
+                p_sys->stats.startup / 1000);
+    }
     return copied;
 }
 
@@ -1816,6 +2071,7 @@ static int Peek(stream_t *s, const uint8_t **pp_peek, unsigned int i_peek)
 {
     stream_sys_t *p_sys = s->p_sys;
     size_t curlen = 0;
+    int peek_segment = -1;
     segment_t *segment;
 
 again:
@@ -1824,13 +2080,26 @@ again:
     {
         msg_Err(s, "segment %d should have been available (stream %d)",
                 p_sys->playback.segment, p_sys->playback.stream);
+        if (peek_segment >= 0)
+        {
+            vlc_mutex_lock(&p_sys->download.lock_wait);
+            p_sys->playback.segment = peek_segment;
+            vlc_mutex_unlock(&p_sys->download.lock_wait);
+        }
         return 0; /* eof? */
     }
 
     vlc_mutex_lock(&segment->lock);
+    if (segment->data == NULL)
+    {
+        /* evicted meanwhile */
+        vlc_mutex_unlock(&segment->lock);
+        goto again;
+    }
 
     /* remember segment to peek */
-    int peek_segment = p_sys->playback.segment;
+    if (peek_segment < 0)
+        peek_segment = p_sys->playback.segment;
     do
     {
         if (i_peek < segment->data->i_buffer)
@@ -1840,16 +2109,20 @@ again:
         }
         else
         {
-            p_sys->playback.segment++;
             vlc_mutex_unlock(&segment->lock);
+            vlc_mutex_lock(&p_sys->download.lock_wait);
+            p_sys->playback.segment++;
+            vlc_mutex_unlock(&p_sys->download.lock_wait);
             goto again;
         }
     } while ((curlen < i_peek) && vlc_object_alive(s));
 
+    vlc_mutex_unlock(&segment->lock);
+
     /* restore segment to read */
+    vlc_mutex_lock(&p_sys->download.lock_wait);
     p_sys->playback.segment = peek_segment;
-
-    vlc_mutex_unlock(&segment->lock);
+    vlc_mutex_unlock(&p_sys->download.lock_wait);
 
     return curlen;
 }
@@ -1906,6 +2179,7 @@ static int segment_Seek(stream_t *s, uint64_t pos)
     vlc_mutex_lock(&hls->lock);
 
     bool b_found = false;
+    int wanted = -1;
     uint64_t length = 0;
     uint64_t size = hls->size;
     int count = vlc_array_count(hls->segments);
@@ -1927,7 +2201,7 @@ static int segment_Seek(stream_t *s, uint64_t pos)
         {
             if (count - n >= 3)
             {
-                p_sys->playback.segment = n;
+                wanted = n;
                 b_found = true;
                 break;
             }
@@ -1940,51 +2214,42 @@ static int segment_Seek(stream_t *s, uint64_t pos)
     /* */
     if (!b_found && (pos >= size))
     {
-        p_sys->playback.segment = count - 1;
+        wanted = count - 1;
         b_found = true;
     }
 
     /* */
     if (b_found)
     {
-        /* restore segment to start position */
-        segment_t *segment = segment_GetSegment(hls, p_sys->playback.segment);
+        /* restore segments left and seeked to to start position */
+        segment_t *segment = segment_GetSegment(hls, wanted);
+        segment_t *current = segment_GetSegment(hls, p_sys->playback.segment);
         if (segment == NULL)
         {
             vlc_mutex_unlock(&hls->lock);
             return VLC_EGENERIC;
         }
-
-        vlc_mutex_lock(&segment->lock);
-        if (segment->data)
-        {
-            uint64_t size = segment->size -segment->data->i_buffer;
-            if (size > 0)
-            {
-                segment->data->i_buffer += size;
-                segment->data->p_buffer -= size;
-            }
-        }
-        vlc_mutex_unlock(&segment->lock);
+        segment_Rewind(segment);
+        if (current != NULL)
+            segment_Rewind(current);
 
         /* start download at current playback segment */
         vlc_mutex_unlock(&hls->lock);
 
-        /* Wake up download thread */
+        /* Wake up download threads */
         vlc_mutex_lock(&p_sys->download.lock_wait);
-        p_sys->download.seek = p_sys->playback.segment;
-        vlc_cond_signal(&p_sys->download.wait);
-        vlc_mutex_unlock(&p_sys->download.lock_wait);
+        p_sys->playback.segment = wanted;
+        p_sys->download.seek = wanted;
+        vlc_cond_broadcast(&p_sys->download.wait);
 
         /* Wait for download to be finished */
-        vlc_mutex_lock(&p_sys->download.lock_wait);
         msg_Info(s, "seek to segment %d", p_sys->playback.segment);
         while (((p_sys->download.seek != -1) ||
                 (p_sys->download.segment - p_sys->playback.segment < 3)) &&
                 (p_sys->download.segment < (count - 6)))
         {
             vlc_cond_wait(&p_sys->download.wait, &p_sys->download.lock_wait);
-            if (!vlc_object_alive(s) || s->b_error) break;
+            if (!vlc_object_alive(s) || s->b_error || p_sys->b_error) break;
         }
         vlc_mutex_unlock(&p_sys->download.lock_wait);
 
@@ -143,6 +143,18 @@ static int Peek( stream_t *s, const uint8_t **pp_peek, unsigned int i_peek )
 
 static int Control( stream_t *s, int i_query, va_list args )
 {
+    if( i_query == STREAM_GET_PACKETS )
+    {
+        unsigned i_packet = va_arg( args, unsigned );
+        unsigned i_max = va_arg( args, unsigned );
+        block_t **pp_block = va_arg( args, block_t ** );
+
+        /* Dump read data */
+        *pp_block = stream_Packets( s->p_source, i_packet, i_max );
+        if( s->p_sys->f && *pp_block )
+            Write( s, (*pp_block)->p_buffer, (*pp_block)->i_buffer );
+        return VLC_SUCCESS;
+    }
     if( i_query != STREAM_SET_RECORD_STATE )
         return stream_vaControl( s->p_source, i_query, args );
 
@@ -206,6 +206,15 @@ static int Send( sout_stream_t *p_stream, sout_stream_id_t *id,
 
         if( id->p_dec && p_buffer->i_buffer > 0 )
         {
+            /* Decoders may write to their input (eg. after
+             * stream_out/duplicate). */
+            p_buffer = block_Writable( p_buffer );
+            if( p_buffer == NULL )
+            {
+                p_buffer = p_next;
+                continue;
+            }
+
             if( p_buffer->i_dts <= VLC_TS_INVALID )
                 p_buffer->i_dts = 0;
             else
@@ -532,6 +532,11 @@ static int Send( sout_stream_t *p_stream, sout_stream_id_t *id,
         return VLC_SUCCESS;
     }
 
+    /* Decoders may write to their input (eg. after stream_out/duplicate). */
+    p_buffer = block_Writable( p_buffer );
+    if( p_buffer == NULL )
+        return VLC_ENOMEM;
+
     while ( (p_pic = p_sys->p_decoder->pf_decode_video( p_sys->p_decoder,
                                                         &p_buffer )) )
     {
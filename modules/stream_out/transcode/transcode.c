@@ -125,7 +125,13 @@
 
 #define THREADS_TEXT N_("Number of threads")
 #define THREADS_LONGTEXT N_( \
-    "Number of threads used for the transcoding." )
+    "Number of threads used for the transcoding. From 1 on, the video is " \
+    "encoded in its own thread, and from 2 on, it is also filtered in its " \
+    "own thread." )
+#define PIPELINE_TEXT N_("Pipelined pictures")
+#define PIPELINE_LONGTEXT N_( \
+    "Number of pictures queued for each video thread. More pictures absorb " \
+    "the encoding time variations, at the expense of memory." )
 #define HP_TEXT N_("High priority")
 #define HP_LONGTEXT N_( \
     "Runs the optional encoder thread at the OUTPUT priority instead of " \
@@ -226,6 +232,8 @@ vlc_module_begin ()
     set_section( N_("Miscellaneous"), NULL )
     add_integer( SOUT_CFG_PREFIX "threads", 0, THREADS_TEXT,
                  THREADS_LONGTEXT, true )
+    add_integer_with_range( SOUT_CFG_PREFIX "pipeline", 4, 1, 64, NULL,
+                            PIPELINE_TEXT, PIPELINE_LONGTEXT, true )
     add_bool( SOUT_CFG_PREFIX "high-priority", false, HP_TEXT, HP_LONGTEXT,
               true )
 
@@ -234,7 +242,8 @@ vlc_module_end ()
 static const char *const ppsz_sout_options[] = {
     "venc", "vcodec", "vb",
     "scale", "fps", "width", "height", "vfilter", "deinterlace",
-    "deinterlace-module", "threads", "hurry-up", "aenc", "acodec", "ab", "alang",
+    "deinterlace-module", "threads", "pipeline", "hurry-up",
+    "aenc", "acodec", "ab", "alang",
     "afilter", "samplerate", "channels", "senc", "scodec", "soverlay",
     "sfilter", "osd", "audio-sync", "high-priority", "maxwidth", "maxheight",
     NULL
@@ -386,6 +395,8 @@ static int Open( vlc_object_t *p_this )
     free( psz_string );
 
     p_sys->i_threads = var_GetInteger( p_stream, SOUT_CFG_PREFIX "threads" );
+    p_sys->i_pipeline = __MAX( 1, var_GetInteger( p_stream,
+                                                  SOUT_CFG_PREFIX "pipeline" ) );
     p_sys->b_high_priority = var_GetBool( p_stream, SOUT_CFG_PREFIX "high-priority" );
 
     if( p_sys->i_vcodec )
@@ -657,6 +668,15 @@ static int Send( sout_stream_t *p_stream, sout_stream_id_t *id,
         return VLC_EGENERIC;
     }
 
+    /* Decoders may write to their input (eg. after stream_out/duplicate).
+     * Del() sends no block at all, to flush the video encoder. */
+    if( p_buffer != NULL )
+    {
+        p_buffer = block_Writable( p_buffer );
+        if( p_buffer == NULL )
+            return VLC_ENOMEM;
+    }
+
     switch( id->p_decoder->fmt_in.i_cat )
     {
     case AUDIO_ES:
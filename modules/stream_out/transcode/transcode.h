@@ -10,11 +10,21 @@
 #include <vlc_codec.h>
 
 
-#define PICTURE_RING_SIZE 64
 #define SUBPICTURE_RING_SIZE 20
 
 #define MASTER_SYNC_MAX_DRIFT 100000
 
+/* Pictures waiting for a video thread */
+typedef struct
+{
+    picture_t       **pp_pics;
+    int             i_size;
+    int             i_first;
+    int             i_count;
+    vlc_cond_t      wait_get;   /* signaled when a picture is queued */
+    vlc_cond_t      wait_put;   /* signaled when a picture is dequeued */
+} transcode_queue_t;
+
 struct sout_stream_sys_t
 {
     VLC_COMMON_MEMBERS
@@ -22,10 +32,14 @@ struct sout_stream_sys_t
     sout_stream_id_t *id_video;
     block_t         *p_buffers;
     vlc_mutex_t     lock_out;
-    vlc_cond_t      cond;
-    picture_t *     pp_pics[PICTURE_RING_SIZE];
-    int             i_first_pic, i_last_pic;
-    bool            b_error;
+    vlc_cond_t      cond_idle;
+    transcode_queue_t filter_queue;
+    transcode_queue_t encoder_queue;
+    vlc_thread_t    filter_thread;
+    vlc_thread_t    encoder_thread;
+    bool            b_filter_thread;
+    bool            b_abort;
+    int             i_busy;     /* pictures being filtered or encoded */
 
     /* Audio */
     vlc_fourcc_t    i_acodec;   /* codec audio (0 if not transcode) */
@@ -51,6 +65,7 @@ struct sout_stream_sys_t
     char            *psz_deinterlace;
     config_chain_t  *p_deinterlace_cfg;
     int             i_threads;
+    int             i_pipeline;
     bool            b_high_priority;
     bool            b_hurry_up;
 
@@ -33,13 +33,22 @@
 #include <vlc_meta.h>
 #include <vlc_spu.h>
 #include <vlc_modules.h>
+#include <vlc_picture_pool.h>
+
+#include <assert.h>
 
 #define ENC_FRAMERATE (25 * 1000 + .5)
 #define ENC_FRAMERATE_BASE 1000
 
+/* Number of pool requests after which an unused pool is freed */
+#define POOL_IDLE_DELAY 256
+
+typedef struct transcode_pool_t transcode_pool_t;
+
 struct decoder_owner_sys_t
 {
     sout_stream_sys_t *p_sys;
+    transcode_pool_t  *p_pool;
 };
 
 static inline void video_timer_start( encoder_t * p_encoder )
@@ -59,6 +68,257 @@ static inline void video_timer_close( encoder_t * p_encoder )
     stats_TimerClean( p_encoder, STATS_TIMER_VIDEO_FRAME_ENCODING );
 }
 
+/*****************************************************************************
+ * Picture pools
+ *****************************************************************************
+ * The decoder and the filters get their pictures from pools, one per format,
+ * instead of allocating them for each frame. When all the pictures of a
+ * format are in use, another pool as large as the previous ones together is
+ * added. Pictures may be released by the encoder thread, so the pools are
+ * protected by a lock, taken by the unlock callback of their pictures.
+ *****************************************************************************/
+typedef struct video_pool_t video_pool_t;
+
+struct video_pool_t
+{
+    video_pool_t      *p_next;
+    transcode_pool_t  *p_owner;
+    picture_pool_t    *p_pool;
+    video_format_t    fmt;
+    int               i_size;
+    int               i_used;   /* pictures not back in the pool */
+    unsigned          i_last;   /* last request served */
+};
+
+struct transcode_pool_t
+{
+    vlc_mutex_t       lock;
+    video_pool_t      *p_first;
+    int               i_size;   /* size of the first pool of a format */
+
+    unsigned          i_requests;
+    unsigned          i_hits;
+    unsigned          i_misses;
+};
+
+struct picture_sys_t
+{
+    video_pool_t      *p_pool;
+    bool              b_used;
+};
+
+/* Called by picture_pool_Get(), with the lock held */
+static int transcode_pool_lock( picture_t *p_pic )
+{
+    /* The reference count may already be 0 while the releasing thread has
+     * yet to call transcode_pool_unlock() */
+    if( p_pic->p_sys->b_used )
+        return VLC_EGENERIC;
+
+    p_pic->p_sys->b_used = true;
+    p_pic->p_sys->p_pool->i_used++;
+    return VLC_SUCCESS;
+}
+
+static void transcode_pool_unlock( picture_t *p_pic )
+{
+    video_pool_t *p_pool = p_pic->p_sys->p_pool;
+
+    vlc_mutex_lock( &p_pool->p_owner->lock );
+    assert( p_pic->p_sys->b_used );
+    p_pic->p_sys->b_used = false;
+    p_pool->i_used--;
+    vlc_mutex_unlock( &p_pool->p_owner->lock );
+}
+
+static bool transcode_pool_SameFormat( const video_format_t *a,
+                                       const video_format_t *b )
+{
+    return a->i_chroma == b->i_chroma &&
+           a->i_width == b->i_width && a->i_height == b->i_height &&
+           a->i_x_offset == b->i_x_offset && a->i_y_offset == b->i_y_offset &&
+           a->i_visible_width == b->i_visible_width &&
+           a->i_visible_height == b->i_visible_height &&
+           a->i_sar_num == b->i_sar_num && a->i_sar_den == b->i_sar_den;
+}
+
+static video_pool_t *video_pool_New( transcode_pool_t *p_owner,
+                                     const video_format_t *p_fmt, int i_size )
+{
+    video_pool_t *p_pool = malloc( sizeof( *p_pool ) );
+    picture_t *pp_pics[i_size];
+    int i;
+
+    if( !p_pool )
+        return NULL;
+
+    for( i = 0; i < i_size; i++ )
+    {
+        pp_pics[i] = picture_NewFromFormat( p_fmt );
+        if( !pp_pics[i] )
+            goto error;
+        pp_pics[i]->p_sys = malloc( sizeof( picture_sys_t ) );
+        if( !pp_pics[i]->p_sys )
+        {
+            i++;
+            goto error;
+        }
+        pp_pics[i]->p_sys->p_pool = p_pool;
+        pp_pics[i]->p_sys->b_used = false;
+    }
+
+    picture_pool_configuration_t cfg;
+    memset( &cfg, 0, sizeof( cfg ) );
+    cfg.picture_count = i_size;
+    cfg.picture       = pp_pics;
+    cfg.lock          = transcode_pool_lock;
+    cfg.unlock        = transcode_pool_unlock;
+
+    p_pool->p_pool = picture_pool_NewExtended( &cfg );
+    if( !p_pool->p_pool )
+        goto error;
+
+    p_pool->p_next  = NULL;
+    p_pool->p_owner = p_owner;
+    p_pool->fmt     = *p_fmt;
+    p_pool->i_size  = i_size;
+    p_pool->i_used  = 0;
+    p_pool->i_last  = p_owner->i_requests;
+    return p_pool;
+
+error:
+    while( i-- > 0 )
+        picture_Release( pp_pics[i] );
+    free( p_pool );
+    return NULL;
+}
+
+static void video_pool_Delete( video_pool_t *p_pool )
+{
+    assert( p_pool->i_used == 0 );
+    picture_pool_Delete( p_pool->p_pool );
+    free( p_pool );
+}
+
+static transcode_pool_t *transcode_pool_New( int i_size )
+{
+    transcode_pool_t *p_pool = malloc( sizeof( *p_pool ) );
+    if( !p_pool )
+        return NULL;
+
+    vlc_mutex_init( &p_pool->lock );
+    p_pool->p_first    = NULL;
+    p_pool->i_size     = i_size;
+    p_pool->i_requests = 0;
+    p_pool->i_hits     = 0;
+    p_pool->i_misses   = 0;
+    return p_pool;
+}
+
+static void transcode_pool_Delete( vlc_object_t *p_obj,
+                                   transcode_pool_t *p_pool )
+{
+    int i_pictures = 0;
+
+    while( p_pool->p_first )
+    {
+        video_pool_t *p_next = p_pool->p_first->p_next;
+
+        i_pictures += p_pool->p_first->i_size;
+        video_pool_Delete( p_pool->p_first );
+        p_pool->p_first = p_next;
+    }
+    msg_Dbg( p_obj, "picture pool: %u hits, %u misses, %d pictures left",
+             p_pool->i_hits, p_pool->i_misses, i_pictures );
+    vlc_mutex_destroy( &p_pool->lock );
+    free( p_pool );
+}
+
+/* Adds i_count pictures to the first pool of each format, including the
+ * formats already served */
+static void transcode_pool_Grow( transcode_pool_t *p_owner, int i_count )
+{
+    if( i_count <= 0 )
+        return;
+
+    vlc_mutex_lock( &p_owner->lock );
+    p_owner->i_size += i_count;
+
+    for( video_pool_t *p_pool = p_owner->p_first; p_pool;
+         p_pool = p_pool->p_next )
+    {
+        video_pool_t *p_prev = p_owner->p_first;
+        while( p_prev != p_pool &&
+               !transcode_pool_SameFormat( &p_prev->fmt, &p_pool->fmt ) )
+            p_prev = p_prev->p_next;
+        if( p_prev != p_pool )
+            continue; /* this format was already grown */
+
+        video_pool_t *p_new = video_pool_New( p_owner, &p_pool->fmt, i_count );
+        if( !p_new )
+            break; /* transcode_pool_Get() will catch up on misses */
+        p_new->p_next = p_pool->p_next;
+        p_pool->p_next = p_new;
+        p_pool = p_new;
+    }
+    vlc_mutex_unlock( &p_owner->lock );
+}
+
+static picture_t *transcode_pool_Get( transcode_pool_t *p_owner,
+                                      const video_format_t *p_fmt )
+{
+    video_pool_t **pp_pool = &p_owner->p_first;
+    picture_t *p_pic = NULL;
+    int i_size = 0;
+
+    vlc_mutex_lock( &p_owner->lock );
+    p_owner->i_requests++;
+
+    while( *pp_pool )
+    {
+        video_pool_t *p_pool = *pp_pool;
+
+        if( transcode_pool_SameFormat( &p_pool->fmt, p_fmt ) )
+        {
+            p_pic = picture_pool_Get( p_pool->p_pool );
+            if( p_pic )
+            {
+                p_pool->i_last = p_owner->i_requests;
+                p_owner->i_hits++;
+                break;
+            }
+            i_size += p_pool->i_size;
+        }
+        else if( p_pool->i_used == 0 &&
+                 p_owner->i_requests - p_pool->i_last > POOL_IDLE_DELAY )
+        {
+            /* Left over by a format change */
+            *pp_pool = p_pool->p_next;
+            video_pool_Delete( p_pool );
+            continue;
+        }
+        pp_pool = &p_pool->p_next;
+    }
+
+    if( !p_pic )
+    {
+        /* All the pictures of this format are in use: double them */
+        p_owner->i_misses++;
+        *pp_pool = video_pool_New( p_owner, p_fmt,
+                                   i_size > 0 ? i_size : p_owner->i_size );
+        if( *pp_pool )
+        {
+            p_pic = picture_pool_Get( (*pp_pool)->p_pool );
+            (*pp_pool)->i_last = p_owner->i_requests;
+        }
+    }
+    vlc_mutex_unlock( &p_owner->lock );
+
+    if( p_pic )
+        picture_Reset( p_pic );
+    return p_pic;
+}
+
 static void video_del_buffer_decoder( decoder_t *p_decoder, picture_t *p_pic )
 {
     VLC_UNUSED(p_decoder);
@@ -79,31 +339,16 @@ static void video_unlink_picture_decoder( decoder_t *p_dec, picture_t *p_pic )
 
 static picture_t *video_new_buffer_decoder( decoder_t *p_dec )
 {
-    sout_stream_sys_t *p_ssys = p_dec->p_owner->p_sys;
-    if( p_ssys->i_threads >= 1 )
-    {
-        int i_first_pic = p_ssys->i_first_pic;
-
-        if( p_ssys->i_first_pic != p_ssys->i_last_pic )
-        {
-            /* Encoder still has stuff to encode, wait to clear-up the list */
-            while( p_ssys->i_first_pic == i_first_pic )
-            {
-#warning THERE IS DEFINITELY A BUG! LOCKING IS INSUFFICIENT!
-                msleep( 10000 );
-                barrier ();
-            }
-        }
-    }
-
     p_dec->fmt_out.video.i_chroma = p_dec->fmt_out.i_codec;
-    return picture_NewFromFormat( &p_dec->fmt_out.video );
+    return transcode_pool_Get( p_dec->p_owner->p_pool,
+                               &p_dec->fmt_out.video );
 }
 
 static picture_t *transcode_video_filter_buffer_new( filter_t *p_filter )
 {
     p_filter->fmt_out.video.i_chroma = p_filter->fmt_out.i_codec;
-    return picture_NewFromFormat( &p_filter->fmt_out.video );
+    return transcode_pool_Get( (transcode_pool_t *)p_filter->p_owner,
+                               &p_filter->fmt_out.video );
 }
 static void transcode_video_filter_buffer_del( filter_t *p_filter, picture_t *p_pic )
 {
@@ -114,7 +359,7 @@ static void transcode_video_filter_buffer_del( filter_t *p_filter, picture_t *p_
 static int transcode_video_filter_allocation_init( filter_t *p_filter,
                                                    void *p_data )
 {
-    VLC_UNUSED(p_data);
+    p_filter->p_owner = (filter_owner_sys_t *)p_data;
     p_filter->pf_video_buffer_new = transcode_video_filter_buffer_new;
     p_filter->pf_video_buffer_del = transcode_video_filter_buffer_del;
     return VLC_SUCCESS;
@@ -122,57 +367,219 @@ static int transcode_video_filter_allocation_init( filter_t *p_filter,
 
 static void transcode_video_filter_allocation_clear( filter_t *p_filter )
 {
-    VLC_UNUSED(p_filter);
+    p_filter->p_owner = NULL;
+}
+
+/*****************************************************************************
+ * Pipeline
+ *****************************************************************************
+ * With threads, the decoded pictures go through bounded queues to the filter
+ * thread, if any, and to the encoder thread. A stage waits while the queue
+ * to the next one is full. All the queues and p_buffers are protected by
+ * lock_out.
+ *****************************************************************************/
+static void transcode_video_filter_picture( sout_stream_t *, sout_stream_id_t *,
+                                            picture_t *, block_t ** );
+
+static int transcode_queue_Init( transcode_queue_t *p_queue, int i_size )
+{
+    p_queue->pp_pics = malloc( i_size * sizeof( *p_queue->pp_pics ) );
+    if( !p_queue->pp_pics )
+        return VLC_ENOMEM;
+
+    p_queue->i_size  = i_size;
+    p_queue->i_first = 0;
+    p_queue->i_count = 0;
+    vlc_cond_init( &p_queue->wait_get );
+    vlc_cond_init( &p_queue->wait_put );
+    return VLC_SUCCESS;
+}
+
+static void transcode_queue_Clean( transcode_queue_t *p_queue )
+{
+    for( ; p_queue->i_count > 0; p_queue->i_count-- )
+    {
+        picture_Release( p_queue->pp_pics[p_queue->i_first] );
+        p_queue->i_first = ( p_queue->i_first + 1 ) % p_queue->i_size;
+    }
+    vlc_cond_destroy( &p_queue->wait_get );
+    vlc_cond_destroy( &p_queue->wait_put );
+    free( p_queue->pp_pics );
+}
+
+/* Waits for room in the queue; the picture is dropped if the pipeline is
+ * stopped meanwhile */
+static void transcode_queue_Put( sout_stream_sys_t *p_sys,
+                                 transcode_queue_t *p_queue, picture_t *p_pic )
+{
+    vlc_mutex_lock( &p_sys->lock_out );
+    while( p_queue->i_count >= p_queue->i_size && !p_sys->b_abort )
+        vlc_cond_wait( &p_queue->wait_put, &p_sys->lock_out );
+
+    if( !p_sys->b_abort )
+    {
+        p_queue->pp_pics[( p_queue->i_first + p_queue->i_count++ )
+                         % p_queue->i_size] = p_pic;
+        vlc_cond_signal( &p_queue->wait_get );
+        p_pic = NULL;
+    }
+    vlc_mutex_unlock( &p_sys->lock_out );
+
+    if( p_pic )
+        picture_Release( p_pic );
+}
+
+/* Waits for a picture, until the pipeline is stopped. Called with lock_out
+ * held; transcode_queue_Done() must be called once the picture is handled. */
+static picture_t *transcode_queue_Get( sout_stream_sys_t *p_sys,
+                                       transcode_queue_t *p_queue )
+{
+    while( p_queue->i_count == 0 && !p_sys->b_abort )
+        vlc_cond_wait( &p_queue->wait_get, &p_sys->lock_out );
+    if( p_sys->b_abort )
+        return NULL;
+
+    picture_t *p_pic = p_queue->pp_pics[p_queue->i_first];
+    p_queue->i_first = ( p_queue->i_first + 1 ) % p_queue->i_size;
+    p_queue->i_count--;
+    p_sys->i_busy++;
+    vlc_cond_signal( &p_queue->wait_put );
+    return p_pic;
+}
+
+/* Called with lock_out held */
+static void transcode_queue_Done( sout_stream_sys_t *p_sys )
+{
+    if( --p_sys->i_busy == 0 )
+        vlc_cond_signal( &p_sys->cond_idle );
+}
+
+static bool transcode_video_pipeline_idle( sout_stream_sys_t *p_sys )
+{
+    return p_sys->i_busy == 0 && p_sys->encoder_queue.i_count == 0 &&
+           ( !p_sys->b_filter_thread || p_sys->filter_queue.i_count == 0 );
+}
+
+static void* FilterThread( void *data )
+{
+    sout_stream_t *p_stream = data;
+    sout_stream_sys_t *p_sys = p_stream->p_sys;
+    picture_t *p_pic;
+    int canc = vlc_savecancel ();
+
+    vlc_mutex_lock( &p_sys->lock_out );
+    while( (p_pic = transcode_queue_Get( p_sys, &p_sys->filter_queue )) )
+    {
+        vlc_mutex_unlock( &p_sys->lock_out );
+        transcode_video_filter_picture( p_stream, p_sys->id_video, p_pic,
+                                        NULL );
+        vlc_mutex_lock( &p_sys->lock_out );
+        transcode_queue_Done( p_sys );
+    }
+    vlc_mutex_unlock( &p_sys->lock_out );
+
+    vlc_restorecancel (canc);
+    return NULL;
 }
 
-static void* EncoderThread( vlc_object_t* p_this )
+static void* EncoderThread( void *data )
 {
-    sout_stream_sys_t *p_sys = (sout_stream_sys_t*)p_this;
+    sout_stream_t *p_stream = data;
+    sout_stream_sys_t *p_sys = p_stream->p_sys;
     sout_stream_id_t *id = p_sys->id_video;
     picture_t *p_pic;
     int canc = vlc_savecancel ();
 
-    while( vlc_object_alive (p_sys) && !p_sys->b_error )
+    vlc_mutex_lock( &p_sys->lock_out );
+    while( (p_pic = transcode_queue_Get( p_sys, &p_sys->encoder_queue )) )
     {
         block_t *p_block;
 
-        vlc_mutex_lock( &p_sys->lock_out );
-        while( p_sys->i_last_pic == p_sys->i_first_pic )
-        {
-            vlc_cond_wait( &p_sys->cond, &p_sys->lock_out );
-            if( !vlc_object_alive (p_sys) || p_sys->b_error ) break;
-        }
-        if( !vlc_object_alive (p_sys) || p_sys->b_error )
-        {
-            vlc_mutex_unlock( &p_sys->lock_out );
-            break;
-        }
-
-        p_pic = p_sys->pp_pics[p_sys->i_first_pic++];
-        p_sys->i_first_pic %= PICTURE_RING_SIZE;
         vlc_mutex_unlock( &p_sys->lock_out );
-
         video_timer_start( id->p_encoder );
         p_block = id->p_encoder->pf_encode_video( id->p_encoder, p_pic );
         video_timer_stop( id->p_encoder );
+        picture_Release( p_pic );
 
         vlc_mutex_lock( &p_sys->lock_out );
         block_ChainAppend( &p_sys->p_buffers, p_block );
+        transcode_queue_Done( p_sys );
+    }
+    vlc_mutex_unlock( &p_sys->lock_out );
 
-        vlc_mutex_unlock( &p_sys->lock_out );
-        picture_Release( p_pic );
+    vlc_restorecancel (canc);
+    return NULL;
+}
+
+static int transcode_video_pipeline_start( sout_stream_t *p_stream )
+{
+    sout_stream_sys_t *p_sys = p_stream->p_sys;
+    int i_priority = p_sys->b_high_priority ? VLC_THREAD_PRIORITY_OUTPUT :
+                       VLC_THREAD_PRIORITY_VIDEO;
+
+    vlc_mutex_init( &p_sys->lock_out );
+    vlc_cond_init( &p_sys->cond_idle );
+    p_sys->p_buffers = NULL;
+    p_sys->i_busy = 0;
+    p_sys->b_abort = false;
+    p_sys->b_filter_thread = false;
+
+    if( transcode_queue_Init( &p_sys->encoder_queue, p_sys->i_pipeline ) )
+        goto error;
+    if( vlc_clone( &p_sys->encoder_thread, EncoderThread, p_stream,
+                   i_priority ) )
+    {
+        msg_Err( p_stream, "cannot spawn encoder thread" );
+        transcode_queue_Clean( &p_sys->encoder_queue );
+        goto error;
     }
 
-    while( p_sys->i_last_pic != p_sys->i_first_pic )
+    if( p_sys->i_threads >= 2 &&
+        !transcode_queue_Init( &p_sys->filter_queue, p_sys->i_pipeline ) )
     {
-        p_pic = p_sys->pp_pics[p_sys->i_first_pic++];
-        p_sys->i_first_pic %= PICTURE_RING_SIZE;
-        picture_Release( p_pic );
+        if( !vlc_clone( &p_sys->filter_thread, FilterThread, p_stream,
+                        VLC_THREAD_PRIORITY_VIDEO ) )
+            p_sys->b_filter_thread = true;
+        else
+        {
+            /* The decoder thread will run the filters */
+            msg_Warn( p_stream, "cannot spawn filter thread" );
+            transcode_queue_Clean( &p_sys->filter_queue );
+        }
     }
-    block_ChainRelease( p_sys->p_buffers );
+    return VLC_SUCCESS;
 
-    vlc_restorecancel (canc);
-    return NULL;
+error:
+    vlc_cond_destroy( &p_sys->cond_idle );
+    vlc_mutex_destroy( &p_sys->lock_out );
+    return VLC_EGENERIC;
+}
+
+static void transcode_video_pipeline_stop( sout_stream_t *p_stream )
+{
+    sout_stream_sys_t *p_sys = p_stream->p_sys;
+
+    vlc_mutex_lock( &p_sys->lock_out );
+    p_sys->b_abort = true;
+    vlc_cond_broadcast( &p_sys->encoder_queue.wait_get );
+    if( p_sys->b_filter_thread )
+    {
+        vlc_cond_broadcast( &p_sys->filter_queue.wait_get );
+        vlc_cond_broadcast( &p_sys->encoder_queue.wait_put );
+    }
+    vlc_mutex_unlock( &p_sys->lock_out );
+
+    if( p_sys->b_filter_thread )
+    {
+        vlc_join( p_sys->filter_thread, NULL );
+        transcode_queue_Clean( &p_sys->filter_queue );
+    }
+    vlc_join( p_sys->encoder_thread, NULL );
+    transcode_queue_Clean( &p_sys->encoder_queue );
+
+    block_ChainRelease( p_sys->p_buffers );
+    vlc_cond_destroy( &p_sys->cond_idle );
+    vlc_mutex_destroy( &p_sys->lock_out );
 }
 
 int transcode_video_new( sout_stream_t *p_stream, sout_stream_id_t *id )
@@ -199,12 +606,29 @@ int transcode_video_new( sout_stream_t *p_stream, sout_stream_id_t *id )
     id->p_decoder->p_owner->p_sys = p_sys;
     /* id->p_decoder->p_cfg = p_sys->p_video_cfg; */
 
+    /* The picture being decoded, and for each thread, its queue and the
+     * picture it works on. transcode_video_filter_init() grows the pool
+     * for the filters, once the first picture gave their formats. */
+    int i_pool = 1;
+    if( p_sys->i_threads >= 1 )
+        i_pool += p_sys->i_pipeline + 1;
+    if( p_sys->i_threads >= 2 )
+        i_pool += p_sys->i_pipeline + 1;
+    id->p_decoder->p_owner->p_pool = transcode_pool_New( i_pool );
+    if( !id->p_decoder->p_owner->p_pool )
+    {
+        free( id->p_decoder->p_owner );
+        return VLC_EGENERIC;
+    }
+
     id->p_decoder->p_module =
         module_need( id->p_decoder, "decoder", "$codec", false );
 
     if( !id->p_decoder->p_module )
     {
         msg_Err( p_stream, "cannot find video decoder" );
+        transcode_pool_Delete( VLC_OBJECT(p_stream),
+                               id->p_decoder->p_owner->p_pool );
         free( id->p_decoder->p_owner );
         return VLC_EGENERIC;
     }
@@ -248,6 +672,8 @@ int transcode_video_new( sout_stream_t *p_stream, sout_stream_id_t *id )
                  (char *)&p_sys->i_vcodec );
         module_unneed( id->p_decoder, id->p_decoder->p_module );
         id->p_decoder->p_module = 0;
+        transcode_pool_Delete( VLC_OBJECT(p_stream),
+                               id->p_decoder->p_owner->p_pool );
         free( id->p_decoder->p_owner );
         return VLC_EGENERIC;
     }
@@ -263,26 +689,16 @@ int transcode_video_new( sout_stream_t *p_stream, sout_stream_id_t *id )
     }
     id->p_encoder->p_module = NULL;
 
-    if( p_sys->i_threads >= 1 )
+    p_sys->id_video = id;
+    if( p_sys->i_threads >= 1 &&
+        transcode_video_pipeline_start( p_stream ) != VLC_SUCCESS )
     {
-        int i_priority = p_sys->b_high_priority ? VLC_THREAD_PRIORITY_OUTPUT :
-                           VLC_THREAD_PRIORITY_VIDEO;
-        p_sys->id_video = id;
-        vlc_mutex_init( &p_sys->lock_out );
-        vlc_cond_init( &p_sys->cond );
-        memset( p_sys->pp_pics, 0, sizeof(p_sys->pp_pics) );
-        p_sys->i_first_pic = 0;
-        p_sys->i_last_pic = 0;
-        p_sys->p_buffers = NULL;
-        p_sys->b_die = p_sys->b_error = 0;
-        if( vlc_thread_create( p_sys, "encoder", EncoderThread, i_priority ) )
-        {
-            msg_Err( p_stream, "cannot spawn encoder thread" );
-            module_unneed( id->p_decoder, id->p_decoder->p_module );
-            id->p_decoder->p_module = 0;
-            free( id->p_decoder->p_owner );
-            return VLC_EGENERIC;
-        }
+        module_unneed( id->p_decoder, id->p_decoder->p_module );
+        id->p_decoder->p_module = 0;
+        transcode_pool_Delete( VLC_OBJECT(p_stream),
+                               id->p_decoder->p_owner->p_pool );
+        free( id->p_decoder->p_owner );
+        return VLC_EGENERIC;
     }
     return VLC_SUCCESS;
 }
@@ -290,12 +706,13 @@ int transcode_video_new( sout_stream_t *p_stream, sout_stream_id_t *id )
 static void transcode_video_filter_init( sout_stream_t *p_stream,
                                          sout_stream_id_t *id )
 {
+    transcode_pool_t *p_pool = id->p_decoder->p_owner->p_pool;
 
     id->p_f_chain = filter_chain_New( p_stream, "video filter2",
                                      false,
                                      transcode_video_filter_allocation_init,
                                      transcode_video_filter_allocation_clear,
-                                     p_stream->p_sys );
+                                     p_pool );
     /* Deinterlace */
     if( p_stream->p_sys->b_deinterlace )
     {
@@ -327,7 +744,7 @@ static void transcode_video_filter_init( sout_stream_t *p_stream,
                                           true,
                            transcode_video_filter_allocation_init,
                            transcode_video_filter_allocation_clear,
-                           p_stream->p_sys );
+                           p_pool );
         filter_chain_Reset( id->p_uf_chain, &id->p_encoder->fmt_in,
                             &id->p_encoder->fmt_in );
         filter_chain_AppendFromString( id->p_uf_chain, p_stream->p_sys->psz_vf2 );
@@ -343,6 +760,14 @@ static void transcode_video_filter_init( sout_stream_t *p_stream,
             id->p_encoder->fmt_in.video.i_sar_den;
     }
 
+    /* Each filter may hold its input picture while it fills its output.
+     * The decoder already has a pool, sized without the filters. */
+    int i_filters = 0;
+    if( id->p_f_chain )
+        i_filters += filter_chain_GetLength( id->p_f_chain );
+    if( id->p_uf_chain )
+        i_filters += filter_chain_GetLength( id->p_uf_chain );
+    transcode_pool_Grow( p_pool, i_filters );
 }
 
 static void transcode_video_encoder_init( sout_stream_t *p_stream,
@@ -562,15 +987,7 @@ void transcode_video_close( sout_stream_t *p_stream,
                                    sout_stream_id_t *id )
 {
     if( p_stream->p_sys->i_threads >= 1 )
-    {
-        vlc_mutex_lock( &p_stream->p_sys->lock_out );
-        vlc_object_kill( p_stream->p_sys );
-        vlc_cond_signal( &p_stream->p_sys->cond );
-        vlc_mutex_unlock( &p_stream->p_sys->lock_out );
-        vlc_thread_join( p_stream->p_sys );
-        vlc_mutex_destroy( &p_stream->p_sys->lock_out );
-        vlc_cond_destroy( &p_stream->p_sys->cond );
-    }
+        transcode_video_pipeline_stop( p_stream );
 
     video_timer_close( id->p_encoder );
 
@@ -580,8 +997,6 @@ void transcode_video_close( sout_stream_t *p_stream,
     if( id->p_decoder->p_description )
         vlc_meta_Delete( id->p_decoder->p_description );
 
-    free( id->p_decoder->p_owner );
-
     /* Close encoder */
     if( id->p_encoder->p_module )
         module_unneed( id->p_encoder, id->p_encoder->p_module );
@@ -591,223 +1006,251 @@ void transcode_video_close( sout_stream_t *p_stream,
         filter_chain_Delete( id->p_f_chain );
     if( id->p_uf_chain )
         filter_chain_Delete( id->p_uf_chain );
+
+    transcode_pool_Delete( VLC_OBJECT(p_stream),
+                           id->p_decoder->p_owner->p_pool );
+    free( id->p_decoder->p_owner );
 }
 
-int transcode_video_process( sout_stream_t *p_stream, sout_stream_id_t *id,
-                                    block_t *in, block_t **out )
+/* Encodes a filtered picture, or queues it for the encoder thread */
+static void transcode_video_encode( sout_stream_t *p_stream,
+                                    sout_stream_id_t *id, picture_t *p_pic,
+                                    block_t **out )
 {
     sout_stream_sys_t *p_sys = p_stream->p_sys;
-    bool b_need_duplicate = false;
-    picture_t *p_pic, *p_pic2 = NULL;
-    *out = NULL;
 
-    if( in == NULL )
+    if( p_sys->i_threads == 0 )
     {
-        if( p_sys->i_threads == 0 )
-        {
-            block_t *p_block;
-            do {
-                video_timer_start( id->p_encoder );
-                p_block = id->p_encoder->pf_encode_video(id->p_encoder, NULL );
-                video_timer_stop( id->p_encoder );
-                block_ChainAppend( out, p_block );
-            } while( p_block );
-        }
-        else
-        {
-            /*
-             * FIXME: we need EncoderThread() to flush buffers and signal us
-             * when it's done so we can send the last frames to the chain
-             */
-        }
-        return VLC_SUCCESS;
+        block_t *p_block;
+
+        video_timer_start( id->p_encoder );
+        p_block = id->p_encoder->pf_encode_video( id->p_encoder, p_pic );
+        video_timer_stop( id->p_encoder );
+
+        block_ChainAppend( out, p_block );
+        picture_Release( p_pic );
     }
+    else
+        transcode_queue_Put( p_sys, &p_sys->encoder_queue, p_pic );
+}
 
+/* Synchronises, filters and encodes a decoded picture. This is run by the
+ * filter thread if there is one, and then out is not used. */
+static void transcode_video_filter_picture( sout_stream_t *p_stream,
+                                            sout_stream_id_t *id,
+                                            picture_t *p_pic, block_t **out )
+{
+    sout_stream_sys_t *p_sys = p_stream->p_sys;
+    transcode_pool_t *p_pool = id->p_decoder->p_owner->p_pool;
+    bool b_need_duplicate = false;
+    picture_t *p_pic2 = NULL;
+    mtime_t i_pts = 0;
 
-    while( (p_pic = id->p_decoder->pf_decode_video( id->p_decoder, &in )) )
+    if( p_sys->b_master_sync )
     {
+        mtime_t i_video_drift;
+        mtime_t i_master_drift = p_sys->i_master_drift;
 
-        sout_UpdateStatistic( p_stream->p_sout, SOUT_STATISTIC_DECODED_VIDEO, 1 );
-
-        if( p_stream->p_sout->i_out_pace_nocontrol && p_sys->b_hurry_up )
+        i_pts = date_Get( &id->interpolated_pts ) + 1;
+        if ( p_pic->date - i_pts > MASTER_SYNC_MAX_DRIFT
+              || p_pic->date - i_pts < -MASTER_SYNC_MAX_DRIFT )
         {
-            mtime_t current_date = mdate();
-            if( current_date + 50000 > p_pic->date )
-            {
-                msg_Dbg( p_stream, "late picture skipped (%"PRId64")",
-                         current_date + 50000 - p_pic->date );
-                picture_Release( p_pic );
-                continue;
-            }
+            msg_Dbg( p_stream, "drift is too high, resetting master sync" );
+            date_Set( &id->interpolated_pts, p_pic->date );
+            i_pts = p_pic->date + 1;
         }
+        i_video_drift = p_pic->date - i_pts;
 
-        if( p_sys->b_master_sync )
-        {
-            mtime_t i_video_drift;
-            mtime_t i_master_drift = p_sys->i_master_drift;
-            mtime_t i_pts;
+        /* Set the pts of the frame being encoded */
+        p_pic->date = i_pts;
 
-            i_pts = date_Get( &id->interpolated_pts ) + 1;
-            if ( p_pic->date - i_pts > MASTER_SYNC_MAX_DRIFT
-                  || p_pic->date - i_pts < -MASTER_SYNC_MAX_DRIFT )
-            {
-                msg_Dbg( p_stream, "drift is too high, resetting master sync" );
-                date_Set( &id->interpolated_pts, p_pic->date );
-                i_pts = p_pic->date + 1;
-            }
-            i_video_drift = p_pic->date - i_pts;
-            b_need_duplicate = false;
-
-            /* Set the pts of the frame being encoded */
-            p_pic->date = i_pts;
-
-            if( i_video_drift < (i_master_drift - 50000) )
-            {
+        if( i_video_drift < (i_master_drift - 50000) )
+        {
 #if 0
-                msg_Dbg( p_stream, "dropping frame (%i)",
-                         (int)(i_video_drift - i_master_drift) );
+            msg_Dbg( p_stream, "dropping frame (%i)",
+                     (int)(i_video_drift - i_master_drift) );
 #endif
-                picture_Release( p_pic );
-                continue;
-            }
-            else if( i_video_drift > (i_master_drift + 50000) )
-            {
+            picture_Release( p_pic );
+            return;
+        }
+        else if( i_video_drift > (i_master_drift + 50000) )
+        {
 #if 0
-                msg_Dbg( p_stream, "adding frame (%i)",
-                         (int)(i_video_drift - i_master_drift) );
+            msg_Dbg( p_stream, "adding frame (%i)",
+                     (int)(i_video_drift - i_master_drift) );
 #endif
-                b_need_duplicate = true;
-            }
+            b_need_duplicate = true;
         }
+    }
 
-        if( unlikely( !id->p_encoder->p_module ) )
-        {
-            transcode_video_encoder_init( p_stream, id );
+    /* Run filter chain */
+    if( id->p_f_chain )
+    {
+        p_pic = filter_chain_VideoFilter( id->p_f_chain, p_pic );
+        if( !p_pic )
+            return;
+    }
 
-            transcode_video_filter_init( p_stream, id );
+    /* Check if we have a subpicture to overlay */
+    if( p_sys->p_spu )
+    {
+        video_format_t fmt;
+        if( filter_chain_GetLength( id->p_f_chain ) > 0 )
+            fmt = filter_chain_GetFmtOut( id->p_f_chain )->video;
+        else
+            fmt = id->p_decoder->fmt_out.video;
 
-            if( transcode_video_encoder_open( p_stream, id ) != VLC_SUCCESS )
+        subpicture_t *p_subpic = spu_Render( p_sys->p_spu, NULL, &fmt, &fmt,
+                                             p_pic->date, p_pic->date, false );
+
+        /* Overlay subpicture */
+        if( p_subpic )
+        {
+            if( picture_IsReferenced( p_pic ) && !filter_chain_GetLength( id->p_f_chain ) )
             {
-                picture_Release( p_pic );
-                transcode_video_close( p_stream, id );
-                id->b_transcode = false;
-                return VLC_EGENERIC;
+                /* We can't modify the picture, we need to duplicate it */
+                picture_t *p_tmp = transcode_pool_Get( p_pool,
+                                                       &p_pic->format );
+                if( p_tmp )
+                {
+                    picture_Copy( p_tmp, p_pic );
+                    picture_Release( p_pic );
+                    p_pic = p_tmp;
+                }
             }
+            if( !p_sys->p_spu_blend )
+                p_sys->p_spu_blend = filter_NewBlend( VLC_OBJECT( p_sys->p_spu ), &fmt );
+            if( p_sys->p_spu_blend )
+                picture_BlendSubpicture( p_pic, p_sys->p_spu_blend, p_subpic );
+            subpicture_Delete( p_subpic );
         }
+    }
 
-        /* Run filter chain */
-        if( id->p_f_chain )
-            p_pic = filter_chain_VideoFilter( id->p_f_chain, p_pic );
+    /* Run user specified filter chain */
+    if( id->p_uf_chain )
+    {
+        p_pic = filter_chain_VideoFilter( id->p_uf_chain, p_pic );
+        if( !p_pic )
+            return;
+    }
 
-        /*
-         * Encoding
-         */
+    if( p_sys->b_master_sync )
+    {
+        i_pts = date_Get( &id->interpolated_pts ) + 1;
+        if ( p_pic->date - i_pts > MASTER_SYNC_MAX_DRIFT
+              || p_pic->date - i_pts < -MASTER_SYNC_MAX_DRIFT )
+        {
+            msg_Dbg( p_stream, "drift is too high, resetting master sync" );
+            date_Set( &id->interpolated_pts, p_pic->date );
+            i_pts = p_pic->date + 1;
+        }
+        date_Increment( &id->interpolated_pts, 1 );
 
-        /* Check if we have a subpicture to overlay */
-        if( p_sys->p_spu )
+        if( unlikely( b_need_duplicate ) )
         {
-            video_format_t fmt;
-            if( filter_chain_GetLength( id->p_f_chain ) > 0 )
-                fmt = filter_chain_GetFmtOut( id->p_f_chain )->video;
+            if( p_sys->i_threads == 0 )
+            {
+                /* Encoded before it is dated again */
+                p_pic2 = picture_Hold( p_pic );
+            }
             else
-                fmt = id->p_decoder->fmt_out.video;
-
-            subpicture_t *p_subpic = spu_Render( p_sys->p_spu, NULL, &fmt, &fmt,
-                                                 p_pic->date, p_pic->date, false );
-
-            /* Overlay subpicture */
-            if( p_subpic )
             {
-                if( picture_IsReferenced( p_pic ) && !filter_chain_GetLength( id->p_f_chain ) )
-                {
-                    /* We can't modify the picture, we need to duplicate it */
-                    picture_t *p_tmp = video_new_buffer_decoder( id->p_decoder );
-                    if( p_tmp )
-                    {
-                        picture_Copy( p_tmp, p_pic );
-                        picture_Release( p_pic );
-                        p_pic = p_tmp;
-                    }
-                }
-                if( !p_sys->p_spu_blend )
-                    p_sys->p_spu_blend = filter_NewBlend( VLC_OBJECT( p_sys->p_spu ), &fmt );
-                if( p_sys->p_spu_blend )
-                    picture_BlendSubpicture( p_pic, p_sys->p_spu_blend, p_subpic );
-                subpicture_Delete( p_subpic );
+                /* We can't modify the picture, we need to duplicate it */
+                p_pic2 = transcode_pool_Get( p_pool, &p_pic->format );
+                if( p_pic2 != NULL )
+                    picture_Copy( p_pic2, p_pic );
             }
         }
+    }
 
-        /* Run user specified filter chain */
-        if( id->p_uf_chain )
-            p_pic = filter_chain_VideoFilter( id->p_uf_chain, p_pic );
+    transcode_video_encode( p_stream, id, p_pic, out );
+    if( p_pic2 != NULL )
+    {
+        p_pic2->date = i_pts;
+        transcode_video_encode( p_stream, id, p_pic2, out );
+    }
+}
 
-        if( p_sys->i_threads == 0 )
+int transcode_video_process( sout_stream_t *p_stream, sout_stream_id_t *id,
+                                    block_t *in, block_t **out )
+{
+    sout_stream_sys_t *p_sys = p_stream->p_sys;
+    picture_t *p_pic;
+    *out = NULL;
+
+    if( in == NULL )
+    {
+        block_t *p_block;
+
+        if( !id->p_encoder->p_module )
+            return VLC_SUCCESS;
+
+        if( p_sys->i_threads >= 1 )
         {
-            block_t *p_block;
+            /* Wait for the queued pictures to be encoded */
+            vlc_mutex_lock( &p_sys->lock_out );
+            while( !transcode_video_pipeline_idle( p_sys ) )
+                vlc_cond_wait( &p_sys->cond_idle, &p_sys->lock_out );
+            *out = p_sys->p_buffers;
+            p_sys->p_buffers = NULL;
+            vlc_mutex_unlock( &p_sys->lock_out );
+        }
 
+        /* The encoder thread, if any, is now waiting: flush the encoder */
+        do {
             video_timer_start( id->p_encoder );
-            p_block = id->p_encoder->pf_encode_video( id->p_encoder, p_pic );
+            p_block = id->p_encoder->pf_encode_video(id->p_encoder, NULL );
             video_timer_stop( id->p_encoder );
-
             block_ChainAppend( out, p_block );
-        }
+        } while( p_block );
+        return VLC_SUCCESS;
+    }
 
-        if( p_sys->b_master_sync )
-        {
-            mtime_t i_pts = date_Get( &id->interpolated_pts ) + 1;
-            if ( p_pic->date - i_pts > MASTER_SYNC_MAX_DRIFT
-                  || p_pic->date - i_pts < -MASTER_SYNC_MAX_DRIFT )
-            {
-                msg_Dbg( p_stream, "drift is too high, resetting master sync" );
-                date_Set( &id->interpolated_pts, p_pic->date );
-                i_pts = p_pic->date + 1;
-            }
-            date_Increment( &id->interpolated_pts, 1 );
 
-            if( unlikely( b_need_duplicate ) )
-            {
+    while( (p_pic = id->p_decoder->pf_decode_video( id->p_decoder, &in )) )
+    {
 
-               if( p_sys->i_threads >= 1 )
-               {
-                   /* We can't modify the picture, we need to duplicate it */
-                   p_pic2 = video_new_buffer_decoder( id->p_decoder );
-                   if( p_pic2 != NULL )
-                   {
-                       picture_Copy( p_pic2, p_pic );
-                       p_pic2->date = i_pts;
-                   }
-               }
-               else
-               {
-                   block_t *p_block;
-                   p_pic->date = i_pts;
-                   video_timer_start( id->p_encoder );
-                   p_block = id->p_encoder->pf_encode_video(id->p_encoder, p_pic);
-                   video_timer_stop( id->p_encoder );
-                   block_ChainAppend( out, p_block );
-               }
-           }
-        }
+        sout_UpdateStatistic( p_stream->p_sout, SOUT_STATISTIC_DECODED_VIDEO, 1 );
 
-        if( p_sys->i_threads == 0 )
+        if( p_stream->p_sout->i_out_pace_nocontrol && p_sys->b_hurry_up )
         {
-            picture_Release( p_pic );
+            mtime_t current_date = mdate();
+            if( current_date + 50000 > p_pic->date )
+            {
+                msg_Dbg( p_stream, "late picture skipped (%"PRId64")",
+                         current_date + 50000 - p_pic->date );
+                picture_Release( p_pic );
+                continue;
+            }
         }
-        else
+
+        if( unlikely( !id->p_encoder->p_module ) )
         {
-            vlc_mutex_lock( &p_sys->lock_out );
-            p_sys->pp_pics[p_sys->i_last_pic++] = p_pic;
-            p_sys->i_last_pic %= PICTURE_RING_SIZE;
-            *out = p_sys->p_buffers;
-            p_sys->p_buffers = NULL;
-            if( p_pic2 != NULL )
+            transcode_video_encoder_init( p_stream, id );
+
+            transcode_video_filter_init( p_stream, id );
+
+            if( transcode_video_encoder_open( p_stream, id ) != VLC_SUCCESS )
             {
-                p_sys->pp_pics[p_sys->i_last_pic++] = p_pic2;
-                p_sys->i_last_pic %= PICTURE_RING_SIZE;
+                picture_Release( p_pic );
+                transcode_video_close( p_stream, id );
+                id->b_transcode = false;
+                return VLC_EGENERIC;
             }
-            vlc_cond_signal( &p_sys->cond );
-            vlc_mutex_unlock( &p_sys->lock_out );
         }
+
+        if( p_sys->b_filter_thread )
+            transcode_queue_Put( p_sys, &p_sys->filter_queue, p_pic );
+        else
+            transcode_video_filter_picture( p_stream, id, p_pic, out );
+    }
+
+    if( p_sys->i_threads >= 1 )
+    {
+        vlc_mutex_lock( &p_sys->lock_out );
+        block_ChainAppend( out, p_sys->p_buffers );
+        p_sys->p_buffers = NULL;
+        vlc_mutex_unlock( &p_sys->lock_out );
     }
 
     return VLC_SUCCESS;
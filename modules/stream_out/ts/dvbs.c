@@ -241,7 +241,6 @@ static block_t *OutputFrame( ts_input_t *p_input, block_t *p_frame )
 
     p_first = tsinput_BuildTS( p_input, p_frame );
 
-    block_Release( p_frame );
     return p_first;
 }
 
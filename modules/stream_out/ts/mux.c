@@ -48,6 +48,8 @@
 #include <vlc_modules.h>
 #include <vlc_rand.h>
 
+#include <assert.h>
+
 #include <bitstream/mpeg/ts.h>
 #include <bitstream/dvb/si.h>
 #include <bitstream/ietf/rtp.h>
@@ -65,6 +67,9 @@
 /* This is dimensioned so that we have time to create all elementary streams
  * before starting. */
 #define DEFAULT_ASYNC_DELAY     1000 /* ms */
+#define POOL_TS_SLOTS           256 /* packets allocated at once */
+#define POOL_OUTPUT_SLOTS       32 /* output buffers allocated at once */
+#define PCR_ACCURACY            500 /* ns, ISO/IEC 13818-1 2.4.2.2 */
 
 /*****************************************************************************
  * Module descriptor
@@ -115,12 +120,22 @@ static void     Close   ( vlc_object_t * );
 #define GRANULARITY_LONGTEXT N_( "Define the number of TS output at once (default 7 in synchronous mode, 1 in asynchronous (file)" )
 #define ASYNC_DELAY_TEXT N_( "Asynchronous buffer" )
 #define ASYNC_DELAY_LONGTEXT N_( "Define the delay (in ms) that's waited for between the input and the output of frames (useful for PSI rap-advance mode)" )
+#define STATMUX_TEXT N_( "Statistical multiplexing group" )
+#define STATMUX_LONGTEXT N_( "Share the bitrate with the other TS muxes of the same group, according to the complexity of their video (capped-vbr or cbr)" )
+#define STATMUX_RATE_TEXT N_( "Statistical multiplexing rate" )
+#define STATMUX_RATE_LONGTEXT N_( "Define the total bitrate of the group, in bi/s (set by the first mux of the group)" )
+#define STATMUX_SERVICE_TEXT N_( "Statistical multiplexing service" )
+#define STATMUX_SERVICE_LONGTEXT N_( "Publish the video bitrate targets to the encoders following this service name" )
+#define WORKERS_TEXT N_( "Packetization threads" )
+#define WORKERS_LONGTEXT N_( "Define the number of threads packetizing the elementary streams, so that large frames do not hold up the caller (synchronous mode only, default 0 = packetize in the caller)" )
 
 /* output */
 #define RTP_TEXT N_( "RTP" )
 #define RTP_LONGTEXT N_( "Prepend an RTP header" )
 #define SSRC_TEXT N_( "RTP SSRC" )
 #define SSRC_LONGTEXT N_( "Define the synchronization source (eg. 12.42.12.42)" )
+#define SPIN_TEXT N_( "Active wait" )
+#define SPIN_LONGTEXT N_( "Define the time (in us) that the mux thread actively waits for before outputting a buffer, to reduce jitter at the expense of CPU time (synchronous mode only)" )
 
 static const char * ppsz_conformance[] =
 {
@@ -187,12 +202,22 @@ vlc_module_begin()
                  GRANULARITY_LONGTEXT, false )
     add_integer( SOUT_CFG_PREFIX "async-delay", DEFAULT_ASYNC_DELAY,
                  ASYNC_DELAY_TEXT, ASYNC_DELAY_LONGTEXT, false )
+    add_integer( SOUT_CFG_PREFIX "workers", 0, WORKERS_TEXT,
+                 WORKERS_LONGTEXT, true )
+    add_string( SOUT_CFG_PREFIX "statmux", "", STATMUX_TEXT,
+                STATMUX_LONGTEXT, true )
+    add_integer( SOUT_CFG_PREFIX "statmux-rate", 0, STATMUX_RATE_TEXT,
+                 STATMUX_RATE_LONGTEXT, true )
+    add_string( SOUT_CFG_PREFIX "statmux-service", "", STATMUX_SERVICE_TEXT,
+                STATMUX_SERVICE_LONGTEXT, true )
 
     /* output */
     add_bool( SOUT_CFG_PREFIX "rtp", false, RTP_TEXT,
               RTP_LONGTEXT, false )
     add_string( SOUT_CFG_PREFIX "ssrc", "", SSRC_TEXT,
                 SSRC_LONGTEXT, false )
+    add_integer( SOUT_CFG_PREFIX "spin", 0, SPIN_TEXT,
+                 SPIN_LONGTEXT, true )
 vlc_module_end()
 
 
@@ -204,26 +229,48 @@ static const char *ppsz_sout_options[] = {
     "es-id-pid", "dynamic-pid", "auto-pcr", "pcr", "inputs",
     "tables", "conformance-tables", "tsid", "nid",
     "muxmode", "muxrate", "padding", "drop", "burst", "granularity", "async-delay",
-    "rtp", "ssrc",
+    "workers", "statmux", "statmux-rate", "statmux-service",
+    "rtp", "ssrc", "spin",
     NULL
 };
 
+static void Destroy( sout_stream_t *p_stream );
 static void CharsetInit( ts_parameters_t *p_ts_params,
                          const char *psz_charset );
 static void CharsetDestroy( ts_parameters_t *p_ts_params );
 static uint8_t *CharsetToStream( ts_charset_t *p_charset,
                                  char *psz_string, size_t *pi_out_string );
+static ts_pool_t *PoolNew( size_t i_size, unsigned int i_slab_slots );
+static void PoolDelete( ts_pool_t *p_pool );
+static block_t *PoolAlloc( ts_pool_t *p_pool );
 static void InputParseConfig( sout_stream_t *p_stream, char *psz_inputs );
 static void InputDelete( sout_stream_t *p_stream, sout_stream_id_t *p_input );
 static sout_stream_id_t *Add ( sout_stream_t *, es_format_t * );
 static int Del ( sout_stream_t *, sout_stream_id_t * );
 static int Send( sout_stream_t *, sout_stream_id_t *, block_t* );
+static int WorkersStart( sout_stream_t *p_stream, int i_nb_workers );
+static void WorkersStop( sout_stream_t *p_stream );
+static void WorkersWait( sout_stream_t *p_stream, sout_stream_id_t *p_input );
+static void WorkersQueue( sout_stream_t *p_stream, sout_stream_id_t *p_input );
+static int StatmuxJoin( sout_stream_t *p_stream, const char *psz_name,
+                        unsigned int i_total_rate );
+static void StatmuxLeave( sout_stream_t *p_stream );
+static void StatmuxAccount( sout_stream_t *p_stream,
+                            sout_stream_id_t *p_input, block_t *p_in );
 static void TableParseConfig( sout_stream_t *p_stream, char *psz_tables );
 static void TableAdd( sout_stream_t *p_stream, char *psz_name,
                       config_chain_t *p_cfg );
 static void TableDel( sout_stream_t *p_stream, sout_stream_id_t *p_table );
 static void MuxValidateParams( sout_stream_t *p_stream );
+static unsigned int MuxTotalBitrate( sout_stream_t *p_stream,
+                                     sout_stream_id_t *p_exclude,
+                                     bool *pb_mode_vbr );
+static int MuxReserve( sout_stream_t *p_stream );
+static void MuxSchedule( sout_stream_t *p_stream, sout_stream_id_t *p_queue );
+static void MuxUnschedule( sout_stream_t *p_stream,
+                           sout_stream_id_t *p_queue );
 static void *MuxThread( vlc_object_t * );
+static void MuxPrintJitter( sout_stream_t *p_stream );
 static void MuxAsync( sout_stream_t *p_stream, bool b_flush );
 
 #define MODE_AUTO   0
@@ -231,12 +278,65 @@ static void MuxAsync( sout_stream_t *p_stream, bool b_flush );
 #define MODE_CBR    2
 #define MODE_CAPPED 3
 
+/* Queues are kept in binary heaps, so that the next queue to mux is found
+ * in O(1) and updated in O(log n). There is one heap per priority keyed on
+ * the muxing date, and one heap keyed on the DTS for emergencies. */
+#define HEAP_MUXING     0
+#define HEAP_DTS        1
+#define NB_PRIORITIES   (TSPACK_PRIORITY_SI + 1)
+
 typedef struct ts_input_cfg_t
 {
     char *psz_name;
     config_chain_t *p_cfg;
 } ts_input_cfg_t;
 
+/* Output jitter histogram: bucket i counts the buffers whose output date
+ * was off by less than pi_jitter_limits[i] ns, and the last bucket the
+ * others. */
+static const int64_t pi_jitter_limits[] =
+{
+    100, 250, PCR_ACCURACY, 1000, 2500, 5000, 10000, 25000, 50000, 100000,
+    1000000
+};
+#define JITTER_BUCKETS  (sizeof(pi_jitter_limits) / sizeof(int64_t) + 1)
+
+typedef struct mux_jitter_t
+{
+    uint64_t pi_buckets[JITTER_BUCKETS];
+    uint64_t i_nb_early, i_nb_late;
+    int64_t i_max;
+} mux_jitter_t;
+
+/* Statistical multiplexing: the muxes of a group share a fixed total
+ * bitrate. Every GOP of its video, a mux reports its complexity and its
+ * share of the group is recalculated. */
+#define STATMUX_SMOOTHING   4 /* GOPs */
+#define STATMUX_MAX_BOOST   2.
+
+typedef struct statmux_member_t
+{
+    sout_stream_t *p_stream;
+    unsigned int i_overhead; /* bi/s, what isn't redistributed */
+    double f_weight; /* 0 until the first report */
+    unsigned int i_rate, i_video_rate; /* bi/s, assigned */
+} statmux_member_t;
+
+typedef struct statmux_t
+{
+    char *psz_name;
+    unsigned int i_total_rate; /* bi/s */
+    statmux_member_t **pp_members;
+    int i_nb_members;
+} statmux_t;
+
+typedef struct mux_heap_t
+{
+    sout_stream_id_t **pp_queues;
+    int i_nb_queues, i_max_queues;
+    int i_type;
+} mux_heap_t;
+
 struct sout_stream_sys_t
 {
     /* For threading stuff */
@@ -245,9 +345,12 @@ struct sout_stream_sys_t
     /* output */
     sout_stream_t *p_stream;
     sout_stream_id_t *id; /* unique output */
+    ts_pool_t *p_out_pool; /* <granularity> packets + RTP header */
     bool b_rtp;
     uint16_t i_rtp_cc;
     uint8_t pi_ssrc[4];
+    int64_t i_spin; /* ns */
+    mux_jitter_t jitter;
 
     /* PIDs management */
     uint16_t i_next_dynamic_pid;
@@ -260,6 +363,23 @@ struct sout_stream_sys_t
     mtime_t i_auto_pcr_period;
     sout_stream_id_t *p_pcr_input;
 
+    /* packetization workers */
+    vlc_thread_t *p_workers;
+    int i_nb_workers;
+    vlc_mutex_t worker_lock;
+    vlc_cond_t worker_wait, worker_done;
+    sout_stream_id_t *p_first_ready, **pp_last_ready;
+    bool b_workers_exit;
+
+    /* statistical multiplexing */
+    vlc_mutex_t *p_statmux_lock; /* global to libvlc, for all groups */
+    statmux_t *p_statmux;
+    statmux_member_t *p_statmux_member;
+    char *psz_statmux_service;
+    sout_stream_id_t *p_statmux_input; /* the video that is measured */
+    mtime_t i_gop_start, i_gop_cpb_delay;
+    uint64_t i_gop_size;
+
     /* stream definition / PSI */
     vlc_mutex_t stream_lock;
     vlc_cond_t stream_wait;
@@ -276,10 +396,15 @@ struct sout_stream_sys_t
     mtime_t i_async_delay;
     mtime_t i_last_muxing, i_last_muxing_remainder;
     bool b_sync;
-    /* temporary buffers for delayed packets */
-    block_t *p_tmp_blocks;
-    block_t **pp_tmp_last;
+    /* scheduler */
+    mux_heap_t p_muxing_heaps[NB_PRIORITIES];
+    mux_heap_t dts_heap;
+    int i_next_sched_rank;
+    sout_stream_id_t *p_dirty_queues; /* muxed since last MuxFixQueues */
+    /* temporary buffer for delayed packets */
+    block_t *p_tmp_out;
     int i_tmp_nb_packets;
+    mtime_t i_tmp_max_muxing;
 };
 
 
@@ -344,9 +469,40 @@ static int Open( vlc_object_t *p_this )
         fmt.i_codec = VLC_CODEC_M2TS;
     }
 
+    var_Get( p_stream, SOUT_CFG_PREFIX "spin", &val );
+    p_sys->i_spin = val.i_int * 1000;
+    memset( &p_sys->jitter, 0, sizeof(mux_jitter_t) );
+
+    var_Get( p_stream, SOUT_CFG_PREFIX "granularity", &val );
+    if ( val.i_int )
+        p_sys->i_granularity = val.i_int;
+    else if ( p_sys->b_sync )
+        p_sys->i_granularity = 7;
+    else
+        p_sys->i_granularity = 1;
+    p_sys->i_granularity_size = p_sys->i_granularity * TS_SIZE
+                                   * INT64_C(1000000);
+
+    p_sys->ts.params.p_pool = PoolNew( TS_SIZE, POOL_TS_SLOTS );
+    p_sys->ts.params.pf_new_ts = PoolAlloc;
+    p_sys->p_out_pool = PoolNew( RTP_HEADER_SIZE
+                                  + p_sys->i_granularity * TS_SIZE,
+                                 POOL_OUTPUT_SLOTS );
+    if ( p_sys->ts.params.p_pool == NULL || p_sys->p_out_pool == NULL )
+    {
+        if ( p_sys->ts.params.p_pool != NULL )
+            PoolDelete( p_sys->ts.params.p_pool );
+        if ( p_sys->p_out_pool != NULL )
+            PoolDelete( p_sys->p_out_pool );
+        vlc_object_release( p_sys );
+        return VLC_ENOMEM;
+    }
+
     if ( (p_sys->id = p_stream->p_next->pf_add( p_stream->p_next, &fmt )) == NULL )
     {
         msg_Err( p_stream, "cannot create chain" );
+        PoolDelete( p_sys->ts.params.p_pool );
+        PoolDelete( p_sys->p_out_pool );
         vlc_object_release( p_sys );
         return VLC_EGENERIC;
     }
@@ -401,16 +557,6 @@ static int Open( vlc_object_t *p_this )
     var_Get( p_stream, SOUT_CFG_PREFIX "burst", &val );
     p_sys->b_burst = val.b_bool;
 
-    var_Get( p_stream, SOUT_CFG_PREFIX "granularity", &val );
-    if ( val.i_int )
-        p_sys->i_granularity = val.i_int;
-    else if ( p_sys->b_sync )
-        p_sys->i_granularity = 7;
-    else
-        p_sys->i_granularity = 1;
-    p_sys->i_granularity_size = p_sys->i_granularity * TS_SIZE
-                                   * INT64_C(1000000);
-
     var_Get( p_stream, SOUT_CFG_PREFIX "padding", &val );
     p_sys->i_padding_bitrate = val.i_int;
 
@@ -457,6 +603,43 @@ static int Open( vlc_object_t *p_this )
     var_Get( p_stream, SOUT_CFG_PREFIX "async-delay", &val );
     p_sys->i_async_delay = val.i_int * 1000;
 
+    vlc_mutex_init( &p_sys->worker_lock );
+    vlc_cond_init( &p_sys->worker_wait );
+    vlc_cond_init( &p_sys->worker_done );
+    p_sys->p_workers = NULL;
+    p_sys->i_nb_workers = 0;
+    p_sys->p_first_ready = NULL;
+    p_sys->pp_last_ready = &p_sys->p_first_ready;
+    p_sys->b_workers_exit = false;
+
+    p_sys->p_statmux = NULL;
+    p_sys->p_statmux_member = NULL;
+    p_sys->psz_statmux_service = NULL;
+    p_sys->p_statmux_input = NULL;
+    p_sys->i_gop_start = VLC_TS_INVALID;
+    var_Get( p_stream, SOUT_CFG_PREFIX "statmux", &val );
+    if ( val.psz_string != NULL && *val.psz_string )
+    {
+        vlc_value_t rate;
+        var_Get( p_stream, SOUT_CFG_PREFIX "statmux-rate", &rate );
+        if ( p_sys->i_muxmode == MODE_VBR && !p_sys->b_auto_muxmode )
+            msg_Warn( p_stream, "statistical multiplexing is impossible in vbr mode" );
+        else if ( StatmuxJoin( p_stream, val.psz_string, rate.i_int ) )
+            msg_Warn( p_stream, "cannot join statmux group %s",
+                      val.psz_string );
+        else
+        {
+            var_Get( p_stream, SOUT_CFG_PREFIX "statmux-service", &rate );
+            if ( rate.psz_string != NULL && *rate.psz_string
+                  && asprintf( &p_sys->psz_statmux_service, "statmux-%s",
+                               rate.psz_string ) != -1 )
+                var_Create( p_stream->p_libvlc, p_sys->psz_statmux_service,
+                            VLC_VAR_INTEGER );
+            free( rate.psz_string );
+        }
+    }
+    free( val.psz_string );
+
     /* TS stream / PSI - in the end because the operating mode must be
      * known first */
     p_sys->ts.i_stream_version = 0;
@@ -469,6 +652,20 @@ static int Open( vlc_object_t *p_this )
     p_sys->ts.pp_tables = NULL;
     p_sys->ts.i_nb_tables = 0;
 
+    for ( int i = 0; i < NB_PRIORITIES; i++ )
+    {
+        p_sys->p_muxing_heaps[i].pp_queues = NULL;
+        p_sys->p_muxing_heaps[i].i_nb_queues = 0;
+        p_sys->p_muxing_heaps[i].i_max_queues = 0;
+        p_sys->p_muxing_heaps[i].i_type = HEAP_MUXING;
+    }
+    p_sys->dts_heap.pp_queues = NULL;
+    p_sys->dts_heap.i_nb_queues = 0;
+    p_sys->dts_heap.i_max_queues = 0;
+    p_sys->dts_heap.i_type = HEAP_DTS;
+    p_sys->i_next_sched_rank = 0;
+    p_sys->p_dirty_queues = NULL;
+
     var_Get( p_stream, SOUT_CFG_PREFIX "tsid", &val );
     if ( val.i_int != -1 )
         p_sys->ts.i_tsid = val.i_int % 65536;
@@ -529,21 +726,26 @@ static int Open( vlc_object_t *p_this )
     /* Start of operations */
     p_sys->i_last_muxing = -1;
     p_sys->i_last_muxing_remainder = 0;
-    p_sys->p_tmp_blocks = NULL;
-    p_sys->pp_tmp_last = NULL;
+    p_sys->p_tmp_out = NULL;
     p_sys->i_tmp_nb_packets = 0;
 
     if( p_sys->b_sync && vlc_thread_create( p_sys, "sout mux thread", MuxThread,
                                             VLC_THREAD_PRIORITY_OUTPUT ) )
     {
         msg_Err( p_sys, "cannot spawn sout mux thread" );
-        vlc_object_release( p_sys );
+        StatmuxLeave( p_stream );
+        Destroy( p_stream );
         return VLC_EGENERIC;
     }
     else
         msg_Dbg( p_stream, "starting TS mux with %s conformance",
                  ppsz_conformance[p_sys->ts.params.i_conformance] );
 
+    var_Get( p_stream, SOUT_CFG_PREFIX "workers", &val );
+    if ( val.i_int > 0 && !p_sys->b_sync )
+        msg_Dbg( p_stream, "packetization threads are useless in asynchronous mode" );
+    else if ( val.i_int > 0 && WorkersStart( p_stream, val.i_int ) )
+        msg_Warn( p_stream, "packetizing in the caller thread" );
 
     p_stream->pf_add    = Add;
     p_stream->pf_del    = Del;
@@ -559,7 +761,10 @@ static void Close( vlc_object_t *p_this )
 {
     sout_stream_t *p_stream = (sout_stream_t *)p_this;
     sout_stream_sys_t *p_sys = p_stream->p_sys;
-    int i;
+
+    /* Packetize what's pending before the mux thread goes away. */
+    WorkersStop( p_stream );
+    StatmuxLeave( p_stream );
 
     if ( p_sys->b_sync )
     {
@@ -568,12 +773,25 @@ static void Close( vlc_object_t *p_this )
         vlc_cond_signal( &p_sys->stream_wait );
         vlc_mutex_unlock( &p_sys->stream_lock );
         vlc_thread_join( p_sys );
+        MuxPrintJitter( p_stream );
     }
     else
     {
         MuxAsync( p_stream, true );
     }
 
+    Destroy( p_stream );
+    p_stream->p_sout->i_out_pace_nocontrol--;
+}
+
+/*****************************************************************************
+ * Destroy: release what Open allocated, once the mux thread is gone
+ *****************************************************************************/
+static void Destroy( sout_stream_t *p_stream )
+{
+    sout_stream_sys_t *p_sys = p_stream->p_sys;
+    int i;
+
     p_stream->p_next->pf_del( p_stream->p_next, p_sys->id );
 
     for ( i = p_sys->ts.i_nb_inputs - 1; i >= 0; i-- )
@@ -590,13 +808,25 @@ static void Close( vlc_object_t *p_this )
     free( p_sys->p_inputs_cfg );
     free( p_sys->ts.pi_raps );
 
+    for ( i = 0; i < NB_PRIORITIES; i++ )
+        free( p_sys->p_muxing_heaps[i].pp_queues );
+    free( p_sys->dts_heap.pp_queues );
+
+    if ( p_sys->p_tmp_out != NULL )
+        block_Release( p_sys->p_tmp_out );
+    /* The pools go away when the last packet is released. */
+    PoolDelete( p_sys->p_out_pool );
+    PoolDelete( p_sys->ts.params.p_pool );
+
     CharsetDestroy( &p_sys->ts.params );
 
     vlc_mutex_destroy( &p_sys->stream_lock );
     vlc_cond_destroy( &p_sys->stream_wait );
+    vlc_mutex_destroy( &p_sys->worker_lock );
+    vlc_cond_destroy( &p_sys->worker_wait );
+    vlc_cond_destroy( &p_sys->worker_done );
 
     vlc_object_release( p_sys );
-    p_stream->p_sout->i_out_pace_nocontrol--;
 }
 
 
@@ -678,6 +908,164 @@ static uint8_t *CharsetToStream( ts_charset_t *p_charset,
 }
 
 
+/*
+ * Packet pools
+ */
+
+#define POOL_ALIGN 16
+#define POOL_ROUND(x) (((x) + POOL_ALIGN - 1) & ~(POOL_ALIGN - 1))
+
+typedef struct ts_pool_slab_t ts_pool_slab_t;
+typedef struct ts_pool_slot_t ts_pool_slot_t;
+
+struct ts_pool_slab_t
+{
+    ts_pool_slab_t *p_next;
+};
+
+struct ts_pool_slot_t
+{
+    ts_packet_t packet;
+    ts_pool_t *p_pool;
+    ts_pool_slot_t *p_next_free;
+    uint8_t p_buffer[];
+};
+
+struct ts_pool_t
+{
+    vlc_mutex_t lock;
+    size_t i_size, i_slot_size;
+    unsigned int i_slab_slots;
+
+    ts_pool_slab_t *p_slabs;
+    ts_pool_slot_t *p_free;
+    unsigned int i_used;
+    bool b_dead;
+};
+
+/*****************************************************************************
+ * PoolNew: allocate data structures
+ *****************************************************************************/
+static ts_pool_t *PoolNew( size_t i_size, unsigned int i_slab_slots )
+{
+    ts_pool_t *p_pool = malloc( sizeof(ts_pool_t) );
+
+    if ( p_pool == NULL )
+        return NULL;
+    vlc_mutex_init( &p_pool->lock );
+    p_pool->i_size = i_size;
+    p_pool->i_slot_size = POOL_ROUND( sizeof(ts_pool_slot_t) + i_size );
+    p_pool->i_slab_slots = i_slab_slots;
+    p_pool->p_slabs = NULL;
+    p_pool->p_free = NULL;
+    p_pool->i_used = 0;
+    p_pool->b_dead = false;
+
+    return p_pool;
+}
+
+/*****************************************************************************
+ * PoolDestroy: deallocate data structures
+ *****************************************************************************/
+static void PoolDestroy( ts_pool_t *p_pool )
+{
+    while ( p_pool->p_slabs != NULL )
+    {
+        ts_pool_slab_t *p_next = p_pool->p_slabs->p_next;
+        free( p_pool->p_slabs );
+        p_pool->p_slabs = p_next;
+    }
+
+    vlc_mutex_destroy( &p_pool->lock );
+    free( p_pool );
+}
+
+/*****************************************************************************
+ * PoolDelete: destroy the pool as soon as all blocks are released
+ *****************************************************************************/
+static void PoolDelete( ts_pool_t *p_pool )
+{
+    bool b_destroy;
+
+    vlc_mutex_lock( &p_pool->lock );
+    p_pool->b_dead = true;
+    b_destroy = !p_pool->i_used;
+    vlc_mutex_unlock( &p_pool->lock );
+
+    if ( b_destroy )
+        PoolDestroy( p_pool );
+}
+
+/*****************************************************************************
+ * PoolRelease: give a block back to its pool (any thread)
+ *****************************************************************************/
+static void PoolRelease( block_t *p_block )
+{
+    ts_pool_slot_t *p_slot = (ts_pool_slot_t *)p_block;
+    ts_pool_t *p_pool = p_slot->p_pool;
+    bool b_destroy;
+
+    if ( p_slot->packet.p_owner != NULL )
+        block_Release( p_slot->packet.p_owner );
+
+    vlc_mutex_lock( &p_pool->lock );
+    p_slot->p_next_free = p_pool->p_free;
+    p_pool->p_free = p_slot;
+    p_pool->i_used--;
+    b_destroy = p_pool->b_dead && !p_pool->i_used;
+    vlc_mutex_unlock( &p_pool->lock );
+
+    if ( b_destroy )
+        PoolDestroy( p_pool );
+}
+
+/*****************************************************************************
+ * PoolAlloc: get a block from the pool, growing it by a slab if needed
+ *****************************************************************************/
+static block_t *PoolAlloc( ts_pool_t *p_pool )
+{
+    ts_pool_slot_t *p_slot;
+
+    vlc_mutex_lock( &p_pool->lock );
+    if ( p_pool->p_free == NULL )
+    {
+        size_t i_header = POOL_ROUND( sizeof(ts_pool_slab_t) );
+        ts_pool_slab_t *p_slab = malloc( i_header
+                                + p_pool->i_slab_slots * p_pool->i_slot_size );
+        unsigned int i;
+
+        if ( p_slab == NULL )
+        {
+            vlc_mutex_unlock( &p_pool->lock );
+            return NULL;
+        }
+        p_slab->p_next = p_pool->p_slabs;
+        p_pool->p_slabs = p_slab;
+
+        for ( i = 0; i < p_pool->i_slab_slots; i++ )
+        {
+            p_slot = (ts_pool_slot_t *)((uint8_t *)p_slab + i_header
+                                         + i * p_pool->i_slot_size);
+            p_slot->p_pool = p_pool;
+            p_slot->p_next_free = p_pool->p_free;
+            p_pool->p_free = p_slot;
+        }
+    }
+
+    p_slot = p_pool->p_free;
+    p_pool->p_free = p_slot->p_next_free;
+    p_pool->i_used++;
+    vlc_mutex_unlock( &p_pool->lock );
+
+    block_Init( &p_slot->packet.self, p_slot->p_buffer, p_pool->i_size );
+    p_slot->packet.self.pf_release = PoolRelease;
+    p_slot->packet.p_payload = NULL;
+    p_slot->packet.i_payload = 0;
+    p_slot->packet.p_owner = NULL;
+    return &p_slot->packet.self;
+}
+
+
 /*
  * Generic PID management (for inputs and tables)
  */
@@ -928,6 +1316,7 @@ static void InputElectPCR( sout_stream_t *p_stream )
                 = (ts_input_t *)p_sys->p_pcr_input->p_packetizer;
             p_old_packetizer->i_pcr_period = 0;
             p_old_packetizer->i_priority = TSPACK_PRIORITY_NONE;
+            MuxSchedule( p_stream, p_sys->p_pcr_input );
         }
 
         p_sys->p_pcr_input = p_pcr_input;
@@ -941,6 +1330,7 @@ static void InputElectPCR( sout_stream_t *p_stream )
                 p_packetizer->i_pcr_period = p_sys->i_auto_pcr_period;
             p_packetizer->i_priority = TSPACK_PRIORITY_PCR;
             InputValidatePCR( p_packetizer );
+            MuxSchedule( p_stream, p_pcr_input );
 
             msg_Dbg( p_stream, "new PCR PID is %d period=%"PRId64,
                      p_packetizer->i_pid, p_packetizer->i_pcr_period );
@@ -964,6 +1354,12 @@ static void InputDelete( sout_stream_t *p_stream, sout_stream_id_t *p_input )
              p_packetizer->fmt.i_id );
 
     TAB_REMOVE( p_sys->ts.i_nb_inputs, p_sys->ts.pp_inputs, p_input );
+    MuxUnschedule( p_stream, p_input );
+    if ( p_sys->p_statmux_input == p_input )
+    {
+        p_sys->p_statmux_input = NULL;
+        p_sys->i_gop_start = VLC_TS_INVALID;
+    }
     p_sys->ts.i_stream_version++;
     if ( p_sys->b_auto_pcr && p_sys->p_pcr_input == p_input )
     {
@@ -976,6 +1372,8 @@ static void InputDelete( sout_stream_t *p_stream, sout_stream_id_t *p_input )
     vlc_object_release( p_packetizer );
 
     block_FifoRelease( p_input->p_fifo );
+    if ( p_input->p_pending != NULL )
+        block_FifoRelease( p_input->p_pending );
     free( p_input );
 }
 
@@ -1017,11 +1415,22 @@ static sout_stream_id_t *Add( sout_stream_t *p_stream, es_format_t *p_fmt )
     if ( p_input != NULL )
         return p_input;
 
+    /* Inputs and tables are only added under the sout lock or at Open(),
+     * so the room is still there when the input is appended below. */
+    vlc_mutex_lock( &p_sys->stream_lock );
+    int i_ret = MuxReserve( p_stream );
+    vlc_mutex_unlock( &p_sys->stream_lock );
+    if ( i_ret != VLC_SUCCESS )
+        return NULL;
+
     p_input = malloc( sizeof( sout_stream_id_t ) );
     memset( p_input, 0, sizeof( sout_stream_id_t ) );
     p_input->p_fifo = block_FifoNew();
+    if ( p_sys->i_nb_workers )
+        p_input->p_pending = block_FifoNew();
     p_input->b_deleted = false;
     p_input->i_min_muxing = 0;
+    p_input->pi_sched_index[HEAP_MUXING] = p_input->pi_sched_index[HEAP_DTS] = -1;
 
     p_packetizer = (ts_input_t *)vlc_object_create( p_stream,
                                                     sizeof(ts_input_t) );
@@ -1038,6 +1447,8 @@ static sout_stream_id_t *Add( sout_stream_t *p_stream, es_format_t *p_fmt )
         vlc_object_release( p_packetizer );
 
         block_FifoRelease( p_input->p_fifo );
+        if ( p_input->p_pending != NULL )
+            block_FifoRelease( p_input->p_pending );
         free( p_input );
         return NULL;
     }
@@ -1047,7 +1458,11 @@ static sout_stream_id_t *Add( sout_stream_t *p_stream, es_format_t *p_fmt )
 
     vlc_mutex_lock( &p_sys->stream_lock );
     TAB_APPEND( p_sys->ts.i_nb_inputs, p_sys->ts.pp_inputs, p_input );
+    p_input->i_sched_rank = p_sys->i_next_sched_rank++;
     p_sys->ts.i_stream_version++;
+    if ( p_sys->p_statmux != NULL && p_sys->p_statmux_input == NULL
+          && p_fmt->i_cat == VIDEO_ES )
+        p_sys->p_statmux_input = p_input;
     if ( p_sys->b_auto_pcr )
     {
         InputElectPCR( p_stream );
@@ -1077,6 +1492,9 @@ static int Del( sout_stream_t *p_stream, sout_stream_id_t *p_input )
     sout_stream_sys_t *p_sys = p_stream->p_sys;
     int i_depth;
 
+    /* Let the workers packetize the pending frames first. */
+    WorkersWait( p_stream, p_input );
+
     vlc_mutex_lock( &p_sys->stream_lock );
 
     vlc_mutex_lock( &p_input->p_fifo->lock );
@@ -1102,38 +1520,23 @@ static int Del( sout_stream_t *p_stream, sout_stream_id_t *p_input )
 }
 
 /*****************************************************************************
- * Send: new packet for a PID
+ * InputPacketize: packetize frames and queue them for muxing
  *****************************************************************************/
-static int Send( sout_stream_t *p_stream, sout_stream_id_t *p_input,
-                 block_t *p_in )
+static void InputPacketize( sout_stream_t *p_stream,
+                            sout_stream_id_t *p_input, block_t *p_in )
 {
     sout_stream_sys_t *p_sys = p_stream->p_sys;
     ts_input_t *p_packetizer = (ts_input_t *)p_input->p_packetizer;
     block_t *p_out;
 
-    for ( block_t *p_block = p_in; p_block != NULL; p_block = p_block->p_next )
-    {
-        if ( p_block->i_dts == VLC_TS_INVALID ||
-             p_block->i_pts == VLC_TS_INVALID )
-        {
-            msg_Warn( p_stream, "packet with invalid timestamp on PID %hu",
-                      p_packetizer->i_pid );
-            block_ChainRelease( p_in );
-            return VLC_SUCCESS;
-        }
-    }
-
     p_out = p_packetizer->pf_send( p_packetizer, p_in );
 
     if ( p_out != NULL )
     {
-        mtime_t i_last_muxing;
-        vlc_mutex_lock( &p_sys->stream_lock );
-        i_last_muxing = p_sys->i_last_muxing;
-        vlc_mutex_unlock( &p_sys->stream_lock );
-
         if ( p_packetizer->fmt.i_cat == VIDEO_ES )
             InputCheckRAP( p_stream, p_out );
+
+        vlc_mutex_lock( &p_sys->stream_lock );
         if ( p_out->i_dts - p_out->i_delay
               < p_sys->i_last_muxing + p_sys->ts.params.i_max_prepare )
             msg_Warn( p_stream, "received late buffer PID %u (%"PRId64")",
@@ -1143,102 +1546,593 @@ static int Send( sout_stream_t *p_stream, sout_stream_id_t *p_input,
                        - p_out->i_dts + p_out->i_delay );
 
         block_FifoPut( p_input->p_fifo, p_out );
+        /* The first block only changes if the queue was empty. */
+        if ( p_input->pi_sched_index[HEAP_DTS] == -1 )
+            MuxSchedule( p_stream, p_input );
 
         if ( p_sys->b_sync )
-        {
-            vlc_mutex_lock( &p_sys->stream_lock );
             vlc_cond_signal( &p_sys->stream_wait );
-            vlc_mutex_unlock( &p_sys->stream_lock );
-        }
-        else
+        vlc_mutex_unlock( &p_sys->stream_lock );
+
+        if ( !p_sys->b_sync )
             MuxAsync( p_stream, false );
     }
+}
+
+/*****************************************************************************
+ * Send: new packet for a PID
+ *****************************************************************************/
+static int Send( sout_stream_t *p_stream, sout_stream_id_t *p_input,
+                 block_t *p_in )
+{
+    ts_input_t *p_packetizer = (ts_input_t *)p_input->p_packetizer;
+
+    for ( block_t *p_block = p_in; p_block != NULL; p_block = p_block->p_next )
+    {
+        if ( p_block->i_dts == VLC_TS_INVALID ||
+             p_block->i_pts == VLC_TS_INVALID )
+        {
+            msg_Warn( p_stream, "packet with invalid timestamp on PID %hu",
+                      p_packetizer->i_pid );
+            block_ChainRelease( p_in );
+            return VLC_SUCCESS;
+        }
+    }
+
+    if ( p_stream->p_sys->p_statmux != NULL )
+        StatmuxAccount( p_stream, p_input, p_in );
+
+    if ( p_input->p_pending != NULL )
+    {
+        block_FifoPut( p_input->p_pending, p_in );
+        WorkersQueue( p_stream, p_input );
+    }
+    else
+        InputPacketize( p_stream, p_input, p_in );
 
     return VLC_SUCCESS;
 }
 
 
 /*
- * Tables
+ * Packetization workers
  */
 
 /*****************************************************************************
- * TableParseConfig: parse the "tables" option, and start PSI tables
+ * WorkerThread: packetize one frame of the first ready input at a time, so
+ * that a large video frame does not delay the other PIDs
  *****************************************************************************/
-static void TableParseConfig( sout_stream_t *p_stream, char *psz_tables )
+static void *WorkerThread( void *data )
 {
-    while ( psz_tables != NULL )
+    sout_stream_t *p_stream = data;
+    sout_stream_sys_t *p_sys = p_stream->p_sys;
+
+    vlc_mutex_lock( &p_sys->worker_lock );
+    for ( ; ; )
     {
-        config_chain_t *p_cfg;
-        char *psz_name, *psz_next;
+        sout_stream_id_t *p_input;
+        block_t *p_in;
 
-        psz_next = config_ChainCreate( &psz_name, &p_cfg, psz_tables );
-        free( psz_tables );
-        psz_tables = psz_next;
+        while ( p_sys->p_first_ready == NULL && !p_sys->b_workers_exit )
+            vlc_cond_wait( &p_sys->worker_wait, &p_sys->worker_lock );
+        if ( p_sys->p_first_ready == NULL )
+            break;
 
-        if ( psz_name != NULL )
-            TableAdd( p_stream, psz_name, p_cfg );
+        p_input = p_sys->p_first_ready;
+        p_sys->p_first_ready = p_input->p_next_ready;
+        if ( p_sys->p_first_ready == NULL )
+            p_sys->pp_last_ready = &p_sys->p_first_ready;
+        vlc_mutex_unlock( &p_sys->worker_lock );
+
+        /* Only one worker owns an input at a time, which keeps its frames
+         * in order. */
+        p_in = block_FifoGet( p_input->p_pending );
+        InputPacketize( p_stream, p_input, p_in );
+
+        vlc_mutex_lock( &p_sys->worker_lock );
+        /* Frames put after the last check are seen here, because the
+         * producer only queues the input if it isn't busy. */
+        if ( block_FifoCount( p_input->p_pending ) )
+        {
+            p_input->p_next_ready = NULL;
+            *p_sys->pp_last_ready = p_input;
+            p_sys->pp_last_ready = &p_input->p_next_ready;
+        }
+        else
+        {
+            p_input->b_busy = false;
+            vlc_cond_broadcast( &p_sys->worker_done );
+        }
     }
+    vlc_mutex_unlock( &p_sys->worker_lock );
+
+    return NULL;
 }
 
 /*****************************************************************************
- * TableAdd: new PSI PID
+ * WorkersStart: spawn the packetization threads
  *****************************************************************************/
-static void TableAdd( sout_stream_t *p_stream, char *psz_name,
-                      config_chain_t *p_cfg )
+static int WorkersStart( sout_stream_t *p_stream, int i_nb_workers )
 {
     sout_stream_sys_t *p_sys = p_stream->p_sys;
-    sout_stream_id_t  *p_table;
-    ts_table_t *p_packetizer;
-
-    p_table = malloc( sizeof( sout_stream_id_t ) );
-    memset( p_table, 0, sizeof( sout_stream_id_t ) );
-    p_table->p_fifo = block_FifoNew();
-    p_table->b_deleted = false;
 
-    p_packetizer = (ts_table_t *)vlc_object_create( p_stream,
-                                                    sizeof(ts_table_t) );
-    p_table->p_packetizer = (ts_packetizer_t *)p_packetizer;
-    vlc_object_attach( p_packetizer, p_stream );
+    p_sys->p_workers = malloc( i_nb_workers * sizeof(vlc_thread_t) );
+    if ( p_sys->p_workers == NULL )
+        return VLC_ENOMEM;
 
-    p_packetizer->p_cfg = p_cfg;
-    p_packetizer->psz_name = psz_name;
-    p_packetizer->p_ts_stream = &p_sys->ts;
-    p_packetizer->p_module =
-        module_need( p_packetizer, "ts packetizer", psz_name, true );
-    if ( p_packetizer->p_module == NULL )
+    while ( p_sys->i_nb_workers < i_nb_workers )
     {
-        free( psz_name );
-        free( p_cfg );
-        vlc_object_release( p_packetizer );
+        if ( vlc_clone( &p_sys->p_workers[p_sys->i_nb_workers], WorkerThread,
+                        p_stream, VLC_THREAD_PRIORITY_INPUT ) )
+        {
+            msg_Err( p_stream, "cannot spawn packetization thread" );
+            break;
+        }
+        p_sys->i_nb_workers++;
+    }
 
-        block_FifoRelease( p_table->p_fifo );
-        free( p_table );
-        return;
+    if ( !p_sys->i_nb_workers )
+    {
+        free( p_sys->p_workers );
+        p_sys->p_workers = NULL;
+        return VLC_EGENERIC;
     }
+    msg_Dbg( p_stream, "started %d packetization threads",
+             p_sys->i_nb_workers );
+    return VLC_SUCCESS;
+}
 
-    p_packetizer->i_pid = PIDAllocate( p_stream, p_table, -1 );
+/*****************************************************************************
+ * WorkersStop: packetize all pending frames and join the threads
+ *****************************************************************************/
+static void WorkersStop( sout_stream_t *p_stream )
+{
+    sout_stream_sys_t *p_sys = p_stream->p_sys;
+    int i;
 
-    vlc_mutex_lock( &p_sys->stream_lock );
-    TAB_APPEND( p_sys->ts.i_nb_tables, p_sys->ts.pp_tables, p_table );
-    vlc_mutex_unlock( &p_sys->stream_lock );
+    if ( !p_sys->i_nb_workers )
+        return;
 
-    msg_Dbg( p_stream, "adding PID %u (%s)", p_packetizer->i_pid,
-             psz_name );
+    vlc_mutex_lock( &p_sys->worker_lock );
+    p_sys->b_workers_exit = true;
+    vlc_cond_broadcast( &p_sys->worker_wait );
+    vlc_mutex_unlock( &p_sys->worker_lock );
+
+    for ( i = 0; i < p_sys->i_nb_workers; i++ )
+        vlc_join( p_sys->p_workers[i], NULL );
+    free( p_sys->p_workers );
+    p_sys->p_workers = NULL;
+    p_sys->i_nb_workers = 0;
 }
 
 /*****************************************************************************
- * TableDel: remove PSI PID / called with stream_lock
+ * WorkersWait: wait until all frames of an input are packetized
  *****************************************************************************/
-static void TableDel( sout_stream_t *p_stream, sout_stream_id_t *p_table )
+static void WorkersWait( sout_stream_t *p_stream, sout_stream_id_t *p_input )
 {
     sout_stream_sys_t *p_sys = p_stream->p_sys;
-    ts_table_t *p_packetizer = (ts_table_t *)p_table->p_packetizer;
 
-    msg_Dbg( p_stream, "removing PID %u (%s)",
-             p_packetizer->i_pid, p_packetizer->psz_name );
+    if ( p_input->p_pending == NULL )
+        return;
+
+    vlc_mutex_lock( &p_sys->worker_lock );
+    while ( p_input->b_busy )
+        vlc_cond_wait( &p_sys->worker_done, &p_sys->worker_lock );
+    vlc_mutex_unlock( &p_sys->worker_lock );
+}
+
+/*****************************************************************************
+ * WorkersQueue: signal the workers that an input has pending frames
+ *****************************************************************************/
+static void WorkersQueue( sout_stream_t *p_stream, sout_stream_id_t *p_input )
+{
+    sout_stream_sys_t *p_sys = p_stream->p_sys;
+
+    vlc_mutex_lock( &p_sys->worker_lock );
+    if ( !p_input->b_busy )
+    {
+        p_input->b_busy = true;
+        p_input->p_next_ready = NULL;
+        *p_sys->pp_last_ready = p_input;
+        p_sys->pp_last_ready = &p_input->p_next_ready;
+        vlc_cond_signal( &p_sys->worker_wait );
+    }
+    vlc_mutex_unlock( &p_sys->worker_lock );
+}
+
+
+/*
+ * Statistical multiplexing
+ */
+
+/*****************************************************************************
+ * StatmuxAllocate: share the rate of the group according to the weights /
+ * called with the statmux lock
+ *****************************************************************************/
+static void StatmuxAllocate( statmux_t *p_statmux )
+{
+    uint64_t i_overhead = 0;
+    double f_total_weight = 0.;
+    int i;
+
+    for ( i = 0; i < p_statmux->i_nb_members; i++ )
+    {
+        i_overhead += p_statmux->pp_members[i]->i_overhead;
+        f_total_weight += p_statmux->pp_members[i]->f_weight;
+    }
+
+    for ( i = 0; i < p_statmux->i_nb_members; i++ )
+    {
+        statmux_member_t *p_member = p_statmux->pp_members[i];
+        uint64_t i_share;
+
+        if ( i_overhead >= p_statmux->i_total_rate )
+        {
+            /* Nothing to redistribute. */
+            p_member->i_rate = p_statmux->i_total_rate
+                                / p_statmux->i_nb_members;
+            p_member->i_video_rate = 0;
+            continue;
+        }
+
+        /* Newcomers get an equal share until they report. */
+        if ( f_total_weight > 0. && p_member->f_weight > 0. )
+            i_share = (p_statmux->i_total_rate - i_overhead)
+                       * p_member->f_weight / f_total_weight;
+        else
+            i_share = (p_statmux->i_total_rate - i_overhead)
+                       / p_statmux->i_nb_members;
+        p_member->i_rate = p_member->i_overhead + i_share;
+        p_member->i_video_rate = i_share * (TS_SIZE - TS_HEADER_SIZE)
+                                  / TS_SIZE;
+    }
+}
+
+/*****************************************************************************
+ * StatmuxRelease: destroy the group if it has no member anymore / called
+ * with the statmux lock
+ *****************************************************************************/
+static void StatmuxRelease( sout_stream_t *p_stream, statmux_t *p_statmux )
+{
+    if ( p_statmux->i_nb_members )
+        return;
+
+    var_SetAddress( p_stream->p_libvlc, p_statmux->psz_name, NULL );
+    var_Destroy( p_stream->p_libvlc, p_statmux->psz_name );
+    free( p_statmux->psz_name );
+    free( p_statmux );
+}
+
+/*****************************************************************************
+ * StatmuxJoin: register with the statmux group, creating it if needed
+ *****************************************************************************/
+static int StatmuxJoin( sout_stream_t *p_stream, const char *psz_name,
+                        unsigned int i_total_rate )
+{
+    sout_stream_sys_t *p_sys = p_stream->p_sys;
+    statmux_t *p_statmux;
+    statmux_member_t *p_member;
+    char *psz_var;
+    vlc_value_t val;
+
+    if ( asprintf( &psz_var, "ts-statmux-%s", psz_name ) == -1 )
+        return VLC_ENOMEM;
+
+    var_Create( p_stream->p_libvlc, "ts-statmux-lock", VLC_VAR_MUTEX );
+    var_Get( p_stream->p_libvlc, "ts-statmux-lock", &val );
+    p_sys->p_statmux_lock = val.p_address;
+
+    vlc_mutex_lock( p_sys->p_statmux_lock );
+    p_statmux = var_GetAddress( p_stream->p_libvlc, psz_var );
+    if ( p_statmux == NULL )
+    {
+        if ( !i_total_rate )
+        {
+            vlc_mutex_unlock( p_sys->p_statmux_lock );
+            msg_Err( p_stream, "you must specify the rate of statmux group %s",
+                     psz_name );
+            free( psz_var );
+            return VLC_EGENERIC;
+        }
+
+        p_statmux = malloc( sizeof(statmux_t) );
+        if ( p_statmux == NULL )
+        {
+            vlc_mutex_unlock( p_sys->p_statmux_lock );
+            free( psz_var );
+            return VLC_ENOMEM;
+        }
+        p_statmux->psz_name = psz_var;
+        p_statmux->i_total_rate = i_total_rate;
+        p_statmux->pp_members = NULL;
+        p_statmux->i_nb_members = 0;
+        var_Create( p_stream->p_libvlc, psz_var, VLC_VAR_ADDRESS );
+        var_SetAddress( p_stream->p_libvlc, psz_var, p_statmux );
+        msg_Dbg( p_stream, "creating statmux group %s at %u bi/s",
+                 psz_name, i_total_rate );
+    }
+    else
+    {
+        if ( i_total_rate && i_total_rate != p_statmux->i_total_rate )
+            msg_Warn( p_stream, "statmux group %s already runs at %u bi/s",
+                      psz_name, p_statmux->i_total_rate );
+        free( psz_var );
+    }
+
+    p_member = malloc( sizeof(statmux_member_t) );
+    if ( p_member == NULL )
+    {
+        StatmuxRelease( p_stream, p_statmux );
+        vlc_mutex_unlock( p_sys->p_statmux_lock );
+        return VLC_ENOMEM;
+    }
+    p_member->p_stream = p_stream;
+    p_member->i_overhead = 0;
+    p_member->f_weight = 0.;
+    TAB_APPEND( p_statmux->i_nb_members, p_statmux->pp_members, p_member );
+    StatmuxAllocate( p_statmux );
+
+    /* The rate is now driven by the group. */
+    p_sys->b_auto_muxrate = false;
+    if ( p_sys->b_auto_muxmode )
+    {
+        p_sys->b_auto_muxmode = false;
+        p_sys->i_muxmode = MODE_CAPPED;
+    }
+    p_sys->i_muxrate = (p_member->i_rate + 7) / 8;
+    MuxValidateParams( p_stream );
+    vlc_mutex_unlock( p_sys->p_statmux_lock );
+
+    p_sys->p_statmux = p_statmux;
+    p_sys->p_statmux_member = p_member;
+    msg_Dbg( p_stream, "joining statmux group %s at %u bi/s",
+             psz_name, p_member->i_rate );
+    return VLC_SUCCESS;
+}
+
+/*****************************************************************************
+ * StatmuxLeave: unregister from the statmux group
+ *****************************************************************************/
+static void StatmuxLeave( sout_stream_t *p_stream )
+{
+    sout_stream_sys_t *p_sys = p_stream->p_sys;
+    statmux_t *p_statmux = p_sys->p_statmux;
+
+    if ( p_statmux == NULL )
+        return;
+
+    vlc_mutex_lock( p_sys->p_statmux_lock );
+    TAB_REMOVE( p_statmux->i_nb_members, p_statmux->pp_members,
+                p_sys->p_statmux_member );
+    free( p_sys->p_statmux_member );
+    StatmuxRelease( p_stream, p_statmux );
+    /* The others get the rate back at their next GOP. */
+    vlc_mutex_unlock( p_sys->p_statmux_lock );
+
+    if ( p_sys->psz_statmux_service != NULL )
+    {
+        var_Destroy( p_stream->p_libvlc, p_sys->psz_statmux_service );
+        free( p_sys->psz_statmux_service );
+    }
+    p_sys->p_statmux = NULL;
+    p_sys->p_statmux_member = NULL;
+}
+
+/*****************************************************************************
+ * StatmuxReport: report the complexity of a GOP, and apply the new share of
+ * the group
+ *****************************************************************************/
+static void StatmuxReport( sout_stream_t *p_stream, uint64_t i_size,
+                           mtime_t i_length, mtime_t i_cpb_delay )
+{
+    sout_stream_sys_t *p_sys = p_stream->p_sys;
+    statmux_member_t *p_member = p_sys->p_statmux_member;
+    ts_input_t *p_packetizer;
+    unsigned int i_overhead, i_rate, i_video_rate;
+    mtime_t i_cpb_length = 0;
+    double f_weight;
+    bool b_vbr = false;
+
+    vlc_mutex_lock( &p_sys->stream_lock );
+    if ( p_sys->p_statmux_input == NULL )
+    {
+        vlc_mutex_unlock( &p_sys->stream_lock );
+        return;
+    }
+    i_overhead = MuxTotalBitrate( p_stream, p_sys->p_statmux_input, &b_vbr );
+    p_packetizer = (ts_input_t *)p_sys->p_statmux_input->p_packetizer;
+    if ( p_packetizer->fmt.i_bitrate )
+        i_cpb_length = p_packetizer->fmt.video.i_cpb_buffer
+                        * INT64_C(1000000) / p_packetizer->fmt.i_bitrate;
+    vlc_mutex_unlock( &p_sys->stream_lock );
+
+    /* The complexity is the bitrate the encoder used for this GOP; it is
+     * boosted when the CPB is lower than half-full, ie. the encoder is
+     * starving, and lowered when it is fuller. */
+    f_weight = (double)i_size * 8000000. / i_length;
+    if ( i_cpb_length && i_cpb_delay > 0 )
+    {
+        double f_boost = (double)i_cpb_length / 2. / i_cpb_delay;
+        if ( f_boost > STATMUX_MAX_BOOST )
+            f_boost = STATMUX_MAX_BOOST;
+        else if ( f_boost < 1. / STATMUX_MAX_BOOST )
+            f_boost = 1. / STATMUX_MAX_BOOST;
+        f_weight *= f_boost;
+    }
+    else if ( i_cpb_length )
+        f_weight *= STATMUX_MAX_BOOST;
+
+    vlc_mutex_lock( p_sys->p_statmux_lock );
+    p_member->i_overhead = i_overhead;
+    if ( p_member->f_weight > 0. )
+        p_member->f_weight += (f_weight - p_member->f_weight)
+                               / STATMUX_SMOOTHING;
+    else
+        p_member->f_weight = f_weight;
+    StatmuxAllocate( p_sys->p_statmux );
+    i_rate = p_member->i_rate;
+    i_video_rate = p_member->i_video_rate;
+    vlc_mutex_unlock( p_sys->p_statmux_lock );
+
+    vlc_mutex_lock( &p_sys->stream_lock );
+    if ( (i_rate + 7) / 8 != p_sys->i_muxrate )
+    {
+        unsigned int i_muxrate = (i_rate + 7) / 8;
+        /* Keep the sub-microsecond part of the muxing date. */
+        p_sys->i_last_muxing_remainder = p_sys->i_last_muxing_remainder
+                                          * i_muxrate / p_sys->i_muxrate;
+        p_sys->i_muxrate = i_muxrate;
+        MuxValidateParams( p_stream );
+    }
+    vlc_mutex_unlock( &p_sys->stream_lock );
+
+    msg_Dbg( p_stream, "statmux: GOP at %"PRIu64" bi/s, new rate %u bi/s (video %u bi/s)",
+             i_size * 8000000 / i_length, i_rate, i_video_rate );
+
+    if ( p_sys->psz_statmux_service != NULL && i_video_rate )
+        var_SetInteger( p_stream->p_libvlc, p_sys->psz_statmux_service,
+                        i_video_rate );
+}
+
+/*****************************************************************************
+ * StatmuxAccount: measure the GOPs of the video input / called from Send
+ *****************************************************************************
+ * The GOP state is reset by InputDelete(), which may run in the mux thread,
+ * so it is handled with stream_lock; the report is made without it.
+ *****************************************************************************/
+static void StatmuxAccount( sout_stream_t *p_stream,
+                            sout_stream_id_t *p_input, block_t *p_in )
+{
+    sout_stream_sys_t *p_sys = p_stream->p_sys;
+
+    for ( ; p_in != NULL; p_in = p_in->p_next )
+    {
+        uint64_t i_size = 0;
+        mtime_t i_length = 0, i_cpb_delay = 0;
+
+        vlc_mutex_lock( &p_sys->stream_lock );
+        if ( p_input != p_sys->p_statmux_input )
+        {
+            vlc_mutex_unlock( &p_sys->stream_lock );
+            return;
+        }
+        if ( p_in->i_flags & BLOCK_FLAG_TYPE_I )
+        {
+            if ( p_sys->i_gop_start != VLC_TS_INVALID
+                  && p_in->i_dts > p_sys->i_gop_start )
+            {
+                i_size = p_sys->i_gop_size;
+                i_length = p_in->i_dts - p_sys->i_gop_start;
+                i_cpb_delay = p_sys->i_gop_cpb_delay;
+            }
+            p_sys->i_gop_start = p_in->i_dts;
+            p_sys->i_gop_cpb_delay = p_in->i_delay;
+            p_sys->i_gop_size = 0;
+        }
+        if ( p_sys->i_gop_start != VLC_TS_INVALID )
+            p_sys->i_gop_size += p_in->i_buffer;
+        vlc_mutex_unlock( &p_sys->stream_lock );
+
+        if ( i_length )
+            StatmuxReport( p_stream, i_size, i_length, i_cpb_delay );
+    }
+}
+
+
+/*
+ * Tables
+ */
+
+/*****************************************************************************
+ * TableParseConfig: parse the "tables" option, and start PSI tables
+ *****************************************************************************/
+static void TableParseConfig( sout_stream_t *p_stream, char *psz_tables )
+{
+    while ( psz_tables != NULL )
+    {
+        config_chain_t *p_cfg;
+        char *psz_name, *psz_next;
+
+        psz_next = config_ChainCreate( &psz_name, &p_cfg, psz_tables );
+        free( psz_tables );
+        psz_tables = psz_next;
+
+        if ( psz_name != NULL )
+            TableAdd( p_stream, psz_name, p_cfg );
+    }
+}
+
+/*****************************************************************************
+ * TableAdd: new PSI PID
+ *****************************************************************************/
+static void TableAdd( sout_stream_t *p_stream, char *psz_name,
+                      config_chain_t *p_cfg )
+{
+    sout_stream_sys_t *p_sys = p_stream->p_sys;
+    sout_stream_id_t  *p_table;
+    ts_table_t *p_packetizer;
+
+    vlc_mutex_lock( &p_sys->stream_lock );
+    int i_ret = MuxReserve( p_stream );
+    vlc_mutex_unlock( &p_sys->stream_lock );
+    if ( i_ret != VLC_SUCCESS )
+    {
+        free( psz_name );
+        free( p_cfg );
+        return;
+    }
+
+    p_table = malloc( sizeof( sout_stream_id_t ) );
+    memset( p_table, 0, sizeof( sout_stream_id_t ) );
+    p_table->p_fifo = block_FifoNew();
+    p_table->b_deleted = false;
+    p_table->pi_sched_index[HEAP_MUXING] = p_table->pi_sched_index[HEAP_DTS] = -1;
+
+    p_packetizer = (ts_table_t *)vlc_object_create( p_stream,
+                                                    sizeof(ts_table_t) );
+    p_table->p_packetizer = (ts_packetizer_t *)p_packetizer;
+    vlc_object_attach( p_packetizer, p_stream );
+
+    p_packetizer->p_cfg = p_cfg;
+    p_packetizer->psz_name = psz_name;
+    p_packetizer->p_ts_stream = &p_sys->ts;
+    p_packetizer->p_module =
+        module_need( p_packetizer, "ts packetizer", psz_name, true );
+    if ( p_packetizer->p_module == NULL )
+    {
+        free( psz_name );
+        free( p_cfg );
+        vlc_object_release( p_packetizer );
+
+        block_FifoRelease( p_table->p_fifo );
+        free( p_table );
+        return;
+    }
+
+    p_packetizer->i_pid = PIDAllocate( p_stream, p_table, -1 );
+
+    vlc_mutex_lock( &p_sys->stream_lock );
+    TAB_APPEND( p_sys->ts.i_nb_tables, p_sys->ts.pp_tables, p_table );
+    p_table->i_sched_rank = p_sys->i_next_sched_rank++;
+    vlc_mutex_unlock( &p_sys->stream_lock );
+
+    msg_Dbg( p_stream, "adding PID %u (%s)", p_packetizer->i_pid,
+             psz_name );
+}
+
+/*****************************************************************************
+ * TableDel: remove PSI PID / called with stream_lock
+ *****************************************************************************/
+static void TableDel( sout_stream_t *p_stream, sout_stream_id_t *p_table )
+{
+    sout_stream_sys_t *p_sys = p_stream->p_sys;
+    ts_table_t *p_packetizer = (ts_table_t *)p_table->p_packetizer;
+
+    msg_Dbg( p_stream, "removing PID %u (%s)",
+             p_packetizer->i_pid, p_packetizer->psz_name );
 
     TAB_REMOVE( p_sys->ts.i_nb_tables, p_sys->ts.pp_tables, p_table );
+    MuxUnschedule( p_stream, p_table );
 
     module_unneed( p_packetizer, p_packetizer->p_module );
     free( p_packetizer->p_cfg );
@@ -1274,11 +2168,229 @@ static void TableSend( sout_stream_t *p_stream )
                            + p_sys->ts.params.i_max_prepare
                            - p_out->i_dts + p_out->i_delay );
             block_FifoPut( p_table->p_fifo, p_out );
+            if ( p_table->pi_sched_index[HEAP_DTS] == -1 )
+                MuxSchedule( p_stream, p_table );
         }
     }
 }
 
 
+/*
+ * Scheduler
+ */
+
+/*****************************************************************************
+ * HeapBefore: compare two queues in a heap
+ *****************************************************************************/
+static inline bool HeapBefore( const mux_heap_t *p_heap,
+                               const sout_stream_id_t *p_queue1,
+                               const sout_stream_id_t *p_queue2 )
+{
+    mtime_t i_key1, i_key2;
+
+    if ( p_heap->i_type == HEAP_MUXING )
+    {
+        i_key1 = p_queue1->i_sched_muxing;
+        i_key2 = p_queue2->i_sched_muxing;
+    }
+    else
+    {
+        i_key1 = p_queue1->i_sched_dts;
+        i_key2 = p_queue2->i_sched_dts;
+    }
+
+    /* Tables are created first, so we send PAT before PMT. */
+    return i_key1 < i_key2
+            || (i_key1 == i_key2 && p_queue1->i_sched_rank < p_queue2->i_sched_rank);
+}
+
+/*****************************************************************************
+ * HeapSet: put a queue at a given position in a heap
+ *****************************************************************************/
+static inline void HeapSet( mux_heap_t *p_heap, int i_index,
+                            sout_stream_id_t *p_queue )
+{
+    p_heap->pp_queues[i_index] = p_queue;
+    p_queue->pi_sched_index[p_heap->i_type] = i_index;
+}
+
+/*****************************************************************************
+ * HeapTop: return the first queue of a heap, or NULL
+ *****************************************************************************/
+static inline sout_stream_id_t *HeapTop( const mux_heap_t *p_heap )
+{
+    return p_heap->i_nb_queues ? p_heap->pp_queues[0] : NULL;
+}
+
+/*****************************************************************************
+ * HeapUpdate: restore the heap property after the key of a queue changed
+ *****************************************************************************/
+static void HeapUpdate( mux_heap_t *p_heap, sout_stream_id_t *p_queue )
+{
+    int i_index = p_queue->pi_sched_index[p_heap->i_type];
+
+    while ( i_index > 0 )
+    {
+        int i_parent = (i_index - 1) / 2;
+        if ( !HeapBefore( p_heap, p_queue, p_heap->pp_queues[i_parent] ) )
+            break;
+        HeapSet( p_heap, i_index, p_heap->pp_queues[i_parent] );
+        i_index = i_parent;
+    }
+
+    for ( ; ; )
+    {
+        int i_child = 2 * i_index + 1;
+        if ( i_child >= p_heap->i_nb_queues )
+            break;
+        if ( i_child + 1 < p_heap->i_nb_queues
+              && HeapBefore( p_heap, p_heap->pp_queues[i_child + 1],
+                             p_heap->pp_queues[i_child] ) )
+            i_child++;
+        if ( !HeapBefore( p_heap, p_heap->pp_queues[i_child], p_queue ) )
+            break;
+        HeapSet( p_heap, i_index, p_heap->pp_queues[i_child] );
+        i_index = i_child;
+    }
+
+    HeapSet( p_heap, i_index, p_queue );
+}
+
+/*****************************************************************************
+ * HeapReserve: make room for i_count queues in a heap
+ *****************************************************************************/
+static int HeapReserve( mux_heap_t *p_heap, int i_count )
+{
+    sout_stream_id_t **pp_queues;
+    int i_max_queues = p_heap->i_max_queues ? p_heap->i_max_queues : 16;
+
+    if ( i_count <= p_heap->i_max_queues )
+        return VLC_SUCCESS;
+
+    while ( i_max_queues < i_count )
+        i_max_queues *= 2;
+    pp_queues = realloc( p_heap->pp_queues,
+                         i_max_queues * sizeof(sout_stream_id_t *) );
+    if ( pp_queues == NULL )
+        return VLC_ENOMEM;
+
+    p_heap->pp_queues = pp_queues;
+    p_heap->i_max_queues = i_max_queues;
+    return VLC_SUCCESS;
+}
+
+/*****************************************************************************
+ * HeapInsert: add a queue to a heap, which MuxReserve() made room for
+ *****************************************************************************/
+static void HeapInsert( mux_heap_t *p_heap, sout_stream_id_t *p_queue )
+{
+    assert( p_heap->i_nb_queues < p_heap->i_max_queues );
+
+    HeapSet( p_heap, p_heap->i_nb_queues++, p_queue );
+    HeapUpdate( p_heap, p_queue );
+}
+
+/*****************************************************************************
+ * HeapRemove: remove a queue from a heap
+ *****************************************************************************/
+static void HeapRemove( mux_heap_t *p_heap, sout_stream_id_t *p_queue )
+{
+    int i_index = p_queue->pi_sched_index[p_heap->i_type];
+    sout_stream_id_t *p_last = p_heap->pp_queues[--p_heap->i_nb_queues];
+
+    p_queue->pi_sched_index[p_heap->i_type] = -1;
+    if ( p_last != p_queue )
+    {
+        HeapSet( p_heap, i_index, p_last );
+        HeapUpdate( p_heap, p_last );
+    }
+}
+
+/*****************************************************************************
+ * MuxReserve: make room for one more queue in every heap, so that
+ * scheduling a queue never fails / called with stream_lock
+ *****************************************************************************/
+static int MuxReserve( sout_stream_t *p_stream )
+{
+    sout_stream_sys_t *p_sys = p_stream->p_sys;
+    int i_count = p_sys->ts.i_nb_tables + p_sys->ts.i_nb_inputs + 1;
+
+    for ( int i = 0; i < NB_PRIORITIES; i++ )
+        if ( HeapReserve( &p_sys->p_muxing_heaps[i], i_count ) )
+            return VLC_ENOMEM;
+    return HeapReserve( &p_sys->dts_heap, i_count );
+}
+
+/*****************************************************************************
+ * MuxSchedule: update the position of a queue after its first block, its
+ * min muxing timestamp or its priority changed / called with stream_lock
+ *****************************************************************************/
+static void MuxSchedule( sout_stream_t *p_stream, sout_stream_id_t *p_queue )
+{
+    sout_stream_sys_t *p_sys = p_stream->p_sys;
+    unsigned int i_priority = __MIN( p_queue->p_packetizer->i_priority,
+                                     NB_PRIORITIES - 1 );
+    block_t *p_block;
+
+    vlc_mutex_lock( &p_queue->p_fifo->lock );
+    p_block = p_queue->p_fifo->p_first;
+    vlc_mutex_unlock( &p_queue->p_fifo->lock );
+
+    if ( p_queue->pi_sched_index[HEAP_MUXING] != -1
+          && (p_block == NULL || i_priority != p_queue->i_sched_priority) )
+        HeapRemove( &p_sys->p_muxing_heaps[p_queue->i_sched_priority],
+                    p_queue );
+
+    if ( p_block == NULL )
+    {
+        if ( p_queue->pi_sched_index[HEAP_DTS] != -1 )
+            HeapRemove( &p_sys->dts_heap, p_queue );
+        return;
+    }
+
+    p_queue->i_sched_muxing = __MAX(p_block->i_dts - p_block->i_delay,
+                                    p_queue->i_min_muxing);
+    p_queue->i_sched_dts = p_block->i_dts;
+    p_queue->i_sched_priority = i_priority;
+
+    if ( p_queue->pi_sched_index[HEAP_MUXING] == -1 )
+        HeapInsert( &p_sys->p_muxing_heaps[i_priority], p_queue );
+    else
+        HeapUpdate( &p_sys->p_muxing_heaps[i_priority], p_queue );
+
+    if ( p_queue->pi_sched_index[HEAP_DTS] == -1 )
+        HeapInsert( &p_sys->dts_heap, p_queue );
+    else
+        HeapUpdate( &p_sys->dts_heap, p_queue );
+}
+
+/*****************************************************************************
+ * MuxUnschedule: forget about a queue that is being deleted / called with
+ * stream_lock
+ *****************************************************************************/
+static void MuxUnschedule( sout_stream_t *p_stream, sout_stream_id_t *p_queue )
+{
+    sout_stream_sys_t *p_sys = p_stream->p_sys;
+    sout_stream_id_t **pp_dirty = &p_sys->p_dirty_queues;
+
+    if ( p_queue->pi_sched_index[HEAP_MUXING] != -1 )
+        HeapRemove( &p_sys->p_muxing_heaps[p_queue->i_sched_priority],
+                    p_queue );
+    if ( p_queue->pi_sched_index[HEAP_DTS] != -1 )
+        HeapRemove( &p_sys->dts_heap, p_queue );
+
+    while ( *pp_dirty != NULL )
+    {
+        if ( *pp_dirty == p_queue )
+        {
+            *pp_dirty = p_queue->p_sched_next_dirty;
+            break;
+        }
+        pp_dirty = &(*pp_dirty)->p_sched_next_dirty;
+    }
+}
+
+
 /*
  * Muxing
  */
@@ -1304,13 +2416,14 @@ static void MuxValidateParams( sout_stream_t *p_stream )
 }
 
 /*****************************************************************************
- * MuxCheckMode: automatically choose appropriate operating mode / called with
- * stream_lock
+ * MuxTotalBitrate: sum the bitrates of the tables and inputs (but one) /
+ * called with stream_lock
  *****************************************************************************/
-static void MuxCheckMode( sout_stream_t *p_stream )
+static unsigned int MuxTotalBitrate( sout_stream_t *p_stream,
+                                     sout_stream_id_t *p_exclude,
+                                     bool *pb_mode_vbr )
 {
     sout_stream_sys_t *p_sys = p_stream->p_sys;
-    bool b_mode_vbr = false;
     unsigned int i_total_bitrate = 0;
     int i;
 
@@ -1325,8 +2438,10 @@ static void MuxCheckMode( sout_stream_t *p_stream )
     {
         sout_stream_id_t *p_input = p_sys->ts.pp_inputs[i];
         ts_input_t *p_packetizer = (ts_input_t *)p_input->p_packetizer;
-        if ( !p_packetizer->i_total_bitrate )
-            b_mode_vbr = true;
+        if ( p_input == p_exclude )
+            ;
+        else if ( !p_packetizer->i_total_bitrate )
+            *pb_mode_vbr = true;
         else
             i_total_bitrate += p_packetizer->i_total_bitrate;
         if ( p_packetizer->i_pcr_period )
@@ -1335,7 +2450,19 @@ static void MuxCheckMode( sout_stream_t *p_stream )
                 / p_packetizer->i_pcr_period;
     }
 
-    i_total_bitrate += p_sys->i_padding_bitrate;
+    return i_total_bitrate + p_sys->i_padding_bitrate;
+}
+
+/*****************************************************************************
+ * MuxCheckMode: automatically choose appropriate operating mode / called with
+ * stream_lock
+ *****************************************************************************/
+static void MuxCheckMode( sout_stream_t *p_stream )
+{
+    sout_stream_sys_t *p_sys = p_stream->p_sys;
+    bool b_mode_vbr = false;
+    unsigned int i_total_bitrate = MuxTotalBitrate( p_stream, NULL,
+                                                    &b_mode_vbr );
 
     if ( p_sys->b_auto_muxmode )
         p_sys->i_muxmode = b_mode_vbr ? MODE_VBR : MODE_CAPPED;
@@ -1409,36 +2536,6 @@ static mtime_t MuxCheckAsync( sout_stream_t *p_stream )
     return i_max_muxing;
 }
 
-#define FOREACH_QUEUE( CMD )                                                \
-    int i;                                                                  \
-    /* Tables are in ascending order so that we send PAT before PMT;        \
-     * inputs are in descending order so that we can delete an input without\
-     * changing the iterator. */                                            \
-                                                                            \
-    for ( i = 0; i < p_sys->ts.i_nb_tables; i++ )                           \
-    {                                                                       \
-        sout_stream_id_t *p_queue = p_sys->ts.pp_tables[i];                 \
-        block_t *p_block;                                                   \
-                                                                            \
-        vlc_mutex_lock( &p_queue->p_fifo->lock );                           \
-        p_block = p_queue->p_fifo->p_first;                                 \
-        vlc_mutex_unlock( &p_queue->p_fifo->lock );                         \
-                                                                            \
-        CMD                                                                 \
-    }                                                                       \
-                                                                            \
-    for ( i = p_sys->ts.i_nb_inputs - 1; i >= 0; i-- )                      \
-    {                                                                       \
-        sout_stream_id_t *p_queue = p_sys->ts.pp_inputs[i];                 \
-        block_t *p_block;                                                   \
-                                                                            \
-        vlc_mutex_lock( &p_queue->p_fifo->lock );                           \
-        p_block = p_queue->p_fifo->p_first;                                 \
-        vlc_mutex_unlock( &p_queue->p_fifo->lock );                         \
-                                                                            \
-        CMD                                                                 \
-    }
-
 /*****************************************************************************
  * MuxShow: return muxing date of the next available TS / called with
  * stream_lock
@@ -1447,79 +2544,107 @@ static mtime_t MuxShow( sout_stream_t *p_stream )
 {
     sout_stream_sys_t *p_sys = p_stream->p_sys;
     mtime_t i_min_muxing = -1;
+    int i;
 
-#define CMD                                                                 \
-    if ( p_block != NULL )                                                  \
-    {                                                                       \
-        mtime_t i_muxing = __MAX(p_block->i_dts - p_block->i_delay,         \
-                                 p_queue->i_min_muxing);                    \
-        if ( i_min_muxing == -1 || i_muxing < i_min_muxing )                \
-            i_min_muxing = i_muxing;                                        \
+    for ( i = 0; i < NB_PRIORITIES; i++ )
+    {
+        sout_stream_id_t *p_queue = HeapTop( &p_sys->p_muxing_heaps[i] );
+        if ( p_queue != NULL && (i_min_muxing == -1
+                                  || p_queue->i_sched_muxing < i_min_muxing) )
+            i_min_muxing = p_queue->i_sched_muxing;
     }
-    FOREACH_QUEUE( CMD )
-#undef CMD
 
     return i_min_muxing;
 }
 
 /*****************************************************************************
  * MuxGet: return next queue to be muxed / called with stream_lock
+ *****************************************************************************
+ * The order is not exactly the one of the former linear scan of the tables
+ * then the inputs:
+ *  - the emergency case returns the queue with the earliest overdue DTS,
+ *    not the first overdue queue in table/input order;
+ *  - otherwise the highest priority eligible queue always wins, whereas the
+ *    scan let a later queue with an earlier muxing date displace it;
+ *  - ties on the date go to the queue added first (i_sched_rank), which for
+ *    the scan was the first in table/input order; they differ once inputs
+ *    have been deleted and the arrays reordered.
  *****************************************************************************/
 static sout_stream_id_t *MuxGet( sout_stream_t *p_stream )
 {
     sout_stream_sys_t *p_sys = p_stream->p_sys;
-    mtime_t i_min_muxing = -1;
     mtime_t i_emergency_muxing = p_sys->i_last_muxing
                                   + p_sys->ts.params.i_packet_interval;
-    unsigned int i_priority = TSPACK_PRIORITY_NONE;
-    sout_stream_id_t *p_next_queue = NULL;
-
-#define CMD                                                                 \
-    if ( p_block != NULL )                                                  \
-    {                                                                       \
-        mtime_t i_muxing = __MAX(p_block->i_dts - p_block->i_delay,         \
-                                 p_queue->i_min_muxing);                    \
-        if ( (i_min_muxing == -1 || i_muxing < i_min_muxing                 \
-               || p_queue->p_packetizer->i_priority > i_priority)           \
-              && i_muxing <= p_sys->i_last_muxing )                         \
-        {                                                                   \
-            i_min_muxing = i_muxing;                                        \
-            i_priority = p_queue->p_packetizer->i_priority;                 \
-            p_next_queue = p_queue;                                         \
-        }                                                                   \
-                                                                            \
-        if ( p_block->i_dts <= i_emergency_muxing )                         \
-            return p_queue;                                                 \
-    }                                                                       \
-    else if ( p_queue->b_deleted )                                          \
-        InputDelete( p_stream, p_queue );
-    FOREACH_QUEUE( CMD )
-#undef CMD
-
-    return p_next_queue;
-}
-
-/*****************************************************************************
- * MuxFixQueues: update min muxing timestamp of each queue wrt. to the peak
- * bitrate, to be T-STD-compliant / called with stream_lock
+    sout_stream_id_t *p_queue;
+    int i;
+
+    p_queue = HeapTop( &p_sys->dts_heap );
+    if ( p_queue != NULL && p_queue->i_sched_dts <= i_emergency_muxing )
+        return p_queue;
+
+    /* Highest priority first, then earliest muxing date. */
+    for ( i = NB_PRIORITIES - 1; i >= 0; i-- )
+    {
+        p_queue = HeapTop( &p_sys->p_muxing_heaps[i] );
+        if ( p_queue != NULL && p_queue->i_sched_muxing <= p_sys->i_last_muxing )
+            return p_queue;
+    }
+
+    return NULL;
+}
+
+/*****************************************************************************
+ * MuxDequeue: get the first block of a queue / called with stream_lock
  *****************************************************************************/
-static void MuxFixQueues( sout_stream_t *p_stream )
+static block_t *MuxDequeue( sout_stream_t *p_stream, sout_stream_id_t *p_queue )
 {
     sout_stream_sys_t *p_sys = p_stream->p_sys;
+    block_t *p_block = block_FifoGet( p_queue->p_fifo );
 
-#define CMD                                                                 \
-    if ( p_queue->p_packetizer->i_peak_bitrate && p_queue->i_muxed_size )   \
-    {                                                                       \
-        p_queue->i_min_muxing = p_sys->i_last_muxing                        \
-            + p_queue->i_muxed_size * INT64_C(8000000)                         \
-            / p_queue->p_packetizer->i_peak_bitrate;                        \
-        p_queue->i_muxed_size = 0;                                          \
+    if ( !p_queue->b_sched_dirty )
+    {
+        p_queue->b_sched_dirty = true;
+        p_queue->p_sched_next_dirty = p_sys->p_dirty_queues;
+        p_sys->p_dirty_queues = p_queue;
     }
-    FOREACH_QUEUE( CMD )
-#undef CMD
+    MuxSchedule( p_stream, p_queue );
+
+    return p_block;
 }
 
-#undef FOREACH_QUEUE
+/*****************************************************************************
+ * MuxFixQueues: update min muxing timestamp of each muxed queue wrt. to the
+ * peak bitrate, to be T-STD-compliant, and remove deleted queues / called
+ * with stream_lock
+ *****************************************************************************/
+static void MuxFixQueues( sout_stream_t *p_stream )
+{
+    sout_stream_sys_t *p_sys = p_stream->p_sys;
+    sout_stream_id_t *p_queue = p_sys->p_dirty_queues;
+
+    p_sys->p_dirty_queues = NULL;
+
+    while ( p_queue != NULL )
+    {
+        sout_stream_id_t *p_next = p_queue->p_sched_next_dirty;
+        p_queue->b_sched_dirty = false;
+        p_queue->p_sched_next_dirty = NULL;
+
+        if ( p_queue->p_packetizer->i_peak_bitrate && p_queue->i_muxed_size )
+        {
+            p_queue->i_min_muxing = p_sys->i_last_muxing
+                + p_queue->i_muxed_size * INT64_C(8000000)
+                / p_queue->p_packetizer->i_peak_bitrate;
+            p_queue->i_muxed_size = 0;
+            MuxSchedule( p_stream, p_queue );
+        }
+
+        if ( p_queue->b_deleted && p_queue->pi_sched_index[HEAP_DTS] == -1 )
+            InputDelete( p_stream, p_queue );
+
+        p_queue = p_next;
+    }
+}
 
 /*****************************************************************************
  * MuxShowMuxing: return the date of the next <granularity> ensemble / called
@@ -1589,7 +2714,7 @@ next_packet:
     if ( *pp_queue == NULL )
         return NULL;
 
-    p_block = block_FifoGet( (*pp_queue)->p_fifo );
+    p_block = MuxDequeue( p_stream, *pp_queue );
 
     if ( p_block->i_dts < p_sys->i_last_muxing )
     {
@@ -1626,22 +2751,21 @@ next_packet:
 }
 
 /*****************************************************************************
- * MuxCheckIncrement: check how much current buffer could bear being delayed /
- * called with stream_lock
+ * MuxNewOutput: allocate the buffer for <granularity> packets
  *****************************************************************************/
-static mtime_t MuxCheckIncrement( sout_stream_t *p_stream, block_t *p_blocks )
+static block_t *MuxNewOutput( sout_stream_t *p_stream )
 {
-    VLC_UNUSED(p_stream);
-    mtime_t i_max_muxing = -1;
+    sout_stream_sys_t *p_sys = p_stream->p_sys;
+    block_t *p_out = PoolAlloc( p_sys->p_out_pool );
 
-    while ( p_blocks != NULL )
+    if ( p_out == NULL )
+        msg_Err( p_stream, "cannot allocate output buffer" );
+    else if ( !p_sys->b_rtp )
     {
-        if ( i_max_muxing == -1 || p_blocks->i_dts < i_max_muxing )
-            i_max_muxing = p_blocks->i_dts;
-        p_blocks = p_blocks->p_next;
+        p_out->p_buffer += RTP_HEADER_SIZE;
+        p_out->i_buffer -= RTP_HEADER_SIZE;
     }
-
-    return i_max_muxing;
+    return p_out;
 }
 
 /*****************************************************************************
@@ -1653,25 +2777,30 @@ static block_t *Mux( sout_stream_t *p_stream )
     sout_stream_id_t *p_queue;
     int i_nb_packets = p_sys->i_granularity;
     mtime_t i_last_packet_muxing = p_sys->i_last_muxing;
-    block_t *p_blocks = NULL;
-    block_t **pp_last = &p_blocks;
+    mtime_t i_max_muxing = -1; /* earliest DTS of the packets already there */
+    block_t *p_out;
     block_t *p_block = NULL;
 
     if ( p_sys->i_tmp_nb_packets )
     {
         i_nb_packets = p_sys->i_tmp_nb_packets;
-        p_blocks = p_sys->p_tmp_blocks;
-        pp_last = p_sys->pp_tmp_last;
+        i_max_muxing = p_sys->i_tmp_max_muxing;
+        p_out = p_sys->p_tmp_out;
 
         p_sys->i_tmp_nb_packets = 0;
-        p_sys->p_tmp_blocks = NULL;
-        p_sys->pp_tmp_last = NULL;
+        p_sys->p_tmp_out = NULL;
+    }
+    else
+    {
+        p_out = MuxNewOutput( p_stream );
+        /* The packets stay in their queues and will be late. */
+        if ( p_out == NULL )
+            return NULL;
     }
 
     if ( p_sys->i_muxmode == MODE_VBR )
     {
         /* Small hack to avoid calling Mux() too often. */
-        mtime_t i_max_muxing = MuxCheckIncrement( p_stream, p_blocks );
         if ( i_max_muxing == -1
               || i_max_muxing > p_sys->i_last_muxing
                                  + p_sys->ts.params.i_packet_interval )
@@ -1684,33 +2813,43 @@ static block_t *Mux( sout_stream_t *p_stream )
 
     do
     {
+        /* Packets are written in place in the output buffer. */
+        uint8_t *p_ts = p_out->p_buffer + p_out->i_buffer
+                         - i_nb_packets * TS_SIZE;
+
         if ( p_queue == NULL )
         {
-            if ( p_sys->i_muxmode != MODE_CBR )
+            if ( p_sys->i_muxmode != MODE_CBR
+                  && (i_max_muxing == -1
+                       || i_max_muxing >= MuxShowMuxing( p_stream )) )
             {
-                mtime_t i_max_muxing = MuxCheckIncrement( p_stream, p_blocks );
-                if ( i_max_muxing == -1
-                      || i_max_muxing >= MuxShowMuxing( p_stream ) )
-                {
-                    p_sys->i_tmp_nb_packets = i_nb_packets;
-                    p_sys->p_tmp_blocks = p_blocks;
-                    p_sys->pp_tmp_last = pp_last;
-                    return NULL;
-                }
+                p_sys->i_tmp_nb_packets = i_nb_packets;
+                p_sys->i_tmp_max_muxing = i_max_muxing;
+                p_sys->p_tmp_out = p_out;
+                return NULL;
             }
 
-            *pp_last = block_New( p_stream, TS_SIZE );
-            ts_pad( (*pp_last)->p_buffer );
+            ts_pad( p_ts );
+            /* Padding packets have no date, so once there is one the
+             * ensemble cannot be delayed anymore. */
+            i_max_muxing = VLC_TS_INVALID;
         }
         else
         {
-            uint8_t *p_ts = p_block->p_buffer;
-            unsigned int i_payload_size = TS_SIZE - (ts_payload(p_ts) - p_ts);
-            *pp_last = p_block;
-            p_queue->i_muxed_size += i_payload_size;
+            const ts_packet_t *p_packet = (const ts_packet_t *)p_block;
+            int i_header = TS_SIZE - p_packet->i_payload;
+
+            /* The payload is copied once, from the PES to the output. */
+            memcpy( p_ts, p_block->p_buffer, i_header );
+            if ( p_packet->i_payload )
+                memcpy( p_ts + i_header, p_packet->p_payload,
+                        p_packet->i_payload );
+            p_queue->i_muxed_size += TS_SIZE - (ts_payload(p_ts) - p_ts);
             i_last_packet_muxing = p_block->i_dts - p_block->i_delay;
+            if ( i_max_muxing == -1 || p_block->i_dts < i_max_muxing )
+                i_max_muxing = p_block->i_dts;
+            block_Release( p_block );
         }
-        pp_last = &(*pp_last)->p_next;
 
         i_nb_packets--;
         if ( i_nb_packets )
@@ -1718,59 +2857,164 @@ static block_t *Mux( sout_stream_t *p_stream )
             p_queue = MuxGet( p_stream );
 
             if ( p_queue != NULL )
-                p_block = block_FifoGet( p_queue->p_fifo );
+                p_block = MuxDequeue( p_stream, p_queue );
         }
     }
     while ( i_nb_packets );
-    *pp_last = NULL;
 
     if ( p_sys->i_muxmode == MODE_VBR )
         /* Fix the small hack. */
         p_sys->i_last_muxing = i_last_packet_muxing;
+    p_out->i_dts = p_sys->i_last_muxing;
 
     MuxClearRAP( p_stream );
     MuxFixQueues( p_stream );
 
-    return p_blocks;
+    return p_out;
 }
 
 /*****************************************************************************
- * MuxGather: packetize <granularity> packets for the output plug-in
+ * MuxGather: stamp PCRs and RTP header on <granularity> packets for the
+ * output plug-in
  *****************************************************************************/
-static block_t *MuxGather( sout_stream_t *p_stream, block_t *p_blocks,
+static block_t *MuxGather( sout_stream_t *p_stream, block_t *p_out,
                            mtime_t i_pcr_date )
 {
     sout_stream_sys_t *p_sys = p_stream->p_sys;
-    block_t *p_block = p_blocks;
+    uint8_t *p_ts = p_out->p_buffer;
+    int i;
 
-    /* First write the PCRs. */
-    while ( p_block != NULL )
+    if ( p_sys->b_rtp )
     {
-        if ( ts_has_adaptation( p_block->p_buffer )
-              && ts_get_adaptation( p_block->p_buffer )
-              && tsaf_has_pcr( p_block->p_buffer ) )
+        rtp_set_hdr( p_out->p_buffer );
+        rtp_set_type( p_out->p_buffer, RTP_TYPE_TS );
+        rtp_set_cc( p_out->p_buffer, p_sys->i_rtp_cc++ );
+        rtp_set_timestamp( p_out->p_buffer, i_pcr_date / 300 );
+        rtp_set_ssrc( p_out->p_buffer, p_sys->pi_ssrc );
+        p_ts += RTP_HEADER_SIZE;
+    }
+
+    for ( i = 0; i < p_sys->i_granularity; i++, p_ts += TS_SIZE )
+    {
+        if ( ts_has_adaptation( p_ts ) && ts_get_adaptation( p_ts )
+              && tsaf_has_pcr( p_ts ) )
         {
-            tsaf_set_pcr( p_block->p_buffer, i_pcr_date / 300 );
-            tsaf_set_pcrext( p_block->p_buffer, i_pcr_date % 300 );
+            tsaf_set_pcr( p_ts, i_pcr_date / 300 );
+            tsaf_set_pcrext( p_ts, i_pcr_date % 300 );
+            /* so that the output does not delay it */
+            p_out->i_flags |= BLOCK_FLAG_CLOCK;
         }
-
-        p_block = p_block->p_next;
     }
 
-    if ( p_sys->b_rtp )
+    return p_out;
+}
+
+/*****************************************************************************
+ * MuxDateNs: return the ideal output date of the current <granularity>
+ * ensemble, in ns
+ *****************************************************************************/
+static int64_t MuxDateNs( sout_stream_t *p_stream )
+{
+    sout_stream_sys_t *p_sys = p_stream->p_sys;
+    int64_t i_date = p_sys->i_last_muxing * 1000;
+
+    /* We need that for sub-microsecond precision PCR (spec says
+     * 500 ns). */
+    if ( p_sys->i_muxrate )
+        i_date += p_sys->i_last_muxing_remainder * 1000 / p_sys->i_muxrate;
+    return i_date;
+}
+
+/*****************************************************************************
+ * MuxPCRClock: return the PCR (27 MHz) of the current <granularity>
+ * ensemble, derived from the ideal muxrate timeline
+ *****************************************************************************/
+static mtime_t MuxPCRClock( sout_stream_t *p_stream )
+{
+    sout_stream_sys_t *p_sys = p_stream->p_sys;
+    mtime_t i_pcr_clock = p_sys->i_last_muxing * 27;
+
+    if ( p_sys->i_muxrate )
+        i_pcr_clock += p_sys->i_last_muxing_remainder * 27
+                        / p_sys->i_muxrate;
+    return i_pcr_clock;
+}
+
+/*****************************************************************************
+ * MuxWait: wait for the date (in ns) of the next <granularity> ensemble,
+ * actively for the last i_spin ns
+ *****************************************************************************/
+static void MuxWait( sout_stream_t *p_stream, int64_t i_date )
+{
+    sout_stream_sys_t *p_sys = p_stream->p_sys;
+
+    if ( !p_sys->i_spin )
     {
-        block_t *p_rtp = block_New( p_stream, RTP_HEADER_SIZE );
-        rtp_set_hdr( p_rtp->p_buffer );
-        rtp_set_type( p_rtp->p_buffer, RTP_TYPE_TS );
-        rtp_set_cc( p_rtp->p_buffer, p_sys->i_rtp_cc++ );
-        rtp_set_timestamp( p_rtp->p_buffer, i_pcr_date / 300 );
-        rtp_set_ssrc( p_rtp->p_buffer, p_sys->pi_ssrc );
+        mwait_ns( i_date );
+        return;
+    }
+
+    if ( i_date - p_sys->i_spin > mdate_ns() )
+        mwait_ns( i_date - p_sys->i_spin );
+    while ( mdate_ns() < i_date )
+        ;
+}
+
+/*****************************************************************************
+ * MuxRecordJitter: account the difference between the ideal and the
+ * effective output date (in ns)
+ *****************************************************************************/
+static void MuxRecordJitter( sout_stream_t *p_stream, int64_t i_jitter )
+{
+    mux_jitter_t *p_jitter = &p_stream->p_sys->jitter;
+    unsigned int i;
 
-        p_rtp->p_next = p_blocks;
-        p_blocks = p_rtp;
+    if ( i_jitter < 0 )
+    {
+        p_jitter->i_nb_early++;
+        i_jitter = -i_jitter;
     }
+    else if ( i_jitter >= PCR_ACCURACY )
+        p_jitter->i_nb_late++;
+    if ( i_jitter > p_jitter->i_max )
+        p_jitter->i_max = i_jitter;
 
-    return block_ChainGather( p_blocks );
+    for ( i = 0; i < JITTER_BUCKETS - 1; i++ )
+        if ( i_jitter < pi_jitter_limits[i] )
+            break;
+    p_jitter->pi_buckets[i]++;
+}
+
+/*****************************************************************************
+ * MuxPrintJitter: dump the output jitter histogram
+ *****************************************************************************/
+static void MuxPrintJitter( sout_stream_t *p_stream )
+{
+    mux_jitter_t *p_jitter = &p_stream->p_sys->jitter;
+    uint64_t i_total = 0;
+    unsigned int i;
+
+    for ( i = 0; i < JITTER_BUCKETS; i++ )
+        i_total += p_jitter->pi_buckets[i];
+    if ( !i_total )
+        return;
+
+    msg_Dbg( p_stream, "output jitter over %"PRIu64" buffers: max %"PRId64" ns, %"PRIu64" late (>= %d ns), %"PRIu64" early",
+             i_total, p_jitter->i_max, p_jitter->i_nb_late, PCR_ACCURACY,
+             p_jitter->i_nb_early );
+    for ( i = 0; i < JITTER_BUCKETS; i++ )
+    {
+        if ( !p_jitter->pi_buckets[i] )
+            continue;
+        if ( i < JITTER_BUCKETS - 1 )
+            msg_Dbg( p_stream, " < %7"PRId64" ns: %"PRIu64" (%.2f%%)",
+                     pi_jitter_limits[i], p_jitter->pi_buckets[i],
+                     100. * p_jitter->pi_buckets[i] / i_total );
+        else
+            msg_Dbg( p_stream, ">= %7"PRId64" ns: %"PRIu64" (%.2f%%)",
+                     pi_jitter_limits[i - 1], p_jitter->pi_buckets[i],
+                     100. * p_jitter->pi_buckets[i] / i_total );
+    }
 }
 
 /*****************************************************************************
@@ -1827,16 +3071,8 @@ static void MuxAsync( sout_stream_t *p_stream, bool b_flush )
         vlc_mutex_unlock( &p_sys->stream_lock );
 
         if ( p_blocks != NULL )
-        {
-            mtime_t i_pcr_clock = p_sys->i_last_muxing * 27;
-            /* We need that for sub-microsecond precision PCR (spec says
-             * 500 ns). */
-            if ( p_sys->i_muxrate )
-                i_pcr_clock += p_sys->i_last_muxing_remainder * 27
-                                / p_sys->i_muxrate;
             p_stream->p_next->pf_send( p_stream->p_next, p_sys->id,
-                MuxGather( p_stream, p_blocks, i_pcr_clock ) );
-        }
+                MuxGather( p_stream, p_blocks, MuxPCRClock( p_stream ) ) );
     }
 }
 
@@ -1898,16 +3134,21 @@ static void *MuxThread( vlc_object_t *p_this )
 
             if ( p_blocks != NULL )
             {
+                int64_t i_date = MuxDateNs( p_stream );
+
                 if ( i_current_date > p_sys->i_last_muxing + 5000 )
                     msg_Warn( p_stream, "output late buffer (%"PRId64")",
                               i_current_date - p_sys->i_last_muxing );
                 else
-                    mwait( p_sys->i_last_muxing );
+                    MuxWait( p_stream, i_date );
 
-                /* FIXME: we are not precise enough for the PCR, but mdate()
-                 * only returns microsecond precision. */
+                /* The PCR follows the ideal timeline, so that it is exact
+                 * relative to the muxrate whatever the scheduling jitter. */
+                p_blocks = MuxGather( p_stream, p_blocks,
+                                      MuxPCRClock( p_stream ) );
+                MuxRecordJitter( p_stream, mdate_ns() - i_date );
                 p_stream->p_next->pf_send( p_stream->p_next, p_sys->id,
-                            MuxGather( p_stream, p_blocks, mdate() * 27 ) );
+                                           p_blocks );
             }
         }
         vlc_restorecancel(canc);
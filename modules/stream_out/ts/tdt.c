@@ -171,9 +171,11 @@ static block_t *BuildTDT( ts_table_t *p_table )
     msg_Dbg( p_table, "new TDT date %"PRIx64, i_utc );
 
     p_ts = tstable_BuildTS( p_table, p_block );
+    block_Release( p_block );
+    if ( p_ts == NULL )
+        return NULL;
     p_ts->i_dts = p_table->i_last_muxing + i_packet_interval;
     p_ts->i_delay = i_packet_interval * 2;
-    block_Release( p_block );
     return p_ts;
 }
 
@@ -248,7 +248,6 @@ static inline block_t *tsaudio_OutputFrame( ts_input_t *p_input,
 
     p_first = tsinput_BuildTS( p_input, p_frame );
 
-    block_Release( p_frame );
     return p_first;
 }
 
@@ -31,6 +31,8 @@
  *****************************************************************************/
 typedef struct ts_parameters_t ts_parameters_t;
 typedef struct ts_charset_t ts_charset_t;
+typedef struct ts_pool_t ts_pool_t;
+typedef struct ts_packet_t ts_packet_t;
 
 #define CONFORMANCE_NONE 0
 #define CONFORMANCE_ISO  1
@@ -43,6 +45,9 @@ struct ts_parameters_t
     unsigned int i_conformance;
     ts_charset_t *p_charset;
     uint8_t *(*pf_charset)( ts_charset_t *, char *, size_t * );
+    /* preallocated TS packets (ts_packet_t), owned by the mux */
+    ts_pool_t *p_pool;
+    block_t *(*pf_new_ts)( ts_pool_t * );
 
     mtime_t i_packet_interval; /* interval between two <granularity> packets */
     /* packets for time T shouldn't arrive later than T - max_prepare */
@@ -52,6 +57,25 @@ struct ts_parameters_t
      * FEC, etc. */
 };
 
+/* The last i_payload bytes of the packet are not in p_buffer but at
+ * p_payload (typically in the PES); the mux copies them straight to the
+ * output. p_owner is released with the packet. */
+struct ts_packet_t
+{
+    block_t self;
+    const uint8_t *p_payload;
+    int i_payload;
+    block_t *p_owner;
+};
+
+/*****************************************************************************
+ * tsparams_NewTS: allocate an uninitialized TS packet, or NULL
+ *****************************************************************************/
+static inline block_t *tsparams_NewTS( ts_parameters_t *p_ts_params )
+{
+    return p_ts_params->pf_new_ts( p_ts_params->p_pool );
+}
+
 /*****************************************************************************
  * TS packetizer module definition
  *****************************************************************************/
@@ -233,8 +257,10 @@ static inline int tsinput_NbTS( ts_input_t *p_input, const block_t *p_frame )
  *****************************************************************************/
 static inline block_t *tsinput_BuildPCRTS( ts_input_t *p_input )
 {
-    block_t *p_block = block_New( p_input, TS_SIZE );
+    block_t *p_block = tsparams_NewTS( p_input->p_ts_params );
 
+    if ( p_block == NULL )
+        return NULL;
     ts_init( p_block->p_buffer );
     ts_set_pid( p_block->p_buffer, p_input->i_pid );
     ts_set_cc( p_block->p_buffer, p_input->i_cc );
@@ -244,13 +270,17 @@ static inline block_t *tsinput_BuildPCRTS( ts_input_t *p_input )
 }
 
 /*****************************************************************************
- * tsinput_BuildPayloadTS: build TS packet containing payload and PCR
+ * tsinput_BuildPayloadTS: build TS packet containing payload and PCR, the
+ * payload is referenced, not copied
  *****************************************************************************/
 static inline block_t *tsinput_BuildPayloadTS( ts_input_t *p_input,
                                                uint8_t *p_buffer, int i_buffer )
 {
-    block_t *p_block = block_New( p_input, TS_SIZE );
+    block_t *p_block = tsparams_NewTS( p_input->p_ts_params );
+    ts_packet_t *p_packet = (ts_packet_t *)p_block;
 
+    if ( p_block == NULL )
+        return NULL;
     ts_init( p_block->p_buffer );
     ts_set_pid( p_block->p_buffer, p_input->i_pid );
     ts_set_cc( p_block->p_buffer, ++p_input->i_cc );
@@ -260,21 +290,24 @@ static inline block_t *tsinput_BuildPayloadTS( ts_input_t *p_input,
                            TS_SIZE - i_buffer - TS_HEADER_SIZE - 1 );
     ts_set_payload( p_block->p_buffer );
 
-    vlc_memcpy( ts_payload( p_block->p_buffer ), p_buffer, i_buffer );
+    p_packet->p_payload = p_buffer;
+    p_packet->i_payload = i_buffer;
 
     return p_block;
 }
 
 /*****************************************************************************
- * tsinput_BuildTS: build a chain of TS packets for a PES
+ * tsinput_BuildTS: build a chain of TS packets for a PES, which is released
+ * with the last one (or at once if the packets cannot be allocated)
  *****************************************************************************/
 static inline block_t *tsinput_BuildTS( ts_input_t *p_input,
-                                        const block_t *p_frame )
+                                        block_t *p_frame )
 {
     int i_nb_ts, i;
     mtime_t i_duration, i_peak_duration;
     block_t *p_first = NULL;
     block_t **pp_last = &p_first;
+    ts_packet_t *p_last_payload = NULL;
     uint8_t *p_buffer = p_frame->p_buffer;
     int i_buffer = p_frame->i_buffer;
 
@@ -309,6 +342,8 @@ static inline block_t *tsinput_BuildTS( ts_input_t *p_input,
             {
                 /* Insert adaptation field-only packet. */
                 *pp_last = tsinput_BuildPCRTS( p_input );
+                if ( *pp_last == NULL )
+                    goto error;
                 (*pp_last)->i_dts = p_frame->i_dts - i * i_peak_duration
                                      / i_nb_ts;
                 (*pp_last)->i_delay = (*pp_last)->i_dts - p_input->i_next_pcr
@@ -334,6 +369,9 @@ static inline block_t *tsinput_BuildTS( ts_input_t *p_input,
             i_ts_payload = i_buffer;
 
         *pp_last = tsinput_BuildPayloadTS( p_input, p_buffer, i_ts_payload );
+        if ( *pp_last == NULL )
+            goto error;
+        p_last_payload = (ts_packet_t *)*pp_last;
         (*pp_last)->i_dts = p_frame->i_dts - i * i_peak_duration / i_nb_ts;
         (*pp_last)->i_delay = (*pp_last)->i_dts - i_muxing
                                + p_input->i_ts_delay;
@@ -367,6 +405,18 @@ static inline block_t *tsinput_BuildTS( ts_input_t *p_input,
     if ( i_buffer )
         msg_Err( p_input, "internal error #2 %d", i_buffer );
 
+    /* The packets are muxed in order, so the last one goes last. */
+    if ( p_last_payload != NULL )
+        p_last_payload->p_owner = p_frame;
+    else
+        block_Release( p_frame );
     return p_first;
+
+error:
+    msg_Err( p_input, "cannot allocate TS packets, dropping PES" );
+    if ( p_first != NULL )
+        block_ChainRelease( p_first );
+    block_Release( p_frame );
+    return NULL;
 }
 
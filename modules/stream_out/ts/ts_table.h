@@ -45,6 +45,19 @@ struct sout_stream_id_t
     /* T-STD stuff */
     mtime_t i_min_muxing;
     unsigned int i_muxed_size;
+
+    /* Scheduler stuff (private to the mux) */
+    int i_sched_rank; /* tie-breaker, in creation order */
+    int pi_sched_index[2]; /* position in the heaps, -1 if not scheduled */
+    unsigned int i_sched_priority;
+    mtime_t i_sched_muxing, i_sched_dts; /* cached from the first block */
+    bool b_sched_dirty;
+    sout_stream_id_t *p_sched_next_dirty;
+
+    /* Packetization workers stuff (private to the mux) */
+    block_fifo_t *p_pending; /* frames not yet packetized */
+    bool b_busy; /* ready or being packetized by a worker */
+    sout_stream_id_t *p_next_ready;
 };
 
 struct ts_stream_t
@@ -183,7 +196,8 @@ static inline int tstable_NbTS( ts_table_t *p_table, const block_t *p_section )
 }
 
 /*****************************************************************************
- * tstable_BuildTS: build a chain of TS packets for a PSI section
+ * tstable_BuildTS: build a chain of TS packets for a PSI section; sections
+ * are sent repeatedly, so their payload is copied
  *****************************************************************************/
 static inline block_t *tstable_BuildTS( ts_table_t *p_table,
                                         const block_t *p_section )
@@ -204,7 +218,14 @@ static inline block_t *tstable_BuildTS( ts_table_t *p_table,
         int i_ts_payload = TS_SIZE - TS_HEADER_SIZE;
         uint8_t *p_ts_payload;
 
-        *pp_last = block_New( p_table, TS_SIZE );
+        *pp_last = tsparams_NewTS( &p_table->p_ts_stream->params );
+        if ( *pp_last == NULL )
+        {
+            msg_Err( p_table, "cannot allocate TS packets, dropping section" );
+            if ( p_first != NULL )
+                block_ChainRelease( p_first );
+            return NULL;
+        }
         (*pp_last)->i_flags = p_section->i_flags;
         ts_init( (*pp_last)->p_buffer );
         ts_set_pid( (*pp_last)->p_buffer, p_table->i_pid );
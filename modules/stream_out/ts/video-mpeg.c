@@ -219,6 +219,7 @@ static block_t *SetPESHeader( ts_input_t *p_input, block_t *p_frame )
 static block_t *OutputFrame( ts_input_t *p_input, block_t *p_frame )
 {
     block_t *p_first, *p_ts;
+    bool b_intra;
     int i_length = p_frame->i_buffer - PES_HEADER_SIZE;
     pes_set_length( p_frame->p_buffer, i_length > 65535 ? 0 : i_length );
 
@@ -232,9 +233,10 @@ static block_t *OutputFrame( ts_input_t *p_input, block_t *p_frame )
     if ( (p_frame->i_flags & BLOCK_FLAG_TYPE_I)
           && p_input->i_pcr_period )
         p_input->i_next_pcr = p_input->i_last_muxing; /* force PCR insertion */
+    b_intra = (p_frame->i_flags & BLOCK_FLAG_TYPE_I) != 0;
     p_first = p_ts = tsinput_BuildTS( p_input, p_frame );
 
-    if ( p_frame->i_flags & BLOCK_FLAG_TYPE_I )
+    if ( b_intra && p_first != NULL )
     {
         if ( ts_has_adaptation( p_first->p_buffer )
               && ts_get_adaptation( p_first->p_buffer ) )
@@ -253,7 +255,6 @@ static block_t *OutputFrame( ts_input_t *p_input, block_t *p_frame )
         }
     }
 
-    block_Release( p_frame );
     return p_first;
 }
 
@@ -217,15 +217,17 @@ static block_t *SetPESHeader( ts_input_t *p_input, block_t *p_frame )
 static block_t *OutputFrame( ts_input_t *p_input, block_t *p_frame )
 {
     block_t *p_first, *p_ts;
+    bool b_intra;
 
     p_frame->i_delay = DEFAULT_DELAY * 1000;
     tsinput_CheckMuxing( p_input, p_frame );
     if ( (p_frame->i_flags & BLOCK_FLAG_TYPE_I)
           && p_input->i_pcr_period )
         p_input->i_next_pcr = p_input->i_last_muxing; /* force PCR */
+    b_intra = (p_frame->i_flags & BLOCK_FLAG_TYPE_I) != 0;
     p_first = p_ts = tsinput_BuildTS( p_input, p_frame );
 
-    if ( p_frame->i_flags & BLOCK_FLAG_TYPE_I )
+    if ( b_intra && p_first != NULL )
     {
         if ( ts_has_adaptation( p_first->p_buffer )
               && ts_get_adaptation( p_first->p_buffer ) )
@@ -243,7 +245,6 @@ static block_t *OutputFrame( ts_input_t *p_input, block_t *p_frame )
         }
     }
 
-    block_Release( p_frame );
     return p_first;
 }
 
@@ -51,6 +51,9 @@
 
 #include <vlc_network.h>
 
+#include "../access/rtp/fec.h"
+#include "../access_output/udp_batch.h"
+
 /*****************************************************************************
  * Module descriptor
  *****************************************************************************/
@@ -68,6 +71,17 @@ static void Close( vlc_object_t * );
 #define TOS_TEXT N_("Type of service (TOS)")
 #define TOS_LONGTEXT N_("Allows you to set the TOS parameter of the IP " \
                         "header of the outgoing stream.")
+#define FEC_L_TEXT N_("FEC columns (L)")
+#define FEC_L_LONGTEXT N_("Number of columns of the SMPTE 2022-1 FEC " \
+                          "matrix protecting an RTP stream; column FEC " \
+                          "packets are sent to the destination port + 2 " \
+                          "(0 disables FEC).")
+#define FEC_D_TEXT N_("FEC rows (D)")
+#define FEC_D_LONGTEXT N_("Number of rows of the SMPTE 2022-1 FEC matrix " \
+                          "(4 to 20).")
+#define FEC_ROW_TEXT N_("FEC row packets")
+#define FEC_ROW_LONGTEXT N_("Also sends row FEC packets to the destination " \
+                            "port + 4, to recover from burst losses.")
 
 vlc_module_begin()
     set_description( _("UDP stream output") )
@@ -80,6 +94,15 @@ vlc_module_begin()
                                  true )
     add_integer( SOUT_CFG_PREFIX "tos", 0, TOS_TEXT, TOS_LONGTEXT,
                                  true )
+    add_udp_batch( SOUT_CFG_PREFIX )
+    add_integer( SOUT_CFG_PREFIX "fec-l", 0, FEC_L_TEXT, FEC_L_LONGTEXT,
+                                 true )
+        change_integer_range( 0, 20 )
+    add_integer( SOUT_CFG_PREFIX "fec-d", 10, FEC_D_TEXT, FEC_D_LONGTEXT,
+                                 true )
+        change_integer_range( 4, 20 )
+    add_bool( SOUT_CFG_PREFIX "fec-row", true, FEC_ROW_TEXT,
+              FEC_ROW_LONGTEXT, true )
 
     set_capability( "sout stream", 100 )
     add_shortcut( "udp" )
@@ -91,17 +114,31 @@ vlc_module_end()
  *****************************************************************************/
 
 static const char *ppsz_sout_options[] = {
-    "dst", "ttl", "tos", NULL
+    "dst", "ttl", "tos", "batch", "batch-window", "fec-l", "fec-d", "fec-row",
+    NULL
 };
 
 struct sout_stream_sys_t
 {
     int i_handle;
+
+    /* batching; the timer flushes the datagrams the mux left waiting */
+    vlc_mutex_t lock;
+    udp_batch_t batch;
+    vlc_timer_t timer;
+    mtime_t i_flush_date; /* the timer is armed for this date, if not 0 */
+    /* SMPTE 2022-1 FEC */
+    rtp_fec_encoder_t *p_fec;
+    int pi_fec_handle[2]; /* column, row */
+    block_t *p_fec_pending; /* sent after the batch they protect */
 };
 
 static sout_stream_id_t *Add ( sout_stream_t *, es_format_t * );
 static int Del ( sout_stream_t *, sout_stream_id_t * );
 static int Send( sout_stream_t *, sout_stream_id_t *, block_t * );
+static void Flush( sout_stream_t * );
+static void FlushTimer( void * );
+static void SendFec( sout_stream_t *, block_t * );
 
 #define DEFAULT_PORT 1234
 
@@ -117,6 +154,9 @@ static int Open( vlc_object_t *p_this )
     int i_tos;
     char *psz_parser;
     int i_port = DEFAULT_PORT;
+    int64_t i_batch, i_batch_window;
+    unsigned int i_fec_l, i_fec_d;
+    bool b_fec_row;
 
     p_sys = malloc( sizeof(sout_stream_sys_t) );
     memset( p_sys, 0, sizeof(sout_stream_sys_t) );
@@ -130,6 +170,23 @@ static int Open( vlc_object_t *p_this )
     var_Get( p_stream, SOUT_CFG_PREFIX "tos", &val );
     i_tos = val.i_int;
 
+    i_batch = var_GetInteger( p_stream, SOUT_CFG_PREFIX "batch" );
+    i_batch_window = var_GetInteger( p_stream,
+                                     SOUT_CFG_PREFIX "batch-window" );
+
+    i_fec_l = var_GetInteger( p_stream, SOUT_CFG_PREFIX "fec-l" );
+    i_fec_d = var_GetInteger( p_stream, SOUT_CFG_PREFIX "fec-d" );
+    b_fec_row = var_GetBool( p_stream, SOUT_CFG_PREFIX "fec-row" );
+    if ( i_fec_l > 20 || i_fec_d < 4 || i_fec_d > 20
+          || i_fec_l * i_fec_d > 100 )
+    {
+        if ( i_fec_l > 0 )
+            msg_Err( p_stream, "invalid FEC matrix %ux%u (FEC disabled)",
+                     i_fec_l, i_fec_d );
+        i_fec_l = 0;
+    }
+    p_sys->pi_fec_handle[0] = p_sys->pi_fec_handle[1] = -1;
+
     var_Get( p_stream, SOUT_CFG_PREFIX "dst", &val );
     psz_parser = val.psz_string;
     if ( *psz_parser == '[' )
@@ -157,6 +214,17 @@ static int Open( vlc_object_t *p_this )
 
     p_sys->i_handle = net_ConnectDgram( p_this, val.psz_string, i_port, i_ttl,
                                         IPPROTO_UDP );
+    if ( p_sys->i_handle != -1 && i_fec_l > 0 )
+    {
+        p_sys->pi_fec_handle[0] = net_ConnectDgram( p_this, val.psz_string,
+                                                    i_port + 2, i_ttl,
+                                                    IPPROTO_UDP );
+        if ( b_fec_row )
+            p_sys->pi_fec_handle[1] = net_ConnectDgram( p_this,
+                                                        val.psz_string,
+                                                        i_port + 4, i_ttl,
+                                                        IPPROTO_UDP );
+    }
     free( val.psz_string );
     if( p_sys->i_handle == -1 )
     {
@@ -170,6 +238,42 @@ static int Open( vlc_object_t *p_this )
     if( i_tos )
         net_SetTOS( p_stream, p_sys->i_handle, i_tos );
 
+    for ( int i = 0; i < 2; i++ )
+    {
+        if ( p_sys->pi_fec_handle[i] == -1 )
+            continue;
+        shutdown( p_sys->pi_fec_handle[i], SHUT_RD );
+        if( i_tos )
+            net_SetTOS( p_stream, p_sys->pi_fec_handle[i], i_tos );
+    }
+    if ( p_sys->pi_fec_handle[0] != -1 )
+    {
+        p_sys->p_fec = rtp_fec_encoder_create( i_fec_l, i_fec_d,
+                                               p_sys->pi_fec_handle[1] != -1 );
+        if ( p_sys->p_fec != NULL )
+            msg_Dbg( p_stream, "SMPTE 2022-1 FEC %ux%u%s", i_fec_l, i_fec_d,
+                     p_sys->pi_fec_handle[1] != -1 ? " with rows" : "" );
+    }
+
+    vlc_mutex_init( &p_sys->lock );
+    p_sys->i_flush_date = 0;
+    if ( udp_batch_Init( p_this, &p_sys->batch, p_sys->i_handle, i_batch,
+                         i_batch_window )
+          || (p_sys->batch.i_size > 1
+               && vlc_timer_create( &p_sys->timer, FlushTimer, p_stream )) )
+    {
+        udp_batch_Clean( p_this, &p_sys->batch );
+        vlc_mutex_destroy( &p_sys->lock );
+        net_Close( p_sys->i_handle );
+        for ( int i = 0; i < 2; i++ )
+            if ( p_sys->pi_fec_handle[i] != -1 )
+                net_Close( p_sys->pi_fec_handle[i] );
+        if ( p_sys->p_fec != NULL )
+            rtp_fec_encoder_destroy( p_sys->p_fec );
+        free( p_sys );
+        return VLC_ENOMEM;
+    }
+
     p_stream->pf_add    = Add;
     p_stream->pf_del    = Del;
     p_stream->pf_send   = Send;
@@ -188,10 +292,20 @@ static void Close( vlc_object_t * p_this )
     sout_stream_t *p_stream = (sout_stream_t *)p_this;
     sout_stream_sys_t *p_sys = p_stream->p_sys;
 
+    if ( p_sys->batch.i_size > 1 )
+        vlc_timer_destroy( p_sys->timer );
+    Flush( p_stream );
     net_Close( p_sys->i_handle );
+    for ( int i = 0; i < 2; i++ )
+        if ( p_sys->pi_fec_handle[i] != -1 )
+            net_Close( p_sys->pi_fec_handle[i] );
+    if ( p_sys->p_fec != NULL )
+        rtp_fec_encoder_destroy( p_sys->p_fec );
 
     p_stream->p_sout->i_out_pace_nocontrol--;
 
+    udp_batch_Clean( p_this, &p_sys->batch );
+    vlc_mutex_destroy( &p_sys->lock );
     msg_Dbg( p_stream, "udp stream output closed" );
     free( p_sys );
 }
@@ -204,6 +318,8 @@ static sout_stream_id_t *Add( sout_stream_t *p_stream, es_format_t *p_fmt )
     if ( p_fmt->i_codec != VLC_CODEC_RTP && p_fmt->i_codec != VLC_CODEC_M2TS )
         msg_Warn( p_stream, "trying to handle unknown datagram source %4.4s",
                   (char *)&p_fmt->i_codec );
+    if ( p_stream->p_sys->p_fec != NULL && p_fmt->i_codec != VLC_CODEC_RTP )
+        msg_Warn( p_stream, "FEC requires an RTP stream (see --sout-ts-rtp)" );
 
     /* Just return non-NULL */
     return (sout_stream_id_t *)1;
@@ -219,6 +335,65 @@ static int Del( sout_stream_t *p_stream, sout_stream_id_t *p_input )
     return VLC_SUCCESS;
 }
 
+/*****************************************************************************
+ * Flush: write the pending datagrams on the network / called with lock
+ *****************************************************************************/
+static void Flush( sout_stream_t *p_stream )
+{
+    sout_stream_sys_t *p_sys = p_stream->p_sys;
+
+    if ( !p_sys->batch.i_nb_blocks )
+        return;
+
+    udp_batch_Send( VLC_OBJECT(p_stream), &p_sys->batch );
+    for ( unsigned int i = 0; i < p_sys->batch.i_nb_blocks; i++ )
+        block_Release( p_sys->batch.pp_blocks[i] );
+    p_sys->batch.i_nb_blocks = 0;
+
+    SendFec( p_stream, p_sys->p_fec_pending );
+    p_sys->p_fec_pending = NULL;
+}
+
+/*****************************************************************************
+ * FlushTimer: send the batch when the window of its first datagram is over
+ *****************************************************************************/
+static void FlushTimer( void *data )
+{
+    sout_stream_t *p_stream = data;
+    sout_stream_sys_t *p_sys = p_stream->p_sys;
+
+    vlc_mutex_lock( &p_sys->lock );
+    /* The batch may have been flushed, and a new one started, while the
+     * timer was firing: only flush the batch the timer was armed for */
+    if ( p_sys->i_flush_date && mdate() >= p_sys->i_flush_date )
+    {
+        Flush( p_stream );
+        p_sys->i_flush_date = 0;
+    }
+    vlc_mutex_unlock( &p_sys->lock );
+}
+
+/*****************************************************************************
+ * SendFec: write FEC packets on the column or row FEC socket
+ *****************************************************************************/
+static void SendFec( sout_stream_t *p_stream, block_t *p_fec )
+{
+    sout_stream_sys_t *p_sys = p_stream->p_sys;
+
+    while ( p_fec != NULL )
+    {
+        block_t *p_next = p_fec->p_next;
+        int i_handle = p_sys->pi_fec_handle[rtp_fec_is_row( p_fec->p_buffer
+                                                             + 12 )];
+
+        if ( i_handle != -1 && send( i_handle, p_fec->p_buffer,
+                                     p_fec->i_buffer, 0 ) == -1 )
+            msg_Warn( p_stream, "FEC send error: %m" );
+        block_Release( p_fec );
+        p_fec = p_next;
+    }
+}
+
 /*****************************************************************************
  * Send: write a packet on the network
  *****************************************************************************/
@@ -227,17 +402,50 @@ static int Send( sout_stream_t *p_stream, sout_stream_id_t *_junk,
 {
     VLC_UNUSED(_junk);
     sout_stream_sys_t *p_sys = p_stream->p_sys;
+    udp_batch_t *p_batch = &p_sys->batch;
 
+    vlc_mutex_lock( &p_sys->lock );
     while ( p_in != NULL )
     {
         block_t *p_next = p_in->p_next;
+        block_t *p_fec = NULL;
+
+        /* FEC packets go out after the media packets they protect */
+        if ( p_sys->p_fec != NULL )
+            p_fec = rtp_fec_encode( p_sys->p_fec, p_in );
+
+        /* i_dts is the date at which the mux wants the datagram out. PCR
+         * datagrams are sent at once, so that they keep their date. */
+        if ( p_batch->i_nb_blocks
+              && ((p_in->i_flags & BLOCK_FLAG_CLOCK)
+                   || p_in->i_dts >= p_batch->pp_blocks[0]->i_dts
+                                      + p_batch->i_window) )
+            Flush( p_stream );
+
+        p_in->p_next = NULL;
+        udp_batch_Append( p_batch, p_in );
+        block_ChainAppend( &p_sys->p_fec_pending, p_fec );
+        if ( udp_batch_IsFull( p_batch )
+              || (p_in->i_flags & BLOCK_FLAG_CLOCK) )
+        {
+            Flush( p_stream );
+            /* The timer must not fire on a later batch */
+            if ( p_sys->i_flush_date )
+            {
+                vlc_timer_schedule( p_sys->timer, false, 0, 0 );
+                p_sys->i_flush_date = 0;
+            }
+        }
+        else if ( p_batch->i_nb_blocks == 1 )
+        {
+            /* Do not wait for the next datagram longer than the window. */
+            p_sys->i_flush_date = mdate() + __MAX( p_batch->i_window, 1 );
+            vlc_timer_schedule( p_sys->timer, true, p_sys->i_flush_date, 0 );
+        }
 
-        if ( send( p_sys->i_handle, p_in->p_buffer, p_in->i_buffer, 0 ) == -1 )
-            msg_Warn( p_stream, "send error: %m" );
-
-        block_Release( p_in );
         p_in = p_next;
     }
+    vlc_mutex_unlock( &p_sys->lock );
 
     return VLC_SUCCESS;
 }
@@ -206,20 +206,112 @@ static void Destroy( vlc_object_t *p_this )
 /*****************************************************************************
  * Run the filter on a Planar YUV picture
  *****************************************************************************/
-static picture_t *FilterPlanar( filter_t *p_filter, picture_t *p_pic )
+typedef struct
 {
+    picture_t *p_pic, *p_outpic;
     int pi_luma[256];
+    int i_sat, i_sin, i_cos, i_x, i_y;
+} adjust_planar_t;
+
+/* Renders the lines [i_start, i_end) of the Y plane, and the matching lines
+ * of the U and V planes */
+static void FilterPlanarSlice( filter_t *p_filter, void *p_data,
+                               int i_start, int i_end )
+{
+    VLC_UNUSED(p_filter);
+    const adjust_planar_t *p_ctx = p_data;
+    const picture_t *p_pic = p_ctx->p_pic;
+    picture_t *p_outpic = p_ctx->p_outpic;
+    const int *pi_luma = p_ctx->pi_luma;
+    const int i_sat = p_ctx->i_sat, i_sin = p_ctx->i_sin, i_cos = p_ctx->i_cos;
+    const int i_x = p_ctx->i_x, i_y = p_ctx->i_y;
+    uint8_t *p_in, *p_in_v, *p_line_end;
+    uint8_t *p_out, *p_out_v;
+
+    /*
+     * Do the Y plane
+     */
+
+    for( int y = i_start; y < i_end; y++ )
+    {
+        p_in = &p_pic->p[Y_PLANE].p_pixels[y * p_pic->p[Y_PLANE].i_pitch];
+        p_out = &p_outpic->p[Y_PLANE].p_pixels[y * p_outpic->p[Y_PLANE].i_pitch];
+        p_line_end = p_in + p_pic->p[Y_PLANE].i_visible_pitch - 8;
+
+        for( ; p_in < p_line_end ; )
+        {
+            /* Do 8 pixels at a time */
+            *p_out++ = pi_luma[ *p_in++ ]; *p_out++ = pi_luma[ *p_in++ ];
+            *p_out++ = pi_luma[ *p_in++ ]; *p_out++ = pi_luma[ *p_in++ ];
+            *p_out++ = pi_luma[ *p_in++ ]; *p_out++ = pi_luma[ *p_in++ ];
+            *p_out++ = pi_luma[ *p_in++ ]; *p_out++ = pi_luma[ *p_in++ ];
+        }
+
+        p_line_end += 8;
+
+        for( ; p_in < p_line_end ; )
+        {
+            *p_out++ = pi_luma[ *p_in++ ];
+        }
+    }
+
+    /*
+     * Do the U and V planes
+     */
+
+    const int i_lines = p_pic->p[Y_PLANE].i_visible_lines;
+    const int i_uv_lines = p_pic->p[U_PLANE].i_visible_lines;
+    const int i_uv_start = i_start * i_uv_lines / i_lines;
+    const int i_uv_end = i_end >= i_lines ? i_uv_lines
+                                          : i_end * i_uv_lines / i_lines;
+
+    for( int y = i_uv_start; y < i_uv_end; y++ )
+    {
+        uint8_t i_u, i_v;
+
+        p_in = &p_pic->p[U_PLANE].p_pixels[y * p_pic->p[U_PLANE].i_pitch];
+        p_in_v = &p_pic->p[V_PLANE].p_pixels[y * p_pic->p[V_PLANE].i_pitch];
+        p_out = &p_outpic->p[U_PLANE].p_pixels[y * p_outpic->p[U_PLANE].i_pitch];
+        p_out_v = &p_outpic->p[V_PLANE].p_pixels[y * p_outpic->p[V_PLANE].i_pitch];
+        p_line_end = p_in + p_pic->p[U_PLANE].i_visible_pitch;
+
+        if ( i_sat > 256 )
+        {
+            for( ; p_in < p_line_end ; )
+            {
+                i_u = *p_in++ ; i_v = *p_in_v++ ;
+                *p_out++ = clip_uint8_vlc( (( ((i_u * i_cos + i_v * i_sin - i_x) >> 8)
+                                       * i_sat) >> 8) + 128);
+                *p_out_v++ = clip_uint8_vlc( (( ((i_v * i_cos - i_u * i_sin - i_y) >> 8)
+                                       * i_sat) >> 8) + 128);
+            }
+        }
+        else
+        {
+            for( ; p_in < p_line_end ; )
+            {
+                i_u = *p_in++ ; i_v = *p_in_v++ ;
+                *p_out++ = (( ((i_u * i_cos + i_v * i_sin - i_x) >> 8)
+                                   * i_sat) >> 8) + 128;
+                *p_out_v++ = (( ((i_v * i_cos - i_u * i_sin - i_y) >> 8)
+                                   * i_sat) >> 8) + 128;
+            }
+        }
+    }
+}
+
+static picture_t *FilterPlanar( filter_t *p_filter, picture_t *p_pic )
+{
+    adjust_planar_t ctx;
     int pi_gamma[256];
 
     picture_t *p_outpic;
-    uint8_t *p_in, *p_in_v, *p_in_end, *p_line_end;
-    uint8_t *p_out, *p_out_v;
 
     bool b_thres;
     double  f_hue;
     double  f_gamma;
     int32_t i_cont, i_lum;
-    int i_sat, i_sin, i_cos, i_x, i_y;
+    int i_sat;
     int i;
 
     filter_sys_t *p_sys = p_filter->p_sys;
@@ -262,7 +354,7 @@ static picture_t *FilterPlanar( filter_t *p_filter, picture_t *p_pic )
         /* Fill the luma lookup table */
         for( i = 0 ; i < 256 ; i++ )
         {
-            pi_luma[ i ] = pi_gamma[clip_uint8_vlc( i_lum + i_cont * i / 256)];
+            ctx.pi_luma[ i ] = pi_gamma[clip_uint8_vlc( i_lum + i_cont * i / 256)];
         }
     }
     else
@@ -273,7 +365,7 @@ static picture_t *FilterPlanar( filter_t *p_filter, picture_t *p_pic )
          */
         for( i = 0 ; i < 256 ; i++ )
         {
-            pi_luma[ i ] = (i < i_lum) ? 0 : 255;
+            ctx.pi_luma[ i ] = (i < i_lum) ? 0 : 255;
         }
 
         /*
@@ -282,142 +374,18 @@ static picture_t *FilterPlanar( filter_t *p_filter, picture_t *p_pic )
         i_sat = 0;
     }
 
-    /*
-     * Do the Y plane
-     */
-
-    p_in = p_pic->p[Y_PLANE].p_pixels;
-    p_in_end = p_in + p_pic->p[Y_PLANE].i_visible_lines
-                      * p_pic->p[Y_PLANE].i_pitch - 8;
-
-    p_out = p_outpic->p[Y_PLANE].p_pixels;
-
-    for( ; p_in < p_in_end ; )
-    {
-        p_line_end = p_in + p_pic->p[Y_PLANE].i_visible_pitch - 8;
-
-        for( ; p_in < p_line_end ; )
-        {
-            /* Do 8 pixels at a time */
-            *p_out++ = pi_luma[ *p_in++ ]; *p_out++ = pi_luma[ *p_in++ ];
-            *p_out++ = pi_luma[ *p_in++ ]; *p_out++ = pi_luma[ *p_in++ ];
-            *p_out++ = pi_luma[ *p_in++ ]; *p_out++ = pi_luma[ *p_in++ ];
-            *p_out++ = pi_luma[ *p_in++ ]; *p_out++ = pi_luma[ *p_in++ ];
-        }
-
-        p_line_end += 8;
-
-        for( ; p_in < p_line_end ; )
-        {
-            *p_out++ = pi_luma[ *p_in++ ];
-        }
-
-        p_in += p_pic->p[Y_PLANE].i_pitch
-              - p_pic->p[Y_PLANE].i_visible_pitch;
-        p_out += p_outpic->p[Y_PLANE].i_pitch
-               - p_outpic->p[Y_PLANE].i_visible_pitch;
-    }
-
-    /*
-     * Do the U and V planes
-     */
-
-    p_in = p_pic->p[U_PLANE].p_pixels;
-    p_in_v = p_pic->p[V_PLANE].p_pixels;
-    p_in_end = p_in + p_pic->p[U_PLANE].i_visible_lines
-                      * p_pic->p[U_PLANE].i_pitch - 8;
-
-    p_out = p_outpic->p[U_PLANE].p_pixels;
-    p_out_v = p_outpic->p[V_PLANE].p_pixels;
-
-    i_sin = sin(f_hue) * 256;
-    i_cos = cos(f_hue) * 256;
-
-    i_x = ( cos(f_hue) + sin(f_hue) ) * 32768;
-    i_y = ( cos(f_hue) - sin(f_hue) ) * 32768;
-
-    if ( i_sat > 256 )
-    {
-#define WRITE_UV_CLIP() \
-    i_u = *p_in++ ; i_v = *p_in_v++ ; \
-    *p_out++ = clip_uint8_vlc( (( ((i_u * i_cos + i_v * i_sin - i_x) >> 8) \
-                           * i_sat) >> 8) + 128); \
-    *p_out_v++ = clip_uint8_vlc( (( ((i_v * i_cos - i_u * i_sin - i_y) >> 8) \
-                           * i_sat) >> 8) + 128)
-
-        uint8_t i_u, i_v;
-
-        for( ; p_in < p_in_end ; )
-        {
-            p_line_end = p_in + p_pic->p[U_PLANE].i_visible_pitch - 8;
-
-            for( ; p_in < p_line_end ; )
-            {
-                /* Do 8 pixels at a time */
-                WRITE_UV_CLIP(); WRITE_UV_CLIP();
-                WRITE_UV_CLIP(); WRITE_UV_CLIP();
-                WRITE_UV_CLIP(); WRITE_UV_CLIP();
-                WRITE_UV_CLIP(); WRITE_UV_CLIP();
-            }
-
-            p_line_end += 8;
-
-            for( ; p_in < p_line_end ; )
-            {
-                WRITE_UV_CLIP();
-            }
-
-            p_in += p_pic->p[U_PLANE].i_pitch
-                  - p_pic->p[U_PLANE].i_visible_pitch;
-            p_in_v += p_pic->p[V_PLANE].i_pitch
-                    - p_pic->p[V_PLANE].i_visible_pitch;
-            p_out += p_outpic->p[U_PLANE].i_pitch
-                   - p_outpic->p[U_PLANE].i_visible_pitch;
-            p_out_v += p_outpic->p[V_PLANE].i_pitch
-                     - p_outpic->p[V_PLANE].i_visible_pitch;
-        }
-#undef WRITE_UV_CLIP
-    }
-    else
-    {
-#define WRITE_UV() \
-    i_u = *p_in++ ; i_v = *p_in_v++ ; \
-    *p_out++ = (( ((i_u * i_cos + i_v * i_sin - i_x) >> 8) \
-                       * i_sat) >> 8) + 128; \
-    *p_out_v++ = (( ((i_v * i_cos - i_u * i_sin - i_y) >> 8) \
-                       * i_sat) >> 8) + 128
-
-        uint8_t i_u, i_v;
-
-        for( ; p_in < p_in_end ; )
-        {
-            p_line_end = p_in + p_pic->p[U_PLANE].i_visible_pitch - 8;
-
-            for( ; p_in < p_line_end ; )
-            {
-                /* Do 8 pixels at a time */
-                WRITE_UV(); WRITE_UV(); WRITE_UV(); WRITE_UV();
-                WRITE_UV(); WRITE_UV(); WRITE_UV(); WRITE_UV();
-            }
-
-            p_line_end += 8;
-
-            for( ; p_in < p_line_end ; )
-            {
-                WRITE_UV();
-            }
-
-            p_in += p_pic->p[U_PLANE].i_pitch
-                  - p_pic->p[U_PLANE].i_visible_pitch;
-            p_in_v += p_pic->p[V_PLANE].i_pitch
-                    - p_pic->p[V_PLANE].i_visible_pitch;
-            p_out += p_outpic->p[U_PLANE].i_pitch
-                   - p_outpic->p[U_PLANE].i_visible_pitch;
-            p_out_v += p_outpic->p[V_PLANE].i_pitch
-                     - p_outpic->p[V_PLANE].i_visible_pitch;
-        }
-#undef WRITE_UV
-    }
+    ctx.p_pic = p_pic;
+    ctx.p_outpic = p_outpic;
+    ctx.i_sat = i_sat;
+    ctx.i_sin = sin(f_hue) * 256;
+    ctx.i_cos = cos(f_hue) * 256;
+    ctx.i_x = ( cos(f_hue) + sin(f_hue) ) * 32768;
+    ctx.i_y = ( cos(f_hue) - sin(f_hue) ) * 32768;
+
+    /* Slices are multiple of 4 lines, so that they do not share chroma
+     * lines */
+    filter_SliceVideo( p_filter, FilterPlanarSlice, &ctx,
+                       p_pic->p[Y_PLANE].i_visible_lines, 4 );
 
     return CopyInfoAndRelease( p_outpic, p_pic );
 }
@@ -33,6 +33,7 @@
 #include <vlc_common.h>
 #include <vlc_plugin.h>
 #include <vlc_filter.h>
+#include <vlc_cpu.h>
 #include "filter_picture.h"
 
 /*****************************************************************************
@@ -41,9 +42,15 @@
 static int  OpenFilter ( vlc_object_t * );
 static void CloseFilter( vlc_object_t * );
 
+#define SIMD_TEXT N_("Use SIMD blending")
+#define SIMD_LONGTEXT N_("Use the SIMD versions of the blending routines " \
+    "when the CPU supports them.")
+
 vlc_module_begin ()
     set_description( N_("Video pictures blending") )
     set_capability( "video blending", 100 )
+    add_bool( "blend-simd", true, SIMD_TEXT, SIMD_LONGTEXT, true )
+        change_private()
     set_callbacks( OpenFilter, CloseFilter )
 vlc_module_end ()
 
@@ -94,9 +101,29 @@ static void BlendRGBAR16( filter_t *, picture_t *, const picture_t *,
 static void BlendRGBAR24( filter_t *, picture_t *, const picture_t *,
                           int, int, int, int, int );
 
+/* Line kernels */
+static void BlendLineAlphaC( uint8_t *, const uint8_t *, const uint8_t *,
+                             int, int, int );
+static void BlendLineConstC( uint8_t *, const uint8_t *, int, int );
+static void BlendLineRGBAC( uint8_t *, uint8_t *, uint8_t *, const uint8_t *,
+                            int, int, int );
+#ifdef CAN_COMPILE_SSE2
+static void BlendLineAlphaSSE2( uint8_t *, const uint8_t *, const uint8_t *,
+                                int, int, int );
+static void BlendLineConstSSE2( uint8_t *, const uint8_t *, int, int );
+static void BlendLineRGBASSE2( uint8_t *, uint8_t *, uint8_t *,
+                               const uint8_t *, int, int, int );
+#endif
+
 struct filter_sys_t
 {
     int i_blendcfg;
+
+    void (*pf_line_alpha)( uint8_t *, const uint8_t *, const uint8_t *,
+                           int, int, int );
+    void (*pf_line_const)( uint8_t *, const uint8_t *, int, int );
+    void (*pf_line_rgba)( uint8_t *, uint8_t *, uint8_t *, const uint8_t *,
+                          int, int, int );
 };
 
 typedef void (*BlendFunction)( filter_t *,
@@ -190,6 +217,19 @@ static int OpenFilter( vlc_object_t *p_this )
     /* Misc init */
     p_filter->pf_video_blend = Blend;
 
+    p_sys->pf_line_alpha = BlendLineAlphaC;
+    p_sys->pf_line_const = BlendLineConstC;
+    p_sys->pf_line_rgba = BlendLineRGBAC;
+#ifdef CAN_COMPILE_SSE2
+    if( ( vlc_CPU() & CPU_CAPABILITY_SSE2 ) &&
+        var_InheritBool( p_filter, "blend-simd" ) )
+    {
+        p_sys->pf_line_alpha = BlendLineAlphaSSE2;
+        p_sys->pf_line_const = BlendLineConstSSE2;
+        p_sys->pf_line_rgba = BlendLineRGBASSE2;
+    }
+#endif
+
     msg_Dbg( p_filter, "chroma: %4.4s -> %4.4s",
              (char *)&p_filter->fmt_in.video.i_chroma,
              (char *)&p_filter->fmt_out.video.i_chroma );
@@ -357,6 +397,317 @@ static void vlc_rgb_index( int *pi_rindex, int *pi_gindex, int *pi_bindex,
 #endif
 }
 
+/***********************************************************************
+ * Line kernels
+ ***********************************************************************/
+/* Blends p_src over i_count pixels of p_dst, with the transparencies of
+ * p_trans scaled by i_alpha. p_src and p_trans are read every i_step
+ * pixels (2 for the chroma of a 4:4:4 source blended onto 4:2:0). */
+static void BlendLineAlphaC( uint8_t *p_dst, const uint8_t *p_src,
+                             const uint8_t *p_trans, int i_alpha,
+                             int i_count, int i_step )
+{
+    for( int i_x = 0; i_x < i_count; i_x++ )
+    {
+        const int i_trans = vlc_alpha( p_trans[i_x * i_step], i_alpha );
+        if( !i_trans )
+            continue;
+
+        p_dst[i_x] = vlc_blend( p_src[i_x * i_step], p_dst[i_x], i_trans );
+    }
+}
+
+/* Blends p_src over i_count pixels of p_dst with the transparency i_alpha */
+static void BlendLineConstC( uint8_t *p_dst, const uint8_t *p_src,
+                             int i_alpha, int i_count )
+{
+    for( int i_x = 0; i_x < i_count; i_x++ )
+        p_dst[i_x] = vlc_blend( p_src[i_x], p_dst[i_x], i_alpha );
+}
+
+/* Blends i_count RGBA pixels over a Y line, and over U and V lines of half
+ * the width unless p_dst_u is NULL */
+static void BlendLineRGBAC( uint8_t *p_dst_y, uint8_t *p_dst_u,
+                            uint8_t *p_dst_v, const uint8_t *p_src,
+                            int i_pix_pitch, int i_alpha, int i_count )
+{
+    for( int i_x = 0; i_x < i_count; i_x++ )
+    {
+        const uint8_t *p_pix = &p_src[i_x * i_pix_pitch];
+        const int i_trans = vlc_alpha( p_pix[3], i_alpha );
+        uint8_t y, u, v;
+
+        if( !i_trans )
+            continue;
+
+        rgb_to_yuv( &y, &u, &v, p_pix[0], p_pix[1], p_pix[2] );
+
+        p_dst_y[i_x] = vlc_blend( y, p_dst_y[i_x], i_trans );
+        if( p_dst_u && i_x % 2 == 0 )
+        {
+            p_dst_u[i_x/2] = vlc_blend( u, p_dst_u[i_x/2], i_trans );
+            p_dst_v[i_x/2] = vlc_blend( v, p_dst_v[i_x/2], i_trans );
+        }
+    }
+}
+
+#ifdef CAN_COMPILE_SSE2
+/* The SSE2 kernels render 8 pixels at a time, with the same results as the
+ * C ones: the computations are done on 16 bits words, which are large
+ * enough for all the intermediate values. */
+typedef struct { uint16_t w[8]; } __attribute__((aligned(16))) blend_pw_t;
+typedef struct { int32_t d[4]; } __attribute__((aligned(16))) blend_pd_t;
+
+static const blend_pw_t pw_1   = {{ 1, 1, 1, 1, 1, 1, 1, 1 }};
+static const blend_pw_t pw_16  = {{ 16, 16, 16, 16, 16, 16, 16, 16 }};
+static const blend_pw_t pw_128 = {{ 128, 128, 128, 128, 128, 128, 128, 128 }};
+static const blend_pw_t pw_255 = {{ 255, 255, 255, 255, 255, 255, 255, 255 }};
+static const blend_pd_t pd_128 = {{ 128, 128, 128, 128 }};
+static const blend_pd_t pd_low = {{ 0xffff, 0xffff, 0xffff, 0xffff }};
+/* rgb_to_yuv() coefficients of R, G, B and A for two pixels */
+static const blend_pw_t pw_rgb_y = {{ 66, 129, 25, 0, 66, 129, 25, 0 }};
+static const blend_pw_t pw_rgb_u = {{ -38, -74, 112, 0, -38, -74, 112, 0 }};
+static const blend_pw_t pw_rgb_v = {{ 112, -94, -18, 0, 112, -94, -18, 0 }};
+
+#ifdef __SSE__
+# define SSE2_CLOBBERS , "xmm0", "xmm1", "xmm2", "xmm3", \
+                         "xmm4", "xmm5", "xmm6", "xmm7"
+#else
+# define SSE2_CLOBBERS
+#endif
+
+/* Broadcasts the alpha operand to the words of xmm7, and zeroes xmm0 */
+#define SSE2_INIT \
+    "pxor       %%xmm0, %%xmm0\n" \
+    "movd       %[alpha], %%xmm7\n" \
+    "pshuflw    $0, %%xmm7, %%xmm7\n" \
+    "punpcklqdq %%xmm7, %%xmm7\n"
+
+/* vlc_alpha() of the words of xmm1 with xmm7: for x <= 255 * 255,
+ * x / 255 == (x + 1 + (x >> 8)) >> 8 */
+#define SSE2_ALPHA \
+    "pmullw     %%xmm7, %%xmm1\n" \
+    "movdqa     %%xmm1, %%xmm2\n" \
+    "psrlw      $8, %%xmm2\n" \
+    "paddw      %%xmm2, %%xmm1\n" \
+    "paddw      %[pw1], %%xmm1\n" \
+    "psrlw      $8, %%xmm1\n"
+
+/* vlc_blend() of the words of xmm3 over xmm4 with the transparencies of
+ * xmm1, into xmm5 */
+#define SSE2_BLEND \
+    "movdqa     %[pw255], %%xmm5\n" \
+    "psubw      %%xmm1, %%xmm5\n" \
+    "movdqa     %%xmm3, %%xmm6\n" \
+    "pmullw     %%xmm1, %%xmm6\n" \
+    "movdqa     %%xmm4, %%xmm2\n" \
+    "pmullw     %%xmm5, %%xmm2\n" \
+    "paddw      %%xmm2, %%xmm6\n" \
+    "psrlw      $8, %%xmm6\n"           /* (s * t + d * (255 - t)) >> 8 */ \
+    "pcmpeqw    %%xmm0, %%xmm5\n"       /* t == 255: s */ \
+    "movdqa     %%xmm1, %%xmm2\n" \
+    "pcmpeqw    %%xmm0, %%xmm2\n"       /* t == 0: d */ \
+    "pand       %%xmm2, %%xmm4\n" \
+    "pandn      %%xmm6, %%xmm2\n" \
+    "por        %%xmm4, %%xmm2\n" \
+    "pand       %%xmm5, %%xmm3\n" \
+    "pandn      %%xmm2, %%xmm5\n" \
+    "por        %%xmm3, %%xmm5\n"
+
+static void BlendLineAlphaSSE2( uint8_t *p_dst, const uint8_t *p_src,
+                                const uint8_t *p_trans, int i_alpha,
+                                int i_count, int i_step )
+{
+    int i_x = 0;
+
+    if( i_step == 1 )
+    {
+        for( ; i_x + 8 <= i_count; i_x += 8 )
+            __asm__ volatile(
+                SSE2_INIT
+                "movq       %[trans], %%xmm1\n"
+                "punpcklbw  %%xmm0, %%xmm1\n"
+                SSE2_ALPHA
+                "movq       %[src], %%xmm3\n"
+                "punpcklbw  %%xmm0, %%xmm3\n"
+                "movq       %[dst], %%xmm4\n"
+                "punpcklbw  %%xmm0, %%xmm4\n"
+                SSE2_BLEND
+                "packuswb   %%xmm5, %%xmm5\n"
+                "movq       %%xmm5, %[dst]\n"
+                : [dst]"+m"(*(uint64_t *)&p_dst[i_x])
+                : [src]"m"(*(const uint64_t *)&p_src[i_x]),
+                  [trans]"m"(*(const uint64_t *)&p_trans[i_x]),
+                  [alpha]"r"(i_alpha), [pw1]"m"(pw_1), [pw255]"m"(pw_255)
+                : "memory" SSE2_CLOBBERS );
+    }
+    else if( i_step == 2 )
+    {
+        /* The even source bytes are the low bytes of its words */
+        for( ; i_x + 8 <= i_count; i_x += 8 )
+            __asm__ volatile(
+                SSE2_INIT
+                "movdqu     %[trans], %%xmm1\n"
+                "pand       %[pw255], %%xmm1\n"
+                SSE2_ALPHA
+                "movdqu     %[src], %%xmm3\n"
+                "pand       %[pw255], %%xmm3\n"
+                "movq       %[dst], %%xmm4\n"
+                "punpcklbw  %%xmm0, %%xmm4\n"
+                SSE2_BLEND
+                "packuswb   %%xmm5, %%xmm5\n"
+                "movq       %%xmm5, %[dst]\n"
+                : [dst]"+m"(*(uint64_t *)&p_dst[i_x])
+                : [src]"m"(*(const blend_pw_t *)&p_src[2 * i_x]),
+                  [trans]"m"(*(const blend_pw_t *)&p_trans[2 * i_x]),
+                  [alpha]"r"(i_alpha), [pw1]"m"(pw_1), [pw255]"m"(pw_255)
+                : "memory" SSE2_CLOBBERS );
+    }
+
+    BlendLineAlphaC( &p_dst[i_x], &p_src[i_x * i_step],
+                     &p_trans[i_x * i_step], i_alpha,
+                     i_count - i_x, i_step );
+}
+
+static void BlendLineConstSSE2( uint8_t *p_dst, const uint8_t *p_src,
+                                int i_alpha, int i_count )
+{
+    int i_x = 0;
+
+    /* 0 < i_alpha < 255, so vlc_blend() is a plain weighted mean */
+    for( ; i_x + 8 <= i_count; i_x += 8 )
+        __asm__ volatile(
+            SSE2_INIT
+            "movdqa     %[pw255], %%xmm1\n"
+            "psubw      %%xmm7, %%xmm1\n"
+            "movq       %[src], %%xmm3\n"
+            "punpcklbw  %%xmm0, %%xmm3\n"
+            "movq       %[dst], %%xmm4\n"
+            "punpcklbw  %%xmm0, %%xmm4\n"
+            "pmullw     %%xmm7, %%xmm3\n"
+            "pmullw     %%xmm1, %%xmm4\n"
+            "paddw      %%xmm4, %%xmm3\n"
+            "psrlw      $8, %%xmm3\n"
+            "packuswb   %%xmm3, %%xmm3\n"
+            "movq       %%xmm3, %[dst]\n"
+            : [dst]"+m"(*(uint64_t *)&p_dst[i_x])
+            : [src]"m"(*(const uint64_t *)&p_src[i_x]),
+              [alpha]"r"(i_alpha), [pw255]"m"(pw_255)
+            : "memory" SSE2_CLOBBERS );
+
+    BlendLineConstC( &p_dst[i_x], &p_src[i_x], i_alpha, i_count - i_x );
+}
+
+/* rgb_to_yuv() component of the 4 RGBA pixels of xmm1 selected by the
+ * coefficients operand, into the dwords of xmm3 */
+#define SSE2_RGB_TO_YUV( coefs ) \
+    "movdqa     %%xmm1, %%xmm3\n" \
+    "punpcklbw  %%xmm0, %%xmm3\n" \
+    "movdqa     %%xmm1, %%xmm4\n" \
+    "punpckhbw  %%xmm0, %%xmm4\n" \
+    "pmaddwd    " coefs ", %%xmm3\n" \
+    "pmaddwd    " coefs ", %%xmm4\n" \
+    "movdqa     %%xmm3, %%xmm5\n" \
+    "shufps     $0x88, %%xmm4, %%xmm5\n" \
+    "shufps     $0xdd, %%xmm4, %%xmm3\n" \
+    "paddd      %%xmm5, %%xmm3\n" \
+    "paddd      %[pd128], %%xmm3\n" \
+    "psrad      $8, %%xmm3\n"
+
+/* rgb_to_yuv() component of the 8 RGBA pixels of the source operands, into
+ * the words of xmm6, without the final offset */
+#define SSE2_RGBA( coefs ) \
+    "movdqu     %[src0], %%xmm1\n" \
+    SSE2_RGB_TO_YUV( coefs ) \
+    "movdqa     %%xmm3, %%xmm6\n" \
+    "movdqu     %[src1], %%xmm1\n" \
+    SSE2_RGB_TO_YUV( coefs ) \
+    "packssdw   %%xmm3, %%xmm6\n"
+
+static void BlendLineRGBASSE2( uint8_t *p_dst_y, uint8_t *p_dst_u,
+                               uint8_t *p_dst_v, const uint8_t *p_src,
+                               int i_pix_pitch, int i_alpha, int i_count )
+{
+    int i_x = 0;
+
+    for( ; i_pix_pitch == 4 && i_x + 8 <= i_count; i_x += 8 )
+    {
+        blend_pw_t y, u, v, t;
+
+        /* Convert to YUV and scale the transparencies */
+        __asm__ volatile(
+            SSE2_INIT
+            SSE2_RGBA( "%[pwy]" )
+            "paddw      %[pw16], %%xmm6\n"
+            "movdqa     %%xmm6, %[y]\n"
+            SSE2_RGBA( "%[pwu]" )
+            "paddw      %[pw128], %%xmm6\n"
+            "movdqa     %%xmm6, %[u]\n"
+            SSE2_RGBA( "%[pwv]" )
+            "paddw      %[pw128], %%xmm6\n"
+            "movdqa     %%xmm6, %[v]\n"
+            "movdqu     %[src0], %%xmm1\n"
+            "movdqu     %[src1], %%xmm2\n"
+            "psrld      $24, %%xmm1\n"
+            "psrld      $24, %%xmm2\n"
+            "packssdw   %%xmm2, %%xmm1\n"
+            SSE2_ALPHA
+            "movdqa     %%xmm1, %[t]\n"
+            : [y]"=m"(y), [u]"=m"(u), [v]"=m"(v), [t]"=m"(t)
+            : [src0]"m"(*(const blend_pw_t *)&p_src[4 * i_x]),
+              [src1]"m"(*(const blend_pw_t *)&p_src[4 * i_x + 16]),
+              [alpha]"r"(i_alpha), [pw1]"m"(pw_1), [pw16]"m"(pw_16),
+              [pw128]"m"(pw_128), [pd128]"m"(pd_128),
+              [pwy]"m"(pw_rgb_y), [pwu]"m"(pw_rgb_u), [pwv]"m"(pw_rgb_v)
+            : "memory" SSE2_CLOBBERS );
+
+        /* Blend the Y line */
+        __asm__ volatile(
+            "pxor       %%xmm0, %%xmm0\n"
+            "movdqa     %[t], %%xmm1\n"
+            "movdqa     %[y], %%xmm3\n"
+            "movq       %[dst], %%xmm4\n"
+            "punpcklbw  %%xmm0, %%xmm4\n"
+            SSE2_BLEND
+            "packuswb   %%xmm5, %%xmm5\n"
+            "movq       %%xmm5, %[dst]\n"
+            : [dst]"+m"(*(uint64_t *)&p_dst_y[i_x])
+            : [t]"m"(t), [y]"m"(y), [pw255]"m"(pw_255)
+            : "memory" SSE2_CLOBBERS );
+
+        if( !p_dst_u )
+            continue;
+
+        /* Blend the U and V lines with the even pixels */
+        uint8_t *pp_dst[2] = { &p_dst_u[i_x/2], &p_dst_v[i_x/2] };
+        const blend_pw_t *pp_uv[2] = { &u, &v };
+        for( int i = 0; i < 2; i++ )
+            __asm__ volatile(
+                "pxor       %%xmm0, %%xmm0\n"
+                "movdqa     %[t], %%xmm1\n"
+                "pand       %[pdlow], %%xmm1\n"
+                "packssdw   %%xmm1, %%xmm1\n"
+                "movdqa     %[uv], %%xmm3\n"
+                "pand       %[pdlow], %%xmm3\n"
+                "packssdw   %%xmm3, %%xmm3\n"
+                "movd       %[dst], %%xmm4\n"
+                "punpcklbw  %%xmm0, %%xmm4\n"
+                SSE2_BLEND
+                "packuswb   %%xmm5, %%xmm5\n"
+                "movd       %%xmm5, %[dst]\n"
+                : [dst]"+m"(*(uint32_t *)pp_dst[i])
+                : [t]"m"(t), [uv]"m"(*pp_uv[i]),
+                  [pdlow]"m"(pd_low), [pw255]"m"(pw_255)
+                : "memory" SSE2_CLOBBERS );
+    }
+
+    BlendLineRGBAC( &p_dst_y[i_x], p_dst_u ? &p_dst_u[i_x/2] : NULL,
+                    p_dst_v ? &p_dst_v[i_x/2] : NULL,
+                    &p_src[i_x * i_pix_pitch], i_pix_pitch, i_alpha,
+                    i_count - i_x );
+}
+#endif
+
 /***********************************************************************
  * YUVA
  ***********************************************************************/
@@ -370,8 +721,9 @@ static void BlendYUVAI420( filter_t *p_filter,
     uint8_t *p_src_u, *p_dst_u;
     uint8_t *p_src_v, *p_dst_v;
     uint8_t *p_trans;
-    int i_x, i_y, i_trans = 0;
+    int i_y;
     bool b_even_scanline = i_y_offset % 2;
+    filter_sys_t *p_sys = p_filter->p_sys;
 
     p_dst_y = vlc_plane_start( &i_dst_pitch, p_dst, Y_PLANE,
                                i_x_offset, i_y_offset, &p_filter->fmt_out.video, 1 );
@@ -399,22 +751,15 @@ static void BlendYUVAI420( filter_t *p_filter,
     {
         b_even_scanline = !b_even_scanline;
 
-        /* Draw until we reach the end of the line */
-        for( i_x = 0; i_x < i_width; i_x++ )
+        /* Blending */
+        p_sys->pf_line_alpha( p_dst_y, p_src_y, p_trans, i_alpha,
+                              i_width, 1 );
+        if( b_even_scanline )
         {
-            if( p_trans )
-                i_trans = vlc_alpha( p_trans[i_x], i_alpha );
-
-            if( !i_trans )
-                continue;
-
-            /* Blending */
-            p_dst_y[i_x] = vlc_blend( p_src_y[i_x], p_dst_y[i_x], i_trans );
-            if( b_even_scanline && i_x % 2 == 0 )
-            {
-                p_dst_u[i_x/2] = vlc_blend( p_src_u[i_x], p_dst_u[i_x/2], i_trans );
-                p_dst_v[i_x/2] = vlc_blend( p_src_v[i_x], p_dst_v[i_x/2], i_trans );
-            }
+            p_sys->pf_line_alpha( p_dst_u, p_src_u, p_trans, i_alpha,
+                                  ( i_width + 1 ) / 2, 2 );
+            p_sys->pf_line_alpha( p_dst_v, p_src_v, p_trans, i_alpha,
+                                  ( i_width + 1 ) / 2, 2 );
         }
     }
 }
@@ -676,8 +1021,9 @@ static void BlendI420I420( filter_t *p_filter,
     uint8_t *p_src_y, *p_dst_y;
     uint8_t *p_src_u, *p_dst_u;
     uint8_t *p_src_v, *p_dst_v;
-    int i_x, i_y;
+    int i_y;
     bool b_even_scanline = i_y_offset % 2;
+    filter_sys_t *p_sys = p_filter->p_sys;
 
     if( i_alpha == 0xff )
     {
@@ -721,19 +1067,14 @@ static void BlendI420I420( filter_t *p_filter,
         }
         b_even_scanline = !b_even_scanline;
 
-        /* Draw until we reach the end of the line */
-        for( i_x = 0; i_x < i_width; i_x++ )
+        /* Blending */
+        p_sys->pf_line_const( p_dst_y, p_src_y, i_alpha, i_width );
+        if( b_even_scanline )
         {
-            if( !i_alpha )
-                continue;
-
-            /* Blending */
-            p_dst_y[i_x] = vlc_blend( p_src_y[i_x], p_dst_y[i_x], i_alpha );
-            if( b_even_scanline && i_x % 2 == 0 )
-            {
-                p_dst_u[i_x/2] = vlc_blend( p_src_u[i_x/2], p_dst_u[i_x/2], i_alpha );
-                p_dst_v[i_x/2] = vlc_blend( p_src_v[i_x/2], p_dst_v[i_x/2], i_alpha );
-            }
+            p_sys->pf_line_const( p_dst_u, p_src_u, i_alpha,
+                                  ( i_width + 1 ) / 2 );
+            p_sys->pf_line_const( p_dst_v, p_src_v, i_alpha,
+                                  ( i_width + 1 ) / 2 );
         }
         if( i_y%2 == 1 )
         {
@@ -1175,10 +1516,10 @@ static void BlendRGBAI420( filter_t *p_filter,
     uint8_t *p_dst_u;
     uint8_t *p_dst_v;
     uint8_t *p_src;
-    int i_x, i_y, i_trans;
-    uint8_t y, u, v;
+    int i_y;
 
     bool b_even_scanline = i_y_offset % 2;
+    filter_sys_t *p_sys = p_filter->p_sys;
 
     i_dst_pitch = p_dst->p[Y_PLANE].i_pitch;
     p_dst_y = p_dst->p[Y_PLANE].p_pixels + i_x_offset +
@@ -1210,27 +1551,10 @@ static void BlendRGBAI420( filter_t *p_filter,
     {
         b_even_scanline = !b_even_scanline;
 
-        /* Draw until we reach the end of the line */
-        for( i_x = 0; i_x < i_width; i_x++ )
-        {
-            const int R = p_src[i_x * i_src_pix_pitch + 0];
-            const int G = p_src[i_x * i_src_pix_pitch + 1];
-            const int B = p_src[i_x * i_src_pix_pitch + 2];
-
-            i_trans = vlc_alpha( p_src[i_x * i_src_pix_pitch + 3], i_alpha );
-            if( !i_trans )
-                continue;
-
-            /* Blending */
-            rgb_to_yuv( &y, &u, &v, R, G, B );
-
-            p_dst_y[i_x] = vlc_blend( y, p_dst_y[i_x], i_trans );
-            if( b_even_scanline && i_x % 2 == 0 )
-            {
-                p_dst_u[i_x/2] = vlc_blend( u, p_dst_u[i_x/2], i_trans );
-                p_dst_v[i_x/2] = vlc_blend( v, p_dst_v[i_x/2], i_trans );
-            }
-        }
+        /* Blending */
+        p_sys->pf_line_rgba( p_dst_y, b_even_scanline ? p_dst_u : NULL,
+                             b_even_scanline ? p_dst_v : NULL,
+                             p_src, i_src_pix_pitch, i_alpha, i_width );
     }
 }
 
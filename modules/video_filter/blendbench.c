@@ -209,32 +209,58 @@ static void Destroy( vlc_object_t *p_this )
 }
 
 /*****************************************************************************
- * Render: displays previously rendered output
+ * blendbench_NewBlend: creates a blending filter, with or without its SIMD
+ * routines
  *****************************************************************************/
-static picture_t *Filter( filter_t *p_filter, picture_t *p_pic )
+static filter_t *blendbench_NewBlend( filter_t *p_filter, bool b_simd )
 {
     filter_sys_t *p_sys = p_filter->p_sys;
     filter_t *p_blend;
 
-    if( p_sys->b_done )
-        return p_pic;
-
     p_blend = vlc_object_create( p_filter, sizeof(filter_t) );
     if( !p_blend )
-    {
-        picture_Release( p_pic );
         return NULL;
-    }
     vlc_object_attach( p_blend, p_filter );
     p_blend->fmt_out.video = p_sys->p_base_image->format;
     p_blend->fmt_in.video = p_sys->p_blend_image->format;
+
+    var_Create( p_blend, "blend-simd", VLC_VAR_BOOL );
+    var_SetBool( p_blend, "blend-simd", b_simd );
+
     p_blend->p_module = module_need( p_blend, "video blending", NULL, false );
     if( !p_blend->p_module )
     {
-        picture_Release( p_pic );
         vlc_object_release( p_blend );
         return NULL;
     }
+    return p_blend;
+}
+
+static void blendbench_DeleteBlend( filter_t *p_blend )
+{
+    module_unneed( p_blend, p_blend->p_module );
+    vlc_object_release( p_blend );
+}
+
+/*****************************************************************************
+ * blendbench_Run: blends the images with the C or SIMD routines
+ *****************************************************************************
+ * The blend image is blended once onto p_check, then i_loops times onto the
+ * base image to measure the speed.
+ *****************************************************************************/
+static int blendbench_Run( filter_t *p_filter, bool b_simd,
+                           picture_t *p_check )
+{
+    filter_sys_t *p_sys = p_filter->p_sys;
+    const char *psz_path = b_simd ? "SIMD" : "C";
+    filter_t *p_blend;
+
+    p_blend = blendbench_NewBlend( p_filter, b_simd );
+    if( !p_blend )
+        return VLC_EGENERIC;
+
+    p_blend->pf_video_blend( p_blend, p_check, p_sys->p_blend_image,
+                             0, 0, p_sys->i_alpha );
 
     mtime_t time = mdate();
     for( int i_iter = 0; i_iter < p_sys->i_loops; ++i_iter )
@@ -245,17 +271,73 @@ static picture_t *Filter( filter_t *p_filter, picture_t *p_pic )
     }
     time = mdate() - time;
 
-    msg_Info( p_filter, "Blended %d images in %f sec", p_sys->i_loops,
-              time / 1000000.0f );
-    msg_Info( p_filter, "Speed is: %f images/second, %f pixels/second",
+    msg_Info( p_filter, "%s: blended %d images in %f sec", psz_path,
+              p_sys->i_loops, time / 1000000.0f );
+    msg_Info( p_filter, "%s: speed is: %f images/second, %f pixels/second",
+              psz_path,
               (float) p_sys->i_loops / time * 1000000,
               (float) p_sys->i_loops / time * 1000000 *
-                  p_sys->p_blend_image->p[Y_PLANE].i_visible_pitch *
-                  p_sys->p_blend_image->p[Y_PLANE].i_visible_lines );
+                  p_sys->p_blend_image->format.i_visible_width *
+                  p_sys->p_blend_image->format.i_visible_height );
 
-    module_unneed( p_blend, p_blend->p_module );
+    blendbench_DeleteBlend( p_blend );
+    return VLC_SUCCESS;
+}
 
-    vlc_object_release( p_blend );
+/*****************************************************************************
+ * blendbench_Compare: checks that the visible pixels of 2 pictures match
+ *****************************************************************************/
+static bool blendbench_Compare( filter_t *p_filter,
+                                const picture_t *p_ref, const picture_t *p_pic )
+{
+    for( int i_plane = 0; i_plane < p_ref->i_planes; i_plane++ )
+    {
+        const plane_t *p_ref_plane = &p_ref->p[i_plane];
+        const plane_t *p_plane = &p_pic->p[i_plane];
+
+        for( int i_line = 0; i_line < p_ref_plane->i_visible_lines; i_line++ )
+        {
+            if( memcmp( &p_ref_plane->p_pixels[i_line * p_ref_plane->i_pitch],
+                        &p_plane->p_pixels[i_line * p_plane->i_pitch],
+                        p_ref_plane->i_visible_pitch ) )
+            {
+                msg_Err( p_filter, "SIMD blending differs from C "
+                         "(plane %d, line %d)", i_plane, i_line );
+                return false;
+            }
+        }
+    }
+    msg_Info( p_filter, "SIMD blending is bit-exact with C" );
+    return true;
+}
+
+/*****************************************************************************
+ * Render: displays previously rendered output
+ *****************************************************************************/
+static picture_t *Filter( filter_t *p_filter, picture_t *p_pic )
+{
+    filter_sys_t *p_sys = p_filter->p_sys;
+    picture_t *p_check[2];
+
+    if( p_sys->b_done )
+        return p_pic;
+
+    /* Both routines blend onto copies of the same base image */
+    for( int i = 0; i < 2; i++ )
+    {
+        p_check[i] = picture_NewFromFormat( &p_sys->p_base_image->format );
+        if( p_check[i] )
+            picture_Copy( p_check[i], p_sys->p_base_image );
+    }
+
+    if( p_check[0] && p_check[1] &&
+        !blendbench_Run( p_filter, false, p_check[0] ) &&
+        !blendbench_Run( p_filter, true, p_check[1] ) )
+        blendbench_Compare( p_filter, p_check[0], p_check[1] );
+
+    for( int i = 0; i < 2; i++ )
+        if( p_check[i] )
+            picture_Release( p_check[i] );
 
     p_sys->b_done = true;
     return p_pic;
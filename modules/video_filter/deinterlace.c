@@ -434,55 +434,96 @@ static void RenderBob( filter_t *p_filter,
 #define Merge p_filter->p_sys->pf_merge
 #define EndMerge if(p_filter->p_sys->pf_end_merge) p_filter->p_sys->pf_end_merge
 
+/* Lines of a plane matching the lines [i_start, i_end) of the first plane,
+ * for the slices of filter_SliceVideo() */
+static void PlaneSlice( const picture_t *p_pic, int i_plane,
+                        int i_start, int i_end, int *pi_start, int *pi_end )
+{
+    const int i_lines = p_pic->p[Y_PLANE].i_visible_lines;
+    const int i_plane_lines = p_pic->p[i_plane].i_visible_lines;
+
+    *pi_start = i_start * i_plane_lines / i_lines;
+    *pi_end = i_end * i_plane_lines / i_lines;
+}
+
+typedef struct
+{
+    picture_t *p_outpic;
+    picture_t *p_pic;
+    int i_field;
+} deinterlace_slice_t;
+
 /*****************************************************************************
  * RenderLinear: BOB with linear interpolation
  *****************************************************************************/
-static void RenderLinear( filter_t *p_filter,
-                          picture_t *p_outpic, picture_t *p_pic, int i_field )
+static void RenderLinearSlice( filter_t *p_filter, void *p_data,
+                               int i_start, int i_end )
 {
-    int i_plane;
+    const deinterlace_slice_t *p_ctx = p_data;
+    picture_t *p_outpic = p_ctx->p_outpic;
+    const picture_t *p_pic = p_ctx->p_pic;
+    const int i_field = p_ctx->i_field;
 
-    /* Copy image and skip lines */
-    for( i_plane = 0 ; i_plane < p_pic->i_planes ; i_plane++ )
+    for( int i_plane = 0 ; i_plane < p_pic->i_planes ; i_plane++ )
     {
-        uint8_t *p_in, *p_out_end, *p_out;
+        const int i_lines = p_outpic->p[i_plane].i_visible_lines;
+        const int i_in_pitch = p_pic->p[i_plane].i_pitch;
+        const uint8_t *p_in = p_pic->p[i_plane].p_pixels;
+        int i_first, i_last;
 
-        p_in = p_pic->p[i_plane].p_pixels;
-        p_out = p_outpic->p[i_plane].p_pixels;
-        p_out_end = p_out + p_outpic->p[i_plane].i_pitch
-                             * p_outpic->p[i_plane].i_visible_lines;
+        PlaneSlice( p_outpic, i_plane, i_start, i_end, &i_first, &i_last );
 
-        /* For BOTTOM field we need to add the first line */
-        if( i_field == 1 )
+        /* Lines of the field are copied, the other ones are interpolated
+         * (for the BOTTOM field, the first line is copied too) */
+        for( int y = i_first; y < i_last; y++ )
         {
-            vlc_memcpy( p_out, p_in, p_pic->p[i_plane].i_pitch );
-            p_in += p_pic->p[i_plane].i_pitch;
-            p_out += p_outpic->p[i_plane].i_pitch;
-        }
+            uint8_t *p_out = &p_outpic->p[i_plane].p_pixels[
+                                        y * p_outpic->p[i_plane].i_pitch];
 
-        p_out_end -= 2 * p_outpic->p[i_plane].i_pitch;
+            if( y < i_field || ( y - i_field ) % 2 == 0 || y + 1 >= i_lines )
+                vlc_memcpy( p_out, &p_in[y * i_in_pitch], i_in_pitch );
+            else
+                Merge( p_out, &p_in[(y - 1) * i_in_pitch],
+                       &p_in[(y + 1) * i_in_pitch], i_in_pitch );
+        }
+    }
+    EndMerge();
+}
 
-        for( ; p_out < p_out_end ; )
-        {
-            vlc_memcpy( p_out, p_in, p_pic->p[i_plane].i_pitch );
+static void RenderLinear( filter_t *p_filter,
+                          picture_t *p_outpic, picture_t *p_pic, int i_field )
+{
+    deinterlace_slice_t ctx = {
+        .p_outpic = p_outpic, .p_pic = p_pic, .i_field = i_field,
+    };
 
-            p_out += p_outpic->p[i_plane].i_pitch;
+    filter_SliceVideo( p_filter, RenderLinearSlice, &ctx,
+                       p_outpic->p[Y_PLANE].i_visible_lines, 2 );
+}
 
-            Merge( p_out, p_in, p_in + 2 * p_pic->p[i_plane].i_pitch,
-                   p_pic->p[i_plane].i_pitch );
+static void RenderMeanSlice( filter_t *p_filter, void *p_data,
+                             int i_start, int i_end )
+{
+    const deinterlace_slice_t *p_ctx = p_data;
+    picture_t *p_outpic = p_ctx->p_outpic;
+    const picture_t *p_pic = p_ctx->p_pic;
 
-            p_in += 2 * p_pic->p[i_plane].i_pitch;
-            p_out += p_outpic->p[i_plane].i_pitch;
-        }
+    for( int i_plane = 0 ; i_plane < p_pic->i_planes ; i_plane++ )
+    {
+        const int i_in_pitch = p_pic->p[i_plane].i_pitch;
+        int i_first, i_last;
 
-        vlc_memcpy( p_out, p_in, p_pic->p[i_plane].i_pitch );
+        PlaneSlice( p_outpic, i_plane, i_start, i_end, &i_first, &i_last );
 
-        /* For TOP field we need to add the last line */
-        if( i_field == 0 )
+        /* All lines: mean value */
+        for( int y = i_first; y < i_last; y++ )
         {
-            p_in += p_pic->p[i_plane].i_pitch;
-            p_out += p_outpic->p[i_plane].i_pitch;
-            vlc_memcpy( p_out, p_in, p_pic->p[i_plane].i_pitch );
+            const uint8_t *p_in = &p_pic->p[i_plane].p_pixels[
+                                                    2 * y * i_in_pitch];
+
+            Merge( &p_outpic->p[i_plane].p_pixels[
+                                        y * p_outpic->p[i_plane].i_pitch],
+                   p_in, p_in + i_in_pitch, i_in_pitch );
         }
     }
     EndMerge();
@@ -491,27 +532,44 @@ static void RenderLinear( filter_t *p_filter,
 static void RenderMean( filter_t *p_filter,
                         picture_t *p_outpic, picture_t *p_pic )
 {
-    int i_plane;
+    deinterlace_slice_t ctx = { .p_outpic = p_outpic, .p_pic = p_pic };
 
-    /* Copy image and skip lines */
-    for( i_plane = 0 ; i_plane < p_pic->i_planes ; i_plane++ )
-    {
-        uint8_t *p_in, *p_out_end, *p_out;
+    filter_SliceVideo( p_filter, RenderMeanSlice, &ctx,
+                       p_outpic->p[Y_PLANE].i_visible_lines, 2 );
+}
 
-        p_in = p_pic->p[i_plane].p_pixels;
+static void RenderBlendSlice( filter_t *p_filter, void *p_data,
+                              int i_start, int i_end )
+{
+    const deinterlace_slice_t *p_ctx = p_data;
+    picture_t *p_outpic = p_ctx->p_outpic;
+    const picture_t *p_pic = p_ctx->p_pic;
+    const bool b_422 = p_filter->fmt_in.video.i_chroma == VLC_CODEC_I422 ||
+                       p_filter->fmt_in.video.i_chroma == VLC_CODEC_J422;
 
-        p_out = p_outpic->p[i_plane].p_pixels;
-        p_out_end = p_out + p_outpic->p[i_plane].i_pitch
-                             * p_outpic->p[i_plane].i_visible_lines;
+    for( int i_plane = 0 ; i_plane < p_pic->i_planes ; i_plane++ )
+    {
+        const int i_in_pitch = p_pic->p[i_plane].i_pitch;
+        /* 4:2:2 chroma lines are blended two by two */
+        const int i_step = b_422 && i_plane != Y_PLANE ? 2 : 1;
+        int i_first, i_last;
 
-        /* All lines: mean value */
-        for( ; p_out < p_out_end ; )
+        PlaneSlice( p_outpic, i_plane, i_start, i_end, &i_first, &i_last );
+
+        for( int y = i_first; y < i_last; y++ )
         {
-            Merge( p_out, p_in, p_in + p_pic->p[i_plane].i_pitch,
-                   p_pic->p[i_plane].i_pitch );
+            uint8_t *p_out = &p_outpic->p[i_plane].p_pixels[
+                                        y * p_outpic->p[i_plane].i_pitch];
 
-            p_out += p_outpic->p[i_plane].i_pitch;
-            p_in += 2 * p_pic->p[i_plane].i_pitch;
+            /* First line: simple copy, remaining lines: mean value */
+            if( y == 0 )
+                vlc_memcpy( p_out, p_pic->p[i_plane].p_pixels, i_in_pitch );
+            else
+            {
+                const uint8_t *p_in = &p_pic->p[i_plane].p_pixels[
+                                        ( y - 1 ) * i_step * i_in_pitch];
+                Merge( p_out, p_in, p_in + i_in_pitch, i_in_pitch );
+            }
         }
     }
     EndMerge();
@@ -520,73 +578,10 @@ static void RenderMean( filter_t *p_filter,
 static void RenderBlend( filter_t *p_filter,
                          picture_t *p_outpic, picture_t *p_pic )
 {
-    int i_plane;
-
-    /* Copy image and skip lines */
-    for( i_plane = 0 ; i_plane < p_pic->i_planes ; i_plane++ )
-    {
-        uint8_t *p_in, *p_out_end, *p_out;
+    deinterlace_slice_t ctx = { .p_outpic = p_outpic, .p_pic = p_pic };
 
-        p_in = p_pic->p[i_plane].p_pixels;
-
-        p_out = p_outpic->p[i_plane].p_pixels;
-        p_out_end = p_out + p_outpic->p[i_plane].i_pitch
-                             * p_outpic->p[i_plane].i_visible_lines;
-
-        switch( p_filter->fmt_in.video.i_chroma )
-        {
-            case VLC_CODEC_I420:
-            case VLC_CODEC_J420:
-            case VLC_CODEC_YV12:
-                /* First line: simple copy */
-                vlc_memcpy( p_out, p_in, p_pic->p[i_plane].i_pitch );
-                p_out += p_outpic->p[i_plane].i_pitch;
-
-                /* Remaining lines: mean value */
-                for( ; p_out < p_out_end ; )
-                {
-                    Merge( p_out, p_in, p_in + p_pic->p[i_plane].i_pitch,
-                           p_pic->p[i_plane].i_pitch );
-
-                    p_out += p_outpic->p[i_plane].i_pitch;
-                    p_in += p_pic->p[i_plane].i_pitch;
-                }
-                break;
-
-            case VLC_CODEC_I422:
-            case VLC_CODEC_J422:
-                /* First line: simple copy */
-                vlc_memcpy( p_out, p_in, p_pic->p[i_plane].i_pitch );
-                p_out += p_outpic->p[i_plane].i_pitch;
-
-                /* Remaining lines: mean value */
-                if( i_plane == Y_PLANE )
-                {
-                    for( ; p_out < p_out_end ; )
-                    {
-                        Merge( p_out, p_in, p_in + p_pic->p[i_plane].i_pitch,
-                               p_pic->p[i_plane].i_pitch );
-
-                        p_out += p_outpic->p[i_plane].i_pitch;
-                        p_in += p_pic->p[i_plane].i_pitch;
-                    }
-                }
-
-                else
-                {
-                    for( ; p_out < p_out_end ; )
-                    {
-                        Merge( p_out, p_in, p_in + p_pic->p[i_plane].i_pitch,
-                               p_pic->p[i_plane].i_pitch );
-
-                        p_out += p_outpic->p[i_plane].i_pitch;
-                        p_in += 2*p_pic->p[i_plane].i_pitch;
-                    }
-                }
-                break;
-        }
-    }
-    EndMerge();
+    filter_SliceVideo( p_filter, RenderBlendSlice, &ctx,
+                       p_outpic->p[Y_PLANE].i_visible_lines, 2 );
 }
 
 #undef Merge
@@ -1435,6 +1430,68 @@ typedef intptr_t x86_reg;
 /* yadif.h comes from vf_yadif.c of mplayer project */
 #include "yadif.h"
 
+typedef struct
+{
+    picture_t *p_dst;
+    picture_t *p_prev, *p_cur, *p_next;
+    int i_order;
+    int i_field;
+    void (*filter)(struct vf_priv_s *p, uint8_t *dst, uint8_t *prev, uint8_t *cur, uint8_t *next, int w, int refs, int parity);
+} yadif_slice_t;
+
+/* Renders the lines [i_start, i_end) but the first and last ones */
+static void RenderYadifSlice( filter_t *p_filter, void *p_data,
+                              int i_start, int i_end )
+{
+    VLC_UNUSED(p_filter);
+    const yadif_slice_t *p_ctx = p_data;
+    picture_t *p_dst = p_ctx->p_dst;
+    const int i_order = p_ctx->i_order;
+    const int i_field = p_ctx->i_field;
+
+    for( int n = 0; n < p_dst->i_planes; n++ )
+    {
+        const plane_t *prevp = &p_ctx->p_prev->p[n];
+        const plane_t *curp  = &p_ctx->p_cur->p[n];
+        const plane_t *nextp = &p_ctx->p_next->p[n];
+        plane_t *dstp        = &p_dst->p[n];
+        int i_first, i_last;
+
+        PlaneSlice( p_dst, n, i_start, i_end, &i_first, &i_last );
+
+        for( int y = __MAX( i_first, 1 );
+             y < __MIN( i_last, dstp->i_visible_lines - 1 ); y++ )
+        {
+            if( (y % 2) == i_field )
+            {
+                vlc_memcpy( &dstp->p_pixels[y * dstp->i_pitch],
+                            &curp->p_pixels[y * curp->i_pitch], dstp->i_visible_pitch );
+            }
+            else
+            {
+                struct vf_priv_s cfg;
+                /* Spatial checks only when enough data */
+                cfg.mode = (y >= 2 && y < dstp->i_visible_lines - 2) ? 0 : 2;
+
+                assert( prevp->i_pitch == curp->i_pitch && curp->i_pitch == nextp->i_pitch );
+                p_ctx->filter( &cfg,
+                               &dstp->p_pixels[y * dstp->i_pitch],
+                               &prevp->p_pixels[y * prevp->i_pitch],
+                               &curp->p_pixels[y * curp->i_pitch],
+                               &nextp->p_pixels[y * nextp->i_pitch],
+                               dstp->i_visible_pitch,
+                               curp->i_pitch,
+                               (i_field ^ (i_order == i_field)) & 1 );
+            }
+        }
+    }
+#if defined(HAVE_YADIF_MMX2)
+    /* The MMX state must not leak to the floating point code of the thread */
+    if( p_ctx->filter == yadif_filter_line_mmx2 )
+        __asm__ volatile( "emms" );
+#endif
+}
+
 static int RenderYadif( filter_t *p_filter, picture_t *p_dst, picture_t *p_src, int i_order, int i_field )
 {
     filter_sys_t *p_sys = p_filter->p_sys;
@@ -1468,52 +1525,44 @@ static int RenderYadif( filter_t *p_filter, picture_t *p_dst, picture_t *p_src,
     /* Filter if we have all the pictures we need */
     if( p_prev && p_cur && p_next )
     {
-        /* */
-        void (*filter)(struct vf_priv_s *p, uint8_t *dst, uint8_t *prev, uint8_t *cur, uint8_t *next, int w, int refs, int parity);
+        yadif_slice_t ctx = {
+            .p_dst = p_dst,
+            .p_prev = p_prev, .p_cur = p_cur, .p_next = p_next,
+            .i_order = i_order, .i_field = i_field,
+        };
+#if defined(HAVE_YADIF_SSSE3)
+        if( vlc_CPU() & CPU_CAPABILITY_SSSE3 )
+            ctx.filter = yadif_filter_line_ssse3;
+        else
+#endif
 #if defined(HAVE_YADIF_SSE2)
         if( vlc_CPU() & CPU_CAPABILITY_SSE2 )
-            filter = yadif_filter_line_mmx2;
+            ctx.filter = yadif_filter_line_sse2;
         else
 #endif
-            filter = yadif_filter_line_c;
+#if defined(HAVE_YADIF_MMX2)
+        if( vlc_CPU() & CPU_CAPABILITY_MMXEXT )
+            ctx.filter = yadif_filter_line_mmx2;
+        else
+#endif
+            ctx.filter = yadif_filter_line_c;
 
+        filter_SliceVideo( p_filter, RenderYadifSlice, &ctx,
+                           p_dst->p[Y_PLANE].i_visible_lines, 2 );
+
+        /* We duplicate the first and last lines */
         for( int n = 0; n < p_dst->i_planes; n++ )
         {
-            const plane_t *prevp = &p_prev->p[n];
-            const plane_t *curp  = &p_cur->p[n];
-            const plane_t *nextp = &p_next->p[n];
-            plane_t *dstp        = &p_dst->p[n];
-
-            for( int y = 1; y < dstp->i_visible_lines - 1; y++ )
-            {
-                if( (y % 2) == i_field )
-                {
-                    vlc_memcpy( &dstp->p_pixels[y * dstp->i_pitch],
-                                &curp->p_pixels[y * curp->i_pitch], dstp->i_visible_pitch );
-                }
-                else
-                {
-                    struct vf_priv_s cfg;
-                    /* Spatial checks only when enough data */
-                    cfg.mode = (y >= 2 && y < dstp->i_visible_lines - 2) ? 0 : 2;
-
-                    assert( prevp->i_pitch == curp->i_pitch && curp->i_pitch == nextp->i_pitch );
-                    filter( &cfg,
-                            &dstp->p_pixels[y * dstp->i_pitch],
-                            &prevp->p_pixels[y * prevp->i_pitch],
-                            &curp->p_pixels[y * curp->i_pitch],
-                            &nextp->p_pixels[y * nextp->i_pitch],
-                            dstp->i_visible_pitch,
-                            curp->i_pitch,
-                            (i_field ^ (i_order == i_field)) & 1 );
-                }
-
-                /* We duplicate the first and last lines */
-                if( y == 1 )
-                    vlc_memcpy(&dstp->p_pixels[(y-1) * dstp->i_pitch], &dstp->p_pixels[y * dstp->i_pitch], dstp->i_pitch);
-                else if( y == dstp->i_visible_lines - 2 )
-                    vlc_memcpy(&dstp->p_pixels[(y+1) * dstp->i_pitch], &dstp->p_pixels[y * dstp->i_pitch], dstp->i_pitch);
-            }
+            plane_t *dstp = &p_dst->p[n];
+            const int i_lines = dstp->i_visible_lines;
+
+            if( i_lines < 3 )
+                continue;
+            vlc_memcpy( &dstp->p_pixels[0],
+                        &dstp->p_pixels[dstp->i_pitch], dstp->i_pitch );
+            vlc_memcpy( &dstp->p_pixels[(i_lines - 1) * dstp->i_pitch],
+                        &dstp->p_pixels[(i_lines - 2) * dstp->i_pitch],
+                        dstp->i_pitch );
         }
 
         /* */
@@ -160,36 +160,29 @@ static void Destroy( vlc_object_t *p_this )
  * until it is displayed and switch the two rendering buffers, preparing next
  * frame.
  *****************************************************************************/
-static picture_t *Filter( filter_t *p_filter, picture_t *p_pic )
+typedef struct
 {
-    picture_t *p_outpic;
+    picture_t *p_pic, *p_outpic;
+} sharpen_slice_t;
+
+/* Renders the lines [i_start, i_end) of the Y plane, with the filter lock
+ * held by the caller of filter_SliceVideo() */
+static void FilterSlice( filter_t *p_filter, void *p_data,
+                         int i_start, int i_end )
+{
+    const sharpen_slice_t *p_ctx = p_data;
+    const picture_t *p_pic = p_ctx->p_pic;
     int i, j;
-    uint8_t *p_src = NULL;
-    uint8_t *p_out = NULL;
-    int i_src_pitch;
-    int i_out_pitch;
+    const uint8_t *p_src = p_pic->p[Y_PLANE].p_pixels;
+    uint8_t *p_out = p_ctx->p_outpic->p[Y_PLANE].p_pixels;
+    const int i_src_pitch = p_pic->p[Y_PLANE].i_pitch;
+    const int i_out_pitch = p_ctx->p_outpic->p[Y_PLANE].i_pitch;
     int pix;
     const int v1 = -1;
     const int v2 = 3; /* 2^3 = 8 */
 
-    if( !p_pic ) return NULL;
-
-    p_outpic = filter_NewPicture( p_filter );
-    if( !p_outpic )
-    {
-        picture_Release( p_pic );
-        return NULL;
-    }
-
-    /* process the Y plane */
-    p_src = p_pic->p[Y_PLANE].p_pixels;
-    p_out = p_outpic->p[Y_PLANE].p_pixels;
-    i_src_pitch = p_pic->p[Y_PLANE].i_pitch;
-    i_out_pitch = p_outpic->p[Y_PLANE].i_pitch;
-
     /* perform convolution only on Y plane. Avoid border line. */
-    vlc_mutex_lock( &p_filter->p_sys->lock );
-    for( i = 0; i < p_pic->p[Y_PLANE].i_visible_lines; i++ )
+    for( i = i_start; i < i_end; i++ )
     {
         if( (i == 0) || (i == p_pic->p[Y_PLANE].i_visible_lines - 1) )
         {
@@ -220,6 +213,27 @@ static picture_t *Filter( filter_t *p_filter, picture_t *p_pic )
                p_filter->p_sys->tab_precalc[pix + 256] );
         }
     }
+}
+
+static picture_t *Filter( filter_t *p_filter, picture_t *p_pic )
+{
+    picture_t *p_outpic;
+
+    if( !p_pic ) return NULL;
+
+    p_outpic = filter_NewPicture( p_filter );
+    if( !p_outpic )
+    {
+        picture_Release( p_pic );
+        return NULL;
+    }
+
+    /* process the Y plane */
+    sharpen_slice_t ctx = { .p_pic = p_pic, .p_outpic = p_outpic };
+
+    vlc_mutex_lock( &p_filter->p_sys->lock );
+    filter_SliceVideo( p_filter, FilterSlice, &ctx,
+                       p_pic->p[Y_PLANE].i_visible_lines, 1 );
     vlc_mutex_unlock( &p_filter->p_sys->lock );
 
     plane_CopyPixels( &p_outpic->p[U_PLANE], &p_pic->p[U_PLANE] );
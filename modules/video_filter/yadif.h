@@ -19,9 +19,9 @@
  */
 
 /* */
-#if defined(CAN_COMPILE_SSE2) && ((__GNUC__ > 3) || (__GNUC__ == 3 && __GNUC_MINOR__ > 0))
+#if defined(CAN_COMPILE_MMXEXT) && ((__GNUC__ > 3) || (__GNUC__ == 3 && __GNUC_MINOR__ > 0))
 
-#define HAVE_YADIF_SSE2
+#define HAVE_YADIF_MMX2
 
 #define LOAD4(mem,dst) \
             "movd      "mem", "#dst" \n\t"\
@@ -295,3 +295,276 @@ static void yadif_filter_line_c(struct vf_priv_s *p, uint8_t *dst, uint8_t *prev
     }
 }
 
+/* SSE2 and SSSE3 versions of yadif_filter_line_mmx2(), working on 8 pixels
+ * at a time. The last pixels of the line are done by yadif_filter_line_c()
+ * so that no more data than in C is read past the end of the line. */
+#if defined(CAN_COMPILE_SSE2) && ((__GNUC__ > 3) || (__GNUC__ == 3 && __GNUC_MINOR__ > 0))
+
+#define HAVE_YADIF_SSE2
+
+typedef struct { uint8_t b[16]; } __attribute__((aligned(16))) yadif_xmm_t;
+
+static const yadif_xmm_t yadif_pw_1 = {{ 1,0, 1,0, 1,0, 1,0, 1,0, 1,0, 1,0, 1,0 }};
+static const yadif_xmm_t yadif_pb_1 = {{ 1,1,1,1, 1,1,1,1, 1,1,1,1, 1,1,1,1 }};
+
+#ifdef __SSE__
+#   define YADIF_XMM_CLOBBERS "xmm0", "xmm1", "xmm2", "xmm3", \
+                              "xmm4", "xmm5", "xmm6", "xmm7"
+#else
+#   define YADIF_XMM_CLOBBERS "memory"
+#endif
+
+#define LOAD8(mem,dst) \
+            "movq      "mem", "#dst" \n\t"\
+            "punpcklbw %%xmm7, "#dst" \n\t"
+
+#define PABS_SSE2(tmp,dst) \
+            "pxor     "#tmp", "#tmp" \n\t"\
+            "psubw    "#dst", "#tmp" \n\t"\
+            "pmaxsw   "#tmp", "#dst" \n\t"
+
+#define PABS_SSSE3(tmp,dst) \
+            "pabsw    "#dst", "#dst" \n\t"
+
+#undef CHECK
+#define CHECK(pj,mj) \
+            "movdqu "#pj"(%[cur],%[mrefs]), %%xmm2 \n\t" /* cur[x-refs-1+j] */\
+            "movdqu "#mj"(%[cur],%[prefs]), %%xmm3 \n\t" /* cur[x+refs-1-j] */\
+            "movdqa    %%xmm2, %%xmm4 \n\t"\
+            "movdqa    %%xmm2, %%xmm5 \n\t"\
+            "pxor      %%xmm3, %%xmm4 \n\t"\
+            "pavgb     %%xmm3, %%xmm5 \n\t"\
+            "pand     %[pb1], %%xmm4 \n\t"\
+            "psubusb   %%xmm4, %%xmm5 \n\t"\
+            "psrldq    $1,    %%xmm5 \n\t"\
+            "punpcklbw %%xmm7, %%xmm5 \n\t" /* (cur[x-refs+j] + cur[x+refs-j])>>1 */\
+            "movdqa    %%xmm2, %%xmm4 \n\t"\
+            "psubusb   %%xmm3, %%xmm2 \n\t"\
+            "psubusb   %%xmm4, %%xmm3 \n\t"\
+            "pmaxub    %%xmm3, %%xmm2 \n\t"\
+            "movdqa    %%xmm2, %%xmm3 \n\t"\
+            "movdqa    %%xmm2, %%xmm4 \n\t" /* ABS(cur[x-refs-1+j] - cur[x+refs-1-j]) */\
+            "psrldq    $1,    %%xmm3 \n\t" /* ABS(cur[x-refs  +j] - cur[x+refs  -j]) */\
+            "psrldq    $2,    %%xmm4 \n\t" /* ABS(cur[x-refs+1+j] - cur[x+refs+1-j]) */\
+            "punpcklbw %%xmm7, %%xmm2 \n\t"\
+            "punpcklbw %%xmm7, %%xmm3 \n\t"\
+            "punpcklbw %%xmm7, %%xmm4 \n\t"\
+            "paddw     %%xmm3, %%xmm2 \n\t"\
+            "paddw     %%xmm4, %%xmm2 \n\t" /* score */
+
+#define CHECK1 \
+            "movdqa    %%xmm0, %%xmm3 \n\t"\
+            "pcmpgtw   %%xmm2, %%xmm3 \n\t" /* if(score < spatial_score) */\
+            "pminsw    %%xmm2, %%xmm0 \n\t" /* spatial_score= score; */\
+            "movdqa    %%xmm3, %%xmm6 \n\t"\
+            "pand      %%xmm3, %%xmm5 \n\t"\
+            "pandn     %%xmm1, %%xmm3 \n\t"\
+            "por       %%xmm5, %%xmm3 \n\t"\
+            "movdqa    %%xmm3, %%xmm1 \n\t" /* spatial_pred= (cur[x-refs+j] + cur[x+refs-j])>>1; */
+
+#define CHECK2 /* pretend not to have checked dir=2 if dir=1 was bad.\
+                  hurts both quality and speed, but matches the C version. */\
+            "paddw    %[pw1], %%xmm6 \n\t"\
+            "psllw     $14,   %%xmm6 \n\t"\
+            "paddsw    %%xmm6, %%xmm2 \n\t"\
+            "movdqa    %%xmm0, %%xmm3 \n\t"\
+            "pcmpgtw   %%xmm2, %%xmm3 \n\t"\
+            "pminsw    %%xmm2, %%xmm0 \n\t"\
+            "pand      %%xmm3, %%xmm5 \n\t"\
+            "pandn     %%xmm1, %%xmm3 \n\t"\
+            "por       %%xmm5, %%xmm3 \n\t"\
+            "movdqa    %%xmm3, %%xmm1 \n\t"
+
+/* CHECK(-3,1) reads 16 bytes from cur[x+1]: x + 8 + 8 <= w + 2 */
+#define FILTER\
+    for(x=0; x+14<=w; x+=8){\
+        __asm__ volatile(\
+            "pxor      %%xmm7, %%xmm7 \n\t"\
+            LOAD8("(%[cur],%[mrefs])", %%xmm0) /* c = cur[x-refs] */\
+            LOAD8("(%[cur],%[prefs])", %%xmm1) /* e = cur[x+refs] */\
+            LOAD8("(%["prev2"])", %%xmm2) /* prev2[x] */\
+            LOAD8("(%["next2"])", %%xmm3) /* next2[x] */\
+            "movdqa    %%xmm3, %%xmm4 \n\t"\
+            "paddw     %%xmm2, %%xmm3 \n\t"\
+            "psraw     $1,    %%xmm3 \n\t" /* d = (prev2[x] + next2[x])>>1 */\
+            "movdqa    %%xmm0, %[tmp0] \n\t" /* c */\
+            "movdqa    %%xmm3, %[tmp1] \n\t" /* d */\
+            "movdqa    %%xmm1, %[tmp2] \n\t" /* e */\
+            "psubw     %%xmm4, %%xmm2 \n\t"\
+            PABS(      %%xmm4, %%xmm2) /* temporal_diff0 */\
+            LOAD8("(%[prev],%[mrefs])", %%xmm3) /* prev[x-refs] */\
+            LOAD8("(%[prev],%[prefs])", %%xmm4) /* prev[x+refs] */\
+            "psubw     %%xmm0, %%xmm3 \n\t"\
+            "psubw     %%xmm1, %%xmm4 \n\t"\
+            PABS(      %%xmm5, %%xmm3)\
+            PABS(      %%xmm5, %%xmm4)\
+            "paddw     %%xmm4, %%xmm3 \n\t" /* temporal_diff1 */\
+            "psrlw     $1,    %%xmm2 \n\t"\
+            "psrlw     $1,    %%xmm3 \n\t"\
+            "pmaxsw    %%xmm3, %%xmm2 \n\t"\
+            LOAD8("(%[next],%[mrefs])", %%xmm3) /* next[x-refs] */\
+            LOAD8("(%[next],%[prefs])", %%xmm4) /* next[x+refs] */\
+            "psubw     %%xmm0, %%xmm3 \n\t"\
+            "psubw     %%xmm1, %%xmm4 \n\t"\
+            PABS(      %%xmm5, %%xmm3)\
+            PABS(      %%xmm5, %%xmm4)\
+            "paddw     %%xmm4, %%xmm3 \n\t" /* temporal_diff2 */\
+            "psrlw     $1,    %%xmm3 \n\t"\
+            "pmaxsw    %%xmm3, %%xmm2 \n\t"\
+            "movdqa    %%xmm2, %[tmp3] \n\t" /* diff */\
+\
+            "paddw     %%xmm0, %%xmm1 \n\t"\
+            "paddw     %%xmm0, %%xmm0 \n\t"\
+            "psubw     %%xmm1, %%xmm0 \n\t"\
+            "psrlw     $1,    %%xmm1 \n\t" /* spatial_pred */\
+            PABS(      %%xmm2, %%xmm0)      /* ABS(c-e) */\
+\
+            "movdqu -1(%[cur],%[mrefs]), %%xmm2 \n\t" /* cur[x-refs-1] */\
+            "movdqu -1(%[cur],%[prefs]), %%xmm3 \n\t" /* cur[x+refs-1] */\
+            "movdqa    %%xmm2, %%xmm4 \n\t"\
+            "psubusb   %%xmm3, %%xmm2 \n\t"\
+            "psubusb   %%xmm4, %%xmm3 \n\t"\
+            "pmaxub    %%xmm3, %%xmm2 \n\t"\
+            "movdqa    %%xmm2, %%xmm3 \n\t"\
+            "psrldq    $2,    %%xmm3 \n\t"\
+            "punpcklbw %%xmm7, %%xmm2 \n\t" /* ABS(cur[x-refs-1] - cur[x+refs-1]) */\
+            "punpcklbw %%xmm7, %%xmm3 \n\t" /* ABS(cur[x-refs+1] - cur[x+refs+1]) */\
+            "paddw     %%xmm2, %%xmm0 \n\t"\
+            "paddw     %%xmm3, %%xmm0 \n\t"\
+            "psubw    %[pw1], %%xmm0 \n\t" /* spatial_score */\
+\
+            CHECK(-2,0)\
+            CHECK1\
+            CHECK(-3,1)\
+            CHECK2\
+            CHECK(0,-2)\
+            CHECK1\
+            CHECK(1,-3)\
+            CHECK2\
+\
+            /* if(p->mode<2) ... */\
+            "movdqa  %[tmp3], %%xmm6 \n\t" /* diff */\
+            "cmpl       $2, %[mode] \n\t"\
+            "jge       1f \n\t"\
+            LOAD8("(%["prev2"],%[mrefs],2)", %%xmm2) /* prev2[x-2*refs] */\
+            LOAD8("(%["next2"],%[mrefs],2)", %%xmm4) /* next2[x-2*refs] */\
+            LOAD8("(%["prev2"],%[prefs],2)", %%xmm3) /* prev2[x+2*refs] */\
+            LOAD8("(%["next2"],%[prefs],2)", %%xmm5) /* next2[x+2*refs] */\
+            "paddw     %%xmm4, %%xmm2 \n\t"\
+            "paddw     %%xmm5, %%xmm3 \n\t"\
+            "psrlw     $1,    %%xmm2 \n\t" /* b */\
+            "psrlw     $1,    %%xmm3 \n\t" /* f */\
+            "movdqa  %[tmp0], %%xmm4 \n\t" /* c */\
+            "movdqa  %[tmp1], %%xmm5 \n\t" /* d */\
+            "movdqa  %[tmp2], %%xmm7 \n\t" /* e */\
+            "psubw     %%xmm4, %%xmm2 \n\t" /* b-c */\
+            "psubw     %%xmm7, %%xmm3 \n\t" /* f-e */\
+            "movdqa    %%xmm5, %%xmm0 \n\t"\
+            "psubw     %%xmm4, %%xmm5 \n\t" /* d-c */\
+            "psubw     %%xmm7, %%xmm0 \n\t" /* d-e */\
+            "movdqa    %%xmm2, %%xmm4 \n\t"\
+            "pminsw    %%xmm3, %%xmm2 \n\t"\
+            "pmaxsw    %%xmm4, %%xmm3 \n\t"\
+            "pmaxsw    %%xmm5, %%xmm2 \n\t"\
+            "pminsw    %%xmm5, %%xmm3 \n\t"\
+            "pmaxsw    %%xmm0, %%xmm2 \n\t" /* max */\
+            "pminsw    %%xmm0, %%xmm3 \n\t" /* min */\
+            "pxor      %%xmm4, %%xmm4 \n\t"\
+            "pmaxsw    %%xmm3, %%xmm6 \n\t"\
+            "psubw     %%xmm2, %%xmm4 \n\t" /* -max */\
+            "pmaxsw    %%xmm4, %%xmm6 \n\t" /* diff= MAX3(diff, min, -max); */\
+            "1: \n\t"\
+\
+            "movdqa  %[tmp1], %%xmm2 \n\t" /* d */\
+            "movdqa    %%xmm2, %%xmm3 \n\t"\
+            "psubw     %%xmm6, %%xmm2 \n\t" /* d-diff */\
+            "paddw     %%xmm6, %%xmm3 \n\t" /* d+diff */\
+            "pmaxsw    %%xmm2, %%xmm1 \n\t"\
+            "pminsw    %%xmm3, %%xmm1 \n\t" /* d = clip(spatial_pred, d-diff, d+diff); */\
+            "packuswb  %%xmm1, %%xmm1 \n\t"\
+            "movq      %%xmm1, %[out] \n\t"\
+\
+            :[tmp0]"=m"(tmp[0]),\
+             [tmp1]"=m"(tmp[1]),\
+             [tmp2]"=m"(tmp[2]),\
+             [tmp3]"=m"(tmp[3]),\
+             [out] "=m"(tmp[4])\
+            :[prev] "r"(prev),\
+             [cur]  "r"(cur),\
+             [next] "r"(next),\
+             [prefs]"r"((x86_reg)refs),\
+             [mrefs]"r"((x86_reg)-refs),\
+             [pw1]  "m"(yadif_pw_1),\
+             [pb1]  "m"(yadif_pb_1),\
+             [mode] "rm"(mode)\
+            :YADIF_XMM_CLOBBERS\
+        );\
+        memcpy(dst, tmp[4].b, 8);\
+        dst += 8;\
+        prev+= 8;\
+        cur += 8;\
+        next+= 8;\
+    }
+
+static void yadif_filter_line_sse2(struct vf_priv_s *p, uint8_t *dst, uint8_t *prev, uint8_t *cur, uint8_t *next, int w, int refs, int parity){
+    const int mode = p->mode;
+    yadif_xmm_t tmp[5];
+    int x;
+
+#define PABS PABS_SSE2
+    if(parity){
+#define prev2 "prev"
+#define next2 "cur"
+        FILTER
+#undef prev2
+#undef next2
+    }else{
+#define prev2 "cur"
+#define next2 "next"
+        FILTER
+#undef prev2
+#undef next2
+    }
+#undef PABS
+    if(x < w)
+        yadif_filter_line_c(p, dst, prev, cur, next, w - x, refs, parity);
+}
+
+#if defined(CAN_COMPILE_SSSE3)
+#define HAVE_YADIF_SSSE3
+
+static void yadif_filter_line_ssse3(struct vf_priv_s *p, uint8_t *dst, uint8_t *prev, uint8_t *cur, uint8_t *next, int w, int refs, int parity){
+    const int mode = p->mode;
+    yadif_xmm_t tmp[5];
+    int x;
+
+#define PABS PABS_SSSE3
+    if(parity){
+#define prev2 "prev"
+#define next2 "cur"
+        FILTER
+#undef prev2
+#undef next2
+    }else{
+#define prev2 "cur"
+#define next2 "next"
+        FILTER
+#undef prev2
+#undef next2
+    }
+#undef PABS
+    if(x < w)
+        yadif_filter_line_c(p, dst, prev, cur, next, w - x, refs, parity);
+}
+#endif
+
+#undef LOAD8
+#undef PABS_SSE2
+#undef PABS_SSSE3
+#undef CHECK
+#undef CHECK1
+#undef CHECK2
+#undef FILTER
+#undef YADIF_XMM_CLOBBERS
+
+#endif
@@ -2602,6 +2602,10 @@ static int EsOutControlLocked( es_out_t *out, int i_query, va_list args )
             return VLC_SUCCESS;
         }
 
+        case ES_OUT_SEEK_TIMESHIFT:
+            /* Nothing is buffered here */
+            return VLC_EGENERIC;
+
         case ES_OUT_SET_FRAME_NEXT:
             EsOutFrameNext( out );
             return VLC_SUCCESS;
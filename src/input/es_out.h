@@ -68,6 +68,9 @@ enum es_out_query_private_e
     /* Set a new time */
     ES_OUT_SET_TIME,                                /* arg1=mtime_t             res=can fail */
 
+    /* Seek to a time inside the timeshift window (only when timeshifting) */
+    ES_OUT_SEEK_TIMESHIFT,                          /* arg1=mtime_t i_time      res=can fail */
+
     /* Set next frame */
     ES_OUT_SET_FRAME_NEXT,                          /*                          res=can fail */
 
@@ -131,6 +134,10 @@ static inline int es_out_SetTime( es_out_t *p_out, mtime_t i_date )
 {
     return es_out_Control( p_out, ES_OUT_SET_TIME, i_date );
 }
+static inline int es_out_SeekTimeshift( es_out_t *p_out, mtime_t i_time )
+{
+    return es_out_Control( p_out, ES_OUT_SEEK_TIMESHIFT, i_time );
+}
 static inline int es_out_SetFrameNext( es_out_t *p_out )
 {
     return es_out_Control( p_out, ES_OUT_SET_FRAME_NEXT );
@@ -37,6 +37,15 @@
 #ifdef HAVE_SYS_STAT_H
 #   include <sys/stat.h>
 #endif
+#ifdef HAVE_UNISTD_H
+#   include <unistd.h>
+#endif
+#ifdef HAVE_MMAP
+#   include <sys/mman.h>
+#endif
+#ifdef HAVE_POSIX_FALLOCATE
+#   include <fcntl.h>
+#endif
 
 #include <vlc_common.h>
 #include <vlc_fs.h>
@@ -151,6 +160,21 @@ typedef struct attribute_packed
     } u;
 } ts_cmd_t;
 
+/* Header of a block in a storage file (the data follows) */
+typedef struct attribute_packed
+{
+    uint32_t i_buffer;
+    uint32_t i_flags;
+    mtime_t  i_pts;
+    mtime_t  i_dts;
+    mtime_t  i_length;
+    uint32_t i_nb_samples;
+    int32_t  i_rate;
+} ts_storage_block_t;
+
+/* Storage files are append-only segments. The commands of a segment are
+ * kept in memory in arrival (thus date) order, and SEND commands point to
+ * their block in the segment: this is the time to offset index. */
 typedef struct ts_storage_t ts_storage_t;
 struct ts_storage_t
 {
@@ -158,18 +182,25 @@ struct ts_storage_t
 
     /* */
     char    *psz_file;  /* Filename */
+    int     fd;         /* File descriptor */
     size_t  i_file_max; /* Max size in bytes */
     int64_t i_file_size;/* Current size in bytes */
-    FILE    *p_filew;   /* FILE handle for data writing */
-    FILE    *p_filer;   /* FILE handle for data reading */
+#ifdef HAVE_MMAP
+    uint8_t *p_map;     /* Mapping of the whole file (NULL if not mapped) */
+    int64_t i_read_ahead; /* End of the read-ahead window */
+    int64_t i_read_done;  /* End of the already released pages */
+#endif
 
     /* */
+    int      i_cmd_h;   /* First command that can be played again */
     int      i_cmd_r;
     int      i_cmd_w;
     int      i_cmd_max;
     ts_cmd_t *p_cmd;
 };
 
+#define TS_READ_AHEAD (1024*1024)
+
 typedef struct
 {
     VLC_COMMON_MEMBERS
@@ -179,6 +210,7 @@ typedef struct
     es_out_t       *p_out;
     int64_t        i_tmp_size_max;
     const char     *psz_tmp_path;
+    int            i_history_max;
 
     /* Lock for all following fields */
     vlc_mutex_t    lock;
@@ -197,12 +229,21 @@ typedef struct
     /* */
     mtime_t        i_buffering_delay;
 
-    /* */
+    /* Segments from p_storage_h to p_storage_r (excluded) were played and
+     * are kept for backward seeks */
+    ts_storage_t   *p_storage_h;
     ts_storage_t   *p_storage_r;
     ts_storage_t   *p_storage_w;
 
     mtime_t        i_cmd_delay;
 
+    /* Commands received before this date are skipped (-1 if none) */
+    mtime_t        i_seek_date;
+
+    /* Last stream time played, and its reception date (-1 if none) */
+    mtime_t        i_time;
+    mtime_t        i_time_date;
+
 } ts_thread_t;
 
 struct es_out_id_t
@@ -218,6 +259,7 @@ struct es_out_sys_t
     /* Configuration */
     int64_t        i_tmp_size_max;    /* Maximal temporary file size in byte */
     char           *psz_tmp_path;     /* Path for temporary files */
+    int            i_history_max;     /* Played files kept for backward seeks */
 
     /* Lock for all following fields */
     vlc_mutex_t    lock;
@@ -249,22 +291,32 @@ static void         TsAutoStop( es_out_t * );
 static void         TsStop( ts_thread_t * );
 static void         TsPushCmd( ts_thread_t *, ts_cmd_t * );
 static int          TsPopCmdLocked( ts_thread_t *, ts_cmd_t *, bool b_flush );
+static void         TsTrimHistory( ts_thread_t *, int i_max );
 static bool         TsHasCmd( ts_thread_t * );
 static bool         TsIsUnused( ts_thread_t * );
 static int          TsChangePause( ts_thread_t *, bool b_source_paused, bool b_paused, mtime_t i_date );
 static int          TsChangeRate( ts_thread_t *, int i_src_rate, int i_rate );
+static int          TsSeek( ts_thread_t *, mtime_t i_time );
 
 static void         *TsRun( vlc_object_t * );
 
 static ts_storage_t *TsStorageNew( const char *psz_path, int64_t i_tmp_size_max );
 static void         TsStorageDelete( ts_storage_t * );
+static void         TsStorageRewind( ts_storage_t *, int i_cmd );
+#ifdef HAVE_MMAP
+static void         TsStorageUnmap( ts_storage_t * );
+#endif
 static void         TsStoragePack( ts_storage_t *p_storage );
 static bool         TsStorageIsFull( ts_storage_t *, const ts_cmd_t *p_cmd );
 static bool         TsStorageIsEmpty( ts_storage_t * );
-static void         TsStoragePushCmd( ts_storage_t *, const ts_cmd_t *p_cmd, bool b_flush );
+static void         TsStoragePushCmd( ts_storage_t *, const ts_cmd_t *p_cmd );
 static void         TsStoragePopCmd( ts_storage_t *p_storage, ts_cmd_t *p_cmd, bool b_flush );
+static int          TsStorageSeek( ts_storage_t *, mtime_t i_date );
+static size_t       TsStorageCmdSize( const ts_cmd_t *p_cmd );
 
 static void CmdClean( ts_cmd_t * );
+static void CmdForget( ts_cmd_t * );
+static bool CmdIsForgotten( const ts_cmd_t * );
 static void cmd_cleanup_routine( void *p ) { CmdClean( p ); }
 
 static int  CmdInitAdd    ( ts_cmd_t *, es_out_id_t *, const es_format_t *, bool b_copy );
@@ -285,7 +337,7 @@ static int  CmdExecuteControl( es_out_t *, ts_cmd_t * );
 
 /* File helpers */
 static char *GetTmpPath( char *psz_path );
-static FILE *GetTmpFile( char **ppsz_file, const char *psz_path );
+static int GetTmpFile( char **ppsz_file, const char *psz_path );
 
 /*****************************************************************************
  * input_EsOutTimeshiftNew:
@@ -335,6 +387,10 @@ es_out_t *input_EsOutTimeshiftNew( input_thread_t *p_input, es_out_t *p_next_out
     msg_Dbg( p_input, "using timeshift granularity of %d MiB",
              (int)p_sys->i_tmp_size_max/(1024*1024) );
 
+    const int64_t i_history = var_CreateGetInteger( p_input, "input-timeshift-history" );
+    p_sys->i_history_max = ( __MAX( i_history, 0 ) * 1024 * 1024 +
+                             p_sys->i_tmp_size_max - 1 ) / p_sys->i_tmp_size_max;
+
     char *psz_tmp_path = var_CreateGetNonEmptyString( p_input, "input-timeshift-path" );
     p_sys->psz_tmp_path = GetTmpPath( psz_tmp_path );
     msg_Dbg( p_input, "using timeshift path '%s'", p_sys->psz_tmp_path );
@@ -670,6 +726,14 @@ static int ControlLocked( es_out_t *p_out, int i_query, va_list args )
 
         return ControlLockedSetTime( p_out, i_date );
     }
+    case ES_OUT_SEEK_TIMESHIFT:
+    {
+        const mtime_t i_time = (mtime_t)va_arg( args, mtime_t );
+
+        if( !p_sys->b_delayed )
+            return VLC_EGENERIC;
+        return TsSeek( p_sys->p_thread, i_time );
+    }
     case ES_OUT_SET_FRAME_NEXT:
     {
         return ControlLockedSetFrameNext( p_out );
@@ -746,6 +810,7 @@ static int TsStart( es_out_t *p_out )
 
     p_ts->i_tmp_size_max = p_sys->i_tmp_size_max;
     p_ts->psz_tmp_path = p_sys->psz_tmp_path;
+    p_ts->i_history_max = p_sys->i_history_max;
     p_ts->p_input = p_sys->p_input;
     p_ts->p_out = p_sys->p_out;
     vlc_mutex_init( &p_ts->lock );
@@ -758,6 +823,10 @@ static int TsStart( es_out_t *p_out )
     p_ts->i_rate_delay = 0;
     p_ts->i_buffering_delay = 0;
     p_ts->i_cmd_delay = 0;
+    p_ts->i_seek_date = -1;
+    p_ts->i_time = -1;
+    p_ts->i_time_date = -1;
+    p_ts->p_storage_h = NULL;
     p_ts->p_storage_r = NULL;
     p_ts->p_storage_w = NULL;
 
@@ -805,8 +874,13 @@ static void TsStop( ts_thread_t *p_ts )
         CmdClean( &cmd );
     }
     assert( !p_ts->p_storage_r || !p_ts->p_storage_r->p_next );
-    if( p_ts->p_storage_r )
-        TsStorageDelete( p_ts->p_storage_r );
+    while( p_ts->p_storage_h )
+    {
+        ts_storage_t *p_next = p_ts->p_storage_h->p_next;
+
+        TsStorageDelete( p_ts->p_storage_h );
+        p_ts->p_storage_h = p_next;
+    }
     vlc_mutex_unlock( &p_ts->lock );
 
     vlc_object_release( p_ts );
@@ -817,7 +891,10 @@ static void TsPushCmd( ts_thread_t *p_ts, ts_cmd_t *p_cmd )
 
     if( !p_ts->p_storage_w || TsStorageIsFull( p_ts->p_storage_w, p_cmd ) )
     {
-        ts_storage_t *p_storage = TsStorageNew( p_ts->psz_tmp_path, p_ts->i_tmp_size_max );
+        /* A segment holds at least one block */
+        ts_storage_t *p_storage = TsStorageNew( p_ts->psz_tmp_path,
+                                                __MAX( p_ts->i_tmp_size_max,
+                                                       (int64_t)TsStorageCmdSize( p_cmd ) ) );
 
         if( !p_storage )
         {
@@ -829,6 +906,7 @@ static void TsPushCmd( ts_thread_t *p_ts, ts_cmd_t *p_cmd )
 
         if( !p_ts->p_storage_w )
         {
+            p_ts->p_storage_h =
             p_ts->p_storage_r = p_ts->p_storage_w = p_storage;
         }
         else
@@ -840,7 +918,7 @@ static void TsPushCmd( ts_thread_t *p_ts, ts_cmd_t *p_cmd )
     }
 
     /* TODO return error and warn the user (but only once) */
-    TsStoragePushCmd( p_ts->p_storage_w, p_cmd, p_ts->p_storage_r == p_ts->p_storage_w );
+    TsStoragePushCmd( p_ts->p_storage_w, p_cmd );
 
     vlc_cond_signal( &p_ts->wait );
 
@@ -850,22 +928,61 @@ static int TsPopCmdLocked( ts_thread_t *p_ts, ts_cmd_t *p_cmd, bool b_flush )
 {
     vlc_assert_locked( &p_ts->lock );
 
-    if( TsStorageIsEmpty( p_ts->p_storage_r ) )
-        return VLC_EGENERIC;
+    for( ;; )
+    {
+        ts_storage_t *p_storage = p_ts->p_storage_r;
 
-    TsStoragePopCmd( p_ts->p_storage_r, p_cmd, b_flush );
+        if( TsStorageIsEmpty( p_storage ) )
+            return VLC_EGENERIC;
 
-    while( p_ts->p_storage_r && TsStorageIsEmpty( p_ts->p_storage_r ) )
-    {
-        ts_storage_t *p_next = p_ts->p_storage_r->p_next;
-        if( !p_next )
-            break;
+        /* Skipped blocks are not even read */
+        const bool b_skip = p_ts->i_seek_date >= 0 &&
+                            p_storage->p_cmd[p_storage->i_cmd_r].i_date < p_ts->i_seek_date;
+        TsStoragePopCmd( p_storage, p_cmd, b_flush || b_skip );
+
+        if( p_cmd->i_type == C_CONTROL &&
+            p_cmd->u.control.i_query == ES_OUT_SET_TIMES )
+        {
+            p_ts->i_time = p_cmd->u.control.u.times.i_time;
+            p_ts->i_time_date = p_cmd->i_date;
+        }
+
+        /* What was played before an ES change cannot be played again */
+        if( p_cmd->i_type == C_ADD || p_cmd->i_type == C_DEL )
+        {
+            TsTrimHistory( p_ts, 0 );
+            p_storage->i_cmd_h = p_storage->i_cmd_r;
+        }
 
-        TsStorageDelete( p_ts->p_storage_r );
-        p_ts->p_storage_r = p_next;
+        while( TsStorageIsEmpty( p_ts->p_storage_r ) && p_ts->p_storage_r->p_next )
+        {
+#ifdef HAVE_MMAP
+            TsStorageUnmap( p_ts->p_storage_r );
+#endif
+            p_ts->p_storage_r = p_ts->p_storage_r->p_next;
+        }
+        TsTrimHistory( p_ts, p_ts->i_history_max );
+
+        /* Commands played before a backward seek are run once only */
+        if( !CmdIsForgotten( p_cmd ) )
+            return VLC_SUCCESS;
     }
+}
+static void TsTrimHistory( ts_thread_t *p_ts, int i_max )
+{
+    int i_history = 0;
 
-    return VLC_SUCCESS;
+    for( ts_storage_t *p = p_ts->p_storage_h; p != p_ts->p_storage_r; p = p->p_next )
+        i_history++;
+
+    /* The played segments are deleted, oldest first */
+    for( ; i_history > i_max; i_history-- )
+    {
+        ts_storage_t *p_next = p_ts->p_storage_h->p_next;
+
+        TsStorageDelete( p_ts->p_storage_h );
+        p_ts->p_storage_h = p_next;
+    }
 }
 static bool TsHasCmd( ts_thread_t *p_ts )
 {
@@ -938,6 +1055,73 @@ static int TsChangeRate( ts_thread_t *p_ts, int i_src_rate, int i_rate )
 
     return i_ret;
 }
+static int TsSeek( ts_thread_t *p_ts, mtime_t i_time )
+{
+    vlc_mutex_lock( &p_ts->lock );
+
+    ts_storage_t *p_storage = p_ts->p_storage_r;
+    if( !p_storage || p_storage->i_cmd_w <= 0 || p_ts->i_time_date < 0 )
+    {
+        vlc_mutex_unlock( &p_ts->lock );
+        return VLC_EGENERIC;
+    }
+    /* The next command (or the last one played when everything received
+     * was played) */
+    const mtime_t i_current =
+        p_storage->p_cmd[__MIN( p_storage->i_cmd_r, p_storage->i_cmd_w - 1 )].i_date;
+
+    /* The stream time is received in real time from the last known one */
+    mtime_t i_date = p_ts->i_time_date + i_time - p_ts->i_time;
+
+    /* Only the first and last dates of each segment are looked at,
+     * then the segment index is searched (no file access) */
+    p_storage = p_ts->p_storage_h;
+    while( p_storage->p_next &&
+           ( p_storage->i_cmd_h >= p_storage->i_cmd_w ||
+             p_storage->p_cmd[p_storage->i_cmd_w-1].i_date < i_date ) )
+        p_storage = p_storage->p_next;
+
+    /* Before the oldest kept command, go to it */
+    const int i_cmd = TsStorageSeek( p_storage, i_date );
+    if( i_cmd >= p_storage->i_cmd_w )
+    {
+        /* After the last received command */
+        vlc_mutex_unlock( &p_ts->lock );
+        return VLC_EGENERIC;
+    }
+    i_date = p_storage->p_cmd[i_cmd].i_date;
+
+    if( i_date <= i_current )
+    {
+        /* Backward: the commands from there were played after the last ES
+         * change, so they can all be played again */
+        for( ts_storage_t *p = p_storage; ; p = p->p_next )
+        {
+            TsStorageRewind( p, p == p_storage ? i_cmd : p->i_cmd_h );
+            if( p == p_ts->p_storage_r )
+                break;
+        }
+#ifdef HAVE_MMAP
+        if( p_storage != p_ts->p_storage_r )
+            TsStorageUnmap( p_ts->p_storage_r );
+#endif
+        p_ts->p_storage_r = p_storage;
+    }
+    /* Forward: the commands in between are executed without delay (or
+     * dropped for SEND commands) */
+
+    /* The next command will be played right away, after a reset of the
+     * decoders and clock */
+    p_ts->i_seek_date = i_date;
+    p_ts->i_cmd_delay += p_ts->i_rate_delay;
+    p_ts->i_rate_date = -1;
+    p_ts->i_rate_delay = 0;
+    p_ts->i_cmd_delay -= i_date - i_current;
+
+    vlc_cond_signal( &p_ts->wait );
+    vlc_mutex_unlock( &p_ts->lock );
+    return VLC_SUCCESS;
+}
 
 static void *TsRun( vlc_object_t *p_thread )
 {
@@ -969,6 +1153,17 @@ static void *TsRun( vlc_object_t *p_thread )
             vlc_cond_wait( &p_ts->wait, &p_ts->lock );
         }
 
+        if( p_ts->i_seek_date >= 0 && cmd.i_date >= p_ts->i_seek_date )
+        {
+            const int canc = vlc_savecancel();
+
+            /* Reset the decoders and clock at the new position */
+            p_ts->i_seek_date = -1;
+            es_out_SetTime( p_ts->p_out, -1 );
+            vlc_restorecancel( canc );
+            i_buffering_date = -1;
+        }
+
         if( b_buffering && i_buffering_date < 0 )
         {
             i_buffering_date = cmd.i_date;
@@ -1072,18 +1267,38 @@ static ts_storage_t *TsStorageNew( const char *psz_tmp_path, int64_t i_tmp_size_
     /* */
     p_storage->i_file_max = i_tmp_size_max;
     p_storage->i_file_size = 0;
-    p_storage->p_filew = GetTmpFile( &p_storage->psz_file, psz_tmp_path );
-    if( p_storage->psz_file )
-        p_storage->p_filer = vlc_fopen( p_storage->psz_file, "rb" );
+    p_storage->fd = GetTmpFile( &p_storage->psz_file, psz_tmp_path );
+#ifdef HAVE_MMAP
+    p_storage->p_map = NULL;
+    p_storage->i_read_ahead = 0;
+    p_storage->i_read_done = 0;
+
+    /* Reserve the whole segment now: running out of disk space while
+     * writing to the mapping would be fatal (SIGBUS) */
+    if( p_storage->fd >= 0 )
+    {
+# ifdef HAVE_POSIX_FALLOCATE
+        const int i_ret = posix_fallocate( p_storage->fd, 0, p_storage->i_file_max );
+# else
+        const int i_ret = ftruncate( p_storage->fd, p_storage->i_file_max );
+# endif
+        if( i_ret )
+        {
+            TsStorageDelete( p_storage );
+            return NULL;
+        }
+    }
+#endif
 
     /* */
     p_storage->i_cmd_w = 0;
     p_storage->i_cmd_r = 0;
+    p_storage->i_cmd_h = 0;
     p_storage->i_cmd_max = 30000;
     p_storage->p_cmd = malloc( p_storage->i_cmd_max * sizeof(*p_storage->p_cmd) );
     //fprintf( stderr, "\nSTORAGE name=%s size=%d KiB\n", p_storage->psz_file, p_storage->i_cmd_max * sizeof(*p_storage->p_cmd) /1024 );
 
-    if( !p_storage->p_cmd || !p_storage->p_filew || !p_storage->p_filer )
+    if( !p_storage->p_cmd || p_storage->fd < 0 )
     {
         TsStorageDelete( p_storage );
         return NULL;
@@ -1102,10 +1317,12 @@ static void TsStorageDelete( ts_storage_t *p_storage )
     }
     free( p_storage->p_cmd );
 
-    if( p_storage->p_filer )
-        fclose( p_storage->p_filer );
-    if( p_storage->p_filew )
-        fclose( p_storage->p_filew );
+#ifdef HAVE_MMAP
+    if( p_storage->p_map )
+        munmap( p_storage->p_map, p_storage->i_file_max );
+#endif
+    if( p_storage->fd >= 0 )
+        close( p_storage->fd );
 
     if( p_storage->psz_file )
     {
@@ -1115,8 +1332,88 @@ static void TsStorageDelete( ts_storage_t *p_storage )
 
     free( p_storage );
 }
+#ifdef HAVE_MMAP
+static uint8_t *TsStorageMap( ts_storage_t *p_storage )
+{
+    if( !p_storage->p_map )
+    {
+        void *p_map = mmap( NULL, p_storage->i_file_max, PROT_READ|PROT_WRITE,
+                            MAP_SHARED, p_storage->fd, 0 );
+        if( p_map == MAP_FAILED )
+            return NULL;
+        p_storage->p_map = p_map;
+    }
+    return p_storage->p_map;
+}
+static void TsStorageUnmap( ts_storage_t *p_storage )
+{
+    if( p_storage->p_map )
+        munmap( p_storage->p_map, p_storage->i_file_max );
+    p_storage->p_map = NULL;
+}
+#endif
+static int TsStorageWrite( ts_storage_t *p_storage, int64_t i_offset,
+                           const void *p_data, size_t i_data )
+{
+    assert( i_offset + i_data <= p_storage->i_file_max );
+#ifdef HAVE_MMAP
+    uint8_t *p_map = TsStorageMap( p_storage );
+    if( !p_map )
+        return VLC_EGENERIC;
+    memcpy( &p_map[i_offset], p_data, i_data );
+    return VLC_SUCCESS;
+#else
+    if( lseek( p_storage->fd, i_offset, SEEK_SET ) != i_offset ||
+        write( p_storage->fd, p_data, i_data ) != (ssize_t)i_data )
+        return VLC_EGENERIC;
+    return VLC_SUCCESS;
+#endif
+}
+static int TsStorageRead( ts_storage_t *p_storage, int64_t i_offset,
+                          void *p_data, size_t i_data )
+{
+    if( i_offset + i_data > (uint64_t)p_storage->i_file_size )
+        return VLC_EGENERIC;
+#ifdef HAVE_MMAP
+    uint8_t *p_map = TsStorageMap( p_storage );
+    if( !p_map )
+        return VLC_EGENERIC;
+
+    /* Read ahead the next part of the segment, and release what was read */
+    if( i_offset + (int64_t)i_data > p_storage->i_read_ahead )
+    {
+        const int64_t i_page = sysconf( _SC_PAGESIZE );
+        const int64_t i_done = i_offset / i_page * i_page;
+        const int64_t i_end = __MIN( i_offset + (int64_t)i_data + TS_READ_AHEAD,
+                                     (int64_t)p_storage->i_file_max );
+
+# ifdef HAVE_POSIX_MADVISE
+        if( i_done > p_storage->i_read_done )
+            posix_madvise( &p_map[p_storage->i_read_done],
+                           i_done - p_storage->i_read_done,
+                           POSIX_MADV_DONTNEED );
+        posix_madvise( &p_map[i_done], i_end - i_done, POSIX_MADV_WILLNEED );
+# endif
+        p_storage->i_read_done = __MAX( p_storage->i_read_done, i_done );
+        p_storage->i_read_ahead = i_end;
+    }
+    memcpy( p_data, &p_map[i_offset], i_data );
+    return VLC_SUCCESS;
+#else
+    if( lseek( p_storage->fd, i_offset, SEEK_SET ) != i_offset ||
+        read( p_storage->fd, p_data, i_data ) != (ssize_t)i_data )
+        return VLC_EGENERIC;
+    return VLC_SUCCESS;
+#endif
+}
 static void TsStoragePack( ts_storage_t *p_storage )
 {
+#ifdef HAVE_MMAP
+    /* The segment is complete: it will be mapped again when read, so that
+     * only the segments being written and read use address space */
+    TsStorageUnmap( p_storage );
+#endif
+
     /* Try to release a bit of memory */
     if( p_storage->i_cmd_w >= p_storage->i_cmd_max )
         return;
@@ -1127,22 +1424,23 @@ static void TsStoragePack( ts_storage_t *p_storage )
     if( p_new )
         p_storage->p_cmd = p_new;
 }
+static size_t TsStorageCmdSize( const ts_cmd_t *p_cmd )
+{
+    if( p_cmd && p_cmd->i_type == C_SEND )
+        return sizeof(ts_storage_block_t) + p_cmd->u.send.p_block->i_buffer;
+    return 0;
+}
 static bool TsStorageIsFull( ts_storage_t *p_storage, const ts_cmd_t *p_cmd )
 {
-    if( p_cmd && p_cmd->i_type == C_SEND && p_storage->i_cmd_w > 0 )
-    {
-        size_t i_size = sizeof(*p_cmd->u.send.p_block) + p_cmd->u.send.p_block->i_buffer;
-
-        if( p_storage->i_file_size + i_size >= p_storage->i_file_max )
-            return true;
-    }
+    if( p_storage->i_file_size + TsStorageCmdSize( p_cmd ) > p_storage->i_file_max )
+        return true;
     return p_storage->i_cmd_w >= p_storage->i_cmd_max;
 }
 static bool TsStorageIsEmpty( ts_storage_t *p_storage )
 {
     return !p_storage || p_storage->i_cmd_r >= p_storage->i_cmd_w;
 }
-static void TsStoragePushCmd( ts_storage_t *p_storage, const ts_cmd_t *p_cmd, bool b_flush )
+static void TsStoragePushCmd( ts_storage_t *p_storage, const ts_cmd_t *p_cmd )
 {
     ts_cmd_t cmd = *p_cmd;
 
@@ -1151,29 +1449,29 @@ static void TsStoragePushCmd( ts_storage_t *p_storage, const ts_cmd_t *p_cmd, bo
     if( cmd.i_type == C_SEND )
     {
         block_t *p_block = cmd.u.send.p_block;
+        const ts_storage_block_t header = {
+            .i_buffer = p_block->i_buffer,
+            .i_flags = p_block->i_flags,
+            .i_pts = p_block->i_pts,
+            .i_dts = p_block->i_dts,
+            .i_length = p_block->i_length,
+            .i_nb_samples = p_block->i_nb_samples,
+            .i_rate = p_block->i_rate,
+        };
 
         cmd.u.send.p_block = NULL;
-        cmd.u.send.i_offset = ftell( p_storage->p_filew );
+        cmd.u.send.i_offset = p_storage->i_file_size;
 
-        if( fwrite( p_block, sizeof(*p_block), 1, p_storage->p_filew ) != 1 )
+        if( TsStorageWrite( p_storage, p_storage->i_file_size,
+                            &header, sizeof(header) ) ||
+            TsStorageWrite( p_storage, p_storage->i_file_size + sizeof(header),
+                            p_block->p_buffer, p_block->i_buffer ) )
         {
             block_Release( p_block );
             return;
         }
-        p_storage->i_file_size += sizeof(*p_block);
-        if( p_block->i_buffer > 0 )
-        {
-            if( fwrite( p_block->p_buffer, p_block->i_buffer, 1, p_storage->p_filew ) != 1 )
-            {
-                block_Release( p_block );
-                return;
-            }
-        }
-        p_storage->i_file_size += p_block->i_buffer;
+        p_storage->i_file_size += sizeof(header) + p_block->i_buffer;
         block_Release( p_block );
-
-        if( b_flush )
-            fflush( p_storage->p_filew );
     }
     p_storage->p_cmd[p_storage->i_cmd_w++] = cmd;
 }
@@ -1181,34 +1479,66 @@ static void TsStoragePopCmd( ts_storage_t *p_storage, ts_cmd_t *p_cmd, bool b_fl
 {
     assert( !TsStorageIsEmpty( p_storage ) );
 
-    *p_cmd = p_storage->p_cmd[p_storage->i_cmd_r++];
+    /* The caller now owns the command: the storage keeps what is needed to
+     * play it again */
+    *p_cmd = p_storage->p_cmd[p_storage->i_cmd_r];
+    CmdForget( &p_storage->p_cmd[p_storage->i_cmd_r++] );
     if( p_cmd->i_type == C_SEND )
     {
-        block_t block;
+        ts_storage_block_t header;
+        block_t *p_block = NULL;
 
         if( !b_flush &&
-            !fseek( p_storage->p_filer, p_cmd->u.send.i_offset, SEEK_SET ) &&
-            fread( &block, sizeof(block), 1, p_storage->p_filer ) == 1 )
+            !TsStorageRead( p_storage, p_cmd->u.send.i_offset,
+                            &header, sizeof(header) ) )
         {
-            block_t *p_block = block_Alloc( block.i_buffer );
+            p_block = block_Alloc( header.i_buffer );
+            if( p_block &&
+                TsStorageRead( p_storage, p_cmd->u.send.i_offset + sizeof(header),
+                               p_block->p_buffer, header.i_buffer ) )
+            {
+                block_Release( p_block );
+                p_block = NULL;
+            }
             if( p_block )
             {
-                p_block->i_dts      = block.i_dts;
-                p_block->i_pts      = block.i_pts;
-                p_block->i_flags    = block.i_flags;
-                p_block->i_length   = block.i_length;
-                p_block->i_rate     = block.i_rate;
-                p_block->i_nb_samples = block.i_nb_samples;
-                p_block->i_buffer = fread( p_block->p_buffer, 1, block.i_buffer, p_storage->p_filer );
+                p_block->i_dts      = header.i_dts;
+                p_block->i_pts      = header.i_pts;
+                p_block->i_flags    = header.i_flags;
+                p_block->i_length   = header.i_length;
+                p_block->i_rate     = header.i_rate;
+                p_block->i_nb_samples = header.i_nb_samples;
             }
-            p_cmd->u.send.p_block = p_block;
         }
+        p_cmd->u.send.p_block = p_block;
+    }
+}
+static void TsStorageRewind( ts_storage_t *p_storage, int i_cmd )
+{
+    assert( i_cmd >= p_storage->i_cmd_h && i_cmd <= p_storage->i_cmd_r );
+
+    p_storage->i_cmd_r = i_cmd;
+#ifdef HAVE_MMAP
+    p_storage->i_read_ahead = 0;
+    p_storage->i_read_done = 0;
+#endif
+}
+static int TsStorageSeek( ts_storage_t *p_storage, mtime_t i_date )
+{
+    /* Commands are stored by date: look for the first one not before i_date */
+    int i_low = p_storage->i_cmd_h;
+    int i_high = p_storage->i_cmd_w;
+
+    while( i_low < i_high )
+    {
+        const int i_mid = i_low + ( i_high - i_low ) / 2;
+
+        if( p_storage->p_cmd[i_mid].i_date < i_date )
+            i_low = i_mid + 1;
         else
-        {
-            //fprintf( stderr, "TsStoragePopCmd: %m\n" );
-            p_cmd->u.send.p_block = block_Alloc( 1 );
-        }
+            i_high = i_mid;
     }
+    return i_low;
 }
 
 /*****************************************************************************
@@ -1235,6 +1565,47 @@ static void CmdClean( ts_cmd_t *p_cmd )
     }
 }
 
+static void CmdForget( ts_cmd_t *p_cmd )
+{
+    switch( p_cmd->i_type )
+    {
+    case C_ADD:
+        p_cmd->u.add.p_fmt = NULL;
+        break;
+    case C_CONTROL:
+        if( p_cmd->u.control.i_query == ES_OUT_SET_GROUP_META ||
+            p_cmd->u.control.i_query == ES_OUT_SET_META )
+            p_cmd->u.control.u.int_meta.p_meta = NULL;
+        else if( p_cmd->u.control.i_query == ES_OUT_SET_GROUP_EPG )
+            p_cmd->u.control.u.int_epg.p_epg = NULL;
+        else if( p_cmd->u.control.i_query == ES_OUT_SET_ES_FMT )
+            p_cmd->u.control.u.es_fmt.p_fmt = NULL;
+        break;
+    default:
+        break;
+    }
+}
+static bool CmdIsForgotten( const ts_cmd_t *p_cmd )
+{
+    /* Only the controls owning data cannot be played again (they are
+     * always created with a copy when timeshifting) */
+    if( p_cmd->i_type != C_CONTROL )
+        return false;
+
+    switch( p_cmd->u.control.i_query )
+    {
+    case ES_OUT_SET_GROUP_META:
+    case ES_OUT_SET_META:
+        return p_cmd->u.control.u.int_meta.p_meta == NULL;
+    case ES_OUT_SET_GROUP_EPG:
+        return p_cmd->u.control.u.int_epg.p_epg == NULL;
+    case ES_OUT_SET_ES_FMT:
+        return p_cmd->u.control.u.es_fmt.p_fmt == NULL;
+    default:
+        return false;
+    }
+}
+
 static int CmdInitAdd( ts_cmd_t *p_cmd, es_out_id_t *p_es, const es_format_t *p_fmt, bool b_copy )
 {
     p_cmd->i_type = C_ADD;
@@ -1591,29 +1962,17 @@ static char *GetTmpPath( char *psz_path )
     return psz_path;
 }
 
-static FILE *GetTmpFile( char **ppsz_file, const char *psz_path )
+static int GetTmpFile( char **ppsz_file, const char *psz_path )
 {
     char *psz_name;
-    int fd;
-    FILE *f;
 
     /* */
     *ppsz_file = NULL;
     if( asprintf( &psz_name, "%s/vlc-timeshift.XXXXXX", psz_path ) < 0 )
-        return NULL;
+        return -1;
 
     /* */
-    fd = vlc_mkstemp( psz_name );
     *ppsz_file = psz_name;
-
-    if( fd < 0 )
-        return NULL;
-
-    /* */
-    f = fdopen( fd, "w+b" );
-    if( !f )
-        close( fd );
-
-    return f;
+    return vlc_mkstemp( psz_name );
 }
 
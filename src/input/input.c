@@ -794,6 +794,10 @@ static void MainLoop( input_thread_t *p_input, bool b_interactive )
                     mtime_t i_current = mdate();
                     if( i_last_seek_mdate + INT64_C(125000) >= i_current )
                         i_limit = __MIN( i_deadline, i_current + INT64_C(20000) );
+                    else if( !es_out_GetBuffering( p_input->p->p_es_out_display ) )
+                        /* Only the timeshift is buffering, as it always does
+                         * while delayed: do not hold seeks into its window */
+                        b_buffering = false;
                 }
 
                 int i_type;
@@ -1721,6 +1725,13 @@ static bool Control( input_thread_t *p_input,
             if( i_time < 0 )
                 i_time = 0;
 
+            /* Inside the timeshift window, the demuxer is not involved */
+            if( !es_out_SeekTimeshift( p_input->p->p_es_out, i_time ) )
+            {
+                b_force_update = true;
+                break;
+            }
+
             /* Reset the decoders states and clock sync (before calling the demuxer */
             es_out_SetTime( p_input->p->p_es_out, -1 );
 
@@ -27,6 +27,7 @@
 
 #include <dirent.h>
 #include <assert.h>
+#include <limits.h>
 
 #include <vlc_common.h>
 #include <vlc_strings.h>
@@ -138,6 +139,8 @@ struct stream_sys_t
         block_t *p_first;
         block_t **pp_last;
 
+        bool     b_shared;       /* blocks of the list are shareable */
+
     } block;
 
     /* Method 2: for pf_read */
@@ -198,6 +201,9 @@ static void AStreamPrebufferStream( stream_t *s );
 static int  AReadStream( stream_t *s, void *p_read, unsigned int i_read );
 
 /* Common */
+static block_t *AStreamPacketsBlock( stream_t *s, unsigned i_packet, unsigned i_max );
+static block_t *AStreamPacketsStream( stream_t *s, unsigned i_packet, unsigned i_max );
+
 static int AStreamControl( stream_t *s, int i_query, va_list );
 static void AStreamDestroy( stream_t *s );
 static void UStreamDestroy( stream_t *s );
@@ -395,6 +401,7 @@ stream_t *stream_AccessNew( access_t *p_access, char **ppsz_list )
         p_sys->block.i_size = 0;
         p_sys->block.p_first = NULL;
         p_sys->block.pp_last = &p_sys->block.p_first;
+        p_sys->block.b_shared = false;
 
         /* Do the prebuffering */
         AStreamPrebufferBlock( s );
@@ -522,6 +529,7 @@ static void AStreamControlReset( stream_t *s )
         p_sys->block.i_size = 0;
         p_sys->block.p_first = NULL;
         p_sys->block.pp_last = &p_sys->block.p_first;
+        p_sys->block.b_shared = false;
 
         /* Do the prebuffering */
         AStreamPrebufferBlock( s );
@@ -649,6 +657,32 @@ static int AStreamControl( stream_t *s, int i_query, va_list args )
         case STREAM_GET_CONTENT_TYPE:
             return access_Control( p_access, ACCESS_GET_CONTENT_TYPE,
                                     va_arg( args, char ** ) );
+
+        case STREAM_GET_PACKETS:
+        {
+            unsigned i_packet = va_arg( args, unsigned );
+            unsigned i_max = va_arg( args, unsigned );
+            block_t **pp_block = va_arg( args, block_t ** );
+
+            if( i_packet == 0 || i_max == 0 )
+                return VLC_EGENERIC;
+            if( i_max > INT_MAX / i_packet )
+                i_max = INT_MAX / i_packet;
+            switch( p_sys->method )
+            {
+            case STREAM_METHOD_BLOCK:
+                *pp_block = AStreamPacketsBlock( s, i_packet, i_max );
+                break;
+            case STREAM_METHOD_STREAM:
+                *pp_block = AStreamPacketsStream( s, i_packet, i_max );
+                break;
+            default:
+                assert(0);
+                return VLC_EGENERIC;
+            }
+            break;
+        }
+
         case STREAM_SET_RECORD_STATE:
         default:
             msg_Err( s, "invalid stream_vaControl query=0x%x", i_query );
@@ -1026,6 +1060,14 @@ static int AStreamRefillBlock( stream_t *s )
     p_sys->stat.i_read_time += mdate() - i_start;
     while( b )
     {
+        block_t *p_next = b->p_next;
+
+        if( p_sys->block.b_shared )
+        {
+            b = block_Shareable( b );
+            b->p_next = p_next;
+        }
+
         /* Append the block */
         p_sys->block.i_size += b->i_buffer;
         *p_sys->block.pp_last = b;
@@ -1039,11 +1081,70 @@ static int AStreamRefillBlock( stream_t *s )
         p_sys->stat.i_bytes += b->i_buffer;
         p_sys->stat.i_read_count++;
 
-        b = b->p_next;
+        b = p_next;
     }
     return VLC_SUCCESS;
 }
 
+/* Hands out the whole packets of the current access block as a view of it,
+ * without copying. Only a packet spanning two access blocks is copied. */
+static block_t *AStreamPacketsBlock( stream_t *s, unsigned i_packet,
+                                     unsigned i_max )
+{
+    stream_sys_t *p_sys = s->p_sys;
+
+    if( !p_sys->block.b_shared )
+    {
+        /* Make the cached blocks shareable, the next ones will be made
+         * shareable as they are read */
+        block_t **pp = &p_sys->block.p_first;
+        while( *pp )
+        {
+            block_t *b = *pp, *p_next = b->p_next;
+            block_t *p_shared = block_Shareable( b );
+
+            p_shared->p_next = p_next;
+            if( p_sys->block.p_current == b )
+                p_sys->block.p_current = p_shared;
+            *pp = p_shared;
+            pp = &p_shared->p_next;
+        }
+        p_sys->block.pp_last = pp;
+        p_sys->block.b_shared = true;
+    }
+
+    block_t *b = p_sys->block.p_current;
+    if( b == NULL )
+        return NULL; /* EOF */
+
+    size_t i_avail = b->i_buffer - p_sys->block.i_offset;
+    if( i_avail < i_packet )
+        return stream_Block( s, i_packet );
+
+    block_t *p_view = block_Share( b );
+    if( p_view == NULL )
+        return NULL;
+
+    const size_t i_size = __MIN( i_avail / i_packet, i_max ) * i_packet;
+    p_view->p_buffer += p_sys->block.i_offset;
+    p_view->i_buffer = i_size;
+    p_view->i_flags = 0;
+    p_view->i_pts = p_view->i_dts = VLC_TS_INVALID;
+    p_view->i_length = 0;
+
+    p_sys->i_pos += i_size;
+    p_sys->block.i_offset += i_size;
+    if( p_sys->block.i_offset >= b->i_buffer )
+    {
+        /* Current block is now empty, switch to next */
+        p_sys->block.i_offset = 0;
+        p_sys->block.p_current = b->p_next;
+        if( !p_sys->block.p_current )
+            AStreamRefillBlock( s );
+    }
+    return p_view;
+}
+
 
 /****************************************************************************
  * Method 2:
@@ -1413,6 +1514,90 @@ static int AStreamRefillStream( stream_t *s )
     return VLC_SUCCESS;
 }
 
+/* Reads whole packets into a new block. The buffered data is copied, then
+ * the access reads straight into the block. The end of the data, at least
+ * one byte, goes back to the track: an empty track means the end of the
+ * stream. */
+static block_t *AStreamPacketsStream( stream_t *s, unsigned i_packet,
+                                      unsigned i_max )
+{
+    stream_sys_t *p_sys = s->p_sys;
+    stream_track_t *tk = &p_sys->stream.tk[p_sys->stream.i_tk];
+    const size_t i_size = (size_t)i_packet * i_max;
+    size_t i_buffered = tk->i_end - tk->i_start - p_sys->stream.i_offset;
+    size_t i_data = 0;
+
+    if( i_buffered == 0 )
+        return NULL; /* EOF */
+
+    block_t *p_block = block_Alloc( i_size + i_packet );
+    if( p_block == NULL )
+        return NULL;
+
+    /* Copy what the track holds */
+    i_buffered = __MIN( i_buffered, i_size );
+    while( i_data < i_buffered )
+    {
+        unsigned i_off = (tk->i_start + p_sys->stream.i_offset) % STREAM_CACHE_TRACK_SIZE;
+        size_t i_copy = __MIN( i_buffered - i_data,
+                               STREAM_CACHE_TRACK_SIZE - i_off );
+
+        memcpy( &p_block->p_buffer[i_data], &tk->p_buffer[i_off], i_copy );
+        i_data += i_copy;
+        p_sys->stream.i_offset += i_copy;
+        p_sys->stream.i_used += i_copy;
+    }
+    p_sys->i_pos += i_data;
+
+    if( tk->i_start + p_sys->stream.i_offset < tk->i_end )
+    {
+        /* i_max packets were buffered */
+        p_block->i_buffer = i_data;
+        return p_block;
+    }
+
+    /* Read straight from the access, at least a packet and a byte */
+    const int64_t i_start = mdate();
+    while( i_data <= i_packet && !s->b_die )
+    {
+        int i_read = AReadStream( s, &p_block->p_buffer[i_data],
+                                  i_size + i_packet - i_data );
+        if( i_read < 0 )
+            continue;
+        if( i_read == 0 )
+            break; /* EOF */
+
+        tk->i_end += i_read;
+        i_data += i_read;
+        p_sys->stat.i_bytes += i_read;
+        p_sys->stat.i_read_count++;
+    }
+    p_sys->stat.i_read_time += mdate() - i_start;
+
+    size_t i_whole = i_data;
+    if( i_data > i_packet )
+        i_whole = __MIN( ( i_data - 1 ) / i_packet, i_max ) * i_packet;
+
+    /* The track now starts after the returned packets. i_buffered was
+     * already counted, and may exceed i_whole: do not let the difference
+     * wrap around in a 32-bit size_t */
+    p_sys->i_pos = p_sys->i_pos - (int64_t)i_buffered + (int64_t)i_whole;
+    tk->i_start = p_sys->i_pos;
+    p_sys->stream.i_offset = 0;
+    for( size_t i_done = i_whole; i_done < i_data; )
+    {
+        unsigned i_off = (tk->i_start + i_done - i_whole) % STREAM_CACHE_TRACK_SIZE;
+        size_t i_copy = __MIN( i_data - i_done,
+                               STREAM_CACHE_TRACK_SIZE - i_off );
+
+        memcpy( &tk->p_buffer[i_off], &p_block->p_buffer[i_done], i_copy );
+        i_done += i_copy;
+    }
+
+    p_block->i_buffer = i_whole;
+    return p_block;
+}
+
 static void AStreamPrebufferStream( stream_t *s )
 {
     stream_sys_t *p_sys = s->p_sys;
@@ -135,6 +135,7 @@ static int Control( stream_t *s, int i_query, va_list args )
             break;
 
         case STREAM_GET_CONTENT_TYPE:
+        case STREAM_GET_PACKETS:
             return VLC_EGENERIC;
 
         case STREAM_CONTROL_ACCESS:
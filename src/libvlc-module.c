@@ -521,6 +521,12 @@ static const char *const ppsz_pos_descriptions[] =
     "picture quality, for instance deinterlacing, or distort " \
     "the video.")
 
+#define FILTER_THREADS_TEXT N_("Video filter threads")
+#define FILTER_THREADS_LONGTEXT N_( \
+    "Number of threads rendering the pictures of the video filters that " \
+    "support it, each on a slice of the picture (0 = number of CPUs, " \
+    "1 = disabled).")
+
 #define SNAP_PATH_TEXT N_("Video snapshot directory (or filename)")
 #define SNAP_PATH_LONGTEXT N_( \
     "Directory where the video snapshots will be stored.")
@@ -791,6 +797,11 @@ static const char *const ppsz_clock_descriptions[] =
     "This is the maximum size in bytes of the temporary files " \
     "that will be used to store the timeshifted streams." )
 
+#define INPUT_TIMESHIFT_HISTORY_TEXT N_("Timeshift history")
+#define INPUT_TIMESHIFT_HISTORY_LONGTEXT N_( \
+    "Amount of already played data (in MiB) kept in the temporary files, " \
+    "so that playback can go back in time. 0 disables backward seeking." )
+
 // DEPRECATED
 #define SUB_CAT_LONGTEXT N_( \
     "These options allow you to modify the behavior of the subpictures " \
@@ -897,6 +908,12 @@ static const char *const ppsz_clock_descriptions[] =
 #define TIMEOUT_LONGTEXT N_( \
     "Default TCP connection timeout (in milliseconds). " )
 
+#define HTTP_THREADS_TEXT N_("HTTP server threads")
+#define HTTP_THREADS_LONGTEXT N_( \
+    "Number of threads serving the clients of each HTTP host. With more " \
+    "than one thread, each of them listens on its own socket where the " \
+    "system supports it (SO_REUSEPORT)." )
+
 #define SOCKS_SERVER_TEXT N_("SOCKS server")
 #define SOCKS_SERVER_LONGTEXT N_( \
     "SOCKS proxy server to use. This must be of the form " \
@@ -1781,6 +1798,9 @@ vlc_module_begin ()
     add_module_list_cat( "video-splitter", SUBCAT_VIDEO_VFILTER, NULL, NULL,
                         VIDEO_SPLITTER_TEXT, VIDEO_SPLITTER_LONGTEXT, false )
     add_deprecated_alias( "vout-filter" )
+    add_integer_with_range( "filter-threads", 0, 0, 64, NULL,
+                            FILTER_THREADS_TEXT,
+                            FILTER_THREADS_LONGTEXT, true )
 #if 0
     add_string( "pixel-ratio", "1", PIXEL_RATIO_TEXT, PIXEL_RATIO_TEXT )
 #endif
@@ -1897,6 +1917,8 @@ vlc_module_begin ()
         change_short('4')
     add_integer( "ipv4-timeout", 5 * 1000, TIMEOUT_TEXT,
                  TIMEOUT_LONGTEXT, true )
+    add_integer( "http-threads", 1, HTTP_THREADS_TEXT,
+                 HTTP_THREADS_LONGTEXT, true )
 
     set_section( N_( "Socks proxy") , NULL )
     add_string( "socks", NULL,
@@ -1956,6 +1978,8 @@ vlc_module_begin ()
                 INPUT_TIMESHIFT_PATH_LONGTEXT, true )
     add_integer( "input-timeshift-granularity", -1, INPUT_TIMESHIFT_GRANULARITY_TEXT,
                  INPUT_TIMESHIFT_GRANULARITY_LONGTEXT, true )
+    add_integer( "input-timeshift-history", 200, INPUT_TIMESHIFT_HISTORY_TEXT,
+                 INPUT_TIMESHIFT_HISTORY_LONGTEXT, true )
 
 /* Decoder options */
     add_category_hint( N_("Decoders"), CODEC_CAT_LONGTEXT , true )
@@ -29,6 +29,7 @@
 #endif
 
 #include <vlc_common.h>
+#include <vlc_atomic.h>
 #include <sys/stat.h>
 #include <assert.h>
 #include <errno.h>
@@ -158,6 +159,8 @@ block_t *block_Realloc( block_t *p_block, ssize_t i_prebody, size_t i_body )
         /* Special case when pf_release if overloaded
          * TODO if used one day, then implement it in a smarter way */
         block_t *p_dup = block_Duplicate( p_block );
+        if( p_dup )
+            BlockMetaCopy( p_dup, p_block );
         block_Release( p_block );
         if( !p_dup )
             return NULL;
@@ -267,6 +270,135 @@ block_t *block_Realloc( block_t *p_block, ssize_t i_prebody, size_t i_body )
 }
 
 
+/**
+ * Internal state for blocks sharing a payload. The payload belongs to the
+ * original block, which is released with the last reference.
+ */
+typedef struct
+{
+    vlc_atomic_t refs;
+    block_t     *payload;
+} block_payload_t;
+
+typedef struct
+{
+    block_t          self;
+    block_payload_t *payload;
+} block_shared_t;
+
+static void BlockSharedRelease( block_t *p_block )
+{
+    block_payload_t *payload = ((block_shared_t *)p_block)->payload;
+
+    if( vlc_atomic_dec( &payload->refs ) == 0 )
+    {
+        block_Release( payload->payload );
+        free( payload );
+    }
+    free( p_block );
+}
+
+static block_t *BlockSharedNew( const block_t *p_block,
+                                block_payload_t *payload )
+{
+    block_shared_t *p_sys = malloc( sizeof (*p_sys) );
+    if( p_sys == NULL )
+        return NULL;
+
+    block_Init( &p_sys->self, p_block->p_buffer, p_block->i_buffer );
+    BlockMetaCopy( &p_sys->self, p_block );
+    p_sys->self.pf_release = BlockSharedRelease;
+    p_sys->payload = payload;
+    return &p_sys->self;
+}
+
+/**
+ * Makes a block shareable with block_Share(). This does not copy the
+ * payload, and does nothing if the block is already shareable.
+ *
+ * @param p_block block to convert (ownership is transferred)
+ * @return the shareable block, or p_block itself if out of memory
+ */
+block_t *block_Shareable( block_t *p_block )
+{
+    if( p_block->pf_release == BlockSharedRelease )
+        return p_block;
+
+    block_payload_t *payload = malloc( sizeof (*payload) );
+    if( payload == NULL )
+        return p_block;
+
+    block_t *p_shared = BlockSharedNew( p_block, payload );
+    if( p_shared == NULL )
+    {
+        free( payload );
+        return p_block;
+    }
+
+    vlc_atomic_set( &payload->refs, 1 );
+    payload->payload = p_block;
+    p_block->p_next = NULL;
+    return p_shared;
+}
+
+/**
+ * Creates a new reference to the payload of a shareable block, in O(1).
+ * The new block has its own header (buffer pointer, size, timestamps and
+ * flags), which can be modified freely; the payload must not be written
+ * without block_Writable(). If p_block is not shareable, this falls back
+ * to a copy.
+ *
+ * @return a new block (not chained), or NULL if out of memory
+ */
+block_t *block_Share( block_t *p_block )
+{
+    block_t *p_dup;
+
+    if( p_block->pf_release != BlockSharedRelease )
+    {
+        p_dup = block_Duplicate( p_block );
+        if( p_dup != NULL )
+            p_dup->i_delay = p_block->i_delay;
+        return p_dup;
+    }
+
+    block_payload_t *payload = ((block_shared_t *)p_block)->payload;
+    p_dup = BlockSharedNew( p_block, payload );
+    if( p_dup == NULL )
+        return NULL;
+
+    vlc_atomic_inc( &payload->refs );
+    p_dup->p_next = NULL;
+    return p_dup;
+}
+
+/**
+ * Ensures the payload of a block may be written to, by copying it if it is
+ * shared with other blocks (copy-on-write).
+ *
+ * @param p_block block to make writable (ownership is transferred)
+ * @return a block with a private payload, or NULL if out of memory
+ */
+block_t *block_Writable( block_t *p_block )
+{
+    if( p_block->pf_release != BlockSharedRelease )
+        return p_block;
+
+    block_payload_t *payload = ((block_shared_t *)p_block)->payload;
+    if( vlc_atomic_get( &payload->refs ) == 1 )
+        return p_block; /* we are the last user */
+
+    block_t *p_dup = block_Alloc( p_block->i_buffer );
+    if( p_dup != NULL )
+    {
+        BlockMetaCopy( p_dup, p_block );
+        memcpy( p_dup->p_buffer, p_block->p_buffer, p_block->i_buffer );
+    }
+    block_Release( p_block );
+    return p_dup;
+}
+
+
 typedef struct
 {
     block_t  self;
@@ -701,3 +833,336 @@ size_t block_FifoCount( const block_fifo_t *p_fifo )
 {
     return p_fifo->i_depth;
 }
+
+/**
+ * @section Lock-free single producer, single consumer block queue
+ *
+ * The producer only writes the write index and the consumer only writes the
+ * read index, so neither side ever takes a lock. Threads only sleep, through
+ * an event count, when the ring is empty (consumer) or full (producer).
+ * Several threads may take turns on either side as long as they serialize
+ * their calls (e.g. with the stream output lock).
+ */
+
+#if defined (__linux__) && defined (__GCC_HAVE_SYNC_COMPARE_AND_SWAP_4)
+# include <linux/futex.h>
+# include <sys/syscall.h>
+# include <limits.h>
+# define RING_FUTEX 1
+/* futex() is not a cancellation point: sleep in slices of this length. */
+# define RING_CANCEL_SLICE 50000 /* µs */
+#endif
+
+/* Event count: bit 0 tells that somebody sleeps (or is about to), the other
+ * bits count the wake ups. Signaling costs a single load when nobody
+ * sleeps, so the producer does not hit the kernel on every block while the
+ * consumer is still being scheduled. */
+typedef struct
+{
+    volatile int seq;
+#ifndef RING_FUTEX
+    vlc_mutex_t  lock;
+    vlc_cond_t   wait;
+#endif
+} ring_event_t;
+
+static void EventInit( ring_event_t *p_ev )
+{
+    p_ev->seq = 0;
+#ifndef RING_FUTEX
+    vlc_mutex_init( &p_ev->lock );
+    vlc_cond_init( &p_ev->wait );
+#endif
+}
+
+static void EventDestroy( ring_event_t *p_ev )
+{
+#ifndef RING_FUTEX
+    vlc_cond_destroy( &p_ev->wait );
+    vlc_mutex_destroy( &p_ev->lock );
+#else
+    (void)p_ev;
+#endif
+}
+
+/* Announces a sleeper (full barrier); the caller must then check its
+ * condition again before calling EventWait() with the returned key. */
+static int EventPrepare( ring_event_t *p_ev )
+{
+#ifdef RING_FUTEX
+    return __sync_or_and_fetch( &p_ev->seq, 1 );
+#else
+    int i_key;
+
+    vlc_mutex_lock( &p_ev->lock );
+    i_key = p_ev->seq |= 1;
+    vlc_mutex_unlock( &p_ev->lock );
+    return i_key;
+#endif
+}
+
+/* Sleeps until the event is signaled after EventPrepare() returned i_key.
+ * This is a cancellation point (unless cancellation is disabled). */
+static void EventWait( ring_event_t *p_ev, int i_key )
+{
+#ifdef RING_FUTEX
+    while( p_ev->seq == i_key )
+    {
+        struct timespec ts = { 0, RING_CANCEL_SLICE * 1000 };
+
+        vlc_testcancel();
+        syscall( SYS_futex, &p_ev->seq, FUTEX_WAIT_PRIVATE, i_key, &ts,
+                 NULL, 0 );
+    }
+#else
+    vlc_mutex_lock( &p_ev->lock );
+    mutex_cleanup_push( &p_ev->lock );
+    while( p_ev->seq == i_key )
+        vlc_cond_wait( &p_ev->wait, &p_ev->lock );
+    vlc_cleanup_run();
+#endif
+}
+
+/* Wakes all sleepers up. The caller must have issued a full barrier after
+ * updating the condition. */
+static void EventSignal( ring_event_t *p_ev )
+{
+    int i_seq = p_ev->seq;
+
+    if( !(i_seq & 1) )
+        return;
+#ifdef RING_FUTEX
+    while( !__sync_bool_compare_and_swap( &p_ev->seq, i_seq,
+                                          (i_seq + 2) & ~1 ) )
+    {
+        i_seq = p_ev->seq;
+        if( !(i_seq & 1) )
+            return;
+    }
+    syscall( SYS_futex, &p_ev->seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL,
+             NULL, 0 );
+#else
+    vlc_mutex_lock( &p_ev->lock );
+    if( p_ev->seq & 1 )
+    {
+        p_ev->seq = (p_ev->seq + 2) & ~1;
+        vlc_cond_broadcast( &p_ev->wait );
+    }
+    vlc_mutex_unlock( &p_ev->lock );
+#endif
+}
+
+struct block_ring_t
+{
+    /* Producer side */
+    size_t        i_write;      /**< Next slot to fill */
+    size_t        i_read_cache; /**< Last read index seen by the producer */
+    volatile size_t i_in;       /**< Bytes ever queued */
+    uint8_t       pad_producer[64];
+
+    /* Consumer side */
+    size_t        i_read;       /**< Next slot to empty */
+    size_t        i_write_cache;/**< Last write index seen by the consumer */
+    volatile size_t i_out;      /**< Bytes ever dequeued */
+    uint8_t       pad_consumer[64];
+
+    vlc_atomic_t  write;        /**< Published write index */
+    vlc_atomic_t  read;         /**< Published read index */
+    vlc_atomic_t  wake;
+    ring_event_t  event;
+    size_t        i_mask;
+    block_t      *pp_slots[];
+};
+
+/* The generic atomic load only orders what precedes it: use a full barrier
+ * so that the slots are not accessed ahead of the index. */
+static inline size_t RingLoad( vlc_atomic_t *p_index )
+{
+    return vlc_atomic_add( p_index, 0 );
+}
+
+static bool RingEmpty( block_ring_t *p_ring )
+{
+    if( p_ring->i_read != p_ring->i_write_cache )
+        return false;
+    p_ring->i_write_cache = RingLoad( &p_ring->write );
+    return p_ring->i_read == p_ring->i_write_cache;
+}
+
+static bool RingFull( block_ring_t *p_ring )
+{
+    if( p_ring->i_write - p_ring->i_read_cache <= p_ring->i_mask )
+        return false;
+    p_ring->i_read_cache = RingLoad( &p_ring->read );
+    return p_ring->i_write - p_ring->i_read_cache > p_ring->i_mask;
+}
+
+/* Waits for a block, returns false if block_RingWake() was called. */
+static bool RingWaitData( block_ring_t *p_ring )
+{
+    for( ;; )
+    {
+        if( !RingEmpty( p_ring ) )
+            return true;
+        if( vlc_atomic_get( &p_ring->wake ) )
+        {
+            vlc_atomic_set( &p_ring->wake, 0 );
+            return false;
+        }
+
+        int i_key = EventPrepare( &p_ring->event );
+        if( RingEmpty( p_ring ) && !vlc_atomic_get( &p_ring->wake ) )
+            EventWait( &p_ring->event, i_key );
+    }
+}
+
+/**
+ * Creates a single producer, single consumer block queue.
+ * @param i_max maximum number of queued blocks (rounded up to a power of 2)
+ */
+block_ring_t *block_RingNew( size_t i_max )
+{
+    size_t i_slots = 2;
+    while( i_slots < i_max )
+        i_slots <<= 1;
+
+    block_ring_t *p_ring = malloc( sizeof( *p_ring )
+                                    + i_slots * sizeof( block_t * ) );
+    if( !p_ring )
+        return NULL;
+
+    p_ring->i_write = p_ring->i_read_cache = 0;
+    p_ring->i_read = p_ring->i_write_cache = 0;
+    p_ring->i_in = p_ring->i_out = 0;
+    vlc_atomic_set( &p_ring->write, 0 );
+    vlc_atomic_set( &p_ring->read, 0 );
+    vlc_atomic_set( &p_ring->wake, 0 );
+    EventInit( &p_ring->event );
+    p_ring->i_mask = i_slots - 1;
+    return p_ring;
+}
+
+/**
+ * Destroys a queue and frees all blocks in it. Both sides must be done with
+ * the queue.
+ */
+void block_RingRelease( block_ring_t *p_ring )
+{
+    while( !RingEmpty( p_ring ) )
+        block_Release( p_ring->pp_slots[p_ring->i_read++ & p_ring->i_mask] );
+    EventDestroy( &p_ring->event );
+    free( p_ring );
+}
+
+/**
+ * Queues one block if there is room (producer side only).
+ * @return false if the queue is full, in which case the caller keeps the
+ * block.
+ */
+bool block_RingTryPut( block_ring_t *p_ring, block_t *p_block )
+{
+    assert( p_block->p_next == NULL );
+
+    if( RingFull( p_ring ) )
+        return false;
+
+    p_ring->pp_slots[p_ring->i_write & p_ring->i_mask] = p_block;
+    p_ring->i_in += p_block->i_buffer;
+    p_ring->i_write++;
+    /* Publish the slot (full barrier) before checking for sleepers. */
+    vlc_atomic_inc( &p_ring->write );
+    EventSignal( &p_ring->event );
+    return true;
+}
+
+/**
+ * Queues a list of blocks (producer side only), waiting for room if the
+ * queue is full. This is not a cancellation point.
+ * @return total number of bytes appended to the queue
+ */
+size_t block_RingPut( block_ring_t *p_ring, block_t *p_block )
+{
+    size_t i_size = 0;
+
+    while( p_block != NULL )
+    {
+        block_t *p_next = p_block->p_next;
+
+        p_block->p_next = NULL;
+        i_size += p_block->i_buffer;
+        while( !block_RingTryPut( p_ring, p_block ) )
+        {
+            int canc = vlc_savecancel();
+            int i_key = EventPrepare( &p_ring->event );
+            if( RingFull( p_ring ) )
+                EventWait( &p_ring->event, i_key );
+            vlc_restorecancel( canc );
+        }
+        p_block = p_next;
+    }
+    return i_size;
+}
+
+/**
+ * Dequeues the first block (consumer side only). If necessary, waits until
+ * there is one. This function is a cancellation point.
+ *
+ * @return a valid block, or NULL if block_RingWake() was called.
+ */
+block_t *block_RingGet( block_ring_t *p_ring )
+{
+    block_t *p_block;
+
+    vlc_testcancel();
+    if( !RingWaitData( p_ring ) )
+        return NULL;
+
+    p_block = p_ring->pp_slots[p_ring->i_read & p_ring->i_mask];
+    p_ring->i_out += p_block->i_buffer;
+    p_ring->i_read++;
+    /* Release the slot (full barrier) before checking for sleepers. */
+    vlc_atomic_inc( &p_ring->read );
+    EventSignal( &p_ring->event );
+    return p_block;
+}
+
+/**
+ * Peeks the first block (consumer side only). If necessary, waits until
+ * there is one. This function is a cancellation point.
+ *
+ * @return a valid block, or NULL if block_RingWake() was called.
+ */
+block_t *block_RingShow( block_ring_t *p_ring )
+{
+    vlc_testcancel();
+    if( !RingWaitData( p_ring ) )
+        return NULL;
+    return p_ring->pp_slots[p_ring->i_read & p_ring->i_mask];
+}
+
+/**
+ * Wakes the consumer up with block_RingGet() = NULL if the queue is empty.
+ */
+void block_RingWake( block_ring_t *p_ring )
+{
+    if( block_RingCount( p_ring ) == 0 )
+        vlc_atomic_set( &p_ring->wake, 1 );
+    EventSignal( &p_ring->event );
+}
+
+/**
+ * Number of queued blocks. This is exact from the consumer (resp. producer)
+ * side as a lower (resp. upper) bound.
+ */
+size_t block_RingCount( const block_ring_t *p_ring )
+{
+    size_t i_read = vlc_atomic_get( &p_ring->read );
+    return vlc_atomic_get( &p_ring->write ) - i_read;
+}
+
+/* Approximate when called concurrently with the other side. */
+size_t block_RingSize( const block_ring_t *p_ring )
+{
+    size_t i_out = p_ring->i_out;
+    return p_ring->i_in - i_out;
+}
@@ -28,6 +28,7 @@
 #include <vlc_filter.h>
 #include <vlc_osd.h>
 #include <vlc_modules.h>
+#include <vlc_cpu.h>
 #include <libvlc.h>
 #include <assert.h>
 
@@ -47,6 +48,8 @@ typedef struct chained_filter_t
     struct chained_filter_t *prev, *next;
     vlc_mouse_t *mouse;
     picture_t *pending;
+    unsigned slices; /* Number of slices per picture, 0 if not sliced */
+    bool slices_held; /* Holds the slice threads */
 } chained_filter_t;
 
 /* Only use this with filter objects from _this_ C module */
@@ -62,6 +65,10 @@ static void AllocatorClean( const filter_chain_allocator_t *,
 
 static bool IsInternalVideoAllocator( chained_filter_t * );
 
+static int  SliceThreadsHold( unsigned );
+static void SliceThreadsRelease( void );
+static void FilterSlices( filter_t *, filter_slice_t, void *, int, int );
+
 static int  InternalVideoInit( filter_t *, void * );
 static void InternalVideoClean( filter_t * );
 
@@ -82,6 +89,7 @@ struct filter_chain_t
     es_format_t fmt_in; /**< Chain input format (constant) */
     es_format_t fmt_out; /**< Chain current output format */
     unsigned length; /**< Number of filters */
+    unsigned slices; /**< Number of slices of the video filters pictures */
     bool b_allow_fmt_out_change; /**< Can the output format be changed? */
     char psz_capability[1]; /**< Module capability for all chained filters */
 };
@@ -133,6 +141,9 @@ filter_chain_t *filter_chain_New( vlc_object_t *p_this,
     p_chain->allocator.pf_clean = pf_buffer_allocation_clean;
     p_chain->allocator.p_data = p_buffer_allocation_data;
 
+    int i_threads = var_InheritInteger( p_this, "filter-threads" );
+    p_chain->slices = i_threads > 0 ? (unsigned)i_threads : vlc_GetCPUCount();
+
     return p_chain;
 }
 
@@ -417,6 +428,19 @@ static filter_t *filter_chain_AppendFilterInternal( filter_chain_t *p_chain,
     p_chained->mouse = p_mouse;
     p_chained->pending = NULL;
 
+    /* The slices of one filter are rendered by the calling thread and
+     * slices - 1 workers shared by all the chains. The workers are held
+     * by the first call of filter_SliceVideo(), as most filters never
+     * make one. */
+    p_chained->slices = 0;
+    p_chained->slices_held = false;
+    if( !strcmp( p_chain->psz_capability, "video filter2" ) &&
+        p_chain->slices > 1 )
+    {
+        p_chained->slices = p_chain->slices;
+        p_filter->pf_video_slices = FilterSlices;
+    }
+
     msg_Dbg( p_chain->p_this, "Filter '%s' (%p) appended to chain",
              psz_name ? psz_name : module_get_name(p_filter->p_module, false),
              p_filter );
@@ -509,6 +533,8 @@ static int filter_chain_DeleteFilterInternal( filter_chain_t *p_chain,
 
     if( p_filter->p_module )
         module_unneed( p_filter, p_filter->p_module );
+    if( p_chained->slices_held )
+        SliceThreadsRelease();
     free( p_chained->mouse );
     vlc_object_release( p_filter );
 
@@ -628,3 +654,200 @@ static void AllocatorClean( const filter_chain_allocator_t *p_alloc,
         p_alloc->pf_clean( &p_filter->filter );
 }
 
+
+/* Slice threads
+ *
+ * A single pool of workers renders the slices of all the sliced video
+ * filters of the process. A job is queued until all its slices are taken;
+ * its caller renders slices too, and then waits for the others. */
+typedef struct slice_job_t
+{
+    struct slice_job_t *p_next;
+    filter_t *p_filter;
+    filter_slice_t pf_slice;
+    void *p_data;
+    int i_lines; /* Number of lines of the picture */
+    int i_step; /* Number of lines per slice */
+    int i_next; /* First line of the next slice to render */
+    unsigned i_pending; /* Number of slices not rendered yet */
+} slice_job_t;
+
+static struct
+{
+    vlc_mutex_t lock;
+    /* The condition variables are kept for the process lifetime, as the
+     * pool may be restarted while it is still stopping */
+    vlc_cond_t wait; /* A job was queued or the workers must exit */
+    vlc_cond_t done; /* A job was completed or the workers exited */
+    bool b_init;
+    slice_job_t *p_first, **pp_last;
+    vlc_thread_t *p_threads;
+    unsigned i_threads;
+    unsigned i_refs;
+    bool b_exit; /* The workers are stopping */
+} slices = { .lock = VLC_STATIC_MUTEX };
+
+/* Renders the next slice of p_job, called with the lock held */
+static void SliceRun( slice_job_t *p_job )
+{
+    const int i_start = p_job->i_next;
+    const int i_end = __MIN( i_start + p_job->i_step, p_job->i_lines );
+
+    p_job->i_next = i_end;
+    if( i_end >= p_job->i_lines )
+    {   /* Nothing left to take: unqueue the job */
+        slice_job_t **pp = &slices.p_first;
+        while( *pp != p_job )
+            pp = &(*pp)->p_next;
+        *pp = p_job->p_next;
+        if( *pp == NULL )
+            slices.pp_last = pp;
+    }
+
+    vlc_mutex_unlock( &slices.lock );
+    p_job->pf_slice( p_job->p_filter, p_job->p_data, i_start, i_end );
+    vlc_mutex_lock( &slices.lock );
+
+    if( --p_job->i_pending == 0 )
+        vlc_cond_broadcast( &slices.done );
+}
+
+static void *SliceThread( void *data )
+{
+    VLC_UNUSED( data );
+
+    vlc_mutex_lock( &slices.lock );
+    for( ;; )
+    {
+        while( !slices.b_exit && slices.p_first == NULL )
+            vlc_cond_wait( &slices.wait, &slices.lock );
+        if( slices.b_exit )
+            break;
+        SliceRun( slices.p_first );
+    }
+    vlc_mutex_unlock( &slices.lock );
+    return NULL;
+}
+
+/* Joins the workers, called with the lock held. The lock is dropped
+ * meanwhile: SliceThreadsHold() waits for the end of the stop. */
+static void SliceThreadsStop( void )
+{
+    vlc_thread_t *p_threads = slices.p_threads;
+    const unsigned i_threads = slices.i_threads;
+
+    slices.b_exit = true;
+    vlc_cond_broadcast( &slices.wait );
+    vlc_mutex_unlock( &slices.lock );
+    for( unsigned i = 0; i < i_threads; i++ )
+        vlc_join( p_threads[i], NULL );
+    vlc_mutex_lock( &slices.lock );
+
+    free( p_threads );
+    slices.p_threads = NULL;
+    slices.i_threads = 0;
+    slices.b_exit = false;
+    vlc_cond_broadcast( &slices.done );
+}
+
+/**
+ * Takes a reference on the slice threads and makes sure that there are at
+ * least i_threads of them.
+ */
+static int SliceThreadsHold( unsigned i_threads )
+{
+    int i_ret = VLC_SUCCESS;
+
+    vlc_mutex_lock( &slices.lock );
+    if( !slices.b_init )
+    {
+        vlc_cond_init( &slices.wait );
+        vlc_cond_init( &slices.done );
+        slices.p_first = NULL;
+        slices.pp_last = &slices.p_first;
+        slices.b_init = true;
+    }
+    /* Do not take a reference on a dying pool */
+    while( slices.b_exit )
+        vlc_cond_wait( &slices.done, &slices.lock );
+
+    if( i_threads > slices.i_threads )
+    {
+        vlc_thread_t *p_threads = realloc( slices.p_threads,
+                                           i_threads * sizeof(*p_threads) );
+        if( p_threads != NULL )
+            slices.p_threads = p_threads;
+
+        while( p_threads != NULL && slices.i_threads < i_threads &&
+               !vlc_clone( &slices.p_threads[slices.i_threads], SliceThread,
+                           NULL, VLC_THREAD_PRIORITY_VIDEO ) )
+            slices.i_threads++;
+
+        if( slices.i_threads == 0 )
+            i_ret = VLC_ENOMEM;
+    }
+
+    if( i_ret == VLC_SUCCESS )
+        slices.i_refs++;
+    vlc_mutex_unlock( &slices.lock );
+    return i_ret;
+}
+
+static void SliceThreadsRelease( void )
+{
+    vlc_mutex_lock( &slices.lock );
+    assert( slices.i_refs > 0 );
+    if( --slices.i_refs == 0 )
+    {
+        assert( slices.p_first == NULL );
+        SliceThreadsStop();
+    }
+    vlc_mutex_unlock( &slices.lock );
+}
+
+static void FilterSlices( filter_t *p_filter, filter_slice_t pf_slice,
+                          void *p_data, int i_lines, int i_align )
+{
+    chained_filter_t *p_chained = chained( p_filter );
+
+    if( !p_chained->slices_held && p_chained->slices > 1 )
+    {
+        if( SliceThreadsHold( p_chained->slices - 1 ) )
+            p_chained->slices = 1; /* no workers: render in one slice */
+        else
+            p_chained->slices_held = true;
+    }
+
+    const unsigned i_slices = p_chained->slices;
+    int i_step = ( i_lines + i_slices - 1 ) / i_slices;
+
+    if( i_align > 1 )
+        i_step = ( i_step + i_align - 1 ) / i_align * i_align;
+    if( i_step <= 0 || i_step >= i_lines )
+    {
+        pf_slice( p_filter, p_data, 0, i_lines );
+        return;
+    }
+
+    slice_job_t job = {
+        .p_next = NULL,
+        .p_filter = p_filter,
+        .pf_slice = pf_slice,
+        .p_data = p_data,
+        .i_lines = i_lines,
+        .i_step = i_step,
+        .i_next = 0,
+        .i_pending = ( i_lines + i_step - 1 ) / i_step,
+    };
+
+    vlc_mutex_lock( &slices.lock );
+    *slices.pp_last = &job;
+    slices.pp_last = &job.p_next;
+    vlc_cond_broadcast( &slices.wait );
+
+    while( job.i_next < i_lines )
+        SliceRun( &job );
+    while( job.i_pending > 0 )
+        vlc_cond_wait( &slices.done, &slices.lock );
+    vlc_mutex_unlock( &slices.lock );
+}
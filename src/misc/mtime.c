@@ -251,6 +251,57 @@ mtime_t mdate( void )
     return res;
 }
 
+/**
+ * Return high precision date, in nanoseconds
+ *
+ * This uses the same time base as mdate(), so that mdate_ns() / 1000 and
+ * mdate() can be compared. The resolution is only 1 MHz (or worse) when the
+ * system does not have clock_gettime().
+ */
+int64_t mdate_ns( void )
+{
+#if defined (HAVE_CLOCK_NANOSLEEP)
+    struct timespec ts;
+
+    if( clock_gettime( CLOCK_MONOTONIC, &ts ) == EINVAL )
+        (void)clock_gettime( CLOCK_REALTIME, &ts );
+
+    return ((int64_t)ts.tv_sec * INT64_C(1000000000)) + (int64_t)ts.tv_nsec;
+#else
+    return mdate() * 1000;
+#endif
+}
+
+/**
+ * Wait for a date given in nanoseconds (see mdate_ns()). Cancellation point.
+ *
+ * Contrary to mwait(), the clock precision is not deducted from the date, so
+ * that the caller may actively wait for the remaining time.
+ * \param date The date to wake up at
+ */
+void mwait_ns( int64_t date )
+{
+#if defined (HAVE_CLOCK_NANOSLEEP)
+    lldiv_t d = lldiv( date, 1000000000 );
+    struct timespec ts = { d.quot, d.rem };
+
+    int val;
+    while( ( val = clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &ts,
+                                    NULL ) ) == EINTR );
+    if( val == EINVAL )
+    {
+        int64_t delay = date - mdate_ns();
+        if( delay <= 0 )
+            return;
+        d = lldiv( delay, 1000000000 );
+        ts.tv_sec = d.quot; ts.tv_nsec = d.rem;
+        while( clock_nanosleep( CLOCK_REALTIME, 0, &ts, &ts ) == EINTR );
+    }
+#else
+    mwait( date / 1000 );
+#endif
+}
+
 #undef mwait
 /**
  * Wait for a date
@@ -69,6 +69,18 @@ httpd_file_t *httpd_FileNew (httpd_host_t *host,
     assert (0);
 }
 
+httpd_file_t *httpd_FileNewFromBlock (httpd_host_t *host,
+                                      const char *url, const char *content_type,
+                                      const char *login, const char *password,
+                                      const vlc_acl_t *acl, block_t *block)
+{
+    (void) host;
+    (void) url; (void) content_type;
+    (void) login; (void) password; (void) acl;
+    block_Release (block);
+    return NULL;
+}
+
 httpd_handler_sys_t *httpd_HandlerDelete (httpd_handler_t *handler)
 {
     (void) handler;
@@ -157,6 +169,12 @@ int httpd_StreamSend (httpd_stream_t *stream, uint8_t *data, int count)
     assert (0);
 }
 
+int httpd_StreamSendBlock (httpd_stream_t *stream, block_t *block)
+{
+    (void) stream; (void) block;
+    assert (0);
+}
+
 httpd_host_t *httpd_TLSHostNew (vlc_object_t *obj, const char *host, int port,
                                 const char *cert, const char *key,
                                 const char *ca, const char *crl)
@@ -29,6 +29,8 @@
 
 #include <vlc_common.h>
 #include <vlc_httpd.h>
+#include <vlc_block.h>
+#include <vlc_atomic.h>
 
 #include <assert.h>
 
@@ -50,6 +52,15 @@
 #ifdef HAVE_POLL
 # include <poll.h>
 #endif
+#ifdef HAVE_SYS_EPOLL_H
+# include <sys/epoll.h>
+#endif
+#ifdef HAVE_SYS_EVENTFD_H
+# include <sys/eventfd.h>
+# ifndef EFD_CLOEXEC
+#  define EFD_CLOEXEC 0
+# endif
+#endif
 
 #if defined( UNDER_CE )
 #   include <winsock.h>
@@ -66,8 +77,26 @@
 #define HTTPD_CL_BUFSIZE 10000
 #endif
 
+/* stream chunks referenced by a client at once (one sendmsg() call) */
+#define HTTPD_CL_CHUNKS 64
+/* small stream blocks are gathered in chunks of this size */
+#define HTTPD_CHUNK_SIZE 32768
+
+/* delay before a client waiting for its url is tried again, unless the url
+ * is a stream, which wakes its clients up when it has new data */
+#define HTTPD_WAIT_DELAY (INT64_C(20000))
+/* inactivity timeouts wheel: 64 slots of 250 ms */
+#define HTTPD_WHEEL_SLOTS 64
+#define HTTPD_WHEEL_TICK (INT64_C(250000))
+/* most events handled per wakeup */
+#define HTTPD_MAX_EVENTS 64
+/* most threads per host */
+#define HTTPD_MAX_WORKERS 32
+
 static void httpd_ClientClean( httpd_client_t *cl );
 
+typedef struct httpd_worker_t httpd_worker_t;
+
 struct httpd_t
 {
     VLC_COMMON_MEMBERS
@@ -93,7 +122,10 @@ struct httpd_host_t
     int         *fds;
     unsigned     nfd;
 
-    vlc_thread_t thread;
+    /* threads serving the clients */
+    int            i_worker;
+    httpd_worker_t *worker;
+
     vlc_mutex_t lock;
     vlc_cond_t  wait;
 
@@ -104,11 +136,45 @@ struct httpd_host_t
     int         i_url;
     httpd_url_t **url;
 
+    /* TLS data */
+    tls_server_t *p_tls;
+};
+
+/* a host thread, with the clients it accepted */
+struct httpd_worker_t
+{
+    httpd_host_t *host;
+    vlc_thread_t thread;
+    vlc_mutex_t  lock;      /* the clients, against httpd_UrlDelete() */
+
+    /* listening sockets: our own with SO_REUSEPORT, else the host ones */
+    int          *fds;
+    unsigned     nfd;
+#ifdef HAVE_SYS_EPOLL_H
+    int          epfd;
+#endif
+
     int            i_client;
     httpd_client_t **client;
 
-    /* TLS data */
-    tls_server_t *p_tls;
+    /* clients without socket events, processed every HTTPD_WAIT_DELAY */
+    int            i_waiting;
+    httpd_client_t **waiting;
+    mtime_t        i_waiting_date;
+
+    /* clients waiting for stream data, processed when a stream signals
+     * wakefd, which it does only if armed is set */
+    int            i_parked;
+    httpd_client_t **parked;
+    int            wakefd[2];
+    vlc_atomic_t   armed;
+
+    /* inactivity timeouts, by HTTPD_WHEEL_TICK */
+    httpd_client_t *wheel[HTTPD_WHEEL_SLOTS];
+    int64_t        i_wheel_tick;
+
+    counter_t *p_total_counter;
+    counter_t *p_active_counter;
 };
 
 
@@ -155,6 +221,24 @@ enum
     HTTPD_CLIENT_BIDIR,     /* check for reading and get data from cb */
 };
 
+/* A piece of stream data, shared by all the clients sending it */
+typedef struct
+{
+    vlc_atomic_t refs;
+    int64_t      i_pos;     /* absolute position of the first byte */
+    bool         b_key;     /* clients may start here */
+    block_t      *p_block;
+} httpd_chunk_t;
+
+static void httpd_ChunkRelease( httpd_chunk_t *chunk )
+{
+    if( vlc_atomic_dec( &chunk->refs ) == 0 )
+    {
+        block_Release( chunk->p_block );
+        free( chunk );
+    }
+}
+
 struct httpd_client_t
 {
     httpd_url_t *url;
@@ -179,6 +263,19 @@ struct httpd_client_t
     httpd_message_t query;  /* client -> httpd */
     httpd_message_t answer; /* httpd -> client */
 
+    /* stream chunks to send after p_buffer, without copy */
+    httpd_chunk_t *pp_chunk[HTTPD_CL_CHUNKS];
+    int     i_chunk;
+    size_t  i_chunk_offset; /* bytes of pp_chunk[0] already sent */
+
+    /* owned by the worker thread */
+    int     i_events;       /* poll events watched on fd */
+    bool    b_waiting;      /* in the waiting list */
+    bool    b_parked;       /* in the parked list */
+    int     i_wheel_slot;   /* -1 if not in the timeouts wheel */
+    httpd_client_t *p_wheel_prev;
+    httpd_client_t *p_wheel_next;
+
     /* TLS data */
     tls_session_t *p_tls;
 };
@@ -389,6 +486,7 @@ struct httpd_file_t
     httpd_file_callback_t pf_fill;
     httpd_file_sys_t      *p_sys;
 
+    httpd_chunk_t *p_chunk; /* constant body, shared with the clients */
 };
 
 static int
@@ -432,8 +530,25 @@ httpd_FileCallBack( httpd_callback_sys_t *p_sys, httpd_client_t *cl,
         /* msg_Warn not supported */
     }
 
-    uint8_t *psz_args = query->psz_args;
-    file->pf_fill( file->p_sys, file, psz_args, pp_body, pi_body );
+    if( file->p_chunk != NULL )
+    {
+        /* Sent from the shared block after the header, without a copy */
+        size_t i_size = file->p_chunk->p_block->i_buffer;
+
+        if( query->i_type != HTTPD_MSG_HEAD && i_size > 0 )
+        {
+            assert( cl->i_chunk == 0 );
+            vlc_atomic_inc( &file->p_chunk->refs );
+            cl->pp_chunk[cl->i_chunk++] = file->p_chunk;
+            cl->i_chunk_offset = 0;
+        }
+        httpd_MsgAdd( answer, "Content-Length", "%zu", i_size );
+    }
+    else
+    {
+        uint8_t *psz_args = query->psz_args;
+        file->pf_fill( file->p_sys, file, psz_args, pp_body, pi_body );
+    }
 
     if( query->i_type == HTTPD_MSG_HEAD && p_body != NULL )
     {
@@ -447,7 +562,8 @@ httpd_FileCallBack( httpd_callback_sys_t *p_sys, httpd_client_t *cl,
         httpd_MsgAdd( answer, "Connection", "%s", psz_connection );
     }
 
-    httpd_MsgAdd( answer, "Content-Length", "%d", answer->i_body );
+    if( file->p_chunk == NULL )
+        httpd_MsgAdd( answer, "Content-Length", "%d", answer->i_body );
 
     return VLC_SUCCESS;
 }
@@ -480,6 +596,7 @@ httpd_file_t *httpd_FileNew( httpd_host_t *host,
 
     file->pf_fill = pf_fill;
     file->p_sys   = p_sys;
+    file->p_chunk = NULL;
 
     httpd_UrlCatch( file->url, HTTPD_MSG_HEAD, httpd_FileCallBack,
                     (httpd_callback_sys_t*)file );
@@ -491,11 +608,50 @@ httpd_file_t *httpd_FileNew( httpd_host_t *host,
     return file;
 }
 
+/**
+ * Creates a file whose content is the given block, of which it takes
+ * ownership. The block is sent as is to all the clients, instead of being
+ * copied for each request by a fill callback.
+ */
+httpd_file_t *httpd_FileNewFromBlock( httpd_host_t *host,
+                                      const char *psz_url,
+                                      const char *psz_mime,
+                                      const char *psz_user,
+                                      const char *psz_password,
+                                      const vlc_acl_t *p_acl,
+                                      block_t *p_block )
+{
+    httpd_chunk_t *chunk = malloc( sizeof( *chunk ) );
+
+    if( chunk == NULL )
+    {
+        block_Release( p_block );
+        return NULL;
+    }
+    vlc_atomic_set( &chunk->refs, 1 );
+    chunk->i_pos = 0;
+    chunk->b_key = true;
+    chunk->p_block = p_block;
+
+    httpd_file_t *file = httpd_FileNew( host, psz_url, psz_mime, psz_user,
+                                        psz_password, p_acl, NULL, NULL );
+    if( file == NULL )
+    {
+        httpd_ChunkRelease( chunk );
+        return NULL;
+    }
+    file->p_chunk = chunk;
+    return file;
+}
+
 httpd_file_sys_t *httpd_FileDelete( httpd_file_t *file )
 {
     httpd_file_sys_t *p_sys = file->p_sys;
 
     httpd_UrlDelete( file->url );
+    /* The clients still sending the block hold their own reference */
+    if( file->p_chunk != NULL )
+        httpd_ChunkRelease( file->p_chunk );
 
     free( file->psz_url );
     free( file->psz_mime );
@@ -719,13 +875,101 @@ struct httpd_stream_t
     uint8_t *p_header;
     int     i_header;
 
-    /* circular buffer */
-    int         i_buffer_size;      /* buffer size, can't be reallocated smaller */
-    uint8_t     *p_buffer;          /* buffer */
+    /* recent chunks, oldest first, in a circular array */
+    httpd_chunk_t **pp_chunk;
+    int         i_chunk_max;        /* array size, a power of 2 */
+    int         i_chunk_first;
+    int         i_chunk;
+    httpd_chunk_t *p_open;          /* last chunk, if more data may be
+                                     * appended to it (no client has it) */
+    bool        b_has_keyframes;
+
+    int64_t     i_buffer_size;      /* bytes of history to keep */
     int64_t     i_buffer_pos;       /* absolute position from begining */
     int64_t     i_buffer_last_pos;  /* a new connection will start with that */
 };
 
+static httpd_chunk_t *httpd_StreamChunk( const httpd_stream_t *stream, int i )
+{
+    return stream->pp_chunk[( stream->i_chunk_first + i )
+                            & ( stream->i_chunk_max - 1 )];
+}
+
+/* Returns the index of the chunk holding i_pos, or -1 if it was dropped */
+static int httpd_StreamFind( const httpd_stream_t *stream, int64_t i_pos )
+{
+    int i_lo = 0, i_hi = stream->i_chunk - 1;
+
+    if( stream->i_chunk == 0 || i_pos < httpd_StreamChunk( stream, 0 )->i_pos )
+        return -1;
+
+    while( i_lo < i_hi )
+    {
+        int i_mid = ( i_lo + i_hi + 1 ) / 2;
+
+        if( httpd_StreamChunk( stream, i_mid )->i_pos <= i_pos )
+            i_lo = i_mid;
+        else
+            i_hi = i_mid - 1;
+    }
+    return i_lo;
+}
+
+/* Queues a new chunk at the current end of the stream */
+static httpd_chunk_t *httpd_StreamAppend( httpd_stream_t *stream,
+                                          block_t *p_block, bool b_key )
+{
+    httpd_chunk_t *chunk = malloc( sizeof( *chunk ) );
+
+    if( chunk == NULL )
+        return NULL;
+
+    if( stream->i_chunk == stream->i_chunk_max )
+    {
+        int i_max = stream->i_chunk_max ? 2 * stream->i_chunk_max : 64;
+        httpd_chunk_t **pp_chunk = malloc( i_max * sizeof( *pp_chunk ) );
+
+        if( pp_chunk == NULL )
+        {
+            free( chunk );
+            return NULL;
+        }
+        for( int i = 0; i < stream->i_chunk; i++ )
+            pp_chunk[i] = httpd_StreamChunk( stream, i );
+        free( stream->pp_chunk );
+        stream->pp_chunk = pp_chunk;
+        stream->i_chunk_max = i_max;
+        stream->i_chunk_first = 0;
+    }
+
+    vlc_atomic_set( &chunk->refs, 1 );
+    chunk->i_pos = stream->i_buffer_pos;
+    chunk->b_key = b_key;
+    chunk->p_block = p_block;
+
+    stream->pp_chunk[( stream->i_chunk_first + stream->i_chunk++ )
+                     & ( stream->i_chunk_max - 1 )] = chunk;
+    if( b_key )
+        stream->i_buffer_last_pos = chunk->i_pos;
+    return chunk;
+}
+
+/* No more data will be appended to the open chunk: give back its unused
+ * room, or a history made of small chunks would pin HTTPD_CHUNK_SIZE bytes
+ * for each of them */
+static void httpd_StreamClose( httpd_stream_t *stream )
+{
+    httpd_chunk_t *chunk = stream->p_open;
+
+    if( chunk == NULL )
+        return;
+    assert( chunk->p_block->i_buffer > 0 );
+    /* this only copies the data if much room is left, and cannot fail */
+    chunk->p_block = block_Realloc( chunk->p_block, 0,
+                                    chunk->p_block->i_buffer );
+    stream->p_open = NULL;
+}
+
 static int httpd_StreamCallBack( httpd_callback_sys_t *p_sys,
                                  httpd_client_t *cl, httpd_message_t *answer,
                                  const httpd_message_t *query )
@@ -739,54 +983,51 @@ static int httpd_StreamCallBack( httpd_callback_sys_t *p_sys,
 
     if( answer->i_body_offset > 0 )
     {
-        int64_t i_write;
-        int     i_pos;
+        int64_t i_pos = answer->i_body_offset;
+        int     i;
 
-#if 0
-        fprintf( stderr, "httpd_StreamCallBack i_body_offset=%lld\n",
-                 answer->i_body_offset );
-#endif
+        assert( cl->i_chunk == 0 );
 
-        if( answer->i_body_offset >= stream->i_buffer_pos )
+        vlc_mutex_lock( &stream->lock );
+        if( i_pos >= stream->i_buffer_pos )
         {
-            /* fprintf( stderr, "httpd_StreamCallBack: no data\n" ); */
+            vlc_mutex_unlock( &stream->lock );
             return VLC_EGENERIC;    /* wait, no data available */
         }
-        if( answer->i_body_offset + stream->i_buffer_size <
-            stream->i_buffer_pos )
-        {
-            /* this client isn't fast enough */
-#if 0
-            fprintf( stderr, "fixing i_body_offset (old=%lld new=%lld)\n",
-                     answer->i_body_offset, stream->i_buffer_last_pos );
-#endif
-            answer->i_body_offset = stream->i_buffer_last_pos;
-        }
 
-        i_pos   = answer->i_body_offset % stream->i_buffer_size;
-        i_write = stream->i_buffer_pos - answer->i_body_offset;
-        if( i_write > HTTPD_CL_BUFSIZE )
+        i = httpd_StreamFind( stream, i_pos );
+        if( i < 0 )
         {
-            i_write = HTTPD_CL_BUFSIZE;
+            /* this client isn't fast enough: skip to the last key frame */
+            i_pos = stream->i_buffer_last_pos;
+            i = httpd_StreamFind( stream, i_pos );
+            if( i < 0 )
+            {
+                i = 0;
+                i_pos = httpd_StreamChunk( stream, 0 )->i_pos;
+            }
         }
-        else if( i_write <= 0 )
+
+        /* The client references the chunks, their data is never copied */
+        cl->i_chunk_offset = i_pos - httpd_StreamChunk( stream, i )->i_pos;
+        for( ; i < stream->i_chunk && cl->i_chunk < HTTPD_CL_CHUNKS; i++ )
         {
-            return VLC_EGENERIC;    /* wait, no data available */
-        }
+            httpd_chunk_t *chunk = httpd_StreamChunk( stream, i );
 
-        /* Don't go past the end of the circular buffer */
-        i_write = __MIN( i_write, stream->i_buffer_size - i_pos );
+            if( chunk == stream->p_open )
+                httpd_StreamClose( stream ); /* it must not change any more */
+            vlc_atomic_inc( &chunk->refs );
+            cl->pp_chunk[cl->i_chunk++] = chunk;
+            i_pos = chunk->i_pos + chunk->p_block->i_buffer;
+        }
+        vlc_mutex_unlock( &stream->lock );
 
         /* using HTTPD_MSG_ANSWER -> data available */
         answer->i_proto  = HTTPD_PROTO_HTTP;
         answer->i_version= 0;
         answer->i_type   = HTTPD_MSG_ANSWER;
 
-        answer->i_body = i_write;
-        answer->p_body = xmalloc( i_write );
-        memcpy( answer->p_body, &stream->p_buffer[i_pos], i_write );
-
-        answer->i_body_offset += i_write;
+        answer->i_body_offset = i_pos;
 
         return VLC_SUCCESS;
     }
@@ -880,8 +1121,13 @@ httpd_stream_t *httpd_StreamNew( httpd_host_t *host,
     }
     stream->i_header = 0;
     stream->p_header = NULL;
+    stream->pp_chunk = NULL;
+    stream->i_chunk_max = 0;
+    stream->i_chunk_first = 0;
+    stream->i_chunk = 0;
+    stream->p_open = NULL;
+    stream->b_has_keyframes = false;
     stream->i_buffer_size = 5000000;    /* 5 Mo per stream */
-    stream->p_buffer = xmalloc( stream->i_buffer_size );
     /* We set to 1 to make life simpler
      * (this way i_body_offset can never be 0) */
     stream->i_buffer_pos = 1;
@@ -916,37 +1162,117 @@ int httpd_StreamHeader( httpd_stream_t *stream, uint8_t *p_data, int i_data )
 
 int httpd_StreamSend( httpd_stream_t *stream, uint8_t *p_data, int i_data )
 {
-    int i_count;
-    int i_pos;
+    block_t *p_block;
 
     if( i_data < 0 || p_data == NULL )
     {
         return VLC_SUCCESS;
     }
-    vlc_mutex_lock( &stream->lock );
 
-    /* save this pointer (to be used by new connection) */
-    stream->i_buffer_last_pos = stream->i_buffer_pos;
+    p_block = block_Alloc( i_data );
+    if( p_block == NULL )
+        return VLC_ENOMEM;
+    memcpy( p_block->p_buffer, p_data, i_data );
+
+    return httpd_StreamSendBlock( stream, p_block );
+}
+
+/* Wakes the workers up, so that they process their parked clients */
+static void httpd_StreamWake( httpd_stream_t *stream )
+{
+    httpd_host_t *host = stream->url->host;
+
+    for( int i = 0; i < host->i_worker; i++ )
+    {
+        httpd_worker_t *w = &host->worker[i];
+
+        if( vlc_atomic_swap( &w->armed, 0 ) )
+        {
+            /* write() is a cancellation point */
+            int canc = vlc_savecancel();
+            if( write( w->wakefd[1], &(uint64_t){ 1 },
+                       sizeof( uint64_t ) ) == -1 )
+                msg_Err( host, "signaling pipe error: %m" );
+            vlc_restorecancel( canc );
+        }
+    }
+}
+
+/* Large blocks become chunks as is, small ones are copied in a shared
+ * chunk. A key frame (BLOCK_FLAG_TYPE_I) always starts a new chunk, where
+ * new and late clients start; without key frames, any chunk will do. */
+int httpd_StreamSendBlock( httpd_stream_t *stream, block_t *p_block )
+{
+    const bool b_key = p_block->i_flags & BLOCK_FLAG_TYPE_I;
+    const size_t i_data = p_block->i_buffer;
+    httpd_chunk_t *chunk = NULL;
 
-    i_pos = stream->i_buffer_pos % stream->i_buffer_size;
-    i_count = i_data;
-    while( i_count > 0)
+    if( i_data == 0 )
     {
-        int i_copy;
+        block_Release( p_block );
+        return VLC_SUCCESS;
+    }
 
-        i_copy = __MIN( i_count, stream->i_buffer_size - i_pos );
+    vlc_mutex_lock( &stream->lock );
+    if( b_key )
+        stream->b_has_keyframes = true;
 
-        /* Ok, we can't go past the end of our buffer */
-        memcpy( &stream->p_buffer[i_pos], p_data, i_copy );
+    if( i_data < HTTPD_CHUNK_SIZE )
+    {
+        chunk = stream->p_open;
+        if( b_key || chunk == NULL
+         || chunk->p_block->i_buffer + i_data > HTTPD_CHUNK_SIZE )
+        {
+            block_t *p_data = block_Alloc( HTTPD_CHUNK_SIZE );
 
-        i_pos = ( i_pos + i_copy ) % stream->i_buffer_size;
-        i_count -= i_copy;
-        p_data  += i_copy;
+            httpd_StreamClose( stream );
+            chunk = NULL;
+            if( p_data != NULL )
+            {
+                p_data->i_buffer = 0;
+                chunk = httpd_StreamAppend( stream, p_data,
+                                            b_key || !stream->b_has_keyframes );
+                if( chunk == NULL )
+                    block_Release( p_data );
+            }
+            stream->p_open = chunk;
+        }
+        if( chunk != NULL )
+        {
+            memcpy( &chunk->p_block->p_buffer[chunk->p_block->i_buffer],
+                    p_block->p_buffer, i_data );
+            chunk->p_block->i_buffer += i_data;
+        }
+        block_Release( p_block );
+    }
+    else
+    {
+        httpd_StreamClose( stream );
+        chunk = httpd_StreamAppend( stream, p_block,
+                                    b_key || !stream->b_has_keyframes );
+        if( chunk == NULL )
+            block_Release( p_block );
     }
 
+    if( chunk == NULL )
+    {
+        vlc_mutex_unlock( &stream->lock );
+        return VLC_ENOMEM;
+    }
     stream->i_buffer_pos += i_data;
 
+    /* Drop the oldest chunks beyond the history size */
+    while( stream->i_chunk > 1 && stream->i_buffer_pos
+             - httpd_StreamChunk( stream, 1 )->i_pos >= stream->i_buffer_size )
+    {
+        httpd_ChunkRelease( httpd_StreamChunk( stream, 0 ) );
+        stream->i_chunk_first = ( stream->i_chunk_first + 1 )
+                                & ( stream->i_chunk_max - 1 );
+        stream->i_chunk--;
+    }
+
     vlc_mutex_unlock( &stream->lock );
+    httpd_StreamWake( stream );
     return VLC_SUCCESS;
 }
 
@@ -956,14 +1282,19 @@ void httpd_StreamDelete( httpd_stream_t *stream )
     vlc_mutex_destroy( &stream->lock );
     free( stream->psz_mime );
     free( stream->p_header );
-    free( stream->p_buffer );
+    for( int i = 0; i < stream->i_chunk; i++ )
+        httpd_ChunkRelease( httpd_StreamChunk( stream, i ) );
+    free( stream->pp_chunk );
     free( stream );
 }
 
 /*****************************************************************************
  * Low level
  *****************************************************************************/
-static void* httpd_HostThread( void * );
+static void* httpd_WorkerThread( void * );
+static int httpd_WorkerInit( httpd_host_t *, httpd_worker_t *, int *, int );
+static void httpd_WorkerClean( httpd_worker_t * );
+static void httpd_WorkerDefer( httpd_worker_t *, httpd_client_t *, mtime_t );
 
 /* create a new host */
 httpd_host_t *httpd_HostNew( vlc_object_t *p_this, const char *psz_host,
@@ -1082,9 +1413,20 @@ httpd_host_t *httpd_TLSHostNew( vlc_object_t *p_this, const char *psz_hostname,
     vlc_cond_init( &host->wait );
     host->i_ref = 1;
 
+    host->worker = NULL;
+    host->i_worker = var_InheritInteger( p_this, "http-threads" );
+    host->i_worker = __MIN( __MAX( host->i_worker, 1 ), HTTPD_MAX_WORKERS );
+
     vlc_object_attach( host, p_this );
 
-    host->fds = net_ListenTCP( p_this, psz_host, i_port );
+    /* let each thread listen on its own socket */
+    if( host->i_worker > 1 )
+    {
+        var_Create( host, "reuse-port", VLC_VAR_BOOL );
+        var_SetBool( host, "reuse-port", true );
+    }
+
+    host->fds = net_ListenTCP( VLC_OBJECT( host ), psz_host, i_port );
     if( host->fds == NULL )
     {
         msg_Err( p_this, "cannot create socket(s) for HTTP host" );
@@ -1092,7 +1434,8 @@ httpd_host_t *httpd_TLSHostNew( vlc_object_t *p_this, const char *psz_hostname,
     }
     for (host->nfd = 0; host->fds[host->nfd] != -1; host->nfd++);
 
-    if( vlc_object_waitpipe( VLC_OBJECT( host ) ) == -1 )
+    int evfd = vlc_object_waitpipe( VLC_OBJECT( host ) );
+    if( evfd == -1 )
     {
         msg_Err( host, "signaling pipe error: %m" );
         goto error;
@@ -1103,18 +1446,41 @@ httpd_host_t *httpd_TLSHostNew( vlc_object_t *p_this, const char *psz_hostname,
 
     host->i_url     = 0;
     host->url       = NULL;
-    host->i_client  = 0;
-    host->client    = NULL;
 
     host->p_tls = p_tls;
 
-    /* create the thread */
-    if( vlc_clone( &host->thread, httpd_HostThread, host,
-                   VLC_THREAD_PRIORITY_LOW ) )
+    /* create the threads */
+    host->worker = calloc( host->i_worker, sizeof( *host->worker ) );
+    if( host->worker == NULL )
+        goto error;
+    for( i = 0; i < host->i_worker; i++ )
+    {
+        httpd_worker_t *w = &host->worker[i];
+        int *fds = NULL;
+
+#ifdef SO_REUSEPORT
+        if( i > 0 )
+        {
+            fds = net_ListenTCP( VLC_OBJECT( host ), psz_host, i_port );
+            if( fds == NULL )
+                msg_Dbg( host, "sharing the listening socket(s)" );
+        }
+#endif
+        if( httpd_WorkerInit( host, w, fds, evfd ) )
+            break;
+        if( vlc_clone( &w->thread, httpd_WorkerThread, w,
+                       VLC_THREAD_PRIORITY_LOW ) )
+        {
+            httpd_WorkerClean( w );
+            break;
+        }
+    }
+    if( i == 0 )
     {
         msg_Err( p_this, "cannot spawn http host thread" );
         goto error;
     }
+    host->i_worker = i;
 
     /* now add it to httpd */
     TAB_APPEND( httpd->i_host, httpd->host, host );
@@ -1133,7 +1499,9 @@ error:
 
     if( host != NULL )
     {
-        net_ListenClose( host->fds );
+        free( host->worker );
+        if( host->fds != NULL )
+            net_ListenClose( host->fds );
         vlc_cond_destroy( &host->wait );
         vlc_mutex_destroy( &host->lock );
         vlc_object_release( host );
@@ -1158,7 +1526,7 @@ void httpd_HostDelete( httpd_host_t *host )
     host->i_ref--;
     if( host->i_ref == 0 )
     {
-        vlc_cond_signal( &host->wait );
+        vlc_cond_broadcast( &host->wait );
         delete = true;
     }
     vlc_mutex_unlock( &host->lock );
@@ -1172,7 +1540,8 @@ void httpd_HostDelete( httpd_host_t *host )
     TAB_REMOVE( httpd->i_host, httpd->host, host );
 
     vlc_object_kill( host );
-    vlc_join( host->thread, NULL );
+    for( i = 0; i < host->i_worker; i++ )
+        vlc_join( host->worker[i].thread, NULL );
 
     msg_Dbg( host, "HTTP host removed" );
 
@@ -1180,16 +1549,9 @@ void httpd_HostDelete( httpd_host_t *host )
     {
         msg_Err( host, "url still registered: %s", host->url[i]->psz_url );
     }
-    for( i = 0; i < host->i_client; i++ )
-    {
-        httpd_client_t *cl = host->client[i];
-        msg_Warn( host, "client still connected" );
-        httpd_ClientClean( cl );
-        TAB_REMOVE( host->i_client, host->client, cl );
-        free( cl );
-        i--;
-        /* TODO */
-    }
+    for( i = 0; i < host->i_worker; i++ )
+        httpd_WorkerClean( &host->worker[i] );
+    free( host->worker );
 
     if( host->p_tls != NULL)
         tls_ServerDelete( host->p_tls );
@@ -1251,7 +1613,7 @@ static httpd_url_t *httpd_UrlNewPrivate( httpd_host_t *host, const char *psz_url
     }
 
     TAB_APPEND( host->i_url, host->url, url );
-    vlc_cond_signal( &host->wait );
+    vlc_cond_broadcast( &host->wait );
     vlc_mutex_unlock( &host->lock );
 
     return url;
@@ -1293,29 +1655,42 @@ void httpd_UrlDelete( httpd_url_t *url )
 
     vlc_mutex_lock( &host->lock );
     TAB_REMOVE( host->i_url, host->url, url );
+    vlc_mutex_unlock( &host->lock );
 
-    vlc_mutex_destroy( &url->lock );
-    free( url->psz_url );
-    free( url->psz_user );
-    free( url->psz_password );
-    ACL_Destroy( url->p_acl );
-
-    for( i = 0; i < host->i_client; i++ )
+    /* The clients may have pending events: kill them, and leave their
+     * removal to their worker. The worker lock is taken before the host
+     * one (see httpd_ClientPrepare()). */
+    for( i = 0; i < host->i_worker; i++ )
     {
-        httpd_client_t *client = host->client[i];
+        httpd_worker_t *w = &host->worker[i];
 
-        if( client->url == url )
+        vlc_mutex_lock( &w->lock );
+        for( int j = 0; j < w->i_client; j++ )
         {
-            /* TODO complete it */
-            msg_Warn( host, "force closing connections" );
-            httpd_ClientClean( client );
-            TAB_REMOVE( host->i_client, host->client, client );
-            free( client );
-            i--;
+            httpd_client_t *client = w->client[j];
+
+            if( client->url == url )
+            {
+                msg_Warn( host, "force closing connections" );
+                client->url = NULL;
+                client->i_state = HTTPD_CLIENT_DEAD;
+                if( client->b_parked )
+                {
+                    TAB_REMOVE( w->i_parked, w->parked, client );
+                    client->b_parked = false;
+                }
+                httpd_WorkerDefer( w, client, mdate() );
+            }
         }
+        vlc_mutex_unlock( &w->lock );
     }
+
+    vlc_mutex_destroy( &url->lock );
+    free( url->psz_url );
+    free( url->psz_user );
+    free( url->psz_password );
+    ACL_Destroy( url->p_acl );
     free( url );
-    vlc_mutex_unlock( &host->lock );
 }
 
 static void httpd_MsgInit( httpd_message_t *msg )
@@ -1407,6 +1782,8 @@ static void httpd_ClientInit( httpd_client_t *cl, mtime_t now )
     cl->p_buffer = xmalloc( cl->i_buffer_size );
     cl->i_mode   = HTTPD_CLIENT_FILE;
     cl->b_read_waiting = false;
+    cl->i_chunk = 0;
+    cl->i_chunk_offset = 0;
 
     httpd_MsgInit( &cl->query );
     httpd_MsgInit( &cl->answer );
@@ -1445,6 +1822,10 @@ static void httpd_ClientClean( httpd_client_t *cl )
     httpd_MsgClean( &cl->answer );
     httpd_MsgClean( &cl->query );
 
+    for( int i = 0; i < cl->i_chunk; i++ )
+        httpd_ChunkRelease( cl->pp_chunk[i] );
+    cl->i_chunk = 0;
+
     free( cl->p_buffer );
     cl->p_buffer = NULL;
 }
@@ -1459,6 +1840,10 @@ static httpd_client_t *httpd_ClientNew( int fd, tls_session_t *p_tls, mtime_t no
     cl->fd      = fd;
     cl->url     = NULL;
     cl->p_tls = p_tls;
+    cl->i_events = 0;
+    cl->b_waiting = false;
+    cl->b_parked = false;
+    cl->i_wheel_slot = -1;
 
     httpd_ClientInit( cl, now );
 
@@ -1922,6 +2307,63 @@ static void httpd_ClientRecv( httpd_client_t *cl )
 #endif
 }
 
+/* Sends the stream chunks of the client, with a single system call
+ * unless TLS is used, and releases the chunks sent completely */
+static ssize_t httpd_ClientSendChunks( httpd_client_t *cl )
+{
+    ssize_t val;
+    size_t i_sent;
+    int i_done = 0;
+
+    if( cl->i_chunk == 0 )
+        return 0;
+
+#if !defined( WIN32 ) && !defined( UNDER_CE )
+    if( cl->p_tls == NULL )
+    {
+        struct iovec iov[HTTPD_CL_CHUNKS];
+        struct msghdr msg;
+
+        for( int i = 0; i < cl->i_chunk; i++ )
+        {
+            iov[i].iov_base = cl->pp_chunk[i]->p_block->p_buffer;
+            iov[i].iov_len = cl->pp_chunk[i]->p_block->i_buffer;
+        }
+        iov[0].iov_base = (uint8_t *)iov[0].iov_base + cl->i_chunk_offset;
+        iov[0].iov_len -= cl->i_chunk_offset;
+
+        memset( &msg, 0, sizeof( msg ) );
+        msg.msg_iov = iov;
+        msg.msg_iovlen = cl->i_chunk;
+        do
+            val = sendmsg( cl->fd, &msg, 0 );
+        while( val == -1 && errno == EINTR );
+    }
+    else
+#endif
+    {
+        const block_t *p_block = cl->pp_chunk[0]->p_block;
+
+        val = httpd_NetSend( cl, &p_block->p_buffer[cl->i_chunk_offset],
+                             p_block->i_buffer - cl->i_chunk_offset );
+    }
+    if( val <= 0 )
+        return val;
+
+    i_sent = cl->i_chunk_offset + val;
+    while( i_done < cl->i_chunk
+        && i_sent >= cl->pp_chunk[i_done]->p_block->i_buffer )
+    {
+        i_sent -= cl->pp_chunk[i_done]->p_block->i_buffer;
+        httpd_ChunkRelease( cl->pp_chunk[i_done++] );
+    }
+    memmove( cl->pp_chunk, &cl->pp_chunk[i_done],
+             ( cl->i_chunk - i_done ) * sizeof( cl->pp_chunk[0] ) );
+    cl->i_chunk -= i_done;
+    cl->i_chunk_offset = i_sent;
+    return val;
+}
+
 static void httpd_ClientSend( httpd_client_t *cl )
 {
     int i;
@@ -1967,13 +2409,19 @@ static void httpd_ClientSend( httpd_client_t *cl )
         fprintf( stderr, "%s",  cl->p_buffer );*/
     }
 
-    i_len = httpd_NetSend( cl, &cl->p_buffer[cl->i_buffer],
-                           cl->i_buffer_size - cl->i_buffer );
-    if( i_len >= 0 )
+    if( cl->i_buffer < cl->i_buffer_size )
     {
-        cl->i_buffer += i_len;
+        i_len = httpd_NetSend( cl, &cl->p_buffer[cl->i_buffer],
+                               cl->i_buffer_size - cl->i_buffer );
+        if( i_len > 0 )
+            cl->i_buffer += i_len;
+    }
+    else
+        i_len = httpd_ClientSendChunks( cl );
 
-        if( cl->i_buffer >= cl->i_buffer_size )
+    if( i_len >= 0 )
+    {
+        if( cl->i_buffer >= cl->i_buffer_size && cl->i_chunk == 0 )
         {
             if( cl->answer.i_body == 0  && cl->answer.i_body_offset > 0 &&
                 !cl->b_read_waiting )
@@ -2000,7 +2448,7 @@ static void httpd_ClientSend( httpd_client_t *cl )
                 cl->answer.i_body = 0;
                 cl->answer.p_body = NULL;
             }
-            else
+            else if( cl->i_chunk == 0 )
             {
                 /* send finished */
                 cl->i_state = HTTPD_CLIENT_SEND_DONE;
@@ -2058,539 +2506,935 @@ static void httpd_ClientTlsHsOut( httpd_client_t *cl )
     }
 }
 
-static void* httpd_HostThread( void *data )
+/* runs the state machine of a client, and returns the poll events it waits
+ * for on its socket (none if it waits for its url or is dead) */
+static int httpd_ClientPrepare( httpd_host_t *host, httpd_client_t *cl )
 {
-    httpd_host_t *host = data;
-    tls_session_t *p_tls = NULL;
-    counter_t *p_total_counter = stats_CounterCreate( host, VLC_VAR_INTEGER, STATS_COUNTER );
-    counter_t *p_active_counter = stats_CounterCreate( host, VLC_VAR_INTEGER, STATS_COUNTER );
-    int evfd = vlc_object_waitpipe( VLC_OBJECT( host ) );
+    int events = 0;
 
-    for( ;; )
+    if( ( cl->i_state == HTTPD_CLIENT_RECEIVING )
+          || ( cl->i_state == HTTPD_CLIENT_TLS_HS_IN ) )
     {
-        /* prepare a new TLS session */
-        if( ( p_tls == NULL ) && ( host->p_tls != NULL ) )
-            p_tls = tls_ServerSessionPrepare( host->p_tls );
+        events = POLLIN;
+    }
+    else if( ( cl->i_state == HTTPD_CLIENT_SENDING )
+          || ( cl->i_state == HTTPD_CLIENT_TLS_HS_OUT ) )
+    {
+        events = POLLOUT;
+    }
+    else if( cl->i_state == HTTPD_CLIENT_RECEIVE_DONE )
+    {
+        httpd_message_t *answer = &cl->answer;
+        httpd_message_t *query  = &cl->query;
+        int i_msg = query->i_type;
+
+        httpd_MsgInit( answer );
 
-        struct pollfd ufd[host->nfd + host->i_client + 1];
-        unsigned nfd;
-        for( nfd = 0; nfd < host->nfd; nfd++ )
+        /* Handle what we received */
+        if( (cl->i_mode != HTTPD_CLIENT_BIDIR) &&
+            (i_msg == HTTPD_MSG_ANSWER || i_msg == HTTPD_MSG_CHANNEL) )
         {
-            ufd[nfd].fd = host->fds[nfd];
-            ufd[nfd].events = POLLIN;
-            ufd[nfd].revents = 0;
+            /* we can only receive request from client when not
+             * in BIDIR mode */
+            cl->url     = NULL;
+            cl->i_state = HTTPD_CLIENT_DEAD;
         }
-
-        /* add all socket that should be read/write and close dead connection */
-        vlc_mutex_lock( &host->lock );
-        while( host->i_url <= 0 && host->i_ref > 0 )
-            vlc_cond_wait( &host->wait, &host->lock );
-
-        mtime_t now = mdate();
-        bool b_low_delay = false;
-
-        for(int i_client = 0; i_client < host->i_client; i_client++ )
+        else if( i_msg == HTTPD_MSG_ANSWER )
         {
-            httpd_client_t *cl = host->client[i_client];
-            if( cl->i_ref < 0 || ( cl->i_ref == 0 &&
-                ( cl->i_state == HTTPD_CLIENT_DEAD ||
-                  ( cl->i_activity_timeout > 0 &&
-                    cl->i_activity_date+cl->i_activity_timeout < now) ) ) )
+            /* We are in BIDIR mode, trigger the callback and then
+             * check for new data */
+            if( cl->url && cl->url->catch[i_msg].cb )
             {
-                httpd_ClientClean( cl );
-                stats_UpdateInteger( host, p_active_counter, -1, NULL );
-                TAB_REMOVE( host->i_client, host->client, cl );
-                free( cl );
-                i_client--;
-                continue;
+                cl->url->catch[i_msg].cb( cl->url->catch[i_msg].p_sys,
+                                          cl, NULL, query );
+            }
+            cl->i_state = HTTPD_CLIENT_WAITING;
+        }
+        else if( i_msg == HTTPD_MSG_CHANNEL )
+        {
+            /* We are in BIDIR mode, trigger the callback and then
+             * check for new data */
+            if( cl->url && cl->url->catch[i_msg].cb )
+            {
+                cl->url->catch[i_msg].cb( cl->url->catch[i_msg].p_sys,
+                                          cl, NULL, query );
             }
+            cl->i_state = HTTPD_CLIENT_WAITING;
+        }
+        else if( i_msg == HTTPD_MSG_OPTIONS )
+        {
 
-            struct pollfd *pufd = ufd + nfd;
-            assert (pufd < ufd + (sizeof (ufd) / sizeof (ufd[0])));
+            answer->i_type   = HTTPD_MSG_ANSWER;
+            answer->i_proto  = query->i_proto;
+            answer->i_status = 200;
+            answer->i_body = 0;
+            answer->p_body = NULL;
 
-            pufd->fd = cl->fd;
-            pufd->events = pufd->revents = 0;
+            httpd_MsgAdd( answer, "Server", "VLC/%s", VERSION );
+            httpd_MsgAdd( answer, "Content-Length", "0" );
 
-            if( ( cl->i_state == HTTPD_CLIENT_RECEIVING )
-                  || ( cl->i_state == HTTPD_CLIENT_TLS_HS_IN ) )
+            switch( query->i_proto )
             {
-                pufd->events = POLLIN;
+                case HTTPD_PROTO_HTTP:
+                    answer->i_version = 1;
+                    httpd_MsgAdd( answer, "Allow",
+                                  "GET,HEAD,POST,OPTIONS" );
+                    break;
+
+                case HTTPD_PROTO_RTSP:
+                {
+                    const char *p;
+                    answer->i_version = 0;
+
+                    p = httpd_MsgGet( query, "Cseq" );
+                    if( p != NULL )
+                        httpd_MsgAdd( answer, "Cseq", "%s", p );
+                    p = httpd_MsgGet( query, "Timestamp" );
+                    if( p != NULL )
+                        httpd_MsgAdd( answer, "Timestamp", "%s", p );
+
+                    p = httpd_MsgGet( query, "Require" );
+                    if( p != NULL )
+                    {
+                        answer->i_status = 551;
+                        httpd_MsgAdd( query, "Unsupported", "%s", p );
+                    }
+
+                    httpd_MsgAdd( answer, "Public", "DESCRIBE,SETUP,"
+                                  "TEARDOWN,PLAY,PAUSE,GET_PARAMETER" );
+                    break;
+                }
             }
-            else if( ( cl->i_state == HTTPD_CLIENT_SENDING )
-                  || ( cl->i_state == HTTPD_CLIENT_TLS_HS_OUT ) )
+
+            cl->i_buffer = -1;  /* Force the creation of the answer in
+                                 * httpd_ClientSend */
+            cl->i_state = HTTPD_CLIENT_SENDING;
+        }
+        else if( i_msg == HTTPD_MSG_NONE )
+        {
+            if( query->i_proto == HTTPD_PROTO_NONE )
             {
-                pufd->events = POLLOUT;
+                cl->url = NULL;
+                cl->i_state = HTTPD_CLIENT_DEAD;
             }
-            else if( cl->i_state == HTTPD_CLIENT_RECEIVE_DONE )
+            else
             {
-                httpd_message_t *answer = &cl->answer;
-                httpd_message_t *query  = &cl->query;
-                int i_msg = query->i_type;
+                char *p;
 
-                httpd_MsgInit( answer );
+                /* unimplemented */
+                answer->i_proto  = query->i_proto ;
+                answer->i_type   = HTTPD_MSG_ANSWER;
+                answer->i_version= 0;
+                answer->i_status = 501;
 
-                /* Handle what we received */
-                if( (cl->i_mode != HTTPD_CLIENT_BIDIR) &&
-                    (i_msg == HTTPD_MSG_ANSWER || i_msg == HTTPD_MSG_CHANNEL) )
-                {
-                    /* we can only receive request from client when not
-                     * in BIDIR mode */
-                    cl->url     = NULL;
-                    cl->i_state = HTTPD_CLIENT_DEAD;
-                }
-                else if( i_msg == HTTPD_MSG_ANSWER )
-                {
-                    /* We are in BIDIR mode, trigger the callback and then
-                     * check for new data */
-                    if( cl->url && cl->url->catch[i_msg].cb )
-                    {
-                        cl->url->catch[i_msg].cb( cl->url->catch[i_msg].p_sys,
-                                                  cl, NULL, query );
-                    }
-                    cl->i_state = HTTPD_CLIENT_WAITING;
-                }
-                else if( i_msg == HTTPD_MSG_CHANNEL )
-                {
-                    /* We are in BIDIR mode, trigger the callback and then
-                     * check for new data */
-                    if( cl->url && cl->url->catch[i_msg].cb )
-                    {
-                        cl->url->catch[i_msg].cb( cl->url->catch[i_msg].p_sys,
-                                                  cl, NULL, query );
-                    }
-                    cl->i_state = HTTPD_CLIENT_WAITING;
-                }
-                else if( i_msg == HTTPD_MSG_OPTIONS )
-                {
+                answer->i_body = httpd_HtmlError (&p, 501, NULL);
+                answer->p_body = (uint8_t *)p;
+                httpd_MsgAdd( answer, "Content-Length", "%d", answer->i_body );
 
-                    answer->i_type   = HTTPD_MSG_ANSWER;
-                    answer->i_proto  = query->i_proto;
-                    answer->i_status = 200;
-                    answer->i_body = 0;
-                    answer->p_body = NULL;
+                cl->i_buffer = -1;  /* Force the creation of the answer in httpd_ClientSend */
+                cl->i_state = HTTPD_CLIENT_SENDING;
+            }
+        }
+        else
+        {
+            bool b_auth_failed = false;
+            bool b_hosts_failed = false;
 
-                    httpd_MsgAdd( answer, "Server", "VLC/%s", VERSION );
-                    httpd_MsgAdd( answer, "Content-Length", "0" );
+            /* Search the url and trigger callbacks */
+            vlc_mutex_lock( &host->lock );
+            for(int i = 0; i < host->i_url; i++ )
+            {
+                httpd_url_t *url = host->url[i];
 
-                    switch( query->i_proto )
+                if( !strcmp( url->psz_url, query->psz_url ) )
+                {
+                    if( url->catch[i_msg].cb )
                     {
-                        case HTTPD_PROTO_HTTP:
-                            answer->i_version = 1;
-                            httpd_MsgAdd( answer, "Allow",
-                                          "GET,HEAD,POST,OPTIONS" );
-                            break;
-
-                        case HTTPD_PROTO_RTSP:
+                        if( answer && ( url->p_acl != NULL ) )
                         {
-                            const char *p;
-                            answer->i_version = 0;
-
-                            p = httpd_MsgGet( query, "Cseq" );
-                            if( p != NULL )
-                                httpd_MsgAdd( answer, "Cseq", "%s", p );
-                            p = httpd_MsgGet( query, "Timestamp" );
-                            if( p != NULL )
-                                httpd_MsgAdd( answer, "Timestamp", "%s", p );
-
-                            p = httpd_MsgGet( query, "Require" );
-                            if( p != NULL )
+                            char ip[NI_MAXNUMERICHOST];
+
+                            if( ( httpd_ClientIP( cl, ip ) == NULL )
+                             || ACL_Check( url->p_acl, ip ) )
                             {
-                                answer->i_status = 551;
-                                httpd_MsgAdd( query, "Unsupported", "%s", p );
+                                b_hosts_failed = true;
+                                break;
                             }
-
-                            httpd_MsgAdd( answer, "Public", "DESCRIBE,SETUP,"
-                                          "TEARDOWN,PLAY,PAUSE,GET_PARAMETER" );
-                            break;
                         }
-                    }
-
-                    cl->i_buffer = -1;  /* Force the creation of the answer in
-                                         * httpd_ClientSend */
-                    cl->i_state = HTTPD_CLIENT_SENDING;
-                }
-                else if( i_msg == HTTPD_MSG_NONE )
-                {
-                    if( query->i_proto == HTTPD_PROTO_NONE )
-                    {
-                        cl->url = NULL;
-                        cl->i_state = HTTPD_CLIENT_DEAD;
-                    }
-                    else
-                    {
-                        char *p;
-
-                        /* unimplemented */
-                        answer->i_proto  = query->i_proto ;
-                        answer->i_type   = HTTPD_MSG_ANSWER;
-                        answer->i_version= 0;
-                        answer->i_status = 501;
-
-                        answer->i_body = httpd_HtmlError (&p, 501, NULL);
-                        answer->p_body = (uint8_t *)p;
-                        httpd_MsgAdd( answer, "Content-Length", "%d", answer->i_body );
-
-                        cl->i_buffer = -1;  /* Force the creation of the answer in httpd_ClientSend */
-                        cl->i_state = HTTPD_CLIENT_SENDING;
-                    }
-                }
-                else
-                {
-                    bool b_auth_failed = false;
-                    bool b_hosts_failed = false;
 
-                    /* Search the url and trigger callbacks */
-                    for(int i = 0; i < host->i_url; i++ )
-                    {
-                        httpd_url_t *url = host->url[i];
-
-                        if( !strcmp( url->psz_url, query->psz_url ) )
+                        if( answer && ( *url->psz_user || *url->psz_password ) )
                         {
-                            if( url->catch[i_msg].cb )
-                            {
-                                if( answer && ( url->p_acl != NULL ) )
-                                {
-                                    char ip[NI_MAXNUMERICHOST];
-
-                                    if( ( httpd_ClientIP( cl, ip ) == NULL )
-                                     || ACL_Check( url->p_acl, ip ) )
-                                    {
-                                        b_hosts_failed = true;
-                                        break;
-                                    }
-                                }
+                            /* create the headers */
+                            const char *b64 = httpd_MsgGet( query, "Authorization" ); /* BASIC id */
+                            char *user = NULL, *pass = NULL;
 
-                                if( answer && ( *url->psz_user || *url->psz_password ) )
-                                {
-                                    /* create the headers */
-                                    const char *b64 = httpd_MsgGet( query, "Authorization" ); /* BASIC id */
-                                    char *user = NULL, *pass = NULL;
-
-                                    if( b64 != NULL
-                                     && !strncasecmp( b64, "BASIC", 5 ) )
-                                    {
-                                        b64 += 5;
-                                        while( *b64 == ' ' )
-                                            b64++;
-
-                                        user = vlc_b64_decode( b64 );
-                                        if (user != NULL)
-                                        {
-                                            pass = strchr (user, ':');
-                                            if (pass != NULL)
-                                                *pass++ = '\0';
-                                        }
-                                    }
-
-                                    if ((user == NULL) || (pass == NULL)
-                                     || strcmp (user, url->psz_user)
-                                     || strcmp (pass, url->psz_password))
-                                    {
-                                        httpd_MsgAdd( answer,
-                                                      "WWW-Authenticate",
-                                                      "Basic realm=\"VLC stream\"" );
-                                        /* We fail for all url */
-                                        b_auth_failed = true;
-                                        free( user );
-                                        break;
-                                    }
-
-                                    free( user );
-                                }
+                            if( b64 != NULL
+                             && !strncasecmp( b64, "BASIC", 5 ) )
+                            {
+                                b64 += 5;
+                                while( *b64 == ' ' )
+                                    b64++;
 
-                                if( !url->catch[i_msg].cb( url->catch[i_msg].p_sys, cl, answer, query ) )
+                                user = vlc_b64_decode( b64 );
+                                if (user != NULL)
                                 {
-                                    if( answer->i_proto == HTTPD_PROTO_NONE )
-                                    {
-                                        /* Raw answer from a CGI */
-                                        cl->i_buffer = cl->i_buffer_size;
-                                    }
-                                    else
-                                        cl->i_buffer = -1;
-
-                                    /* only one url can answer */
-                                    answer = NULL;
-                                    if( cl->url == NULL )
-                                    {
-                                        cl->url = url;
-                                    }
+                                    pass = strchr (user, ':');
+                                    if (pass != NULL)
+                                        *pass++ = '\0';
                                 }
                             }
-                        }
-                    }
 
-                    if( answer )
-                    {
-                        char *p;
-
-                        answer->i_proto  = query->i_proto;
-                        answer->i_type   = HTTPD_MSG_ANSWER;
-                        answer->i_version= 0;
+                            if ((user == NULL) || (pass == NULL)
+                             || strcmp (user, url->psz_user)
+                             || strcmp (pass, url->psz_password))
+                            {
+                                httpd_MsgAdd( answer,
+                                              "WWW-Authenticate",
+                                              "Basic realm=\"VLC stream\"" );
+                                /* We fail for all url */
+                                b_auth_failed = true;
+                                free( user );
+                                break;
+                            }
 
-                        if( b_hosts_failed )
-                        {
-                            answer->i_status = 403;
-                        }
-                        else if( b_auth_failed )
-                        {
-                            answer->i_status = 401;
-                        }
-                        else
-                        {
-                            /* no url registered */
-                            answer->i_status = 404;
+                            free( user );
                         }
 
-                        answer->i_body = httpd_HtmlError (&p,
-                                                          answer->i_status,
-                                                          query->psz_url);
-                        answer->p_body = (uint8_t *)p;
+                        if( !url->catch[i_msg].cb( url->catch[i_msg].p_sys, cl, answer, query ) )
+                        {
+                            if( answer->i_proto == HTTPD_PROTO_NONE )
+                            {
+                                /* Raw answer from a CGI */
+                                cl->i_buffer = cl->i_buffer_size;
+                            }
+                            else
+                                cl->i_buffer = -1;
 
-                        cl->i_buffer = -1;  /* Force the creation of the answer in httpd_ClientSend */
-                        httpd_MsgAdd( answer, "Content-Length", "%d", answer->i_body );
-                        httpd_MsgAdd( answer, "Content-Type", "%s", "text/html" );
+                            /* only one url can answer */
+                            answer = NULL;
+                            if( cl->url == NULL )
+                            {
+                                cl->url = url;
+                            }
+                        }
                     }
-
-                    cl->i_state = HTTPD_CLIENT_SENDING;
                 }
             }
-            else if( cl->i_state == HTTPD_CLIENT_SEND_DONE )
+            vlc_mutex_unlock( &host->lock );
+
+            if( answer )
             {
-                if( cl->i_mode == HTTPD_CLIENT_FILE || cl->answer.i_body_offset == 0 )
-                {
-                    const char *psz_connection = httpd_MsgGet( &cl->answer, "Connection" );
-                    const char *psz_query = httpd_MsgGet( &cl->query, "Connection" );
-                    bool b_connection = false;
-                    bool b_keepalive = false;
-                    bool b_query = false;
-
-                    cl->url = NULL;
-                    if( psz_connection )
-                    {
-                        b_connection = ( strcasecmp( psz_connection, "Close" ) == 0 );
-                        b_keepalive = ( strcasecmp( psz_connection, "Keep-Alive" ) == 0 );
-                    }
+                char *p;
 
-                    if( psz_query )
-                    {
-                        b_query = ( strcasecmp( psz_query, "Close" ) == 0 );
-                    }
+                answer->i_proto  = query->i_proto;
+                answer->i_type   = HTTPD_MSG_ANSWER;
+                answer->i_version= 0;
 
-                    if( ( ( cl->query.i_proto == HTTPD_PROTO_HTTP ) &&
-                          ( ( cl->query.i_version == 0 && b_keepalive ) ||
-                            ( cl->query.i_version == 1 && !b_connection ) ) ) ||
-                        ( ( cl->query.i_proto == HTTPD_PROTO_RTSP ) &&
-                          !b_query && !b_connection ) )
-                    {
-                        httpd_MsgClean( &cl->query );
-                        httpd_MsgInit( &cl->query );
-
-                        cl->i_buffer = 0;
-                        cl->i_buffer_size = 1000;
-                        free( cl->p_buffer );
-                        cl->p_buffer = xmalloc( cl->i_buffer_size );
-                        cl->i_state = HTTPD_CLIENT_RECEIVING;
-                    }
-                    else
-                    {
-                        cl->i_state = HTTPD_CLIENT_DEAD;
-                    }
-                    httpd_MsgClean( &cl->answer );
+                if( b_hosts_failed )
+                {
+                    answer->i_status = 403;
                 }
-                else if( cl->b_read_waiting )
+                else if( b_auth_failed )
                 {
-                    /* we have a message waiting for us to read it */
-                    httpd_MsgClean( &cl->answer );
-                    httpd_MsgClean( &cl->query );
-
-                    cl->i_buffer = 0;
-                    cl->i_buffer_size = 1000;
-                    free( cl->p_buffer );
-                    cl->p_buffer = xmalloc( cl->i_buffer_size );
-                    cl->i_state = HTTPD_CLIENT_RECEIVING;
-                    cl->b_read_waiting = false;
+                    answer->i_status = 401;
                 }
                 else
                 {
-                    int64_t i_offset = cl->answer.i_body_offset;
-                    httpd_MsgClean( &cl->answer );
+                    /* no url registered */
+                    answer->i_status = 404;
+                }
 
-                    cl->answer.i_body_offset = i_offset;
-                    free( cl->p_buffer );
-                    cl->p_buffer = NULL;
-                    cl->i_buffer = 0;
-                    cl->i_buffer_size = 0;
+                answer->i_body = httpd_HtmlError (&p,
+                                                  answer->i_status,
+                                                  query->psz_url);
+                answer->p_body = (uint8_t *)p;
 
-                    cl->i_state = HTTPD_CLIENT_WAITING;
-                }
+                cl->i_buffer = -1;  /* Force the creation of the answer in httpd_ClientSend */
+                httpd_MsgAdd( answer, "Content-Length", "%d", answer->i_body );
+                httpd_MsgAdd( answer, "Content-Type", "%s", "text/html" );
             }
-            else if( cl->i_state == HTTPD_CLIENT_WAITING )
-            {
-                int64_t i_offset = cl->answer.i_body_offset;
-                int     i_msg = cl->query.i_type;
-
-                httpd_MsgInit( &cl->answer );
-                cl->answer.i_body_offset = i_offset;
 
-                cl->url->catch[i_msg].cb( cl->url->catch[i_msg].p_sys, cl,
-                                          &cl->answer, &cl->query );
-                if( cl->answer.i_type != HTTPD_MSG_NONE )
-                {
-                    /* we have new data, so re-enter send mode */
-                    cl->i_buffer      = 0;
-                    cl->p_buffer      = cl->answer.p_body;
-                    cl->i_buffer_size = cl->answer.i_body;
-                    cl->answer.p_body = NULL;
-                    cl->answer.i_body = 0;
-                    cl->i_state = HTTPD_CLIENT_SENDING;
-                }
+            cl->i_state = HTTPD_CLIENT_SENDING;
+        }
+    }
+    else if( cl->i_state == HTTPD_CLIENT_SEND_DONE )
+    {
+        if( cl->i_mode == HTTPD_CLIENT_FILE || cl->answer.i_body_offset == 0 )
+        {
+            const char *psz_connection = httpd_MsgGet( &cl->answer, "Connection" );
+            const char *psz_query = httpd_MsgGet( &cl->query, "Connection" );
+            bool b_connection = false;
+            bool b_keepalive = false;
+            bool b_query = false;
+
+            cl->url = NULL;
+            if( psz_connection )
+            {
+                b_connection = ( strcasecmp( psz_connection, "Close" ) == 0 );
+                b_keepalive = ( strcasecmp( psz_connection, "Keep-Alive" ) == 0 );
             }
 
-            /* Special for BIDIR mode we also check reading */
-            if( cl->i_mode == HTTPD_CLIENT_BIDIR &&
-                cl->i_state == HTTPD_CLIENT_SENDING )
+            if( psz_query )
             {
-                pufd->events |= POLLIN;
+                b_query = ( strcasecmp( psz_query, "Close" ) == 0 );
             }
 
-            if (pufd->events != 0)
-                nfd++;
+            if( ( ( cl->query.i_proto == HTTPD_PROTO_HTTP ) &&
+                  ( ( cl->query.i_version == 0 && b_keepalive ) ||
+                    ( cl->query.i_version == 1 && !b_connection ) ) ) ||
+                ( ( cl->query.i_proto == HTTPD_PROTO_RTSP ) &&
+                  !b_query && !b_connection ) )
+            {
+                httpd_MsgClean( &cl->query );
+                httpd_MsgInit( &cl->query );
+
+                cl->i_buffer = 0;
+                cl->i_buffer_size = 1000;
+                free( cl->p_buffer );
+                cl->p_buffer = xmalloc( cl->i_buffer_size );
+                cl->i_state = HTTPD_CLIENT_RECEIVING;
+            }
             else
-                b_low_delay = true;
+            {
+                cl->i_state = HTTPD_CLIENT_DEAD;
+            }
+            httpd_MsgClean( &cl->answer );
         }
-        vlc_mutex_unlock( &host->lock );
+        else if( cl->b_read_waiting )
+        {
+            /* we have a message waiting for us to read it */
+            httpd_MsgClean( &cl->answer );
+            httpd_MsgClean( &cl->query );
 
-        ufd[nfd].fd = evfd;
-        ufd[nfd].events = POLLIN;
-        ufd[nfd].revents = 0;
-        nfd++;
+            cl->i_buffer = 0;
+            cl->i_buffer_size = 1000;
+            free( cl->p_buffer );
+            cl->p_buffer = xmalloc( cl->i_buffer_size );
+            cl->i_state = HTTPD_CLIENT_RECEIVING;
+            cl->b_read_waiting = false;
+        }
+        else
+        {
+            int64_t i_offset = cl->answer.i_body_offset;
+            httpd_MsgClean( &cl->answer );
+
+            cl->answer.i_body_offset = i_offset;
+            free( cl->p_buffer );
+            cl->p_buffer = NULL;
+            cl->i_buffer = 0;
+            cl->i_buffer_size = 0;
+
+            cl->i_state = HTTPD_CLIENT_WAITING;
+        }
+    }
+    else if( cl->i_state == HTTPD_CLIENT_WAITING )
+    {
+        int64_t i_offset = cl->answer.i_body_offset;
+        int     i_msg = cl->query.i_type;
 
-        /* we will wait 20ms (not too big) if HTTPD_CLIENT_WAITING */
-        switch( poll( ufd, nfd, b_low_delay ? 20 : -1) )
+        httpd_MsgInit( &cl->answer );
+        cl->answer.i_body_offset = i_offset;
+
+        cl->url->catch[i_msg].cb( cl->url->catch[i_msg].p_sys, cl,
+                                  &cl->answer, &cl->query );
+        if( cl->answer.i_type != HTTPD_MSG_NONE )
         {
-            case -1:
-                if (errno != EINTR)
-                {
-                    /* Kernel on low memory or a bug: pace */
-                    msg_Err( host, "polling error: %m" );
-                    msleep( 100000 );
-                }
-            case 0:
-                continue;
+            /* we have new data, so re-enter send mode */
+            cl->i_buffer      = 0;
+            cl->p_buffer      = cl->answer.p_body;
+            cl->i_buffer_size = cl->answer.i_body;
+            cl->answer.p_body = NULL;
+            cl->answer.i_body = 0;
+            cl->i_state = HTTPD_CLIENT_SENDING;
         }
+    }
 
-        if( ufd[nfd - 1].revents )
-            break;
+    /* Special for BIDIR mode we also check reading */
+    if( cl->i_mode == HTTPD_CLIENT_BIDIR &&
+        cl->i_state == HTTPD_CLIENT_SENDING )
+    {
+        events |= POLLIN;
+    }
 
-        /* Handle client sockets */
-        vlc_mutex_lock( &host->lock );
-        now = mdate();
-        nfd = host->nfd;
-        for( int i_client = 0; i_client < host->i_client; i_client++ )
+    return events;
+}
+
+static void httpd_ClientIO( httpd_client_t *cl, int revents, mtime_t now )
+{
+    cl->i_activity_date = now;
+
+    if( cl->i_state == HTTPD_CLIENT_RECEIVING )
+    {
+        httpd_ClientRecv( cl );
+    }
+    else if( cl->i_state == HTTPD_CLIENT_SENDING )
+    {
+        httpd_ClientSend( cl );
+    }
+    else if( cl->i_state == HTTPD_CLIENT_TLS_HS_IN )
+    {
+        httpd_ClientTlsHsIn( cl );
+    }
+    else if( cl->i_state == HTTPD_CLIENT_TLS_HS_OUT )
+    {
+        httpd_ClientTlsHsOut( cl );
+    }
+
+    if( cl->i_mode == HTTPD_CLIENT_BIDIR &&
+        cl->i_state == HTTPD_CLIENT_SENDING &&
+        (revents & POLLIN) )
+    {
+        cl->b_read_waiting = true;
+    }
+}
+
+/*****************************************************************************
+ * Host workers
+ *****************************************************************************
+ * Each host runs "http-threads" workers. A worker owns the clients it has
+ * accepted and waits for them in a persistent epoll set where available, so
+ * that a wakeup costs in proportion to the ready sockets, not to all the
+ * clients. Inactivity timeouts are kept in a timer wheel. Clients waiting
+ * for more data from their url (HTTPD_CLIENT_WAITING) are not watched: the
+ * stream clients are parked until httpd_StreamSendBlock() signals the worker
+ * wakefd, the others are tried again every HTTPD_WAIT_DELAY.
+ *
+ * The worker arms the signal before it runs any client callback, so a block
+ * sent after a client found no data always wakes the worker up.
+ *
+ * The Lua telnet interface (VLM) does not use httpd: it has its own poll()
+ * loop in share/lua/intf/modules/host.lua, for a few console clients.
+ *****************************************************************************/
+
+/* sets the events a client waits for on its socket */
+static void httpd_WorkerWatch( httpd_worker_t *w, httpd_client_t *cl,
+                               int events )
+{
+    if( events == cl->i_events )
+        return;
+#ifdef HAVE_SYS_EPOLL_H
+    struct epoll_event ev;
+
+    ev.events = ( ( events & POLLIN ) ? EPOLLIN : 0 )
+              | ( ( events & POLLOUT ) ? EPOLLOUT : 0 );
+    ev.data.ptr = cl;
+    if( cl->i_events == 0 )
+        epoll_ctl( w->epfd, EPOLL_CTL_ADD, cl->fd, &ev );
+    else if( events == 0 )
+        epoll_ctl( w->epfd, EPOLL_CTL_DEL, cl->fd, &ev );
+    else
+        epoll_ctl( w->epfd, EPOLL_CTL_MOD, cl->fd, &ev );
+#else
+    VLC_UNUSED( w );
+#endif
+    cl->i_events = events;
+}
+
+/* queues a client to be processed again when its stream has new data, or
+ * after HTTPD_WAIT_DELAY */
+static void httpd_WorkerDefer( httpd_worker_t *w, httpd_client_t *cl,
+                               mtime_t now )
+{
+    if( cl->b_waiting || cl->b_parked )
+        return;
+    if( cl->i_mode == HTTPD_CLIENT_STREAM
+     && cl->i_state == HTTPD_CLIENT_WAITING && w->wakefd[0] != -1 )
+    {
+        TAB_APPEND( w->i_parked, w->parked, cl );
+        cl->b_parked = true;
+        return;
+    }
+    if( w->i_waiting == 0 )
+        w->i_waiting_date = now + HTTPD_WAIT_DELAY;
+    TAB_APPEND( w->i_waiting, w->waiting, cl );
+    cl->b_waiting = true;
+}
+
+static void httpd_WheelInsert( httpd_worker_t *w, httpd_client_t *cl )
+{
+    int64_t i_tick = w->i_wheel_tick + HTTPD_WHEEL_SLOTS;
+
+    if( cl->i_activity_timeout > 0 )
+    {
+        int64_t i_deadline = ( cl->i_activity_date + cl->i_activity_timeout )
+                             / HTTPD_WHEEL_TICK + 1;
+        if( i_deadline < i_tick )
+            i_tick = __MAX( i_deadline, w->i_wheel_tick + 1 );
+    }
+
+    cl->i_wheel_slot = i_tick % HTTPD_WHEEL_SLOTS;
+    cl->p_wheel_prev = NULL;
+    cl->p_wheel_next = w->wheel[cl->i_wheel_slot];
+    if( cl->p_wheel_next != NULL )
+        cl->p_wheel_next->p_wheel_prev = cl;
+    w->wheel[cl->i_wheel_slot] = cl;
+}
+
+static void httpd_WheelRemove( httpd_worker_t *w, httpd_client_t *cl )
+{
+    if( cl->i_wheel_slot < 0 )
+        return;
+    if( cl->p_wheel_prev != NULL )
+        cl->p_wheel_prev->p_wheel_next = cl->p_wheel_next;
+    else
+        w->wheel[cl->i_wheel_slot] = cl->p_wheel_next;
+    if( cl->p_wheel_next != NULL )
+        cl->p_wheel_next->p_wheel_prev = cl->p_wheel_prev;
+    cl->i_wheel_slot = -1;
+}
+
+static void httpd_WorkerRemove( httpd_worker_t *w, httpd_client_t *cl )
+{
+    httpd_WorkerWatch( w, cl, 0 );
+    if( cl->b_waiting )
+        TAB_REMOVE( w->i_waiting, w->waiting, cl );
+    if( cl->b_parked )
+        TAB_REMOVE( w->i_parked, w->parked, cl );
+    httpd_WheelRemove( w, cl );
+
+    httpd_ClientClean( cl );
+    stats_UpdateInteger( w->host, w->p_active_counter, -1, NULL );
+    TAB_REMOVE( w->i_client, w->client, cl );
+    free( cl );
+}
+
+/* runs the client state machine until it waits for its socket or for its
+ * url, or dies */
+static void httpd_WorkerProcess( httpd_worker_t *w, httpd_client_t *cl,
+                                 mtime_t now )
+{
+    int events, i_state;
+
+    do
+    {
+        i_state = cl->i_state;
+        events = httpd_ClientPrepare( w->host, cl );
+    }
+    while( events == 0 && cl->i_state != i_state );
+
+    if( cl->i_ref < 0
+     || ( cl->i_ref == 0 && cl->i_state == HTTPD_CLIENT_DEAD ) )
+        httpd_WorkerRemove( w, cl );
+    else
+    {
+        httpd_WorkerWatch( w, cl, events );
+        if( events == 0 )
+            httpd_WorkerDefer( w, cl, now );
+    }
+}
+
+static void httpd_WorkerParked( httpd_worker_t *w, mtime_t now )
+{
+    int i_parked = w->i_parked;
+    httpd_client_t **parked = w->parked;
+
+    w->i_parked = 0;
+    w->parked = NULL;
+    for( int i = 0; i < i_parked; i++ )
+    {
+        parked[i]->b_parked = false;
+        httpd_WorkerProcess( w, parked[i], now );
+    }
+    free( parked );
+}
+
+static void httpd_WorkerWaiting( httpd_worker_t *w, mtime_t now )
+{
+    int i_waiting = w->i_waiting;
+    httpd_client_t **waiting = w->waiting;
+
+    if( i_waiting == 0 || now < w->i_waiting_date )
+        return;
+
+    w->i_waiting = 0;
+    w->waiting = NULL;
+    for( int i = 0; i < i_waiting; i++ )
+    {
+        waiting[i]->b_waiting = false;
+        httpd_WorkerProcess( w, waiting[i], now );
+    }
+    free( waiting );
+}
+
+static void httpd_WorkerTimers( httpd_worker_t *w, mtime_t now )
+{
+    int64_t i_tick = now / HTTPD_WHEEL_TICK;
+
+    /* each slot holds the deadlines of a whole round at most */
+    if( i_tick - w->i_wheel_tick > HTTPD_WHEEL_SLOTS )
+        w->i_wheel_tick = i_tick - HTTPD_WHEEL_SLOTS;
+
+    while( w->i_wheel_tick < i_tick )
+    {
+        int i_slot = ++w->i_wheel_tick % HTTPD_WHEEL_SLOTS;
+        httpd_client_t *cl = w->wheel[i_slot];
+
+        w->wheel[i_slot] = NULL;
+        while( cl != NULL )
         {
-            httpd_client_t *cl = host->client[i_client];
-            const struct pollfd *pufd = &ufd[nfd];
+            httpd_client_t *next = cl->p_wheel_next;
 
-            assert( pufd < &ufd[sizeof(ufd) / sizeof(ufd[0])] );
+            /* the activity date may have moved since the insertion */
+            cl->i_wheel_slot = -1;
+            if( cl->i_ref == 0 && cl->i_activity_timeout > 0
+             && cl->i_activity_date + cl->i_activity_timeout < now )
+                httpd_WorkerRemove( w, cl );
+            else
+                httpd_WheelInsert( w, cl );
+            cl = next;
+        }
+    }
+}
 
-            if( cl->fd != pufd->fd )
-                continue; // we were not waiting for this client
-            ++nfd;
-            if( pufd->revents == 0 )
-                continue; // no event received
+/* poll timeout in milliseconds */
+static int httpd_WorkerTimeout( const httpd_worker_t *w, mtime_t now )
+{
+    mtime_t i_deadline;
 
-            cl->i_activity_date = now;
+    if( w->i_client == 0 )
+        return -1;
 
-            if( cl->i_state == HTTPD_CLIENT_RECEIVING )
-            {
-                httpd_ClientRecv( cl );
-            }
-            else if( cl->i_state == HTTPD_CLIENT_SENDING )
+    i_deadline = ( w->i_wheel_tick + 1 ) * HTTPD_WHEEL_TICK;
+    if( w->i_waiting > 0 && w->i_waiting_date < i_deadline )
+        i_deadline = w->i_waiting_date;
+    if( i_deadline <= now )
+        return 0;
+    return ( i_deadline - now + 999 ) / 1000;
+}
+
+static void httpd_WorkerAccept( httpd_worker_t *w, tls_session_t **pp_tls,
+                                mtime_t now )
+{
+    httpd_host_t *host = w->host;
+
+    for( unsigned nfd = 0; nfd < w->nfd; nfd++ )
+    {
+        httpd_client_t *cl;
+        int i_state = -1;
+        int fd;
+
+        /* the sockets are non-blocking, and shared ones may have been
+         * emptied by another worker already */
+        fd = vlc_accept( w->fds[nfd], NULL, NULL, true );
+        if (fd == -1)
+            continue;
+        setsockopt (fd, SOL_SOCKET, SO_REUSEADDR,
+                    &(int){ 1 }, sizeof(int));
+
+        if( *pp_tls != NULL )
+        {
+            switch( tls_ServerSessionHandshake( *pp_tls, fd ) )
             {
-                httpd_ClientSend( cl );
+                case -1:
+                    msg_Err( host, "Rejecting TLS connection" );
+                    net_Close( fd );
+                    fd = -1;
+                    *pp_tls = NULL;
+                    break;
+
+                case 1: /* missing input - most likely */
+                    i_state = HTTPD_CLIENT_TLS_HS_IN;
+                    break;
+
+                case 2: /* missing output */
+                    i_state = HTTPD_CLIENT_TLS_HS_OUT;
+                    break;
             }
-            else if( cl->i_state == HTTPD_CLIENT_TLS_HS_IN )
+
+            if( (*pp_tls == NULL) != (host->p_tls == NULL) )
+                break; // wasted TLS session, cannot accept() anymore
+        }
+
+        cl = httpd_ClientNew( fd, *pp_tls, now );
+        if( cl == NULL )
+        {
+            if( *pp_tls != NULL )
+                tls_ServerSessionClose( *pp_tls );
+            *pp_tls = NULL;
+            net_Close( fd );
+            break;
+        }
+        *pp_tls = NULL;
+        stats_UpdateInteger( host, w->p_total_counter, 1, NULL );
+        stats_UpdateInteger( host, w->p_active_counter, 1, NULL );
+        TAB_APPEND( w->i_client, w->client, cl );
+        if( i_state != -1 )
+            cl->i_state = i_state; // override state for TLS
+
+        httpd_WheelInsert( w, cl );
+        httpd_WorkerProcess( w, cl, now );
+
+        if (host->p_tls != NULL)
+            break; // cannot accept further without new TLS session
+    }
+}
+
+/* a socket event: cl is NULL for the listening sockets */
+typedef struct
+{
+    httpd_client_t *cl;
+    int             revents;
+} httpd_event_t;
+
+#ifndef HAVE_SYS_EPOLL_H
+/* Without epoll, the pollfd set is rebuilt from the events the clients
+ * wait for, without running their state machine again. */
+static int httpd_WorkerPoll( httpd_worker_t *w, int evfd,
+                             httpd_event_t *events, int i_timeout,
+                             bool *pb_die, bool *pb_woken )
+{
+    /* only the worker adds or removes clients */
+    struct pollfd ufd[w->nfd + w->i_client + 2];
+    httpd_client_t *clients[w->nfd + w->i_client];
+    unsigned nfd = 0;
+    int n = 0;
+
+    vlc_mutex_lock( &w->lock );
+    for( unsigned i = 0; i < w->nfd; i++ )
+    {
+        ufd[nfd].fd = w->fds[i];
+        ufd[nfd].events = POLLIN;
+        clients[nfd++] = NULL;
+    }
+    for( int i = 0; i < w->i_client; i++ )
+    {
+        httpd_client_t *cl = w->client[i];
+
+        if( cl->i_events == 0 )
+            continue;
+        ufd[nfd].fd = cl->fd;
+        ufd[nfd].events = cl->i_events;
+        clients[nfd++] = cl;
+    }
+    vlc_mutex_unlock( &w->lock );
+    ufd[nfd].fd = evfd;
+    ufd[nfd].events = POLLIN;
+    ufd[nfd + 1].fd = w->wakefd[0];
+    ufd[nfd + 1].events = POLLIN;
+
+    if( poll( ufd, nfd + 2, i_timeout ) == -1 )
+        return -1;
+    if( ufd[nfd].revents )
+        *pb_die = true;
+    if( ufd[nfd + 1].revents )
+        *pb_woken = true;
+
+    for( unsigned i = 0; i < nfd; i++ )
+    {
+        if( ufd[i].revents == 0 )
+            continue;
+        if( clients[i] == NULL && n > 0 && events[n - 1].cl == NULL )
+            continue; /* one accept() pass for all the listening sockets */
+        events[n].cl = clients[i];
+        events[n++].revents = ufd[i].revents;
+    }
+    return n;
+}
+#endif
+
+static int httpd_WorkerInit( httpd_host_t *host, httpd_worker_t *w,
+                             int *fds, int evfd )
+{
+    w->host = host;
+    w->fds = ( fds != NULL ) ? fds : host->fds;
+    for( w->nfd = 0; w->fds[w->nfd] != -1; w->nfd++ );
+
+#ifdef HAVE_SYS_EPOLL_H
+    struct epoll_event ev;
+
+    w->epfd = epoll_create1( EPOLL_CLOEXEC );
+    if( w->epfd == -1 )
+    {
+        msg_Err( host, "cannot create epoll set: %m" );
+        if( fds != NULL )
+            net_ListenClose( fds );
+        return VLC_EGENERIC;
+    }
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL; /* the host is being deleted */
+    epoll_ctl( w->epfd, EPOLL_CTL_ADD, evfd, &ev );
+    ev.data.ptr = w; /* a connection to accept */
+    for( unsigned i = 0; i < w->nfd; i++ )
+        epoll_ctl( w->epfd, EPOLL_CTL_ADD, w->fds[i], &ev );
+#else
+    VLC_UNUSED( evfd );
+#endif
+
+    /* without it, the stream clients are tried every HTTPD_WAIT_DELAY */
+#if defined( HAVE_SYS_EVENTFD_H )
+    w->wakefd[0] = w->wakefd[1] = eventfd( 0, EFD_CLOEXEC );
+    if( w->wakefd[0] == -1 )
+#endif
+#ifndef WIN32
+    if( pipe( w->wakefd ) )
+#endif
+        w->wakefd[0] = w->wakefd[1] = -1;
+#ifdef HAVE_SYS_EPOLL_H
+    ev.data.ptr = w->wakefd; /* new stream data */
+    if( w->wakefd[0] != -1 )
+        epoll_ctl( w->epfd, EPOLL_CTL_ADD, w->wakefd[0], &ev );
+#endif
+    vlc_atomic_set( &w->armed, 0 );
+
+    w->i_client = 0;
+    w->client = NULL;
+    w->i_waiting = 0;
+    w->waiting = NULL;
+    w->i_waiting_date = 0;
+    w->i_parked = 0;
+    w->parked = NULL;
+    for( int i = 0; i < HTTPD_WHEEL_SLOTS; i++ )
+        w->wheel[i] = NULL;
+    w->i_wheel_tick = mdate() / HTTPD_WHEEL_TICK;
+    w->p_total_counter = NULL;
+    w->p_active_counter = NULL;
+    vlc_mutex_init( &w->lock );
+    return VLC_SUCCESS;
+}
+
+static void httpd_WorkerClean( httpd_worker_t *w )
+{
+    for( int i = 0; i < w->i_client; i++ )
+    {
+        msg_Warn( w->host, "client still connected" );
+        httpd_ClientClean( w->client[i] );
+        free( w->client[i] );
+    }
+    free( w->client );
+    free( w->waiting );
+    free( w->parked );
+    if( w->wakefd[1] != -1 && w->wakefd[1] != w->wakefd[0] )
+        close( w->wakefd[1] );
+    if( w->wakefd[0] != -1 )
+        close( w->wakefd[0] );
+
+    if( w->fds != w->host->fds )
+        net_ListenClose( w->fds );
+#ifdef HAVE_SYS_EPOLL_H
+    close( w->epfd );
+#endif
+    vlc_mutex_destroy( &w->lock );
+}
+
+static void* httpd_WorkerThread( void *data )
+{
+    httpd_worker_t *w = data;
+    httpd_host_t *host = w->host;
+    tls_session_t *p_tls = NULL;
+
+    w->p_total_counter = stats_CounterCreate( host, VLC_VAR_INTEGER, STATS_COUNTER );
+    w->p_active_counter = stats_CounterCreate( host, VLC_VAR_INTEGER, STATS_COUNTER );
+
+    for( ;; )
+    {
+        bool b_die = false, b_woken = false;
+        int n, i_timeout;
+
+        /* prepare a new TLS session */
+        if( ( p_tls == NULL ) && ( host->p_tls != NULL ) )
+            p_tls = tls_ServerSessionPrepare( host->p_tls );
+
+        vlc_mutex_lock( &host->lock );
+        while( host->i_url <= 0 && host->i_ref > 0 )
+            vlc_cond_wait( &host->wait, &host->lock );
+        vlc_mutex_unlock( &host->lock );
+
+        vlc_mutex_lock( &w->lock );
+        i_timeout = httpd_WorkerTimeout( w, mdate() );
+        vlc_mutex_unlock( &w->lock );
+
+#ifdef HAVE_SYS_EPOLL_H
+        struct epoll_event ev[HTTPD_MAX_EVENTS];
+        httpd_event_t events[HTTPD_MAX_EVENTS];
+        bool b_accept = false;
+
+        int i_ev = epoll_wait( w->epfd, ev, HTTPD_MAX_EVENTS, i_timeout );
+
+        n = ( i_ev == -1 ) ? -1 : 0;
+        for( int i = 0; i < i_ev; i++ )
+        {
+            if( ev[i].data.ptr == NULL )
+                b_die = true;
+            else if( ev[i].data.ptr == w->wakefd )
+                b_woken = true;
+            else if( ev[i].data.ptr == w )
             {
-                httpd_ClientTlsHsIn( cl );
+                /* one accept() pass for all the listening sockets */
+                if( b_accept )
+                    continue;
+                b_accept = true;
+                events[n].cl = NULL;
+                events[n++].revents = POLLIN;
             }
-            else if( cl->i_state == HTTPD_CLIENT_TLS_HS_OUT )
+            else
             {
-                httpd_ClientTlsHsOut( cl );
+                events[n].cl = ev[i].data.ptr;
+                events[n++].revents =
+                    ( ( ev[i].events & EPOLLIN ) ? POLLIN : 0 )
+                  | ( ( ev[i].events & EPOLLOUT ) ? POLLOUT : 0 )
+                  | ( ( ev[i].events & EPOLLERR ) ? POLLERR : 0 )
+                  | ( ( ev[i].events & EPOLLHUP ) ? POLLHUP : 0 );
             }
+        }
+#else
+        httpd_event_t events[w->nfd + w->i_client];
 
-            if( cl->i_mode == HTTPD_CLIENT_BIDIR &&
-                cl->i_state == HTTPD_CLIENT_SENDING &&
-                (pufd->revents & POLLIN) )
+        n = httpd_WorkerPoll( w, vlc_object_waitpipe( VLC_OBJECT( host ) ),
+                              events, i_timeout, &b_die, &b_woken );
+#endif
+        if( n == -1 )
+        {
+            if (errno != EINTR)
             {
-                cl->b_read_waiting = true;
+                /* Kernel on low memory or a bug: pace */
+                msg_Err( host, "polling error: %m" );
+                msleep( 100000 );
             }
+            continue;
         }
-        vlc_mutex_unlock( &host->lock );
+        if( b_die )
+            break;
+        if( b_woken
+         && read( w->wakefd[0], &(uint64_t){ 0 }, sizeof( uint64_t ) ) == -1 )
+            msg_Err( host, "signaling pipe error: %m" );
 
-        /* Handle server sockets (accept new connections) */
-        for( nfd = 0; nfd < host->nfd; nfd++ )
-        {
-            httpd_client_t *cl;
-            int i_state = -1;
-            int fd = ufd[nfd].fd;
+        vlc_mutex_lock( &w->lock );
+        mtime_t now = mdate();
 
-            assert (fd == host->fds[nfd]);
+        /* from now on, new stream data wakes the next poll up */
+        vlc_atomic_set( &w->armed, 1 );
+        if( b_woken )
+            httpd_WorkerParked( w, now );
 
-            if( ufd[nfd].revents == 0 )
-                continue;
+        /* Handle client sockets */
+        for( int i = 0; i < n; i++ )
+        {
+            httpd_client_t *cl = events[i].cl;
 
-            /* */
-            fd = vlc_accept (fd, NULL, NULL, true);
-            if (fd == -1)
+            if( cl == NULL )
                 continue;
-            setsockopt (fd, SOL_SOCKET, SO_REUSEADDR,
-                        &(int){ 1 }, sizeof(int));
-
-            if( p_tls != NULL )
-            {
-                switch( tls_ServerSessionHandshake( p_tls, fd ) )
-                {
-                    case -1:
-                        msg_Err( host, "Rejecting TLS connection" );
-                        net_Close( fd );
-                        fd = -1;
-                        p_tls = NULL;
-                        break;
-
-                    case 1: /* missing input - most likely */
-                        i_state = HTTPD_CLIENT_TLS_HS_IN;
-                        break;
-
-                    case 2: /* missing output */
-                        i_state = HTTPD_CLIENT_TLS_HS_OUT;
-                        break;
-                }
+            httpd_ClientIO( cl, events[i].revents, now );
+            httpd_WorkerProcess( w, cl, now );
+        }
 
-                if( (p_tls == NULL) != (host->p_tls == NULL) )
-                    break; // wasted TLS session, cannot accept() anymore
-            }
+        httpd_WorkerWaiting( w, now );
+        httpd_WorkerTimers( w, now );
 
-            stats_UpdateInteger( host, p_total_counter, 1, NULL );
-            stats_UpdateInteger( host, p_active_counter, 1, NULL );
-            cl = httpd_ClientNew( fd, p_tls, now );
-            p_tls = NULL;
-            vlc_mutex_lock( &host->lock );
-            TAB_APPEND( host->i_client, host->client, cl );
-            vlc_mutex_unlock( &host->lock );
-            if( i_state != -1 )
-                cl->i_state = i_state; // override state for TLS
-
-            if (host->p_tls != NULL)
-                break; // cannot accept further without new TLS session
-        }
+        /* Handle server sockets (accept new connections) */
+        for( int i = 0; i < n; i++ )
+            if( events[i].cl == NULL )
+                httpd_WorkerAccept( w, &p_tls, now );
 
+        if( w->i_parked == 0 )
+            vlc_atomic_set( &w->armed, 0 );
+        vlc_mutex_unlock( &w->lock );
     }
 
     if( p_tls != NULL )
         tls_ServerSessionClose( p_tls );
-    if( p_total_counter )
-        stats_CounterClean( p_total_counter );
-    if( p_active_counter )
-        stats_CounterClean( p_active_counter );
+    if( w->p_total_counter )
+        stats_CounterClean( w->p_total_counter );
+    if( w->p_active_counter )
+        stats_CounterClean( w->p_active_counter );
     return NULL;
 }
@@ -33,10 +33,13 @@
 #endif
 
 #include <vlc_common.h>
+#include <vlc_block.h>
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <limits.h>
+#include <time.h>
 
 #include <errno.h>
 #include <assert.h>
@@ -89,6 +92,13 @@ int net_Socket (vlc_object_t *p_this, int family, int socktype,
 
     setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &(int){ 1 }, sizeof (int));
 
+#ifdef SO_REUSEPORT
+    /* Lets several sockets listen on the same port (see httpd.c) */
+    if (var_Type (p_this, "reuse-port")
+     && var_GetBool (p_this, "reuse-port"))
+        setsockopt (fd, SOL_SOCKET, SO_REUSEPORT, &(int){ 1 }, sizeof (int));
+#endif
+
 #ifdef IPV6_V6ONLY
     /*
      * Accepts only IPv6 connections on IPv6 sockets.
@@ -382,6 +392,231 @@ silent:
     return -1;
 }
 
+/* datagrams fetched at once by net_ReadBatch() */
+struct net_batch_t
+{
+    int       fd;
+    size_t    i_mtu;
+    unsigned  i_count;
+    uint8_t  *p_ring; /* i_count buffers of i_mtu bytes */
+#ifdef HAVE_RECVMMSG
+    struct mmsghdr *p_msgs;
+    struct iovec   *p_iovs;
+    union
+    {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE (sizeof (struct timespec))];
+    } *p_ctrl;
+#endif
+};
+
+#undef net_BatchNew
+/**
+ * Prepares the batched reception of datagrams from a socket.
+ * The buffers are allocated once here; only the pages actually written by
+ * the kernel get used.
+ *
+ * @param fd datagram socket (it must stay open until net_BatchDelete())
+ * @param i_mtu largest datagram size
+ * @param i_count most datagrams returned by a single net_ReadBatch() call
+ * @return NULL on error
+ */
+net_batch_t *net_BatchNew (vlc_object_t *p_this, int fd, size_t i_mtu,
+                           unsigned i_count)
+{
+    net_batch_t *batch = malloc (sizeof (*batch));
+    if (batch == NULL)
+        return NULL;
+
+#ifndef HAVE_RECVMMSG
+    i_count = 1;
+#endif
+    batch->fd = fd;
+    batch->i_mtu = i_mtu;
+    batch->i_count = i_count;
+    batch->p_ring = malloc (i_count * i_mtu);
+#ifdef HAVE_RECVMMSG
+    batch->p_msgs = calloc (i_count, sizeof (*batch->p_msgs));
+    batch->p_iovs = calloc (i_count, sizeof (*batch->p_iovs));
+    batch->p_ctrl = calloc (i_count, sizeof (*batch->p_ctrl));
+    if (batch->p_msgs == NULL || batch->p_iovs == NULL
+     || batch->p_ctrl == NULL)
+    {
+        free (batch->p_ring);
+        batch->p_ring = NULL;
+    }
+#endif
+    if (batch->p_ring == NULL)
+    {
+        net_BatchDelete (batch);
+        return NULL;
+    }
+
+#ifdef HAVE_RECVMMSG
+    for (unsigned i = 0; i < i_count; i++)
+    {
+        batch->p_iovs[i].iov_base = batch->p_ring + i * i_mtu;
+        batch->p_iovs[i].iov_len = i_mtu;
+        batch->p_msgs[i].msg_hdr.msg_iov = &batch->p_iovs[i];
+        batch->p_msgs[i].msg_hdr.msg_iovlen = 1;
+        batch->p_msgs[i].msg_hdr.msg_control = batch->p_ctrl[i].buf;
+    }
+# ifdef SO_TIMESTAMPNS
+    if (setsockopt (fd, SOL_SOCKET, SO_TIMESTAMPNS, &(int){ 1 },
+                    sizeof (int)))
+        msg_Dbg (p_this, "no kernel reception timestamps: %m");
+# endif
+#else
+    VLC_UNUSED(p_this);
+#endif
+    return batch;
+}
+
+void net_BatchDelete (net_batch_t *batch)
+{
+#ifdef HAVE_RECVMMSG
+    free (batch->p_ctrl);
+    free (batch->p_iovs);
+    free (batch->p_msgs);
+#endif
+    free (batch->p_ring);
+    free (batch);
+}
+
+#ifdef HAVE_RECVMMSG
+/* Converts the kernel reception time of a datagram to the mdate() clock */
+static mtime_t net_ArrivalDate (struct msghdr *msg, mtime_t now,
+                                const struct timespec *restrict wall)
+{
+# ifdef SCM_TIMESTAMPNS
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR (msg); cmsg != NULL;
+         cmsg = CMSG_NXTHDR (msg, cmsg))
+    {
+        struct timespec ts;
+
+        if (cmsg->cmsg_level != SOL_SOCKET
+         || cmsg->cmsg_type != SCM_TIMESTAMPNS)
+            continue;
+
+        memcpy (&ts, CMSG_DATA (cmsg), sizeof (ts));
+        mtime_t age = (wall->tv_sec - ts.tv_sec) * CLOCK_FREQ
+                    + (wall->tv_nsec - ts.tv_nsec) / 1000;
+        return (age > 0) ? now - age : now;
+    }
+# else
+    VLC_UNUSED(msg); VLC_UNUSED(wall);
+# endif
+    return now;
+}
+#endif
+
+#undef net_ReadBatch
+/**
+ * Reads all the datagrams queued on a socket, up to the batch size, with a
+ * single system call (recvmmsg() where available). This blocks until at
+ * least one datagram is received, or p_this is killed, like net_Read().
+ *
+ * Each datagram is copied to a block of its own size. The reception time
+ * (mdate() clock, from the kernel timestamp where supported) is stored in
+ * the block i_pts.
+ *
+ * This function is a cancellation point.
+ *
+ * @return a chain of blocks, or NULL on error or if p_this was killed.
+ */
+block_t *net_ReadBatch (vlc_object_t *restrict p_this, net_batch_t *batch)
+{
+    struct pollfd ufd[2] = {
+        { .fd = batch->fd,                    .events = POLLIN },
+        { .fd = vlc_object_waitpipe (p_this), .events = POLLIN },
+    };
+    int n;
+#ifndef HAVE_RECVMMSG
+    ssize_t val;
+#endif
+
+    if (ufd[1].fd == -1)
+        return NULL; /* vlc_object_waitpipe() sets errno */
+
+    for (;;)
+    {
+        ufd[0].revents = ufd[1].revents = 0;
+
+        if (poll (ufd, sizeof (ufd) / sizeof (ufd[0]), -1) < 0)
+        {
+            if (errno != EINTR)
+                goto error;
+            continue;
+        }
+
+        if (ufd[1].revents)
+        {
+            assert (p_this->b_die);
+            msg_Dbg (p_this, "socket %d polling interrupted", batch->fd);
+            errno = EINTR;
+            return NULL;
+        }
+
+#ifdef HAVE_RECVMMSG
+        for (unsigned i = 0; i < batch->i_count; i++)
+            batch->p_msgs[i].msg_hdr.msg_controllen =
+                sizeof (batch->p_ctrl[i]);
+        n = recvmmsg (batch->fd, batch->p_msgs, batch->i_count,
+                      MSG_DONTWAIT, NULL);
+#else
+        val = recv (batch->fd, batch->p_ring, batch->i_mtu, 0);
+        n = (val >= 0) ? 1 : -1;
+#endif
+        if (n > 0)
+            break;
+        if (n == -1)
+        {
+#if defined(WIN32) || defined(UNDER_CE)
+            if (WSAGetLastError () == WSAEWOULDBLOCK)
+                continue;
+#else
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                continue; /* spurious wakeup */
+#endif
+            goto error;
+        }
+    }
+
+    mtime_t now = mdate ();
+#ifdef HAVE_RECVMMSG
+    struct timespec wall;
+    clock_gettime (CLOCK_REALTIME, &wall);
+#endif
+    block_t *chain = NULL, **pp_last = &chain;
+
+    for (int i = 0; i < n; i++)
+    {
+#ifdef HAVE_RECVMMSG
+        size_t len = batch->p_msgs[i].msg_len;
+#else
+        size_t len = val;
+#endif
+        block_t *block = block_Alloc (len);
+        if (unlikely(block == NULL))
+            break;
+
+        memcpy (block->p_buffer, batch->p_ring + i * batch->i_mtu, len);
+#ifdef HAVE_RECVMMSG
+        block->i_pts = net_ArrivalDate (&batch->p_msgs[i].msg_hdr, now,
+                                        &wall);
+#else
+        block->i_pts = now;
+#endif
+        *pp_last = block;
+        pp_last = &block->p_next;
+    }
+    return chain;
+
+error:
+    msg_Err (p_this, "Read error: %m");
+    return NULL;
+}
+
 #undef net_Write
 /**
  * Writes data to a file descriptor.
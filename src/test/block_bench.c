@@ -0,0 +1,130 @@
+/*****************************************************************************
+ * block_bench.c: block_fifo_t vs block_ring_t throughput
+ *****************************************************************************
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+/*
+ * A producer thread sends blocks to the main thread, which hands them back
+ * on a second queue, like the UDP output does with its empty datagrams. The
+ * number of blocks in flight is bounded, so both sides regularly find their
+ * queue empty.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#undef NDEBUG
+#include <assert.h>
+
+#include <vlc_common.h>
+#include <vlc_block.h>
+
+#define BENCH_BLOCKS   2000000
+#define BENCH_INFLIGHT 256
+
+static block_t *NewBlocks (void)
+{
+    block_t *list = NULL;
+
+    for (unsigned i = 0; i < BENCH_INFLIGHT; i++)
+    {
+        block_t *block = block_Alloc (1316);
+        assert (block != NULL);
+        block->p_next = list;
+        list = block;
+    }
+    return list;
+}
+
+/*
+ * Mutex-based FIFO
+ */
+static block_fifo_t *fifo_data, *fifo_empty;
+
+static void *FifoProducer (void *data)
+{
+    (void) data;
+    for (unsigned i = 0; i < BENCH_BLOCKS; i++)
+        block_FifoPut (fifo_data, block_FifoGet (fifo_empty));
+    return NULL;
+}
+
+static void FifoRun (void)
+{
+    fifo_data = block_FifoNew ();
+    fifo_empty = block_FifoNew ();
+    block_FifoPut (fifo_empty, NewBlocks ());
+
+    vlc_thread_t th;
+    int val = vlc_clone (&th, FifoProducer, NULL, VLC_THREAD_PRIORITY_LOW);
+    assert (val == 0);
+    for (unsigned i = 0; i < BENCH_BLOCKS; i++)
+        block_FifoPut (fifo_empty, block_FifoGet (fifo_data));
+    vlc_join (th, NULL);
+
+    block_FifoRelease (fifo_data);
+    block_FifoRelease (fifo_empty);
+}
+
+/*
+ * Lock-free ring
+ */
+static block_ring_t *ring_data, *ring_empty;
+
+static void *RingProducer (void *data)
+{
+    (void) data;
+    for (unsigned i = 0; i < BENCH_BLOCKS; i++)
+        block_RingPut (ring_data, block_RingGet (ring_empty));
+    return NULL;
+}
+
+static void RingRun (void)
+{
+    ring_data = block_RingNew (BENCH_INFLIGHT);
+    ring_empty = block_RingNew (BENCH_INFLIGHT);
+    block_RingPut (ring_empty, NewBlocks ());
+
+    vlc_thread_t th;
+    int val = vlc_clone (&th, RingProducer, NULL, VLC_THREAD_PRIORITY_LOW);
+    assert (val == 0);
+    for (unsigned i = 0; i < BENCH_BLOCKS; i++)
+        block_RingPut (ring_empty, block_RingGet (ring_data));
+    vlc_join (th, NULL);
+
+    block_RingRelease (ring_data);
+    block_RingRelease (ring_empty);
+}
+
+static void Bench (const char *name, void (*run) (void))
+{
+    mtime_t start = mdate ();
+    run ();
+    mtime_t duration = mdate () - start;
+
+    printf ("%-6s %8"PRId64" us  %6.2f Mblocks/s\n", name, duration,
+            (double)BENCH_BLOCKS / duration);
+}
+
+int main (void)
+{
+    Bench ("fifo", FifoRun);
+    Bench ("ring", RingRun);
+    return 0;
+}
@@ -84,10 +84,130 @@ static void test_block (void)
     //assert (block == NULL);
 }
 
+static void test_block_Share (void)
+{
+    block_t *block = block_Alloc (sizeof (text));
+    assert (block != NULL);
+    memcpy (block->p_buffer, text, sizeof (text));
+    block->i_dts = 42;
+    block->i_delay = 12;
+
+    block = block_Shareable (block);
+    assert (block != NULL);
+    assert (block_Shareable (block) == block);
+
+    block_t *share = block_Share (block);
+    assert (share != NULL);
+    assert (share->p_buffer == block->p_buffer);
+    assert (share->i_buffer == sizeof (text));
+    assert (share->i_dts == 42 && share->i_delay == 12);
+
+    /* Private headers */
+    share->p_buffer += 5;
+    share->i_buffer -= 5;
+    assert (block->i_buffer == sizeof (text));
+
+    /* Copy-on-write */
+    share = block_Writable (share);
+    assert (share != NULL);
+    assert (share->p_buffer != block->p_buffer + 5);
+    assert (!memcmp (share->p_buffer, text + 5, sizeof (text) - 5));
+    share->p_buffer[0] = 'X';
+    assert (!memcmp (block->p_buffer, text, sizeof (text)));
+    block_Release (share);
+
+    /* Last reference: no copy */
+    share = block_Share (block);
+    uint8_t *buf = block->p_buffer;
+    block_Release (block);
+    share = block_Writable (share);
+    assert (share->p_buffer == buf);
+    assert (!memcmp (share->p_buffer, text, sizeof (text)));
+
+    /* Reallocation must not touch the shared payload */
+    block = block_Shareable (share);
+    share = block_Share (block);
+    share = block_Realloc (share, 2, sizeof (text) + 2);
+    assert (share != NULL);
+    assert (!memcmp (share->p_buffer + 2, text, sizeof (text)));
+    assert (!memcmp (block->p_buffer, text, sizeof (text)));
+    block_Release (share);
+    block_Release (block);
+}
+
+#define RING_BLOCKS 10000
+
+static void *test_block_RingProducer (void *data)
+{
+    block_ring_t *ring = data;
+
+    for (unsigned i = 0; i < RING_BLOCKS; i += 2)
+    {
+        block_t *chain = block_Alloc (1);
+        chain->p_buffer[0] = i;
+        chain->p_next = block_Alloc (1);
+        chain->p_next->p_buffer[0] = i + 1;
+        assert (block_RingPut (ring, chain) == 2);
+    }
+    return NULL;
+}
+
+static void test_block_Ring (void)
+{
+    block_ring_t *ring = block_RingNew (3);
+    assert (ring != NULL);
+
+    /* Rounded up to 4 slots */
+    block_t *blocks[5];
+    for (unsigned i = 0; i < 5; i++)
+    {
+        blocks[i] = block_Alloc (i + 1);
+        assert (blocks[i] != NULL);
+    }
+    for (unsigned i = 0; i < 4; i++)
+        assert (block_RingTryPut (ring, blocks[i]));
+    assert (!block_RingTryPut (ring, blocks[4]));
+    assert (block_RingCount (ring) == 4);
+    assert (block_RingSize (ring) == 1 + 2 + 3 + 4);
+    assert (block_RingShow (ring) == blocks[0]);
+    assert (block_RingGet (ring) == blocks[0]);
+    assert (block_RingTryPut (ring, blocks[4]));
+    for (unsigned i = 1; i < 5; i++)
+    {
+        assert (block_RingGet (ring) == blocks[i]);
+        block_Release (blocks[i]);
+    }
+    block_Release (blocks[0]);
+    assert (block_RingCount (ring) == 0 && block_RingSize (ring) == 0);
+
+    block_RingWake (ring);
+    assert (block_RingGet (ring) == NULL);
+
+    /* Both sides sleep: the ring is much smaller than the stream */
+    vlc_thread_t th;
+    int val = vlc_clone (&th, test_block_RingProducer, ring,
+                         VLC_THREAD_PRIORITY_LOW);
+    assert (val == 0);
+    for (unsigned i = 0; i < RING_BLOCKS; i++)
+    {
+        block_t *block = block_RingGet (ring);
+        assert (block != NULL && block->p_next == NULL);
+        assert (block->p_buffer[0] == (uint8_t)i);
+        block_Release (block);
+    }
+    vlc_join (th, NULL);
+
+    /* Remaining blocks are released with the ring */
+    assert (block_RingPut (ring, block_Alloc (16)) == 16);
+    block_RingRelease (ring);
+}
+
 int main (void)
 {
     test_block_File ();
     test_block ();
+    test_block_Share ();
+    test_block_Ring ();
     return 0;
 }
 
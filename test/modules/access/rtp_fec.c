@@ -0,0 +1,219 @@
+/*****************************************************************************
+ * rtp_fec.c: SMPTE 2022-1 FEC recovery under simulated packet loss
+ *****************************************************************************
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#include "../../libvlc/test.h"
+
+#include <string.h>
+#include <vlc_common.h>
+#include <vlc_block.h>
+
+#include "../../../modules/access/rtp/fec.h"
+#include "rtp_fec.h"
+
+#define FEC_PACKETS 200000
+#define FEC_SLOT_MS ((7 * 188 + 12) * 8 / 10000.)
+
+static const loss_model_t p_models[] = {
+    { "random 0.1%", 0.001, 1 },
+    { "random 1%",   0.01,  1 },
+    { "random 5%",   0.05,  1 },
+    { "burst 0.1%x5",  0.001, 5 },
+    { "burst 0.1%x20", 0.001, 20 },
+};
+
+static const struct
+{
+    unsigned i_cols, i_rows;
+    bool b_row;
+} p_matrices[] = {
+    { 10, 10, false },
+    { 10, 10, true },
+    { 20, 5, true },
+    { 5, 20, true },
+    { 4, 4, true },
+};
+
+static bool pb_received[FEC_PACKETS];
+
+static void Simulate( unsigned i_cols, unsigned i_rows, bool b_row,
+                      const loss_model_t *p_model )
+{
+    rtp_fec_encoder_t *p_enc = rtp_fec_encoder_create( i_cols, i_rows,
+                                                       b_row );
+    rtp_fec_t *p_fec = rtp_fec_create();
+    unsigned i_lost = 0, i_recovered = 0, i_burst = 0;
+    unsigned i_fec = 0, i_max_delay = 0;
+    uint64_t i_total_delay = 0;
+
+    assert( p_enc != NULL && p_fec != NULL );
+    srand( 0 );
+
+    for( unsigned i = 0; i < FEC_PACKETS; i++ )
+    {
+        block_t *p_media = MediaPacket( i );
+        block_t *p_chain = rtp_fec_encode( p_enc, p_media );
+
+        pb_received[i] = !Lost( p_model, &i_burst );
+        if( pb_received[i] )
+            rtp_fec_media( p_fec, p_media );
+        else
+            i_lost++;
+        block_Release( p_media );
+
+        while( p_chain != NULL )
+        {
+            block_t *p_block = p_chain;
+            p_chain = p_block->p_next;
+            p_block->p_next = NULL;
+            i_fec++;
+
+            if( Lost( p_model, &i_burst ) )
+            {
+                block_Release( p_block );
+                continue;
+            }
+
+            for( block_t *p_rec = rtp_fec_recover( p_fec, p_block ), *p_next;
+                 p_rec != NULL; p_rec = p_next )
+            {
+                unsigned i_delay = (uint16_t)( i - GetWBE( p_rec->p_buffer
+                                                           + 2 ) );
+                unsigned i_seq = i - i_delay;
+                unsigned i_size = PayloadSize( i_seq );
+
+                p_next = p_rec->p_next;
+                assert( i_seq < FEC_PACKETS && !pb_received[i_seq] );
+                assert( p_rec->i_buffer == 12 + i_size );
+                assert( GetDWBE( p_rec->p_buffer + 8 ) == 0x12345678 );
+                for( unsigned j = 0; j < i_size; j++ )
+                    assert( p_rec->p_buffer[12 + j] == PayloadByte( i_seq, j ) );
+
+                pb_received[i_seq] = true;
+                i_recovered++;
+                i_total_delay += i_delay;
+                if( i_delay > i_max_delay )
+                    i_max_delay = i_delay;
+                block_Release( p_rec );
+            }
+        }
+    }
+
+    printf( "%2ux%-2u %-4s %-14s overhead %5.1f%%  lost %5u  recovered %5u"
+            "  residual %.4f%%  delay avg %5.1f max %3u pkt (%.1f ms)\n",
+            i_cols, i_rows, b_row ? "2D" : "1D", p_model->psz_name,
+            100. * i_fec / FEC_PACKETS, i_lost, i_recovered,
+            100. * ( i_lost - i_recovered ) / FEC_PACKETS,
+            i_recovered ? (double)i_total_delay / i_recovered : 0.,
+            i_max_delay, i_max_delay * FEC_SLOT_MS );
+
+    rtp_fec_destroy( p_fec );
+    rtp_fec_encoder_destroy( p_enc );
+}
+
+/* The column FEC packets are spread over the next matrix, so that any burst
+ * of up to L packets (media or FEC) can be repaired */
+static void CheckBursts( unsigned i_cols, unsigned i_rows, bool b_row )
+{
+    const unsigned i_media = 4 * i_cols * i_rows;
+    rtp_fec_encoder_t *p_enc = rtp_fec_encoder_create( i_cols, i_rows,
+                                                       b_row );
+    block_t *pp_sent[2 * i_media];
+    bool pb_got[i_media];
+    unsigned i_sent = 0;
+
+    assert( p_enc != NULL );
+    for( unsigned i = 0; i < i_media; i++ )
+    {
+        block_t *p_chain = rtp_fec_encode( p_enc, pp_sent[i_sent++] =
+                                                  MediaPacket( i ) );
+        while( p_chain != NULL )
+        {
+            pp_sent[i_sent++] = p_chain;
+            p_chain = p_chain->p_next;
+            pp_sent[i_sent - 1]->p_next = NULL;
+        }
+    }
+    rtp_fec_encoder_destroy( p_enc );
+
+    for( unsigned i_start = i_sent / 4; i_start < i_sent / 2; i_start++ )
+    {
+        rtp_fec_t *p_fec = rtp_fec_create();
+        unsigned i_lost = 0;
+
+        assert( p_fec != NULL );
+        memset( pb_got, 0, sizeof( pb_got ) );
+        for( unsigned i = 0; i < i_sent; i++ )
+        {
+            block_t *p_block = pp_sent[i];
+            bool b_lost = i >= i_start && i < i_start + i_cols;
+
+            if( ( p_block->p_buffer[1] & 0x7F ) == 33 )
+            {   /* media */
+                if( b_lost )
+                    i_lost++;
+                else
+                {
+                    rtp_fec_media( p_fec, p_block );
+                    pb_got[GetWBE( p_block->p_buffer + 2 )] = true;
+                }
+                continue;
+            }
+            if( b_lost )
+                continue;
+
+            for( block_t *p_rec = rtp_fec_recover( p_fec,
+                                                   block_Duplicate( p_block ) ),
+                         *p_next;
+                 p_rec != NULL; p_rec = p_next )
+            {
+                unsigned i_seq = GetWBE( p_rec->p_buffer + 2 );
+
+                p_next = p_rec->p_next;
+                assert( i_seq < i_media && !pb_got[i_seq] );
+                assert( p_rec->i_buffer == 12 + PayloadSize( i_seq ) );
+                pb_got[i_seq] = true;
+                i_lost--;
+                block_Release( p_rec );
+            }
+        }
+        assert( i_lost == 0 );
+        rtp_fec_destroy( p_fec );
+    }
+
+    for( unsigned i = 0; i < i_sent; i++ )
+        block_Release( pp_sent[i] );
+}
+
+int main( void )
+{
+    (void)test_defaults_nargs;
+    test_init();
+
+    for( unsigned i = 0; i < sizeof( p_matrices ) / sizeof( p_matrices[0] );
+         i++ )
+        CheckBursts( p_matrices[i].i_cols, p_matrices[i].i_rows,
+                     p_matrices[i].b_row );
+
+    for( unsigned i = 0; i < sizeof( p_matrices ) / sizeof( p_matrices[0] );
+         i++ )
+        for( unsigned j = 0; j < sizeof( p_models ) / sizeof( p_models[0] );
+             j++ )
+            Simulate( p_matrices[i].i_cols, p_matrices[i].i_rows,
+                      p_matrices[i].b_row, p_models + j );
+    return 0;
+}
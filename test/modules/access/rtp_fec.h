@@ -0,0 +1,75 @@
+/*****************************************************************************
+ * rtp_fec.h: RTP FEC test helpers
+ *****************************************************************************
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#ifndef RTP_FEC_TEST_H
+#define RTP_FEC_TEST_H
+
+#include <vlc_common.h>
+#include <vlc_block.h>
+
+typedef struct
+{
+    const char *psz_name;
+    double f_loss;      /* probability to enter a loss burst */
+    unsigned i_burst;   /* length of a loss burst */
+} loss_model_t;
+
+static unsigned PayloadSize( unsigned i )
+{
+    return 188 * ( 1 + ( i * 2654435761u >> 16 ) % 7 );
+}
+
+static uint8_t PayloadByte( unsigned i, unsigned j )
+{
+    return ( i * 2654435761u + j * 40503u ) >> 11;
+}
+
+static block_t *MediaPacket( unsigned i )
+{
+    unsigned i_size = PayloadSize( i );
+    block_t *p_block = block_Alloc( 12 + i_size );
+    assert( p_block != NULL );
+
+    uint8_t *p = p_block->p_buffer;
+    p[0] = 0x80;
+    p[1] = 33; /* MP2T */
+    SetWBE( p + 2, i );
+    SetDWBE( p + 4, i * 1052 * 90 / 1000 );
+    SetDWBE( p + 8, 0x12345678 );
+    for( unsigned j = 0; j < i_size; j++ )
+        p[12 + j] = PayloadByte( i, j );
+    return p_block;
+}
+
+/* Gilbert-like channel: losses come in bursts of i_burst packets */
+static bool Lost( const loss_model_t *p_model, unsigned *pi_burst )
+{
+    if( *pi_burst > 0 )
+    {
+        (*pi_burst)--;
+        return true;
+    }
+    if( rand() < p_model->f_loss * RAND_MAX )
+    {
+        *pi_burst = p_model->i_burst - 1;
+        return true;
+    }
+    return false;
+}
+
+#endif
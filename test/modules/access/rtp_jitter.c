@@ -0,0 +1,151 @@
+/*****************************************************************************
+ * rtp_jitter.c: RTP jitter buffer with FEC under simulated packet loss
+ *****************************************************************************
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#include "../../libvlc/test.h"
+#include <../src/control/libvlc_internal.h>
+
+#include <string.h>
+#include <vlc_common.h>
+#include <vlc_block.h>
+#include <vlc_demux.h>
+
+#include "../../../modules/access/rtp/rtp.h"
+#include "../../../modules/access/rtp/fec.h"
+#include "rtp_fec.h"
+
+/* The RTP jitter buffer must wait for the packets that FEC rebuilds */
+#define JITTER_PACKETS  2000
+#define JITTER_INTERVAL 250 /* us: 2 L D packets outlast the 25 ms wait */
+
+static bool pb_received[JITTER_PACKETS];
+static bool pb_decoded[JITTER_PACKETS];
+static int i_last_decoded;
+
+static void JitterDecode( demux_t *p_demux, void *p_data, block_t *p_block )
+{
+    /* The RTP header is still in front of the payload */
+    unsigned i_seq = GetWBE( p_block->p_buffer - 10 );
+
+    assert( i_seq < JITTER_PACKETS && (int)i_seq > i_last_decoded );
+    assert( p_block->i_buffer == PayloadSize( i_seq ) );
+    assert( p_block->p_buffer[0] == PayloadByte( i_seq, 0 ) );
+    pb_decoded[i_seq] = true;
+    i_last_decoded = i_seq;
+    block_Release( p_block );
+    (void)p_demux; (void)p_data;
+}
+
+static void CheckJitterBuffer( libvlc_instance_t *p_vlc,
+                               unsigned i_cols, unsigned i_rows,
+                               const loss_model_t *p_model )
+{
+    demux_t *p_demux = vlc_object_create( p_vlc->p_libvlc_int,
+                                          sizeof( *p_demux ) );
+    demux_sys_t sys;
+    const rtp_pt_t pt = {
+        .decode = JitterDecode, .frequency = 90000, .number = 33,
+    };
+    rtp_fec_encoder_t *p_enc = rtp_fec_encoder_create( i_cols, i_rows,
+                                                       false );
+    unsigned i_burst = 0, i_recovered = 0;
+    mtime_t i_deadline;
+
+    assert( p_demux != NULL && p_enc != NULL );
+    memset( &sys, 0, sizeof( sys ) );
+    p_demux->p_sys = &sys;
+    sys.timeout = INT64_C(60) * CLOCK_FREQ;
+    sys.max_dropout = 3000;
+    sys.max_misorder = 100;
+    sys.max_src = 1;
+    sys.fec = rtp_fec_create();
+    sys.session = rtp_session_create( p_demux );
+    assert( sys.fec != NULL && sys.session != NULL );
+    assert( rtp_add_type( p_demux, sys.session, &pt ) == 0 );
+
+    srand( 0 );
+    memset( pb_received, 0, sizeof( pb_received ) );
+    memset( pb_decoded, 0, sizeof( pb_decoded ) );
+    i_last_decoded = -1;
+
+    const mtime_t i_start = mdate();
+    for( unsigned i = 0; i < JITTER_PACKETS; i++ )
+    {
+        block_t *p_media = MediaPacket( i );
+        SetDWBE( p_media->p_buffer + 4, i * JITTER_INTERVAL * 9 / 100 );
+        block_t *p_chain = rtp_fec_encode( p_enc, p_media );
+
+        mwait( i_start + i * JITTER_INTERVAL );
+        pb_received[i] = !Lost( p_model, &i_burst );
+        if( pb_received[i] )
+        {
+            rtp_fec_media( sys.fec, p_media );
+            rtp_queue( p_demux, sys.session, p_media );
+        }
+        else
+            block_Release( p_media );
+
+        while( p_chain != NULL )
+        {
+            block_t *p_block = p_chain;
+            p_chain = p_block->p_next;
+            p_block->p_next = NULL;
+
+            if( Lost( p_model, &i_burst ) )
+            {
+                block_Release( p_block );
+                continue;
+            }
+            for( block_t *p_rec = rtp_fec_recover( sys.fec, p_block ), *p_next;
+                 p_rec != NULL; p_rec = p_next )
+            {
+                p_next = p_rec->p_next;
+                p_rec->p_next = NULL;
+                pb_received[GetWBE( p_rec->p_buffer + 2 )] = true;
+                i_recovered++;
+                rtp_queue( p_demux, sys.session, p_rec );
+            }
+        }
+        rtp_dequeue( p_demux, sys.session, &i_deadline );
+    }
+    while( rtp_dequeue( p_demux, sys.session, &i_deadline ) )
+        mwait( i_deadline );
+
+    /* Every packet received or rebuilt in time is decoded, in order */
+    assert( i_recovered > 0 );
+    for( unsigned i = 0; i < JITTER_PACKETS; i++ )
+        assert( pb_decoded[i] == pb_received[i] );
+
+    rtp_session_destroy( p_demux, sys.session );
+    rtp_fec_destroy( sys.fec );
+    rtp_fec_encoder_destroy( p_enc );
+    vlc_object_release( p_demux );
+}
+
+int main( void )
+{
+    static const loss_model_t random = { "random 1%", 0.01, 1 };
+
+    test_init();
+
+    libvlc_instance_t *p_vlc = libvlc_new( test_defaults_nargs,
+                                           test_defaults_args );
+    assert( p_vlc != NULL );
+    CheckJitterBuffer( p_vlc, 10, 10, &random );
+    libvlc_release( p_vlc );
+    return 0;
+}
@@ -0,0 +1,109 @@
+/*****************************************************************************
+ * csa.c: CSA batch (de)scrambling check
+ *****************************************************************************
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#include "../../libvlc/test.h"
+#include <../src/control/libvlc_internal.h>
+
+#include <string.h>
+#include <vlc_common.h>
+
+#include "../../../modules/mux/mpeg/csa.h"
+
+#define CSA_PACKETS 1000
+
+static uint8_t p_ref[CSA_PACKETS][188], p_batch[CSA_PACKETS][188];
+static uint8_t *pp_pkts[CSA_PACKETS];
+
+/* Random packets, some with an adaptation field and some with both keys */
+static void FillPackets( bool b_scrambled )
+{
+    for( int i = 0; i < CSA_PACKETS; i++ )
+    {
+        for( int j = 0; j < 188; j++ )
+            p_ref[i][j] = rand();
+
+        p_ref[i][0] = 0x47;
+        p_ref[i][3] = 0x10 | ( i & 0xf );
+        if( b_scrambled )
+            p_ref[i][3] |= 0x80 | ( rand() % 2 ? 0x40 : 0 );
+        if( rand() % 4 == 0 )
+        {
+            p_ref[i][3] |= 0x20;
+            p_ref[i][4] = rand() % 184; /* sometimes leaves < 8 bytes */
+        }
+        pp_pkts[i] = p_batch[i];
+    }
+    memcpy( p_batch, p_ref, sizeof( p_ref ) );
+}
+
+static void CheckDecrypt( csa_t *c )
+{
+    log( "Checking csa_DecryptBatch()\n" );
+    FillPackets( true );
+    for( int i = 0; i < CSA_PACKETS; i++ )
+        csa_Decrypt( c, p_ref[i], 188 );
+    csa_DecryptBatch( c, pp_pkts, CSA_PACKETS, 188 );
+    assert( !memcmp( p_ref, p_batch, sizeof( p_ref ) ) );
+}
+
+static void CheckEncrypt( vlc_object_t *p_obj, csa_t *c, bool b_odd )
+{
+    log( "Checking csa_EncryptBatch() with the %s key\n",
+         b_odd ? "odd" : "even" );
+    csa_UseKey( p_obj, c, b_odd );
+    FillPackets( false );
+    for( int i = 0; i < CSA_PACKETS; i++ )
+        csa_Encrypt( c, p_ref[i], 188 );
+    csa_EncryptBatch( c, pp_pkts, CSA_PACKETS, 188 );
+    assert( !memcmp( p_ref, p_batch, sizeof( p_ref ) ) );
+
+    /* and back */
+    for( int i = 0; i < CSA_PACKETS; i++ )
+        csa_Decrypt( c, p_ref[i], 188 );
+    csa_DecryptBatch( c, pp_pkts, CSA_PACKETS, 188 );
+    assert( !memcmp( p_ref, p_batch, sizeof( p_ref ) ) );
+}
+
+int main( void )
+{
+    libvlc_instance_t *p_vlc;
+    vlc_object_t *p_obj;
+    csa_t *c;
+
+    test_init();
+
+    p_vlc = libvlc_new( test_defaults_nargs, test_defaults_args );
+    assert( p_vlc != NULL );
+    p_obj = VLC_OBJECT( p_vlc->p_libvlc_int );
+
+    c = csa_New();
+    assert( c != NULL );
+    assert( csa_SetCW( p_obj, c, (char *)"0x0123456789abcdef", true )
+             == VLC_SUCCESS );
+    assert( csa_SetCW( p_obj, c, (char *)"0xfedcba9876543210", false )
+             == VLC_SUCCESS );
+
+    srand( 0 );
+    CheckDecrypt( c );
+    CheckEncrypt( p_obj, c, false );
+    CheckEncrypt( p_obj, c, true );
+
+    csa_Delete( c );
+    libvlc_release( p_vlc );
+    return 0;
+}
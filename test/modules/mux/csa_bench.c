@@ -0,0 +1,114 @@
+/*****************************************************************************
+ * csa_bench.c: CSA batch (de)scrambling throughput
+ *****************************************************************************
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#include "../../libvlc/test.h"
+#include <../src/control/libvlc_internal.h>
+
+#include <string.h>
+#include <vlc_common.h>
+
+#include "../../../modules/mux/mpeg/csa.h"
+
+#define CSA_PACKETS 1000
+#define CSA_ROUNDS  50
+
+static uint8_t p_ref[CSA_PACKETS][188], p_batch[CSA_PACKETS][188];
+static uint8_t *pp_pkts[CSA_PACKETS];
+
+/* Random packets, some with an adaptation field and some with both keys */
+static void FillPackets( bool b_scrambled )
+{
+    for( int i = 0; i < CSA_PACKETS; i++ )
+    {
+        for( int j = 0; j < 188; j++ )
+            p_ref[i][j] = rand();
+
+        p_ref[i][0] = 0x47;
+        p_ref[i][3] = 0x10 | ( i & 0xf );
+        if( b_scrambled )
+            p_ref[i][3] |= 0x80 | ( rand() % 2 ? 0x40 : 0 );
+        if( rand() % 4 == 0 )
+        {
+            p_ref[i][3] |= 0x20;
+            p_ref[i][4] = rand() % 184; /* sometimes leaves < 8 bytes */
+        }
+        pp_pkts[i] = p_batch[i];
+    }
+    memcpy( p_batch, p_ref, sizeof( p_ref ) );
+}
+
+static void Bench( csa_t *c, const char *psz_name, bool b_batch,
+                   bool b_encrypt )
+{
+    FillPackets( !b_encrypt );
+
+    mtime_t i_start = mdate();
+
+    for( int r = 0; r < CSA_ROUNDS; r++ )
+    {
+        memcpy( p_batch, p_ref, sizeof( p_ref ) );
+        if( b_batch && b_encrypt )
+            csa_EncryptBatch( c, pp_pkts, CSA_PACKETS, 188 );
+        else if( b_batch )
+            csa_DecryptBatch( c, pp_pkts, CSA_PACKETS, 188 );
+        else
+        {
+            for( int i = 0; i < CSA_PACKETS; i++ )
+            {
+                if( b_encrypt )
+                    csa_Encrypt( c, pp_pkts[i], 188 );
+                else
+                    csa_Decrypt( c, pp_pkts[i], 188 );
+            }
+        }
+    }
+
+    mtime_t i_duration = mdate() - i_start;
+    printf( "%-14s %8"PRId64" us  %7.2f Mbit/s\n", psz_name, i_duration,
+            (double)CSA_ROUNDS * CSA_PACKETS * 188 * 8 / i_duration );
+}
+
+int main( void )
+{
+    libvlc_instance_t *p_vlc;
+    vlc_object_t *p_obj;
+    csa_t *c;
+
+    (void)test_default_sample;
+
+    p_vlc = libvlc_new( test_defaults_nargs, test_defaults_args );
+    assert( p_vlc != NULL );
+    p_obj = VLC_OBJECT( p_vlc->p_libvlc_int );
+
+    c = csa_New();
+    assert( c != NULL );
+    assert( csa_SetCW( p_obj, c, (char *)"0x0123456789abcdef", true )
+             == VLC_SUCCESS );
+    assert( csa_SetCW( p_obj, c, (char *)"0xfedcba9876543210", false )
+             == VLC_SUCCESS );
+
+    srand( 0 );
+    Bench( c, "decrypt", false, false );
+    Bench( c, "decrypt batch", true, false );
+    Bench( c, "encrypt", false, true );
+    Bench( c, "encrypt batch", true, true );
+
+    csa_Delete( c );
+    libvlc_release( p_vlc );
+    return 0;
+}
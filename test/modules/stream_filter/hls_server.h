@@ -0,0 +1,220 @@
+/*****************************************************************************
+ * hls_server.h: HTTP Live Streaming origin for the httplive tests
+ *****************************************************************************
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+/*
+ * A local HTTP server serves a meta playlist with three bitrates of the same
+ * program. It answers each request after a fixed latency and can share a
+ * throttled link between all the connections. Every 188 bytes packet of a
+ * segment carries its bitrate and segment number as "v<variant> s<segment>".
+ */
+
+#ifndef HLS_SERVER_H
+#define HLS_SERVER_H
+
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define HLS_SEGMENTS    15
+#define HLS_VARIANTS    3
+#define HLS_CHUNK       1316
+
+static const unsigned pi_variants[HLS_VARIANTS] = { 500000, 1500000, 4000000 };
+
+static mtime_t i_latency;      /* per request */
+static unsigned i_link;         /* bits per second, 0 for no limit */
+static pthread_mutex_t link_lock = PTHREAD_MUTEX_INITIALIZER;
+static mtime_t i_link_free;
+
+static size_t SegmentSize( unsigned i_variant )
+{
+    return pi_variants[i_variant] / 8 / 188 * 188;
+}
+
+static void Send( int fd, const void *p_data, size_t i_data )
+{
+    const uint8_t *p = p_data;
+
+    while( i_data > 0 )
+    {
+        ssize_t i_ret = send( fd, p, i_data, MSG_NOSIGNAL );
+        if( i_ret < 0 )
+            return; /* the client went away */
+        p += i_ret;
+        i_data -= i_ret;
+    }
+}
+
+/* All connections share the link: each chunk waits for its slot */
+static void SendThrottled( int fd, const uint8_t *p, size_t i_data )
+{
+    while( i_data > 0 )
+    {
+        size_t i_chunk = i_data < HLS_CHUNK ? i_data : HLS_CHUNK;
+
+        pthread_mutex_lock( &link_lock );
+        mtime_t i_start = mdate();
+        if( i_start < i_link_free )
+            i_start = i_link_free;
+        i_link_free = i_start + i_chunk * 8 * CLOCK_FREQ / i_link;
+        pthread_mutex_unlock( &link_lock );
+
+        mwait( i_link_free );
+        Send( fd, p, i_chunk );
+        p += i_chunk;
+        i_data -= i_chunk;
+    }
+}
+
+static void Reply( int fd, const char *psz_type, const void *p_data,
+                   size_t i_data, bool b_throttle )
+{
+    char psz_header[256];
+    int i_header = snprintf( psz_header, sizeof( psz_header ),
+                             "HTTP/1.0 200 OK\r\n"
+                             "Content-Type: %s\r\n"
+                             "Content-Length: %zu\r\n"
+                             "Connection: close\r\n\r\n", psz_type, i_data );
+
+    Send( fd, psz_header, i_header );
+    if( b_throttle && i_link > 0 )
+        SendThrottled( fd, p_data, i_data );
+    else
+        Send( fd, p_data, i_data );
+}
+
+static void *Serve( void *data )
+{
+    int fd = (intptr_t)data;
+    char psz_request[1024], psz_path[256];
+    size_t i_request = 0;
+    unsigned i_variant, i_segment;
+
+    /* The request headers are ignored */
+    while( i_request < sizeof( psz_request ) - 1 )
+    {
+        ssize_t i_ret = recv( fd, psz_request + i_request,
+                              sizeof( psz_request ) - 1 - i_request, 0 );
+        if( i_ret <= 0 )
+            goto out;
+        i_request += i_ret;
+        psz_request[i_request] = '\0';
+        if( strstr( psz_request, "\r\n\r\n" ) != NULL )
+            break;
+    }
+    if( sscanf( psz_request, "GET %255s", psz_path ) != 1 )
+        goto out;
+
+    mwait( mdate() + i_latency );
+
+    if( !strcmp( psz_path, "/master.m3u8" ) )
+    {
+        char psz_list[512];
+        int i_list = sprintf( psz_list, "#EXTM3U\n" );
+
+        for( unsigned i = 0; i < HLS_VARIANTS; i++ )
+            i_list += sprintf( psz_list + i_list, "#EXT-X-STREAM-INF:"
+                               "PROGRAM-ID=1,BANDWIDTH=%u\nv%u.m3u8\n",
+                               pi_variants[i], i );
+        Reply( fd, "application/vnd.apple.mpegurl", psz_list, i_list, false );
+    }
+    else if( sscanf( psz_path, "/v%u/s%u.ts", &i_variant, &i_segment ) == 2 &&
+             i_variant < HLS_VARIANTS && i_segment < HLS_SEGMENTS )
+    {
+        size_t i_size = SegmentSize( i_variant );
+        uint8_t *p_data = calloc( 1, i_size );
+        assert( p_data != NULL );
+
+        for( size_t i = 0; i < i_size; i += 188 )
+        {
+            p_data[i] = 0x47;
+            sprintf( (char *)p_data + i + 4, "v%u s%u", i_variant, i_segment );
+        }
+        Reply( fd, "video/MP2T", p_data, i_size, true );
+        free( p_data );
+    }
+    else if( sscanf( psz_path, "/v%u.m3u8", &i_variant ) == 1 &&
+             i_variant < HLS_VARIANTS )
+    {
+        char psz_list[64 + 32 * HLS_SEGMENTS];
+        int i_list = sprintf( psz_list, "#EXTM3U\n#EXT-X-TARGETDURATION:1\n"
+                              "#EXT-X-MEDIA-SEQUENCE:0\n" );
+
+        for( unsigned i = 0; i < HLS_SEGMENTS; i++ )
+            i_list += sprintf( psz_list + i_list, "#EXTINF:1,\nv%u/s%u.ts\n",
+                               i_variant, i );
+        i_list += sprintf( psz_list + i_list, "#EXT-X-ENDLIST\n" );
+        Reply( fd, "application/vnd.apple.mpegurl", psz_list, i_list, false );
+    }
+    else
+        Send( fd, "HTTP/1.0 404 Not Found\r\n\r\n", 26 );
+out:
+    close( fd );
+    return NULL;
+}
+
+static void *Listen( void *data )
+{
+    int fd = (intptr_t)data;
+
+    for( ;; )
+    {
+        pthread_t thread;
+        int i_conn = accept( fd, NULL, NULL );
+
+        if( i_conn < 0 )
+        {
+            if( errno == EINTR || errno == ECONNABORTED )
+                continue;
+            break;
+        }
+        if( pthread_create( &thread, NULL, Serve, (void *)(intptr_t)i_conn ) )
+            close( i_conn );
+        else
+            pthread_detach( thread );
+    }
+    return NULL;
+}
+
+/* Returns the port of the server */
+static int StartServer( mtime_t i_request_latency, unsigned i_link_rate )
+{
+    struct sockaddr_in addr;
+    socklen_t i_addr = sizeof( addr );
+    pthread_t thread;
+    int fd = socket( AF_INET, SOCK_STREAM, 0 );
+
+    i_latency = i_request_latency;
+    i_link = i_link_rate;
+    assert( fd >= 0 );
+    memset( &addr, 0, sizeof( addr ) );
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+    assert( bind( fd, (struct sockaddr *)&addr, sizeof( addr ) ) == 0 );
+    assert( listen( fd, 16 ) == 0 );
+    assert( getsockname( fd, (struct sockaddr *)&addr, &i_addr ) == 0 );
+    assert( pthread_create( &thread, NULL, Listen, (void *)(intptr_t)fd )
+            == 0 );
+    return ntohs( addr.sin_port );
+}
+
+#endif
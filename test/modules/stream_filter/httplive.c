@@ -0,0 +1,106 @@
+/*****************************************************************************
+ * httplive.c: test for the HTTP Live Streaming stream filter
+ *****************************************************************************
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#include "../../libvlc/test.h"
+#include <../src/control/libvlc_internal.h>
+
+#include <vlc_common.h>
+#include <vlc_stream.h>
+
+#include "hls_server.h"
+
+static const struct
+{
+    int i_prefetch;
+    int i_cache; /* kB */
+} p_settings[] = {
+    { 1, 32768 },
+    { 4, 32768 },
+    { 4, 1024 },
+};
+
+/* Every segment must be played whole, once and in order, from any variant */
+static void Read( int i_port, int i_prefetch, int i_cache )
+{
+    char psz_prefetch[32], psz_cache[32], psz_url[64];
+    const char *ppsz_argv[test_defaults_nargs + 2];
+
+    log( "Reading with %d download thread(s) and a %d kB cache\n",
+         i_prefetch, i_cache );
+    for( int i = 0; i < test_defaults_nargs; i++ )
+        ppsz_argv[i] = test_defaults_args[i];
+    sprintf( psz_prefetch, "--hls-prefetch=%d", i_prefetch );
+    sprintf( psz_cache, "--hls-cache=%d", i_cache );
+    ppsz_argv[test_defaults_nargs] = psz_prefetch;
+    ppsz_argv[test_defaults_nargs + 1] = psz_cache;
+
+    libvlc_instance_t *p_vlc = libvlc_new( test_defaults_nargs + 2,
+                                           ppsz_argv );
+    assert( p_vlc != NULL );
+
+    snprintf( psz_url, sizeof( psz_url ), "http://127.0.0.1:%d/master.m3u8",
+              i_port );
+    stream_t *p_source = stream_UrlNew( p_vlc->p_libvlc_int, psz_url );
+    assert( p_source != NULL );
+    stream_t *s = stream_FilterNew( p_source, "stream_filter_httplive" );
+    assert( s != NULL );
+
+    int i_last = -1;
+    unsigned i_last_variant = 0;
+    size_t i_packets = 0;
+    uint8_t p_packet[188];
+
+    while( stream_Read( s, p_packet, sizeof( p_packet ) ) ==
+           sizeof( p_packet ) )
+    {
+        unsigned i_variant, i_segment;
+
+        assert( p_packet[0] == 0x47 );
+        assert( sscanf( (char *)p_packet + 4, "v%u s%u", &i_variant,
+                        &i_segment ) == 2 );
+        assert( i_variant < HLS_VARIANTS );
+        if( (int)i_segment != i_last )
+        {
+            assert( (int)i_segment == i_last + 1 );
+            assert( i_last < 0
+                     || i_packets == SegmentSize( i_last_variant ) / 188 );
+            i_last = i_segment;
+            i_last_variant = i_variant;
+            i_packets = 0;
+        }
+        assert( i_variant == i_last_variant );
+        i_packets++;
+    }
+    assert( i_last == HLS_SEGMENTS - 1 );
+    assert( i_packets == SegmentSize( i_last_variant ) / 188 );
+
+    stream_Delete( s ); /* and its source */
+    libvlc_release( p_vlc );
+}
+
+int main( void )
+{
+    test_init();
+
+    /* No latency and no throttling: only the contents are checked */
+    int i_port = StartServer( 0, 0 );
+    for( unsigned i = 0; i < sizeof( p_settings ) / sizeof( p_settings[0] );
+         i++ )
+        Read( i_port, p_settings[i].i_prefetch, p_settings[i].i_cache );
+    return 0;
+}
@@ -0,0 +1,137 @@
+/*****************************************************************************
+ * httplive_bench.c: HTTP Live Streaming startup and rebuffering measurements
+ *****************************************************************************
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+/*
+ * The origin answers each request after a fixed latency and shares a
+ * throttled link between all the connections. The httplive stream filter is
+ * read at the pace of a player, and for each setting the program prints the
+ * startup time, the number of rebufferings and how many segments were
+ * played in each bitrate.
+ */
+
+#include "../../libvlc/test.h"
+#include <../src/control/libvlc_internal.h>
+
+#include <vlc_common.h>
+#include <vlc_stream.h>
+
+#include "hls_server.h"
+
+#define HLS_LATENCY     (CLOCK_FREQ * 3 / 10)   /* per request */
+#define HLS_LINK        2500000                 /* bits per second */
+
+static const struct
+{
+    int i_prefetch;
+    int i_cache; /* kB */
+} p_settings[] = {
+    { 1, 32768 },
+    { 2, 32768 },
+    { 4, 32768 },
+    { 4, 1024 },
+};
+
+/*****************************************************************************
+ * Player
+ *****************************************************************************/
+static void Play( int i_port, int i_prefetch, int i_cache )
+{
+    char psz_prefetch[32], psz_cache[32], psz_url[64];
+    const char *ppsz_argv[test_defaults_nargs + 2];
+    unsigned pi_played[HLS_VARIANTS] = { 0 };
+    unsigned i_rebuffers = 0, i_segments = 0;
+    mtime_t i_stalled = 0;
+
+    for( int i = 0; i < test_defaults_nargs; i++ )
+        ppsz_argv[i] = test_defaults_args[i];
+    sprintf( psz_prefetch, "--hls-prefetch=%d", i_prefetch );
+    sprintf( psz_cache, "--hls-cache=%d", i_cache );
+    ppsz_argv[test_defaults_nargs] = psz_prefetch;
+    ppsz_argv[test_defaults_nargs + 1] = psz_cache;
+
+    libvlc_instance_t *p_vlc = libvlc_new( test_defaults_nargs + 2,
+                                           ppsz_argv );
+    assert( p_vlc != NULL );
+
+    snprintf( psz_url, sizeof( psz_url ), "http://127.0.0.1:%d/master.m3u8",
+              i_port );
+
+    mtime_t i_open = mdate();
+    stream_t *p_source = stream_UrlNew( p_vlc->p_libvlc_int, psz_url );
+    assert( p_source != NULL );
+    stream_t *s = stream_FilterNew( p_source, "stream_filter_httplive" );
+    assert( s != NULL );
+
+    /* Segment n is played from i_start + n seconds on; if it is not there
+     * on time, playback stalls until it is. */
+    mtime_t i_start = 0;
+    int i_last = -1;
+    uint8_t p_packet[188];
+
+    while( stream_Read( s, p_packet, sizeof( p_packet ) ) ==
+           sizeof( p_packet ) )
+    {
+        unsigned i_variant, i_segment;
+
+        assert( p_packet[0] == 0x47 );
+        assert( sscanf( (char *)p_packet + 4, "v%u s%u", &i_variant,
+                        &i_segment ) == 2 );
+        assert( i_variant < HLS_VARIANTS );
+        if( (int)i_segment == i_last )
+            continue;
+        assert( (int)i_segment == i_last + 1 );
+        i_last = i_segment;
+        i_segments++;
+        pi_played[i_variant]++;
+
+        mtime_t i_now = mdate();
+        if( i_start == 0 )
+            i_start = i_now;
+
+        mtime_t i_deadline = i_start + i_segment * CLOCK_FREQ;
+        if( i_now > i_deadline + CLOCK_FREQ / 20 )
+        {
+            i_rebuffers++;
+            i_stalled += i_now - i_deadline;
+            i_start += i_now - i_deadline;
+        }
+        else
+            mwait( i_deadline );
+    }
+
+    printf( "prefetch %d cache %5d kB: startup %4"PRId64" ms, "
+            "%2u rebuffering(s) for %5"PRId64" ms, segments %2u/%u "
+            "(%u low, %u mid, %u high)\n", i_prefetch, i_cache,
+            ( i_start - i_open ) / 1000, i_rebuffers, i_stalled / 1000,
+            i_segments, HLS_SEGMENTS, pi_played[0], pi_played[1],
+            pi_played[2] );
+
+    stream_Delete( s ); /* and its source */
+    libvlc_release( p_vlc );
+}
+
+int main( void )
+{
+    (void)test_default_sample;
+
+    int i_port = StartServer( HLS_LATENCY, HLS_LINK );
+    for( unsigned i = 0; i < sizeof( p_settings ) / sizeof( p_settings[0] );
+         i++ )
+        Play( i_port, p_settings[i].i_prefetch, p_settings[i].i_cache );
+    return 0;
+}
@@ -0,0 +1,79 @@
+/*****************************************************************************
+ * deinterlace.c: test for the deinterlace filter
+ *****************************************************************************
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#include "../../libvlc/test.h"
+#include <../src/control/libvlc_internal.h>
+
+#include "deinterlace.h"
+
+#define FRAMES          8
+#define SLICES          3
+
+static const struct
+{
+    int i_width;
+    int i_height;
+} p_sizes[] = {
+    { 720, 576 },
+    { 352, 208 }, /* the slices are not all the same size */
+};
+
+#define SIZES (sizeof( p_sizes ) / sizeof( p_sizes[0] ))
+
+/* The pictures must not depend on the number of slices, and the yadif
+ * kernels must all give the pictures of the C code. */
+int main( void )
+{
+    uint32_t pi_ref[SIZES][MODES];
+
+    test_init();
+
+    for( unsigned c = 0; c < CPUS; c++ )
+    {
+        uint32_t pi_sum[SIZES][MODES];
+
+        for( int i_threads = 1; i_threads <= SLICES; i_threads += SLICES - 1 )
+        {
+            libvlc_instance_t *p_vlc = NewInstance( c, i_threads );
+
+            log( "Testing the %s code with %d slice(s)\n",
+                 p_cpus[c].psz_name, i_threads );
+            for( unsigned s = 0; s < SIZES; s++ )
+                for( unsigned m = 0; m < MODES; m++ )
+                {
+                    uint32_t i_sum;
+                    mtime_t i_time;
+
+                    Deinterlace( p_vlc, ppsz_modes[m], p_sizes[s].i_width,
+                                 p_sizes[s].i_height, FRAMES, &i_sum,
+                                 &i_time );
+                    if( i_threads == 1 )
+                        pi_sum[s][m] = i_sum;
+                    else
+                        assert( i_sum == pi_sum[s][m] );
+
+                    if( c == 0 )
+                        pi_ref[s][m] = i_sum;
+                    else if( !strncmp( ppsz_modes[m], "yadif", 5 ) )
+                        assert( i_sum == pi_ref[s][m] );
+                }
+            libvlc_release( p_vlc );
+        }
+    }
+    return 0;
+}
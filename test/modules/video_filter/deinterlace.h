@@ -0,0 +1,193 @@
+/*****************************************************************************
+ * deinterlace.h: deinterlace filter test helpers
+ *****************************************************************************
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#ifndef DEINTERLACE_TEST_H
+#define DEINTERLACE_TEST_H
+
+#include <string.h>
+
+#include <vlc_common.h>
+#include <vlc_filter.h>
+
+#define SOURCES         4
+
+static const char *const ppsz_modes[] = {
+    "discard", "blend", "mean", "bob", "linear", "x", "yadif", "yadif2x",
+};
+
+#define MODES (sizeof( ppsz_modes ) / sizeof( ppsz_modes[0] ))
+
+/* Each set of options leaves the instruction sets up to the named one */
+static const struct
+{
+    const char *psz_name;
+    const char *ppsz_args[8];
+} p_cpus[] = {
+#if defined( __i386__ ) || defined( __x86_64__ )
+    { "C",      { "--no-mmx", "--no-mmxext", "--no-sse", "--no-sse2",
+                  "--no-sse3", "--no-ssse3", "--no-sse41", "--no-sse42" } },
+    { "MMXEXT", { "--no-sse", "--no-sse2", "--no-sse3", "--no-ssse3",
+                  "--no-sse41", "--no-sse42" } },
+    { "SSE2",   { "--no-sse3", "--no-ssse3", "--no-sse41", "--no-sse42" } },
+    { "SSSE3",  { "--no-sse41", "--no-sse42" } },
+#else
+    { "default", { NULL } },
+#endif
+};
+
+#define CPUS (sizeof( p_cpus ) / sizeof( p_cpus[0] ))
+
+/* The 3 first and last pixels of the two first and two last lines are left
+ * out: yadif reads a few bytes before and after the planes for them. */
+static uint32_t Checksum( uint32_t i_sum, const picture_t *p_pic )
+{
+    for( int i = 0; i < p_pic->i_planes; i++ )
+    {
+        const plane_t *p = &p_pic->p[i];
+
+        for( int y = 0; y < p->i_visible_lines; y++ )
+        {
+            const bool b_edge = y < 2 || y >= p->i_visible_lines - 2;
+
+            for( int x = b_edge ? 3 : 0;
+                 x < p->i_visible_pitch - (b_edge ? 3 : 0); x++ )
+                i_sum = ( i_sum ^ p->p_pixels[y * p->i_pitch + x] )
+                        * 16777619;
+        }
+    }
+    return i_sum;
+}
+
+/* Noise, with a different pattern in each field */
+static picture_t *NewSource( const video_format_t *p_fmt, uint32_t *pi_seed )
+{
+    picture_t *p_pic = picture_NewFromFormat( p_fmt );
+    assert( p_pic != NULL );
+
+    for( int i = 0; i < p_pic->i_planes; i++ )
+    {
+        plane_t *p = &p_pic->p[i];
+
+        for( int y = 0; y < p->i_lines; y++ )
+            for( int x = 0; x < p->i_pitch; x++ )
+            {
+                *pi_seed = *pi_seed * 1103515245 + 12345;
+                p->p_pixels[y * p->i_pitch + x] =
+                    ( *pi_seed >> 16 ) & ( y % 2 ? 0xff : 0x7f );
+            }
+    }
+    p_pic->b_progressive = false;
+    p_pic->b_top_field_first = true;
+    return p_pic;
+}
+
+static picture_t *BufferNew( filter_t *p_filter )
+{
+    return picture_NewFromFormat( &p_filter->fmt_out.video );
+}
+
+static void BufferDel( filter_t *p_filter, picture_t *p_pic )
+{
+    VLC_UNUSED( p_filter );
+    picture_Release( p_pic );
+}
+
+static int BufferInit( filter_t *p_filter, void *p_data )
+{
+    VLC_UNUSED( p_data );
+    p_filter->pf_video_buffer_new = BufferNew;
+    p_filter->pf_video_buffer_del = BufferDel;
+    return VLC_SUCCESS;
+}
+
+/* Each instance of libvlc computes the CPU flags once: i_cpu selects the
+ * instruction sets, i_threads the number of slices */
+static libvlc_instance_t *NewInstance( unsigned i_cpu, int i_threads )
+{
+    const char *ppsz_argv[test_defaults_nargs + 9];
+    char psz_threads[32];
+    int i_argc = 0;
+
+    for( int i = 0; i < test_defaults_nargs; i++ )
+        ppsz_argv[i_argc++] = test_defaults_args[i];
+    snprintf( psz_threads, sizeof( psz_threads ), "--filter-threads=%d",
+              i_threads );
+    ppsz_argv[i_argc++] = psz_threads;
+    for( int i = 0; i < 8 && p_cpus[i_cpu].ppsz_args[i] != NULL; i++ )
+        ppsz_argv[i_argc++] = p_cpus[i_cpu].ppsz_args[i];
+
+    libvlc_instance_t *p_vlc = libvlc_new( i_argc, ppsz_argv );
+    assert( p_vlc != NULL );
+    return p_vlc;
+}
+
+/* Deinterlaces i_frames pictures, returns the number of output pictures and
+ * the time it took. *pi_sum is the checksum of the output pictures. */
+static unsigned Deinterlace( libvlc_instance_t *p_vlc, const char *psz_mode,
+                             int i_width, int i_height, int i_frames,
+                             uint32_t *pi_sum, mtime_t *pi_time )
+{
+    char psz_chain[64];
+    es_format_t fmt;
+    picture_t *pp_src[SOURCES];
+    uint32_t i_seed = 1;
+    unsigned i_out = 0;
+
+    es_format_Init( &fmt, VIDEO_ES, VLC_CODEC_I420 );
+    video_format_Setup( &fmt.video, VLC_CODEC_I420, i_width, i_height, 1, 1 );
+    for( int i = 0; i < SOURCES; i++ )
+        pp_src[i] = NewSource( &fmt.video, &i_seed );
+
+    filter_chain_t *p_chain = filter_chain_New( p_vlc->p_libvlc_int,
+                                                "video filter2", true,
+                                                BufferInit, NULL, NULL );
+    assert( p_chain != NULL );
+    filter_chain_Reset( p_chain, &fmt, &fmt );
+    snprintf( psz_chain, sizeof( psz_chain ), "deinterlace{mode=%s}",
+              psz_mode );
+    assert( filter_chain_AppendFromString( p_chain, psz_chain ) == 0 );
+
+    *pi_sum = 2166136261u;
+    mtime_t i_start = mdate();
+    for( int i = 0; i < i_frames; i++ )
+    {
+        picture_t *p_pic = picture_Hold( pp_src[i % SOURCES] );
+
+        p_pic->date = VLC_TS_0 + i * CLOCK_FREQ / 25;
+        /* The second picture of the double rate modes is pending */
+        for( p_pic = filter_chain_VideoFilter( p_chain, p_pic );
+             p_pic != NULL;
+             p_pic = filter_chain_VideoFilter( p_chain, NULL ) )
+        {
+            /* yadif renders its first picture with the X method */
+            if( i >= 2 )
+                *pi_sum = Checksum( *pi_sum, p_pic );
+            picture_Release( p_pic );
+            i_out++;
+        }
+    }
+    *pi_time = mdate() - i_start;
+
+    filter_chain_Delete( p_chain );
+    for( int i = 0; i < SOURCES; i++ )
+        picture_Release( pp_src[i] );
+    es_format_Clean( &fmt );
+    return i_out;
+}
+
+#endif
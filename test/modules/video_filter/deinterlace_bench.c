@@ -0,0 +1,71 @@
+/*****************************************************************************
+ * deinterlace_bench.c: deinterlace filter throughput
+ *****************************************************************************
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+/*
+ * Interlaced SD and HD I420 pictures are deinterlaced with every mode, on
+ * one thread, once per instruction set the filter can use. The program
+ * prints the number of output pictures per second of each run.
+ */
+
+#include "../../libvlc/test.h"
+#include <../src/control/libvlc_internal.h>
+
+#include "deinterlace.h"
+
+#define FRAMES          60
+
+static const struct
+{
+    int i_width;
+    int i_height;
+} p_sizes[] = {
+    { 720, 576 },
+    { 1920, 1080 },
+};
+
+int main( void )
+{
+    (void)test_default_sample;
+
+    for( unsigned c = 0; c < CPUS; c++ )
+    {
+        libvlc_instance_t *p_vlc = NewInstance( c, 1 );
+
+        for( unsigned s = 0; s < sizeof( p_sizes ) / sizeof( p_sizes[0] );
+             s++ )
+        {
+            for( unsigned m = 0; m < MODES; m++ )
+            {
+                uint32_t i_sum;
+                mtime_t i_time;
+                unsigned i_out = Deinterlace( p_vlc, ppsz_modes[m],
+                                              p_sizes[s].i_width,
+                                              p_sizes[s].i_height, FRAMES,
+                                              &i_sum, &i_time );
+
+                /* The time of the checksums is negligible */
+                printf( "%-7s %4dx%-4d %-8s %8.1f pictures/s\n",
+                        p_cpus[c].psz_name, p_sizes[s].i_width,
+                        p_sizes[s].i_height, ppsz_modes[m],
+                        (double)i_out * CLOCK_FREQ / i_time );
+            }
+        }
+        libvlc_release( p_vlc );
+    }
+    return 0;
+}
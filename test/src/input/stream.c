@@ -0,0 +1,148 @@
+/*****************************************************************************
+ * stream.c: test for stream_Block() and stream_Packets()
+ *****************************************************************************
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#include "../../libvlc/test.h"
+#include <../src/control/libvlc_internal.h>
+
+#include <string.h>
+#include <unistd.h>
+
+#include <vlc_common.h>
+#include <vlc_stream.h>
+
+#define TS_SIZE         188
+#define TS_PER_READ     100
+#define DATA_SIZE       ( 20000 * TS_SIZE + 100 ) /* a partial packet last */
+
+/* Every byte depends on its position */
+static uint8_t Byte( uint64_t i_pos )
+{
+    return ( i_pos * 2654435761u ) >> 13;
+}
+
+static void Check( stream_t *s, uint64_t *pi_pos, const uint8_t *p,
+                   size_t i_size )
+{
+    for( size_t i = 0; i < i_size; i++ )
+        assert( p[i] == Byte( *pi_pos + i ) );
+    *pi_pos += i_size;
+    assert( (uint64_t)stream_Tell( s ) == *pi_pos );
+}
+
+static void CheckPackets( stream_t *s, uint64_t *pi_pos, block_t *p_block,
+                          unsigned i_max )
+{
+    /* Whole packets, but for the end of the stream */
+    assert( p_block->i_buffer > 0 );
+    assert( p_block->i_buffer <= TS_SIZE * i_max );
+    assert( p_block->i_buffer % TS_SIZE == 0
+             || *pi_pos + p_block->i_buffer == DATA_SIZE );
+    Check( s, pi_pos, p_block->p_buffer, p_block->i_buffer );
+    block_Release( p_block );
+}
+
+static void Test( stream_t *s )
+{
+    block_t *p_block;
+    uint64_t i_pos;
+
+    assert( stream_Size( s ) == DATA_SIZE );
+
+    log( "Reading with stream_Block()\n" );
+    i_pos = 0;
+    while( ( p_block = stream_Block( s, TS_SIZE * TS_PER_READ ) ) != NULL )
+    {
+        Check( s, &i_pos, p_block->p_buffer, p_block->i_buffer );
+        block_Release( p_block );
+    }
+    assert( i_pos == DATA_SIZE );
+
+    log( "Reading with stream_Packets()\n" );
+    assert( stream_Seek( s, 0 ) == VLC_SUCCESS );
+    i_pos = 0;
+    while( ( p_block = stream_Packets( s, TS_SIZE, TS_PER_READ ) ) != NULL )
+        CheckPackets( s, &i_pos, p_block, TS_PER_READ );
+    assert( i_pos == DATA_SIZE );
+
+    /* The buffered data is not a whole number of packets */
+    log( "Mixing stream_Read(), stream_Seek() and stream_Packets()\n" );
+    assert( stream_Seek( s, 0 ) == VLC_SUCCESS );
+    i_pos = 0;
+    for( unsigned i = 0; ; i++ )
+    {
+        uint8_t p_buf[500];
+        unsigned i_max = 1 + i % 7;
+        int i_read = stream_Read( s, p_buf, i * 37 % sizeof( p_buf ) );
+
+        assert( i_read >= 0 );
+        Check( s, &i_pos, p_buf, i_read );
+        if( i % 16 == 15 )
+        {
+            i_pos -= __MIN( i_pos, i * 1009 % 8192 );
+            assert( stream_Seek( s, i_pos ) == VLC_SUCCESS );
+        }
+
+        p_block = stream_Packets( s, TS_SIZE, i_max );
+        if( p_block == NULL )
+            break;
+        CheckPackets( s, &i_pos, p_block, i_max );
+    }
+    assert( i_pos == DATA_SIZE );
+}
+
+int main( void )
+{
+    libvlc_instance_t *p_vlc;
+    char psz_path[] = "/tmp/vlc-test-stream-XXXXXX";
+    char psz_url[64];
+    uint8_t *p_data;
+    stream_t *s;
+
+    test_init();
+
+    p_vlc = libvlc_new( test_defaults_nargs, test_defaults_args );
+    assert( p_vlc != NULL );
+
+    p_data = malloc( DATA_SIZE );
+    assert( p_data != NULL );
+    for( size_t i = 0; i < DATA_SIZE; i++ )
+        p_data[i] = Byte( i );
+
+    log( "Testing a memory stream\n" );
+    s = stream_MemoryNew( p_vlc->p_libvlc_int, p_data, DATA_SIZE, true );
+    assert( s != NULL );
+    Test( s );
+    stream_Delete( s );
+
+    log( "Testing a file stream\n" );
+    int fd = mkstemp( psz_path );
+    assert( fd >= 0 );
+    assert( write( fd, p_data, DATA_SIZE ) == DATA_SIZE );
+    close( fd );
+
+    snprintf( psz_url, sizeof( psz_url ), "file://%s", psz_path );
+    s = stream_UrlNew( p_vlc->p_libvlc_int, psz_url );
+    assert( s != NULL );
+    Test( s );
+    stream_Delete( s );
+    unlink( psz_path );
+
+    free( p_data );
+    libvlc_release( p_vlc );
+    return 0;
+}
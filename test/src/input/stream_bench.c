@@ -0,0 +1,245 @@
+/*****************************************************************************
+ * stream_bench.c: fixed size packet reads throughput
+ *****************************************************************************
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#include "../../libvlc/test.h"
+#include <../src/control/libvlc_internal.h>
+
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <vlc_common.h>
+#include <vlc_stream.h>
+
+#define TS_SIZE         188
+#define TS_PER_READ     100
+#define FILE_PACKETS    (256 * 1024)        /* 48 MiB */
+#define FILE_PASSES     4
+#define UDP_PORT        12346
+#define UDP_PACKETS     7
+#define UDP_DATAGRAMS   100000
+#define UDP_RATE        50000000                /* bytes per second */
+
+static void Fill( uint8_t *p, uint32_t i_packet )
+{
+    p[0] = 0x47;
+    SetWBE( p + 1, 0x0100 );
+    SetDWBE( p + 4, i_packet );
+}
+
+static uint64_t CpuTime( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts );
+    return ts.tv_sec * UINT64_C(1000000) + ts.tv_nsec / 1000;
+}
+
+/* Reads the whole stream, checks the packets and returns their count */
+static uint32_t ReadAll( stream_t *s, bool b_packets )
+{
+    uint32_t i_next = 0, i_count = 0;
+
+    for( ;; )
+    {
+        block_t *p_block = b_packets
+                         ? stream_Packets( s, TS_SIZE, TS_PER_READ )
+                         : stream_Block( s, TS_SIZE * TS_PER_READ );
+        if( p_block == NULL )
+            break;
+
+        assert( p_block->i_buffer % TS_SIZE == 0 );
+        for( size_t i = 0; i < p_block->i_buffer; i += TS_SIZE )
+        {
+            const uint8_t *p = p_block->p_buffer + i;
+
+            assert( p[0] == 0x47 );
+            if( ( GetWBE( p + 1 ) & 0x1fff ) == 0x1fff )
+                continue;
+            /* UDP datagrams can be lost, but not reordered on loopback */
+            assert( GetDWBE( p + 4 ) >= i_next );
+            i_next = GetDWBE( p + 4 ) + 1;
+            i_count++;
+        }
+        block_Release( p_block );
+    }
+    return i_count;
+}
+
+/*****************************************************************************
+ * File
+ *****************************************************************************/
+static void BenchFile( libvlc_instance_t *p_vlc, const char *psz_path,
+                       bool b_packets )
+{
+    char psz_url[64];
+    double f_rate = 0.;
+
+    snprintf( psz_url, sizeof( psz_url ), "file://%s", psz_path );
+    for( int i = 0; i < FILE_PASSES; i++ )
+    {
+        stream_t *s = stream_UrlNew( p_vlc->p_libvlc_int, psz_url );
+        assert( s != NULL );
+
+        mtime_t i_start = mdate();
+        assert( ReadAll( s, b_packets ) == FILE_PACKETS );
+        double f = (double)FILE_PACKETS * TS_SIZE /
+                   ( mdate() - i_start ); /* MB/s */
+        if( f > f_rate )
+            f_rate = f;
+        stream_Delete( s );
+    }
+    printf( "file %-14s %7.1f MB/s\n",
+            b_packets ? "stream_Packets" : "stream_Block", f_rate );
+}
+
+/*****************************************************************************
+ * UDP
+ *****************************************************************************/
+typedef struct
+{
+    pthread_mutex_t lock;
+    stream_t *s;
+} udp_bench_t;
+
+static void *Send( void *data )
+{
+    udp_bench_t *p_bench = data;
+    uint8_t p_datagram[UDP_PACKETS * TS_SIZE];
+    struct sockaddr_in addr;
+    int fd = socket( AF_INET, SOCK_DGRAM, 0 );
+
+    assert( fd >= 0 );
+    memset( &addr, 0, sizeof( addr ) );
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons( UDP_PORT );
+    addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+    memset( p_datagram, 0xff, sizeof( p_datagram ) );
+
+    /* Null packets until the stream is open: it waits for data */
+    for( ;; )
+    {
+        pthread_mutex_lock( &p_bench->lock );
+        bool b_open = p_bench->s != NULL;
+        pthread_mutex_unlock( &p_bench->lock );
+        if( b_open )
+            break;
+
+        for( int j = 0; j < UDP_PACKETS; j++ )
+        {
+            Fill( p_datagram + j * TS_SIZE, 0 );
+            SetWBE( p_datagram + j * TS_SIZE + 1, 0x1fff );
+        }
+        sendto( fd, p_datagram, sizeof( p_datagram ), 0,
+                (struct sockaddr *)&addr, sizeof( addr ) );
+        mwait( mdate() + CLOCK_FREQ / 100 );
+    }
+
+    /* Bursts of 32 datagrams at UDP_RATE */
+    mtime_t i_start = mdate();
+    for( uint32_t i = 0; i < UDP_DATAGRAMS; i++ )
+    {
+        for( int j = 0; j < UDP_PACKETS; j++ )
+            Fill( p_datagram + j * TS_SIZE, i * UDP_PACKETS + j );
+        sendto( fd, p_datagram, sizeof( p_datagram ), 0,
+                (struct sockaddr *)&addr, sizeof( addr ) );
+        if( i % 32 == 31 )
+            mwait( i_start + (mtime_t)( i * sizeof( p_datagram ) )
+                             * CLOCK_FREQ / UDP_RATE );
+    }
+    close( fd );
+
+    /* Let the reader drain the socket, then stop it */
+    mwait( mdate() + CLOCK_FREQ / 2 );
+    vlc_object_kill( p_bench->s->p_parent );
+    return NULL;
+}
+
+static void BenchUDP( libvlc_instance_t *p_vlc, bool b_packets )
+{
+    char psz_url[64];
+    udp_bench_t bench;
+    pthread_t thread;
+
+    snprintf( psz_url, sizeof( psz_url ), "udp://@127.0.0.1:%d", UDP_PORT );
+    pthread_mutex_init( &bench.lock, NULL );
+    bench.s = NULL;
+    assert( pthread_create( &thread, NULL, Send, &bench ) == 0 );
+
+    stream_t *s = stream_UrlNew( p_vlc->p_libvlc_int, psz_url );
+    assert( s != NULL );
+
+    uint64_t i_cpu = CpuTime();
+    pthread_mutex_lock( &bench.lock );
+    bench.s = s;
+    pthread_mutex_unlock( &bench.lock );
+
+    uint32_t i_packets = ReadAll( s, b_packets );
+
+    i_cpu = CpuTime() - i_cpu;
+    pthread_join( thread, NULL );
+    stream_Delete( s );
+    pthread_mutex_destroy( &bench.lock );
+
+    printf( "udp  %-14s %7.1f MB/s of reader CPU time, %5.2f%% lost\n",
+            b_packets ? "stream_Packets" : "stream_Block",
+            (double)i_packets * TS_SIZE / i_cpu,
+            100. - 100. * i_packets / ( UDP_DATAGRAMS * UDP_PACKETS ) );
+}
+
+int main( void )
+{
+    (void)test_default_sample;
+
+    libvlc_instance_t *p_vlc = libvlc_new( test_defaults_nargs,
+                                           test_defaults_args );
+    assert( p_vlc != NULL );
+
+    /* File */
+    char psz_path[] = "/tmp/vlc-test-stream-XXXXXX";
+    int fd = mkstemp( psz_path );
+    assert( fd >= 0 );
+
+    uint8_t *p_data = malloc( TS_SIZE * 1024 );
+    assert( p_data != NULL );
+    memset( p_data, 0xff, TS_SIZE * 1024 );
+    for( uint32_t i = 0; i < FILE_PACKETS; i += 1024 )
+    {
+        for( uint32_t j = 0; j < 1024; j++ )
+            Fill( p_data + j * TS_SIZE, i + j );
+        assert( write( fd, p_data, TS_SIZE * 1024 ) == TS_SIZE * 1024 );
+    }
+    free( p_data );
+    close( fd );
+
+    BenchFile( p_vlc, psz_path, false );
+    BenchFile( p_vlc, psz_path, true );
+    unlink( psz_path );
+
+    /* UDP */
+    BenchUDP( p_vlc, false );
+    BenchUDP( p_vlc, true );
+
+    libvlc_release( p_vlc );
+    return 0;
+}